@@ -0,0 +1,724 @@
+/*****************************************************************************
+ * INCLUDED FILES & MACRO DEFINITIONS
+ *****************************************************************************/
+
+#include <libldap.h>
+#include <LDAPObject.h>
+#include <LDAPCompletionQueue.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <math.h>
+#ifdef __linux__
+#define __HAVE_EPOLL__ 1
+#include <sys/epoll.h>
+#endif /* __linux__ */
+
+
+/* ready connections handled per wakeup, the others are reported by the
+   next one (level-triggered) */
+#define LDAPCQ_MAXEVENTS	256
+
+typedef struct {
+    int fd;
+    int hangup;
+} LDAPCQEvent_t;
+
+/*****************************************************************************
+ * LOCAL FUNCTION DECLARATIONS
+ *****************************************************************************/
+
+static int LDAPCompletionQueue_valid(
+    LDAPCompletionQueueObject *, const char *);
+static int LDAPCompletionQueue_fd(
+    LDAPCompletionQueueObject *, PyObject *, const char *);
+static int LDAPCompletionQueue_watch(
+    LDAPCompletionQueueObject *, PyObject *, int, const char *);
+static void LDAPCompletionQueue_unwatch(
+    LDAPCompletionQueueObject *, PyObject *, int);
+static int LDAPCompletionQueue_remove(
+    LDAPCompletionQueueObject *, PyObject *, const char *);
+static int LDAPCompletionQueue_sync(LDAPCompletionQueueObject *);
+static int LDAPCompletionQueue_closed(
+    LDAPCompletionQueueObject *, PyObject *);
+static int LDAPCompletionQueue_poll(
+    LDAPCompletionQueueObject *, int, LDAPCQEvent_t *);
+static int LDAPCompletionQueue_push(
+    LDAPCompletionQueueObject *, PyObject *, PyObject *, PyObject *);
+static int LDAPCompletionQueue_drain(
+    LDAPCompletionQueueObject *, PyObject *, int);
+
+/*****************************************************************************
+ * libldap.CompletionQueue OBJECT
+ *****************************************************************************/
+
+/* DOC */
+
+PyDoc_STRVAR(LDAPCompletionQueueObjectDoc, "");
+
+/* METHODS */
+
+PyDoc_STRVAR(LDAPCompletionQueueDoc_register, "");
+
+static PyObject *
+LDAPCompletionQueue_register(LDAPCompletionQueueObject *self, PyObject *args)
+{
+    int fd, rc;
+    PyObject *l, *entry;
+
+    if (!LDAPCompletionQueue_valid(self, "register"))
+	return NULL;
+    if (!PyArg_ParseTuple(
+	    args, "O!", LibLDAP_state((PyObject *) self)->ldap_type, &l))
+	return NULL;
+    /* the descriptor of another connection may be stale */
+    if (LDAPCompletionQueue_sync(self) < 0)
+	return NULL;
+    rc = PyDict_Contains(self->conns, l);
+    if (rc)
+	return rc < 0 ? NULL : PyErr_Format(
+	    LibLDAPErr(self), "%s.register(): connection already registered",
+	    LDAPObjName(self)
+	    );
+    fd = LDAPCompletionQueue_fd(self, l, "register");
+    if (fd < 0)
+	return NULL;
+    if (LDAPCompletionQueue_watch(self, l, fd, "register") < 0)
+	return NULL;
+    entry = Py_BuildValue("(ik)", fd, ((LDAPObject *) l)->handle);
+    if (!entry || PyDict_SetItem(self->conns, l, entry) < 0) {
+	Py_XDECREF(entry);
+	LDAPCompletionQueue_unwatch(self, l, fd);
+	return NULL;
+    }
+    Py_DECREF(entry);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(LDAPCompletionQueueDoc_unregister, "");
+
+static PyObject *
+LDAPCompletionQueue_unregister(LDAPCompletionQueueObject *self, PyObject *args)
+{
+    PyObject *l;
+
+    if (!LDAPCompletionQueue_valid(self, "unregister"))
+	return NULL;
+    if (!PyArg_ParseTuple(
+	    args, "O!", LibLDAP_state((PyObject *) self)->ldap_type, &l))
+	return NULL;
+    if (LDAPCompletionQueue_remove(self, l, "unregister") < 0)
+	return NULL;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(LDAPCompletionQueueDoc_wait, "");
+
+static PyObject *
+LDAPCompletionQueue_wait(LDAPCompletionQueueObject *self, PyObject *args,
+			 PyObject *kwds)
+{
+    int i, n, ms;
+    double timeout = 0.0, deadline = 0.0, left;
+    LDAPCQEvent_t evs[LDAPCQ_MAXEVENTS];
+    PyObject *ret;
+    static char *kwlist[] = {"timeout", NULL};
+
+    if (!LDAPCompletionQueue_valid(self, "wait"))
+	return NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|d", kwlist, &timeout))
+	return NULL;
+    if (timeout > 0.0)
+	deadline = LibLDAP_monotonic() + timeout;
+    /* same timeout convention as LDAP_.result(): 0 waits with no limit,
+       a negative timeout polls */
+    for (;;) {
+	/* connections reopened (fork()) or closed since the last wait */
+	if (LDAPCompletionQueue_sync(self) < 0)
+	    return NULL;
+	if (PyList_GET_SIZE(self->ready) || !PyDict_Size(self->fds))
+	    break;
+	if (timeout == 0.0)
+	    ms = -1;
+	else if (timeout < 0.0)
+	    ms = 0;
+	else {
+	    left = deadline - LibLDAP_monotonic();
+	    if (left > 1e6)
+		left = 1e6;
+	    ms = left > 0.0 ? (int) ceil(left * 1e3) : 0;
+	}
+	n = LDAPCompletionQueue_poll(self, ms, evs);
+	if (n < 0)
+	    return NULL;
+	for (i = 0; i < n; i++) {
+	    int rc;
+	    PyObject *key, *l;
+
+	    /* closed by another thread while the GIL was released */
+	    if (!LDAPCompletionQueue_valid(self, "wait"))
+		return NULL;
+	    key = PyLong_FromLong((long) evs[i].fd);
+	    if (!key)
+		return NULL;
+	    l = PyDict_GetItem(self->fds, key);
+	    Py_DECREF(key);
+	    /* unregistered by another thread meanwhile */
+	    if (!l)
+		continue;
+	    Py_INCREF(l);
+	    rc = LDAPCompletionQueue_drain(self, l, evs[i].hangup);
+	    Py_DECREF(l);
+	    if (rc < 0)
+		return NULL;
+	}
+	if (!ms)
+	    break;
+	if (!LDAPCompletionQueue_valid(self, "wait"))
+	    return NULL;
+    }
+    ret = PyList_New(0);
+    if (!ret)
+	return NULL;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->ready) {
+	PyObject *tmp = self->ready;
+
+	self->ready = ret;
+	ret = tmp;
+    }
+    Py_END_CRITICAL_SECTION();
+    return ret;
+}
+
+PyDoc_STRVAR(LDAPCompletionQueueDoc_close, "");
+
+static PyObject *
+LDAPCompletionQueue_close(LDAPCompletionQueueObject *self)
+{
+    int epfd;
+    PyObject *conns, *fds, *ready;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    epfd = self->epfd;
+    conns = self->conns;
+    fds = self->fds;
+    ready = self->ready;
+    self->epfd = -1;
+    self->conns = self->fds = self->ready = NULL;
+    Py_END_CRITICAL_SECTION();
+#ifdef __HAVE_EPOLL__
+    if (epfd >= 0)
+	(void) close(epfd);
+#else
+    (void) epfd;
+#endif /* __HAVE_EPOLL__ */
+    Py_XDECREF(conns);
+    Py_XDECREF(fds);
+    Py_XDECREF(ready);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef LDAPCompletionQueueMethods[] = {
+    {"register", (PyCFunction) LDAPCompletionQueue_register, METH_VARARGS,
+     LDAPCompletionQueueDoc_register
+    },
+    {"unregister", (PyCFunction) LDAPCompletionQueue_unregister,
+     METH_VARARGS, LDAPCompletionQueueDoc_unregister
+    },
+    {"wait", (PyCFunction) LDAPCompletionQueue_wait,
+     METH_VARARGS | METH_KEYWORDS, LDAPCompletionQueueDoc_wait
+    },
+    {"close", (PyCFunction) LDAPCompletionQueue_close, METH_NOARGS,
+     LDAPCompletionQueueDoc_close
+    },
+    {NULL, NULL, 0, NULL}
+};
+
+/* GET/SET */
+
+static PyObject *
+LDAPCompletionQueue_get_connections(LDAPCompletionQueueObject *self,
+				    void *closure)
+{
+    if (!self->conns)
+	return PyList_New(0);
+    return PyDict_Keys(self->conns);
+}
+
+static PyGetSetDef LDAPCompletionQueueGetSet[] = {
+    {"connections", (getter) LDAPCompletionQueue_get_connections, NULL,
+     "registered connections", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+/* SPECIAL METHODS */
+
+/* a connection may reference its queue (e.g. stored in an attribute
+   of a subclass): the queue takes part in garbage collection */
+static int
+LDAPCompletionQueueObject_traverse(LDAPCompletionQueueObject *self,
+				   visitproc visit, void *arg)
+{
+    Py_VISIT(Py_TYPE(self));
+    Py_VISIT(self->conns);
+    Py_VISIT(self->fds);
+    Py_VISIT(self->ready);
+    return 0;
+}
+
+/* leaves the queue closed */
+static int
+LDAPCompletionQueueObject_clear(LDAPCompletionQueueObject *self)
+{
+    Py_CLEAR(self->conns);
+    Py_CLEAR(self->fds);
+    Py_CLEAR(self->ready);
+    return 0;
+}
+
+static void
+LDAPCompletionQueueObject_dealloc(LDAPCompletionQueueObject *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+
+    PyObject_GC_UnTrack((PyObject *) self);
+#ifdef __HAVE_EPOLL__
+    if (self->epfd >= 0)
+	(void) close(self->epfd);
+#endif /* __HAVE_EPOLL__ */
+    (void) LDAPCompletionQueueObject_clear(self);
+    tp->tp_free((PyObject *) self);
+    Py_DECREF(tp);
+}
+
+static int
+LDAPCompletionQueueObject_init(LDAPCompletionQueueObject *self,
+			       PyObject *args, PyObject *kwds)
+{
+    if (!PyArg_ParseTuple(args, ":CompletionQueue"))
+	return -1;
+#ifdef __HAVE_EPOLL__
+    if (self->epfd >= 0)
+	return 0;
+    self->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (self->epfd < 0) {
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.__init__(): epoll_create1(): %s",
+	    LDAPObjName(self), strerror(errno)
+	    );
+	return -1;
+    }
+#endif /* __HAVE_EPOLL__ */
+    return 0;
+}
+
+static PyObject *
+LDAPCompletionQueueObject_new(PyTypeObject *type, PyObject *args,
+			      PyObject *kwds)
+{
+    LDAPCompletionQueueObject *self;
+
+    self = (LDAPCompletionQueueObject *) type->tp_alloc(type, 0);
+    if (!self)
+	return NULL;
+    self->epfd = -1;
+    self->handles = LDAPObject_handles;
+    self->forkgen = LDAPObject_forkgen;
+    self->unconnected = 0;
+    self->conns = PyDict_New();
+    self->fds = PyDict_New();
+    self->ready = PyList_New(0);
+    if (!self->conns || !self->fds || !self->ready) {
+	Py_DECREF(self);
+	return NULL;
+    }
+    return (PyObject *) self;
+}
+
+/* TYPE */
+
+static PyType_Slot LDAPCompletionQueueTypeSlots[] = {
+    {Py_tp_doc, (void *) LDAPCompletionQueueObjectDoc},
+    {Py_tp_dealloc, (void *) LDAPCompletionQueueObject_dealloc},
+    {Py_tp_traverse, (void *) LDAPCompletionQueueObject_traverse},
+    {Py_tp_clear, (void *) LDAPCompletionQueueObject_clear},
+    {Py_tp_methods, (void *) LDAPCompletionQueueMethods},
+    {Py_tp_getset, (void *) LDAPCompletionQueueGetSet},
+    {Py_tp_init, (void *) LDAPCompletionQueueObject_init},
+    {Py_tp_new, (void *) LDAPCompletionQueueObject_new},
+    {0, NULL}
+};
+
+PyType_Spec LDAPCompletionQueueTypeSpec = {
+    "_libldap.CompletionQueue",			/* name */
+    sizeof(LDAPCompletionQueueObject),		/* basicsize */
+    0,						/* itemsize */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE |
+    Py_TPFLAGS_HAVE_GC,				/* flags */
+    LDAPCompletionQueueTypeSlots		/* slots */
+};
+
+/*****************************************************************************
+ * LOCAL FUNCTION DEFINITIONS
+ *****************************************************************************/
+
+static int
+LDAPCompletionQueue_valid(LDAPCompletionQueueObject *self, const char *func)
+{
+    if (!self->conns) {
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.%s(): queue closed", LDAPObjName(self), func
+	    );
+	return 0;
+    }
+    return 1;
+}
+
+static int
+LDAPCompletionQueue_fd(LDAPCompletionQueueObject *self, PyObject *l,
+		       const char *func)
+{
+    int fd = -1;
+    LDAP *ldp = ((LDAPObject *) l)->ldp;
+
+    if (!ldp ||
+	ldap_get_option(ldp, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS ||
+	fd < 0) {
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.%s(): connection not established",
+	    LDAPObjName(self), func
+	    );
+	return -1;
+    }
+    return fd;
+}
+
+/* watches descriptor `fd' of connection `l' */
+static int
+LDAPCompletionQueue_watch(LDAPCompletionQueueObject *self, PyObject *l,
+			  int fd, const char *func)
+{
+    int rc;
+    PyObject *key;
+
+#ifdef __HAVE_EPOLL__
+    struct epoll_event ev = {.events = EPOLLIN};
+
+    ev.data.fd = fd;
+    /* still registered if the descriptor was duplicated */
+    if (epoll_ctl(self->epfd, EPOLL_CTL_ADD, fd, &ev) < 0 &&
+	(errno != EEXIST ||
+	 epoll_ctl(self->epfd, EPOLL_CTL_MOD, fd, &ev) < 0)) {
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.%s(): epoll_ctl(): %s",
+	    LDAPObjName(self), func, strerror(errno)
+	    );
+	return -1;
+    }
+#endif /* __HAVE_EPOLL__ */
+    key = PyLong_FromLong((long) fd);
+    rc = key ? PyDict_SetItem(self->fds, key, l) : -1;
+    Py_XDECREF(key);
+    if (rc < 0) {
+#ifdef __HAVE_EPOLL__
+	(void) epoll_ctl(self->epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif /* __HAVE_EPOLL__ */
+	return -1;
+    }
+    return 0;
+}
+
+/* stops watching descriptor `fd' of connection `l', unless it was
+   reused by another registered connection meanwhile */
+static void
+LDAPCompletionQueue_unwatch(LDAPCompletionQueueObject *self, PyObject *l,
+			    int fd)
+{
+    PyObject *key;
+
+    if (fd < 0)
+	return;
+    key = PyLong_FromLong((long) fd);
+    if (!key) {
+	PyErr_Clear();
+	return;
+    }
+    if (PyDict_GetItem(self->fds, key) == l) {
+#ifdef __HAVE_EPOLL__
+	(void) epoll_ctl(self->epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif /* __HAVE_EPOLL__ */
+	if (PyDict_DelItem(self->fds, key) < 0)
+	    PyErr_Clear();
+    }
+    Py_DECREF(key);
+}
+
+/* the descriptor of `l' may be closed already: it is only looked up */
+static int
+LDAPCompletionQueue_remove(LDAPCompletionQueueObject *self, PyObject *l,
+			   const char *func)
+{
+    PyObject *entry;
+
+    if (!LDAPCompletionQueue_valid(self, func))
+	return -1;
+    entry = PyDict_GetItemWithError(self->conns, l);
+    if (!entry) {
+	if (!PyErr_Occurred())
+	    (void) PyErr_Format(
+		LibLDAPErr(self), "%s.%s(): connection not registered",
+		LDAPObjName(self), func
+		);
+	return -1;
+    }
+    LDAPCompletionQueue_unwatch(
+	self, l, (int) PyLong_AsLong(PyTuple_GET_ITEM(entry, 0)));
+    return PyDict_DelItem(self->conns, l);
+}
+
+/* Brings the watched descriptors up to date with the connections: the
+   handle of a registered connection may have been replaced (reconnect
+   in a forked child) or freed (unbind_s()) since it was registered,
+   its descriptor number being then stale or reused. Only done when a
+   handle changed anywhere, or when a reopened connection has no socket
+   yet (libldap connects on first use). A freed connection is reported
+   as broken and unregistered. In the child of a fork(), the epoll
+   instance shared with the parent is replaced and the connections are
+   only watched again once reopened */
+static int
+LDAPCompletionQueue_sync(LDAPCompletionQueueObject *self)
+{
+    int unconnected = 0;
+    unsigned long handles;
+    Py_ssize_t i, pos = 0;
+    PyObject *l, *entry, *gone;
+
+    handles = __atomic_load_n(&LDAPObject_handles, __ATOMIC_RELAXED);
+    if (handles == self->handles && !self->unconnected &&
+	self->forkgen == LDAPObject_forkgen)
+	return 0;
+    if (self->forkgen != LDAPObject_forkgen) {
+#ifdef __HAVE_EPOLL__
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (epfd < 0) {
+	    (void) PyErr_Format(
+		LibLDAPErr(self), "%s.wait(): epoll_create1(): %s",
+		LDAPObjName(self), strerror(errno)
+		);
+	    return -1;
+	}
+	(void) close(self->epfd);
+	self->epfd = epfd;
+#endif /* __HAVE_EPOLL__ */
+	PyDict_Clear(self->fds);
+	self->forkgen = LDAPObject_forkgen;
+    }
+    gone = PyList_New(0);
+    if (!gone)
+	return -1;
+    /* only the values of `conns' are changed while iterating */
+    while (PyDict_Next(self->conns, &pos, &l, &entry)) {
+	LDAPObject *lo = (LDAPObject *) l;
+	int fd = (int) PyLong_AsLong(PyTuple_GET_ITEM(entry, 0));
+	unsigned long handle = PyLong_AsUnsignedLong(
+	    PyTuple_GET_ITEM(entry, 1));
+
+	if (fd >= 0 && handle == lo->handle &&
+	    PyDict_GetItem(self->fds, PyTuple_GET_ITEM(entry, 0)) == l)
+	    continue;
+	LDAPCompletionQueue_unwatch(self, l, fd);
+	if (!lo->ldp) {
+	    if (PyList_Append(gone, l) < 0)
+		goto failed;
+	    continue;
+	}
+	fd = -1;
+	/* the socket of an inherited connection is the parent's one */
+	if (lo->forkgen != LDAPObject_forkgen ||
+	    ldap_get_option(lo->ldp, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS ||
+	    fd < 0) {
+	    fd = -1;
+	    unconnected++;
+	}
+	else if (LDAPCompletionQueue_watch(self, l, fd, "wait") < 0)
+	    goto failed;
+	entry = Py_BuildValue("(ik)", fd, lo->handle);
+	if (!entry || PyDict_SetItem(self->conns, l, entry) < 0) {
+	    Py_XDECREF(entry);
+	    goto failed;
+	}
+	Py_DECREF(entry);
+    }
+    for (i = 0; i < PyList_GET_SIZE(gone); i++) {
+	l = PyList_GET_ITEM(gone, i);
+	if (LDAPCompletionQueue_closed(self, l) < 0 ||
+	    PyDict_DelItem(self->conns, l) < 0)
+	    goto failed;
+    }
+    self->handles = handles;
+    self->unconnected = unconnected;
+    Py_DECREF(gone);
+    return 0;
+ failed:
+    Py_DECREF(gone);
+    return -1;
+}
+
+/* reports the connection `l' as broken */
+static int
+LDAPCompletionQueue_closed(LDAPCompletionQueueObject *self, PyObject *l)
+{
+    int rc;
+    PyObject *value;
+
+    value = PyObject_CallFunction(
+	LibLDAPErr(self), "N", PyUnicode_FromFormat(
+	    "%s.wait(): connection closed", LDAPObjName(self)));
+    if (!value)
+	return -1;
+    rc = LDAPCompletionQueue_push(self, l, Py_None, value);
+    Py_DECREF(value);
+    return rc;
+}
+
+/* waits at most `ms' milliseconds (-1: no limit) for registered
+   connections to be readable, the GIL being released: returns their
+   number, -1 on error */
+static int
+LDAPCompletionQueue_poll(LDAPCompletionQueueObject *self, int ms,
+			 LDAPCQEvent_t *evs)
+{
+    int i, n, err;
+#ifdef __HAVE_EPOLL__
+    struct epoll_event events[LDAPCQ_MAXEVENTS];
+
+    Py_BEGIN_ALLOW_THREADS
+    n = epoll_wait(self->epfd, events, LDAPCQ_MAXEVENTS, ms);
+    err = errno;
+    Py_END_ALLOW_THREADS
+    for (i = 0; i < n; i++) {
+	evs[i].fd = events[i].data.fd;
+	evs[i].hangup = (events[i].events & (EPOLLHUP | EPOLLERR)) != 0;
+    }
+#else
+    int nfds = 0;
+    Py_ssize_t pos = 0;
+    PyObject *key, *value;
+    struct pollfd *pfds;
+
+    pfds = PyMem_New(struct pollfd, PyDict_Size(self->fds));
+    if (!pfds) {
+	(void) PyErr_NoMemory();
+	return -1;
+    }
+    while (PyDict_Next(self->fds, &pos, &key, &value)) {
+	pfds[nfds].fd = (int) PyLong_AsLong(key);
+	pfds[nfds].events = POLLIN;
+	pfds[nfds++].revents = 0;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    n = poll(pfds, (nfds_t) nfds, ms);
+    err = errno;
+    Py_END_ALLOW_THREADS
+    if (n > 0)
+	for (i = n = 0; i < nfds && n < LDAPCQ_MAXEVENTS; i++) {
+	    if (!pfds[i].revents)
+		continue;
+	    evs[n].fd = pfds[i].fd;
+	    evs[n++].hangup =
+		(pfds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) != 0;
+	}
+    PyMem_Free(pfds);
+#endif /* __HAVE_EPOLL__ */
+    if (n < 0) {
+	if (err == EINTR)
+	    return PyErr_CheckSignals() < 0 ? -1 : 0;
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.wait(): %s(): %s", LDAPObjName(self),
+#ifdef __HAVE_EPOLL__
+	    "epoll_wait",
+#else
+	    "poll",
+#endif /* __HAVE_EPOLL__ */
+	    strerror(err)
+	    );
+	return -1;
+    }
+    return n;
+}
+
+static int
+LDAPCompletionQueue_push(LDAPCompletionQueueObject *self, PyObject *l,
+			 PyObject *msgid, PyObject *result)
+{
+    int rc;
+    PyObject *item;
+
+    /* result() released the GIL: close() may have been called */
+    if (!LDAPCompletionQueue_valid(self, "wait"))
+	return -1;
+    item = PyTuple_Pack(3, l, msgid, result);
+    if (!item)
+	return -1;
+    rc = PyList_Append(self->ready, item);
+    Py_DECREF(item);
+    return rc;
+}
+
+/* Moves the answers already received on connection `l' to the ready
+   list: libldap may have buffered several messages in a single read,
+   which the descriptor would not report anymore, so the connection is
+   polled until nothing is complete. A failed operation is queued with
+   its LDAPError as result, a broken connection with no msgid, and is
+   unregistered */
+static int
+LDAPCompletionQueue_drain(LDAPCompletionQueueObject *self, PyObject *l,
+			  int hangup)
+{
+    int rc;
+    PyObject *res, *type, *value, *tb, *msgid;
+
+    for (;;) {
+	res = PyObject_CallMethod(l, "result", "(id)", LDAP_RES_ANY, -1.0);
+	if (res == Py_None) {
+	    Py_DECREF(res);
+	    break;
+	}
+	if (res) {
+	    rc = LDAPCompletionQueue_push(
+		self, l, PyTuple_GET_ITEM(res, 0), PyTuple_GET_ITEM(res, 1));
+	    Py_DECREF(res);
+	    if (rc < 0)
+		return -1;
+	    continue;
+	}
+	if (!PyErr_ExceptionMatches(LibLDAPErr(self)))
+	    return -1;
+	PyErr_Fetch(&type, &value, &tb);
+	PyErr_NormalizeException(&type, &value, &tb);
+	Py_XDECREF(type);
+	Py_XDECREF(tb);
+	msgid = PyObject_GetAttrString(value, "msgid");
+	if (!msgid) {
+	    PyErr_Clear();
+	    msgid = Py_None;
+	    Py_INCREF(msgid);
+	}
+	rc = LDAPCompletionQueue_push(self, l, msgid, value);
+	Py_DECREF(value);
+	if (rc < 0 || msgid == Py_None) {
+	    Py_DECREF(msgid);
+	    return rc < 0 ? -1 : LDAPCompletionQueue_remove(self, l, "wait");
+	}
+	Py_DECREF(msgid);
+    }
+    if (hangup) {
+	/* nothing more to read and no error reported by libldap */
+	if (LDAPCompletionQueue_closed(self, l) < 0)
+	    return -1;
+	return LDAPCompletionQueue_remove(self, l, "wait");
+    }
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef LDAPCOMPLETIONQUEUE_H
+#define LDAPCOMPLETIONQUEUE_H
+
+/*****************************************************************************
+ * libldap.CompletionQueue OBJECT
+ *****************************************************************************/
+
+/* OBJECT */
+
+typedef struct {
+    PyObject_HEAD
+    int       epfd;		/* epoll descriptor, -1 with poll(2) */
+    unsigned long handles;	/* LDAPObject_handles when last synced */
+    unsigned long forkgen;	/* process of `epfd' */
+    int       unconnected;	/* registered connections without socket */
+    PyObject *conns;		/* LDAP object -> (descriptor, handle) */
+    PyObject *fds;		/* socket descriptor -> LDAP object */
+    PyObject *ready;		/* completed (connection, msgid, result) */
+} LDAPCompletionQueueObject;
+
+extern PyType_Spec LDAPCompletionQueueTypeSpec;
+
+#define LDAPCompletionQueueObject_Check(st, o)				\
+    PyObject_TypeCheck((o), (st)->cq_type)
+
+#endif /* LDAPCOMPLETIONQUEUE_H */
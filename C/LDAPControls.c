@@ -3,12 +3,9 @@
  *****************************************************************************/
 
 #include <libldap.h>
+#include <LDAPObject.h>
 #include <LDAPControls.h>
 
-#ifdef __LIBLDAP_DARWIN__
-extern PyObject *LibLDAPErr;
-#endif
-
 /*****************************************************************************
  * libldap.LDAPControl OBJECT
  *****************************************************************************/
@@ -22,16 +19,19 @@ PyDoc_STRVAR(LDAPControlObjectDoc, "");
 static void
 LDAPControlObject_dealloc(LDAPControlObject *self)
 {
+    PyTypeObject *tp = Py_TYPE(self);
+
     if (self->ctrl)
 	ldap_control_free(self->ctrl);
-    Py_TYPE(self)->tp_free((PyObject *) self);
+    tp->tp_free((PyObject *) self);
+    Py_DECREF(tp);
 }
 
 static int
 LDAPControlObject_init(LDAPControlObject *self, PyObject *args, PyObject *kwds)
 {
     PyErr_SetString(
-        LibLDAPErr, "`LDAPControl' object cannot be created directly, "
+        LibLDAPErr(self), "`LDAPControl' object cannot be created directly, "
         "use instead `create_*_control()' methods of a `LDAP' object instance"
         );
     return -1;
@@ -50,45 +50,20 @@ LDAPControlObject_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 
 /* TYPE */
 
-PyTypeObject LDAPControlTypeObject = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "_libldap.LDAPControl",			/* tp_name */
-    sizeof(LDAPControlObject),			/* tp_basicsize */
-    0,						/* tp_itemsize */
-    (destructor) LDAPControlObject_dealloc,	/* tp_dealloc */
-    0,						/* tp_print */
-    0,						/* tp_getattr */
-    0,						/* tp_setattr */
-    0,						/* tp_compare */
-    0,						/* tp_repr */
-    0,						/* tp_as_number */
-    0,						/* tp_as_sequence */
-    0,						/* tp_as_mapping */
-    0,						/* tp_hash  */
-    0,						/* tp_call */
-    0,						/* tp_str */
-    0,						/* tp_getattro */
-    0,						/* tp_setattro */
-    0,						/* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT,				/* tp_flags */
-    LDAPControlObjectDoc,			/* tp_doc */
-    0,						/* tp_traverse */
-    0,						/* tp_clear */
-    0,						/* tp_richcompare */
-    0,						/* tp_weaklistoffset */
-    0,						/* tp_iter */
-    0,						/* tp_iternext */
-    0,						/* tp_methods */
-    0,						/* tp_members */
-    0,						/* tp_getset */
-    0,						/* tp_base */
-    0,						/* tp_dict */
-    0,						/* tp_descr_get */
-    0,						/* tp_descr_set */
-    0,						/* tp_dictoffset */
-    (initproc) LDAPControlObject_init,		/* tp_init */
-    0,						/* tp_alloc */
-    (newfunc) LDAPControlObject_new,		/* tp_new */
+static PyType_Slot LDAPControlTypeSlots[] = {
+    {Py_tp_doc, (void *) LDAPControlObjectDoc},
+    {Py_tp_dealloc, (void *) LDAPControlObject_dealloc},
+    {Py_tp_init, (void *) LDAPControlObject_init},
+    {Py_tp_new, (void *) LDAPControlObject_new},
+    {0, NULL}
+};
+
+PyType_Spec LDAPControlTypeSpec = {
+    "_libldap.LDAPControl",			/* name */
+    sizeof(LDAPControlObject),			/* basicsize */
+    0,						/* itemsize */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE,	/* flags */
+    LDAPControlTypeSlots			/* slots */
 };
 
 /*****************************************************************************
@@ -104,9 +79,12 @@ PyDoc_STRVAR(LDAPControlsObjectDoc, "");
 static void
 LDAPControlsObject_dealloc(LDAPControlsObject *self)
 {
+    PyTypeObject *tp = Py_TYPE(self);
+
     if (self->ctrls)
 	ldap_controls_free(self->ctrls);
-    Py_TYPE(self)->tp_free((PyObject *) self);
+    tp->tp_free((PyObject *) self);
+    Py_DECREF(tp);
 }
 
 static int
@@ -114,7 +92,7 @@ LDAPControlsObject_init(LDAPControlsObject *self, PyObject *args,
 			PyObject *kwds)
 {
     Py_ssize_t i, len = PyTuple_GET_SIZE(args);
-    LDAPControl **ctrls;
+    LDAPControl **ctrls, **prev;
 
     if (!len) {
 	(void) PyErr_Format(
@@ -126,7 +104,7 @@ LDAPControlsObject_init(LDAPControlsObject *self, PyObject *args,
     for (i = 0; i < len; i++) {
 	PyObject *ctrl = PyTuple_GET_ITEM(args, i);
 
-	if (!LDAPControlObject_Check(ctrl)) {
+	if (!LDAPControlObject_Check(LibLDAP_state((PyObject *) self), ctrl)) {
 	    (void) PyErr_Format(
 		PyExc_TypeError, "%s.__init__(): arg%d is not an instance "
 		"of LDAPControl object", LDAPObjName(self), i + 1
@@ -134,26 +112,42 @@ LDAPControlsObject_init(LDAPControlsObject *self, PyObject *args,
 	    return -1;
 	}
     }
-    self->ctrls = PyMem_New(LDAPControl *, len + 1);
-    if (!self->ctrls) {
+    /* freed with ldap_controls_free(), hence allocated by libldap */
+    ctrls = ldap_memalloc((len + 1) * sizeof(LDAPControl *));
+    if (!ctrls) {
 	PyErr_SetNone(PyExc_MemoryError);
 	return -1;
     }
-    (void) memset((void *) self->ctrls, 0, (len + 1) * sizeof(LDAPControl *));
-    for (i = 0, ctrls = self->ctrls; i < len; i++, ctrls++) {
+    (void) memset((void *) ctrls, 0, (len + 1) * sizeof(LDAPControl *));
+    for (i = 0; i < len; i++) {
 	LDAPControlObject *ctrl =
 	    (LDAPControlObject *) PyTuple_GET_ITEM(args, i);
 
-	*ctrls = ldap_control_dup(ctrl->ctrl);
-	if (!*ctrls) {
-	    ldap_controls_free(self->ctrls);
+	ctrls[i] = ldap_control_dup(ctrl->ctrl);
+	if (!ctrls[i]) {
+	    ldap_controls_free(ctrls);
 	    (void) PyErr_Format(
-		LibLDAPErr, "%s.__init__(): ldap_control_dup() failed",
+		LibLDAPErr(self), "%s.__init__(): ldap_control_dup() failed",
 		LDAPObjName(self)
 		);
 	    return -1;
 	}
     }
+    /* the controls are used by operations running without the GIL:
+       they are never replaced under their feet */
+    Py_BEGIN_CRITICAL_SECTION(self);
+    prev = self->ctrls;
+    if (!prev)
+	self->ctrls = ctrls;
+    Py_END_CRITICAL_SECTION();
+    if (prev) {
+	ldap_controls_free(ctrls);
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.__init__(): already initialized",
+	    LDAPObjName(self)
+	    );
+	return -1;
+    }
     return 0;
 }
 
@@ -170,56 +164,32 @@ LDAPControlsObject_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 
 /* TYPE */
 
-PyTypeObject LDAPControlsTypeObject = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "_libldap.LDAPControls",			/* tp_name */
-    sizeof(LDAPControlsObject),			/* tp_basicsize */
-    0,						/* tp_itemsize */
-    (destructor) LDAPControlsObject_dealloc,	/* tp_dealloc */
-    0,						/* tp_print */
-    0,						/* tp_getattr */
-    0,						/* tp_setattr */
-    0,						/* tp_compare */
-    0,						/* tp_repr */
-    0,						/* tp_as_number */
-    0,						/* tp_as_sequence */
-    0,						/* tp_as_mapping */
-    0,						/* tp_hash  */
-    0,						/* tp_call */
-    0,						/* tp_str */
-    0,						/* tp_getattro */
-    0,						/* tp_setattro */
-    0,						/* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT,				/* tp_flags */
-    LDAPControlsObjectDoc,			/* tp_doc */
-    0,						/* tp_traverse */
-    0,						/* tp_clear */
-    0,						/* tp_richcompare */
-    0,						/* tp_weaklistoffset */
-    0,						/* tp_iter */
-    0,						/* tp_iternext */
-    0,						/* tp_methods */
-    0,						/* tp_members */
-    0,						/* tp_getset */
-    0,						/* tp_base */
-    0,						/* tp_dict */
-    0,						/* tp_descr_get */
-    0,						/* tp_descr_set */
-    0,						/* tp_dictoffset */
-    (initproc) LDAPControlsObject_init,		/* tp_init */
-    0,						/* tp_alloc */
-    (newfunc) LDAPControlsObject_new,		/* tp_new */
+static PyType_Slot LDAPControlsTypeSlots[] = {
+    {Py_tp_doc, (void *) LDAPControlsObjectDoc},
+    {Py_tp_dealloc, (void *) LDAPControlsObject_dealloc},
+    {Py_tp_init, (void *) LDAPControlsObject_init},
+    {Py_tp_new, (void *) LDAPControlsObject_new},
+    {0, NULL}
+};
+
+PyType_Spec LDAPControlsTypeSpec = {
+    "_libldap.LDAPControls",			/* name */
+    sizeof(LDAPControlsObject),			/* basicsize */
+    0,						/* itemsize */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE,	/* flags */
+    LDAPControlsTypeSlots			/* slots */
 };
 
 /*****************************************************************************
  * GLOBAL FUNCTION DEFINITIONS
  *****************************************************************************/
 
+/* `o' is the LDAP_ object which got `res' */
 int
-LDAPControls_Check(
-    LDAP *ldp, LDAPMessage *res, const char *cls, const char *meth
-    )
+LDAPControls_Check(PyObject *o, LDAPMessage *res, const char *meth)
 {
+    LDAP *ldp = ((LDAPObject *) o)->ldp;
+    const char *cls = LDAPObjName(o);
     int ecode, errcode;
     char *errmsg = NULL;
     LDAPControl **ctrls, **ptr;
@@ -228,7 +198,7 @@ LDAPControls_Check(
 	ldp, res, &errcode, NULL, &errmsg, NULL, &ctrls, 0);
     if (ecode != LDAP_SUCCESS || errcode != LDAP_SUCCESS) {
 	(void) PyErr_Format(
-	    LibLDAPErr,
+	    LibLDAPErr(o),
 	    "%s.%s(): ldap_parse_result(): %s: error code %d: error msg: %s",
 	    cls, meth, ldap_err2string(ecode), errcode,
 	    errmsg ? errmsg : "<none>"
@@ -246,7 +216,7 @@ LDAPControls_Check(
 	    ecode = ldap_parse_sortresponse_control(ldp, *ptr, &errcode, &attr);
 	    if (ecode != LDAP_SUCCESS || errcode != LDAP_SUCCESS) {
 		(void) PyErr_Format(
-		    LibLDAPErr, "%s.%s(): ldap_parse_sortresponse_control: "
+		    LibLDAPErr(o), "%s.%s(): ldap_parse_sortresponse_control: "
 		    "%s: error code %d: attribute in error: %s",
 		    cls, meth, ldap_err2string(ecode), errcode,
 		    attr ? attr : "<none>"
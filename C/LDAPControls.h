@@ -5,7 +5,7 @@
  * GLOBAL FUNCTION DECLARATIONS
  *****************************************************************************/
 
-int LDAPControls_Check(LDAP *, LDAPMessage *, const char *, const char *);
+int LDAPControls_Check(PyObject *, LDAPMessage *, const char *);
 
 /*****************************************************************************
  * libldap.LDAPControl OBJECT
@@ -18,9 +18,10 @@ typedef struct {
     LDAPControl *ctrl;
 } LDAPControlObject;
 
-extern PyTypeObject LDAPControlTypeObject;
+extern PyType_Spec LDAPControlTypeSpec;
 
-#define LDAPControlObject_Check(o) ((o)->ob_type == &LDAPControlTypeObject)
+#define LDAPControlObject_Check(st, o)					\
+    PyObject_TypeCheck((o), (st)->control_type)
 
 /*****************************************************************************
  * libldap.LDAPControls OBJECT
@@ -33,8 +34,9 @@ typedef struct {
     LDAPControl **ctrls;
 } LDAPControlsObject;
 
-extern PyTypeObject LDAPControlsTypeObject;
+extern PyType_Spec LDAPControlsTypeSpec;
 
-#define LDAPControlsObject_Check(o) ((o)->ob_type == &LDAPControlsTypeObject)
+#define LDAPControlsObject_Check(st, o)				\
+    PyObject_TypeCheck((o), (st)->controls_type)
 
 #endif /* LDAPCONTROLS_H */
@@ -3,14 +3,8 @@
  *****************************************************************************/
 
 #include <libldap.h>
-#include <locale.h>
-#include <wchar.h>
 #include <LDAPModObject.h>
 
-#ifdef __LIBLDAP_DARWIN__
-extern PyObject *LibLDAPErr;
-#endif
-
 /*****************************************************************************
  * libldap.LDAPMod OBJECT
  *****************************************************************************/
@@ -28,13 +22,13 @@ PyDoc_STRVAR(LDAPModObjectDoc, "");
 static PyObject *
 LDAPModObject_getmode(LDAPModObject *self, void *closure)
 {
-    return PyLong_FromLong((long) self->mod->mod_op);
+    return PyLong_FromLong((long) self->mod.mod_op);
 }
 
 static PyObject *
 LDAPModObject_getattr(LDAPModObject *self, void *closure)
 {
-    return PyUnicode_FromString(self->mod->mod_type);
+    return PyUnicode_FromString(self->mod.mod_type);
 }
 
 static PyObject *
@@ -43,18 +37,20 @@ LDAPModObject_getvalues(LDAPModObject *self, void *closure)
     char **ptr;
     PyObject *ret;
     
-    if (!self->mod->mod_values)
+    if (!self->mod.mod_values)
 	Py_RETURN_NONE;
     ret = PyList_New(0);
     if (!ret)
 	return NULL;
-    for (ptr = self->mod->mod_values; *ptr; ptr++) {
+    for (ptr = self->mod.mod_values; *ptr; ptr++) {
 	PyObject *val = PyUnicode_FromString(*ptr);
 
-	if (!val)
-	    return NULL;
-	if (PyList_Append(ret, val) == -1)
+	if (!val || PyList_Append(ret, val) == -1) {
+	    Py_XDECREF(val);
+	    Py_DECREF(ret);
 	    return NULL;
+	}
+	Py_DECREF(val);
     }
     return ret;
 }
@@ -71,154 +67,305 @@ static PyGetSetDef LDAPModObjectGetSet[] = {
 
 /* SPECIAL METHODS */
 
+/* objects of LDAPMod itself (not of subclasses) with room for
+   LDAPModObject_SMALL bytes of data, a few short values, are kept on a
+   freelist of the module state when deallocated. The free-threaded build
+   has none: the state is shared by all threads without locking */
+#define LDAPModObject_SMALL \
+    (256 - (Py_ssize_t) sizeof(LDAPModObject))
+#define LDAPModObject_FREELIST 64
+
+/* data stored in the object itself, suitably aligned for mod_values */
+#define LDAPModObject_INLINE(self) \
+    ((char *) (self) + sizeof(LDAPModObject))
+
+/* subclasses defined in Python have subtype_dealloc() */
+#define LDAPModObject_RECYCLABLE(tp) \
+    ((tp)->tp_dealloc == (destructor) LDAPModObject_dealloc)
+
+static void LDAPModObject_dealloc(LDAPModObject *);
+
+static LDAPModObject *
+LDAPModObject_alloc(PyTypeObject *tp, Py_ssize_t size)
+{
+#ifndef Py_GIL_DISABLED
+    if (size <= LDAPModObject_SMALL && LDAPModObject_RECYCLABLE(tp)) {
+	LibLDAPState_t *st = (LibLDAPState_t *) PyType_GetModuleState(tp);
+	LDAPModObject *self = (LDAPModObject *) st->mod_free;
+
+	if (self) {
+	    st->mod_free = (PyObject *) self->data;
+	    st->mod_nfree--;
+	    (void) PyObject_InitVar(
+		(PyVarObject *) self, tp, LDAPModObject_SMALL);
+	    (void) memset((void *) &self->mod, 0, sizeof(LDAPMod));
+	    self->data = NULL;
+	    return self;
+	}
+	size = LDAPModObject_SMALL;
+    }
+#endif
+    return (LDAPModObject *) tp->tp_alloc(tp, size);
+}
+
+void
+LDAPModObject_freelist_clear(LibLDAPState_t *st)
+{
+    while (st->mod_free) {
+	LDAPModObject *self = (LDAPModObject *) st->mod_free;
+
+	st->mod_free = (PyObject *) self->data;
+	PyObject_Free((void *) self);
+    }
+    st->mod_nfree = 0;
+}
+
 static void
 LDAPModObject_dealloc(LDAPModObject *self)
 {
-    PyMem_Free((void *) self->mod->mod_type);
-    LibLDAP_value_free((void **) self->mod->mod_values);
-    PyMem_Free((void *) self->mod);
-    Py_TYPE(self)->tp_free((PyObject *) self);
+    PyTypeObject *tp = Py_TYPE(self);
+
+    if (self->data != LDAPModObject_INLINE(self))
+	PyMem_Free((void *) self->data);
+#ifndef Py_GIL_DISABLED
+    /* no more recycling once the module is cleared */
+    if (LDAPModObject_RECYCLABLE(tp) &&
+	Py_SIZE(self) == LDAPModObject_SMALL) {
+	LibLDAPState_t *st = (LibLDAPState_t *) PyType_GetModuleState(tp);
+
+	if (st->mod_type && st->mod_nfree < LDAPModObject_FREELIST) {
+	    self->data = (char *) st->mod_free;
+	    st->mod_free = (PyObject *) self;
+	    st->mod_nfree++;
+	    Py_DECREF(tp);
+	    return;
+	}
+    }
+#endif
+    tp->tp_free((PyObject *) self);
+    Py_DECREF(tp);
 }
 
-static int
-LDAPModObject_init(LDAPModObject *self, PyObject *args, PyObject *kwds)
+/* size of the data of a mod, -1 if the arguments are invalid. Values
+   are converted to UTF-8, as sent on the wire: the conversion does not
+   depend on the process locale, which is never changed. It is cached by
+   Python for LDAPModObject_fill() */
+static Py_ssize_t
+LDAPModObject_size(
+    const char *name, int mod_op, const char *mod_type, PyObject *values)
 {
-    int mod_op;
-    char *mod_type;
-    PyObject *values = Py_None;
-    static char *kwlist[] = {"mode", "attr", "values", NULL};
+    Py_ssize_t i, len, size = strlen(mod_type) + 1;
 
-    if (!PyArg_ParseTupleAndKeywords(
-	    args, kwds, "is|O", kwlist, &mod_op, &mod_type, &values))
-	return -1;
     switch (mod_op) {
     case LDAP_MOD_ADD:
     case LDAP_MOD_DELETE:
     case LDAP_MOD_REPLACE:
-	self->mod->mod_op = mod_op;
 	break;
     default:
 	(void) PyErr_Format(
 	    PyExc_ValueError, "%s.__init__(): argument `mode' must be "
-	    "LDAP_MOD_[ADD|DELETE|REPLACE]", LDAPObjName(self)
+	    "LDAP_MOD_[ADD|DELETE|REPLACE]", name
 	    );
 	return -1;
     }
-    if (!PyList_Check(values) && values != Py_None) {
+    if (values == Py_None)
+	return size;
+    if (!PyList_Check(values)) {
 	(void) PyErr_Format(
 	    PyExc_TypeError, "%s.__init__(): argument `values' must be "
-	    "a list or None", LDAPObjName(self)
+	    "a list or None", name
 	    );
 	return -1;
     }
-    self->mod->mod_type = PyMem_New(char, strlen(mod_type) + 1);
-    if (!self->mod->mod_type) {
-	PyErr_SetNone(PyExc_MemoryError);
+    len = PyList_GET_SIZE(values);
+    if (!len) {
+	(void) PyErr_Format(
+	    PyExc_TypeError, "%s.__init__(): argument `values' must be "
+	    "a non empty list", name
+	    );
 	return -1;
     }
-    (void) strcpy(self->mod->mod_type, mod_type);
-    if (PyList_Check(values)) {
-	char **ptr;
-        wchar_t *tmp;
-	Py_ssize_t i, len = PyList_GET_SIZE(values);
+    size += (len + 1) * sizeof(char *);
+    for (i = 0; i < len; i++) {
+	PyObject *py_value = PyList_GET_ITEM(values, i);
+	Py_ssize_t l;
 
-	if (!len) {
+	if (!PyUnicode_Check(py_value)) {
 	    (void) PyErr_Format(
-		PyExc_TypeError, "%s.__init__(): argument `values' must be "
-		"a non empty list", LDAPObjName(self)
+		PyExc_TypeError,
+		"%s.__init__(): argument `values' must be a list of "
+		"strings", name
 		);
 	    return -1;
 	}
-	self->mod->mod_values = PyMem_New(char *, len + 1);
-	if (!self->mod->mod_values) {
-	    PyErr_SetNone(PyExc_MemoryError);
+	if (!PyUnicode_AsUTF8AndSize(py_value, &l))
 	    return -1;
-	}
-	self->mod->mod_values[len] = NULL;
-        setlocale(LC_ALL, "");
-	for (i = 0, ptr=self->mod->mod_values; i < len; i++, ptr++) {
-	    PyObject *py_value = PyList_GET_ITEM(values, i);
-	    Py_ssize_t l;
-	    
-	    if (!PyUnicode_Check(py_value)) {
-		PyMem_Free((void *) self->mod->mod_values);
-		self->mod->mod_values = NULL;
-		PyErr_Format(
-		    PyExc_TypeError,
-		    "%s.__init__(): argument `values' must be a list of "
-		    "strings", LDAPObjName(self)
-		    );
-		return -1;
-	    }
-            tmp=PyUnicode_AsWideCharString(py_value,&l);
-	    *ptr = PyMem_New(char, 2*l);
-	    if (!*ptr || !tmp) {
-		LibLDAP_value_free((void **) self->mod->mod_values);
-		PyErr_SetNone(PyExc_MemoryError);
-		return -1;
-	    }
+	size += l + 1;
+    }
+    return size;
+}
 
-            wcstombs(*ptr,tmp,2*l);
-            PyMem_Free((void*)tmp);
+/* lays out in `data' the mod checked by LDAPModObject_size() */
+static void
+LDAPModObject_fill(
+    LDAPModObject *self, char *data, int mod_op, const char *mod_type,
+    PyObject *values)
+{
+    char *ptr = data;
+    Py_ssize_t l;
+
+    self->data = data;
+    self->mod.mod_op = mod_op;
+    if (values != Py_None) {
+	Py_ssize_t i, len = PyList_GET_SIZE(values);
+
+	self->mod.mod_values = (char **) data;
+	ptr += (len + 1) * sizeof(char *);
+	for (i = 0; i < len; i++) {
+	    const char *value = PyUnicode_AsUTF8AndSize(
+		PyList_GET_ITEM(values, i), &l);
+
+	    (void) memcpy((void *) ptr, (const void *) value, l + 1);
+	    self->mod.mod_values[i] = ptr;
+	    ptr += l + 1;
 	}
+	self->mod.mod_values[len] = NULL;
+    }
+    l = strlen(mod_type) + 1;
+    (void) memcpy((void *) ptr, (const void *) mod_type, l);
+    self->mod.mod_type = ptr;
+}
+
+static int
+LDAPModObject_set(
+    LDAPModObject *self, int mod_op, const char *mod_type, PyObject *values)
+{
+    Py_ssize_t size;
+    char *data;
+    int rc = -1;
+
+    /* the data is used by operations running without the GIL: it is
+       never replaced under their feet */
+    Py_BEGIN_CRITICAL_SECTION2(self, values);
+    size = LDAPModObject_size(LDAPObjName(self), mod_op, mod_type, values);
+    if (size < 0)
+	goto done;
+    if (self->mod.mod_type) {
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.__init__(): already initialized",
+	    LDAPObjName(self)
+	    );
+	goto done;
     }
-    return 0;
+    if (size <= Py_SIZE(self))
+	data = LDAPModObject_INLINE(self);
+    else if (!(data = PyMem_Malloc(size))) {
+	PyErr_SetNone(PyExc_MemoryError);
+	goto done;
+    }
+    LDAPModObject_fill(self, data, mod_op, mod_type, values);
+    rc = 0;
+  done:
+    Py_END_CRITICAL_SECTION2();
+    return rc;
+}
+
+static int
+LDAPModObject_init(LDAPModObject *self, PyObject *args, PyObject *kwds)
+{
+    int mod_op;
+    char *mod_type;
+    PyObject *values = Py_None;
+    static char *kwlist[] = {"mode", "attr", "values", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(
+	    args, kwds, "is|O", kwlist, &mod_op, &mod_type, &values))
+	return -1;
+    return LDAPModObject_set(self, mod_op, mod_type, values);
 }
 
+/* the size of the data is not known yet: __init__() stores it apart
+   unless it fits in a recycled object */
 static PyObject *
 LDAPModObject_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 {
-    LDAPModObject *self;
-
-    self = (LDAPModObject *) type->tp_alloc(type, 0);
-    if (self) {
-	self->mod = PyMem_New(LDAPMod, 1);
-	if (!self->mod)
-	    return PyErr_NoMemory();
-	(void) memset((void *) self->mod, 0, sizeof(LDAPMod));
+    return (PyObject *) LDAPModObject_alloc(type, 0);
+}
+
+/* LDAPMod(...) without the argument tuple and dictionary of tp_new and
+   tp_init, in a single allocation. Subclasses redefining __new__ or
+   __init__ go the usual way */
+PyObject *
+LDAPModObject_vectorcall(
+    PyObject *type, PyObject *const *args, size_t nargsf, PyObject *kwnames)
+{
+    int mod_op;
+    const char *mod_type;
+    Py_ssize_t size, nargs = PyVectorcall_NARGS(nargsf);
+    PyTypeObject *tp = (PyTypeObject *) type;
+    LDAPModObject *self = NULL;
+    PyObject *values = Py_None;
+    static char *kwlist[] = {"mode", "attr", "values", NULL};
+
+    if (tp->tp_new != LDAPModObject_new ||
+	tp->tp_init != (initproc) LDAPModObject_init) {
+	PyObject *a, *kw = NULL, *ret;
+	Py_ssize_t i;
+
+	a = PyTuple_New(nargs);
+	if (!a)
+	    return NULL;
+	for (i = 0; i < nargs; i++) {
+	    Py_INCREF(args[i]);
+	    PyTuple_SET_ITEM(a, i, args[i]);
+	}
+	if (kwnames && PyTuple_GET_SIZE(kwnames)) {
+	    kw = PyDict_New();
+	    for (i = 0; kw && i < PyTuple_GET_SIZE(kwnames); i++)
+		if (PyDict_SetItem(
+			kw, PyTuple_GET_ITEM(kwnames, i), args[nargs + i]) < 0)
+		    Py_CLEAR(kw);
+	    if (!kw) {
+		Py_DECREF(a);
+		return NULL;
+	    }
+	}
+	ret = PyType_Type.tp_call(type, a, kw);
+	Py_DECREF(a);
+	Py_XDECREF(kw);
+	return ret;
     }
+    if (!LibLDAP_parse_args(
+	    tp->tp_name, args, nargs, kwnames, "is|O", kwlist, &mod_op,
+	    &mod_type, &values))
+	return NULL;
+    Py_BEGIN_CRITICAL_SECTION(values);
+    size = LDAPModObject_size(tp->tp_name, mod_op, mod_type, values);
+    if (size >= 0)
+	self = LDAPModObject_alloc(tp, size);
+    if (self)
+	LDAPModObject_fill(
+	    self, LDAPModObject_INLINE(self), mod_op, mod_type, values);
+    Py_END_CRITICAL_SECTION();
     return (PyObject *) self;
 }
 
 /* TYPE */
 
-PyTypeObject LDAPModTypeObject = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "_libldap.LDAPMod",				/* tp_name */
-    sizeof(LDAPModObject),			/* tp_basicsize */
-    0,						/* tp_itemsize */
-    (destructor) LDAPModObject_dealloc,		/* tp_dealloc */
-    0,						/* tp_print */
-    0,						/* tp_getattr */
-    0,						/* tp_setattr */
-    0,						/* tp_compare */
-    0,						/* tp_repr */
-    0,						/* tp_as_number */
-    0,						/* tp_as_sequence */
-    0,						/* tp_as_mapping */
-    0,						/* tp_hash  */
-    0,						/* tp_call */
-    0,						/* tp_str */
-    0,						/* tp_getattro */
-    0,						/* tp_setattro */
-    0,						/* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,	/* tp_flags */
-    LDAPModObjectDoc,				/* tp_doc */
-    0,						/* tp_traverse */
-    0,						/* tp_clear */
-    0,						/* tp_richcompare */
-    0,						/* tp_weaklistoffset */
-    0,						/* tp_iter */
-    0,						/* tp_iternext */
-    0,						/* tp_methods */
-    0,						/* tp_members */
-    LDAPModObjectGetSet,			/* tp_getset */
-    0,						/* tp_base */
-    0,						/* tp_dict */
-    0,						/* tp_descr_get */
-    0,						/* tp_descr_set */
-    0,						/* tp_dictoffset */
-    (initproc) LDAPModObject_init,		/* tp_init */
-    0,						/* tp_alloc */
-    (newfunc) LDAPModObject_new,		/* tp_new */
+static PyType_Slot LDAPModTypeSlots[] = {
+    {Py_tp_doc, (void *) LDAPModObjectDoc},
+    {Py_tp_dealloc, (void *) LDAPModObject_dealloc},
+    {Py_tp_getset, (void *) LDAPModObjectGetSet},
+    {Py_tp_init, (void *) LDAPModObject_init},
+    {Py_tp_new, (void *) LDAPModObject_new},
+    {0, NULL}
+};
+
+PyType_Spec LDAPModTypeSpec = {
+    "_libldap.LDAPMod",				/* name */
+    sizeof(LDAPModObject),			/* basicsize */
+    1,						/* itemsize */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE |
+    Py_TPFLAGS_IMMUTABLETYPE,			/* flags */
+    LDAPModTypeSlots				/* slots */
 };
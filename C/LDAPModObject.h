@@ -7,13 +7,21 @@
 
 /* OBJECT */
 
+/* the type and the values are stored after the object itself, in the
+   same allocation of ob_size bytes, or in `data' allocated apart when
+   they do not fit */
 typedef struct {
-    PyObject_HEAD
-    LDAPMod *mod;
+    PyObject_VAR_HEAD
+    LDAPMod   mod;
+    char     *data;		/* mod_values then the strings */
 } LDAPModObject;
 
-extern PyTypeObject LDAPModTypeObject;
+extern PyType_Spec LDAPModTypeSpec;
 
-#define LDAPModObject_Check(o) ((o)->ob_type == &LDAPModTypeObject)
+PyObject *LDAPModObject_vectorcall(
+    PyObject *, PyObject *const *, size_t, PyObject *);
+void LDAPModObject_freelist_clear(LibLDAPState_t *);
+
+#define LDAPModObject_Check(st, o) PyObject_TypeCheck((o), (st)->mod_type)
 
 #endif /* LDAPMODOBJECT_H */
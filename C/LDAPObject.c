@@ -6,6 +6,8 @@
 #include <LDAPObject.h>
 #include <LDAPModObject.h>
 #include <LDAPControls.h>
+#include <LDAPTrace.h>
+#include <LDAPTLS.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #ifdef __HAVE_SASL__
@@ -13,10 +15,54 @@
 #endif /* __HAVE_SASL__ */
 #include <termios.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <pthread.h>
 
-#ifdef __LIBLDAP_DARWIN__
-extern PyObject *LibLDAPErr;
-#endif
+
+/* ldapi:// connections go through a Unix socket: no address, no port */
+#define LDAPObject_is_ldapi(self)					\
+    (!strcasecmp((self)->lud->lud_scheme, "ldapi"))
+
+/* Happy Eyeballs (RFC 8305): delay between two connection attempts */
+#define LDAPObject_HE_DELAY	0.25
+
+/* search profiling: each mark charges the time elapsed since the previous
+   mark to the given phase of the current search, kept in the mark until
+   committed to the connection */
+#define LDAPObject_prof_start(self, mark)				\
+    do {								\
+	if ((self)->profile) {						\
+	    (void) memset(						\
+		(void *) &(mark).prof, 0, sizeof(LDAPProfile_t));	\
+	    (mark).t = LibLDAP_monotonic();				\
+	}								\
+    } while (0)
+
+#define LDAPObject_prof_mark(self, mark, phase)			\
+    do {								\
+	if ((self)->profile) {						\
+	    double __now = LibLDAP_monotonic();				\
+									\
+	    (mark).prof.phase += __now - (mark).t;			\
+	    (mark).t = __now;						\
+	}								\
+    } while (0)
+
+#define LDAPObject_prof_commit(self, mark, n)				\
+    do {								\
+	if ((self)->profile)						\
+	    LDAPObject_prof_add((self), &(mark).prof, (n));		\
+    } while (0)
+
+/* DN buffer of LDAPObject_complete_dn() */
+#define LDAPObject_DN_MAX	1024
+
+typedef struct {
+    double           t;
+    LDAPProfile_t    prof;
+} LDAPObject_mark_t;
 
 #ifdef __HAVE_SASL__
 typedef struct {
@@ -27,20 +73,73 @@ typedef struct {
 } SASLAuth_t;
 #endif /* __HAVE_SASL__ */
 
+/*****************************************************************************
+ * GLOBAL VARIABLES
+ *****************************************************************************/
+
+unsigned long LDAPObject_handles = 0;
+/* incremented in the child by each fork(): a connection made by another
+   generation belongs to the parent */
+volatile unsigned long LDAPObject_forkgen = 0;
+
 /*****************************************************************************
  * LOCAL VARIABLES
  *****************************************************************************/
 
-static char LDAPObject_complete_dn_buf[1024];
+static char *LDAPObject_noattrs[] = {LDAP_NO_ATTRS, NULL};
+static unsigned long LDAPObject_serial = 0;
+static pthread_once_t LDAPObject_atfork_once = PTHREAD_ONCE_INIT;
 
 /*****************************************************************************
  * LOCAL FUNCTION DECLARATIONS
  *****************************************************************************/
 
 static const char *ldap_url_err2string(int);
-static const char *LDAPObject_complete_dn(const char *, PyObject *);
-static LDAPMod **LDAPObject_mods_parse(LDAPObject *, PyObject *, const char *);
+static const char *LDAPObject_complete_dn(
+    LDAPObject *, const char *, char *, const char *);
+static char **LDAPObject_attrs_parse(LDAPObject *, PyObject *, const char *);
+static LDAPMod **LDAPObject_mods_parse(
+    LDAPObject *, PyObject **, int, const char *);
+static void LDAPObject_mods_free(LDAPMod **, PyObject *);
 static int LDAPObject_conn_valid(PyObject *, const char *);
+static int LDAPObject_enter(LDAPObject *, const char *);
+static void LDAPObject_leave(LDAPObject *);
+static void LDAPObject_renumber(LDAPObject *);
+static void LDAPObject_atfork_child(void);
+static void LDAPObject_atfork_register(void);
+static int LDAPObject_connect(LDAPObject *, int, const char *);
+static void LDAPObject_detach(LDAPObject *);
+static int LDAPObject_reconnect(LDAPObject *, const char *);
+static int LDAPObject_bound(
+    LDAPObject *, const char *, const char *, const char *);
+static void LDAPObject_bind_done(LDAPObject *, int, int);
+static int LDAPObject_resolve(LDAPObject *);
+static int LDAPObject_happy_eyeballs(LDAPObject *, const char *);
+static PyObject *LDAPObject_entries2py(
+    LDAPObject *, LDAPMessage *, const char *, int, LDAPObject_mark_t *,
+    size_t *);
+static int LDAPObject_deref2py(
+    LDAPObject *, LDAPMessage *, const char *, PyObject **, size_t *);
+static PyObject *LDAPObject_refs2py(LDAPObject *, LDAPMessage *, const char *);
+static PyObject *LDAPObject_prof2py(LDAPProfile_t *);
+static void LDAPObject_prof_add(LDAPObject *, LDAPProfile_t *, Py_ssize_t);
+static int LDAPObject_result_code(LDAPObject *);
+static int LDAPObject_result_wait(
+    LDAPObject *, int, double, LDAPMessage **);
+static void LDAPObject_timeval(double, struct timeval *);
+static PyObject *LDAPObject_msg2py(
+    LDAPObject *, LDAPMessage *, const char *, size_t *);
+static void LDAPObject_op_sent(LDAPObject *, LibLDAPOp_t *, int, int);
+static void LDAPObject_op_done(
+    LDAPObject *, int, LDAPMessage *, int, size_t);
+static LDAPControl *LDAPObject_proxy_authz(
+    LDAPObject *, const char *, int, const char *);
+static int LDAPObject_as_user(
+    LDAPObject *, const char *, LDAPControl ***, const char *);
+static void LDAPObject_as_user_free(const char *, LDAPControl **);
+static Py_ssize_t LDAPObject_search_noattrs(
+    LDAPObject *, PyObject *const *, Py_ssize_t, PyObject *, const char *,
+    PyObject *);
 #ifdef __HAVE_SASL__
 static int sasl_parse_mechs(PyObject *, char **);
 static int sasl_interact(LDAP *, unsigned int, void *, void *);
@@ -61,56 +160,201 @@ PyDoc_STRVAR(LDAPObjectDoc, "");
 PyDoc_STRVAR(LDAPObjectDoc_simple_bind_s, "");
 
 static PyObject *
-LDAPObject_simple_bind_s(LDAPObject *self, PyObject *args, PyObject *kwds)
+LDAPObject_simple_bind_s(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
 {
-    int ecode;
+    char dnbuf[LDAPObject_DN_MAX];
+    int ecode, msgid = -1;
     const char *user = NULL, *password = NULL;
-    static char *kwlist[] = {"user", "password", NULL};
+    double timeout = 0.0;
+    BerValue cred = {0, NULL};
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {"user", "password", "timeout", NULL};
 
     if (!LDAPObject_conn_valid((PyObject *) self, "simple_bind_s"))
 	return NULL;
-    if (!PyArg_ParseTupleAndKeywords(
-	    args, kwds, "|ss", kwlist, &user, &password))
+    if (!LibLDAP_parse_args(
+	    "simple_bind_s", args, nargs, kwnames, "|ssd", kwlist, &user,
+	    &password, &timeout))
 	return NULL;
-    if (user)
-	user = LDAPObject_complete_dn(user, self->dn);
-    ecode = ldap_simple_bind_s(self->ldp, user, password);
+    if (user) {
+	user = LDAPObject_complete_dn(self, user, dnbuf, "simple_bind_s");
+	if (!user)
+	    return NULL;
+    }
+    if (password) {
+	cred.bv_val = (char *) password;
+	cred.bv_len = strlen(password);
+    }
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_BIND, user, -1, NULL);
+    ecode = ldap_sasl_bind(
+	self->ldp, user, LDAP_SASL_SIMPLE, &cred, NULL, NULL, &msgid);
+    if (ecode == LDAP_SUCCESS)
+	ecode = LDAPObject_result_wait(self, msgid, timeout, NULL);
+    LibLDAP_op_end(&op, msgid, ecode, 0, 0);
     if (ecode != LDAP_SUCCESS)
 	return PyErr_Format(
-	    LibLDAPErr, "%s.simple_bind_s(): ldap_simple_bind_s(): %s",
+	    LibLDAPErr(self), "%s.simple_bind_s(): ldap_sasl_bind(): %s",
 	    LDAPObjName(self), ldap_err2string(ecode)
 	    );
+    if (LDAPObject_bound(self, "SIMPLE", user, password) < 0)
+	return NULL;
     Py_RETURN_NONE;
 }
 
+PyDoc_STRVAR(LDAPObjectDoc_simple_bind, "");
+
+static PyObject *
+LDAPObject_simple_bind(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    char dnbuf[LDAPObject_DN_MAX];
+    int ecode, msgid = -1;
+    const char *user = NULL, *password = NULL;
+    BerValue cred = {0, NULL};
+    PyObject *req, *old;
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {"user", "password", NULL};
+
+    if (!LDAPObject_conn_valid((PyObject *) self, "simple_bind"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "simple_bind", args, nargs, kwnames, "|ss", kwlist, &user,
+	    &password))
+	return NULL;
+    if (user) {
+	user = LDAPObject_complete_dn(self, user, dnbuf, "simple_bind");
+	if (!user)
+	    return NULL;
+    }
+    if (password) {
+	cred.bv_val = (char *) password;
+	cred.bv_len = strlen(password);
+    }
+    /* the bind to replay once result() gets its success */
+    req = Py_BuildValue("(szz)", "SIMPLE", user, password);
+    if (!req)
+	return NULL;
+    LibLDAP_op_prepare(&op, self->serial, LDAP_REQ_BIND, user, -1, NULL);
+    ecode = ldap_sasl_bind(
+	self->ldp, user, LDAP_SASL_SIMPLE, &cred, NULL, NULL, &msgid);
+    LDAPObject_op_sent(self, &op, msgid, ecode);
+    if (ecode != LDAP_SUCCESS) {
+	Py_DECREF(req);
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.simple_bind(): ldap_sasl_bind(): %s",
+	    LDAPObjName(self), ldap_err2string(ecode)
+	    );
+    }
+    Py_BEGIN_CRITICAL_SECTION(self);
+    old = self->bindreq;
+    self->bindreq = req;
+    self->bind_msgid = msgid;
+    Py_END_CRITICAL_SECTION();
+    Py_XDECREF(old);
+    return PyLong_FromLong((long) msgid);
+}
+
 PyDoc_STRVAR(LDAPObjectDoc_bind_s, "");
 
 static PyObject *
-LDAPObject_bind_s(LDAPObject *self, PyObject *args, PyObject *kwds)
+LDAPObject_bind_s(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
 {
-    int ecode, method = LDAP_AUTH_SIMPLE;
+    char dnbuf[LDAPObject_DN_MAX];
+    int ecode, method = LDAP_AUTH_SIMPLE, msgid = -1;
     const char *user = NULL, *password = NULL;
-    static char *kwlist[] = {"user", "password", "method", NULL};
+    double timeout = 0.0;
+    BerValue cred = {0, NULL};
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {"user", "password", "method", "timeout", NULL};
 
     if (!LDAPObject_conn_valid((PyObject *) self, "bind_s"))
 	return NULL;
-    if (!PyArg_ParseTupleAndKeywords(
-	    args, kwds, "|ssi", kwlist, &user, &password, &method))
+    if (!LibLDAP_parse_args(
+	    "bind_s", args, nargs, kwnames, "|ssid", kwlist, &user, &password,
+	    &method, &timeout))
 	return NULL;
     if (method != LDAP_AUTH_SIMPLE)
 	return PyErr_Format(
-	    LibLDAPErr,
+	    LibLDAPErr(self),
 	    "%s.bind_s(): only simple authentication [LDAP_AUTH_SIMPLE] "
 	    "is supported", LDAPObjName(self)
 	    );
-    if (user)
-	user = LDAPObject_complete_dn(user, self->dn);
-    ecode = ldap_bind_s(self->ldp, user, password, method);
+    if (user) {
+	user = LDAPObject_complete_dn(self, user, dnbuf, "bind_s");
+	if (!user)
+	    return NULL;
+    }
+    if (password) {
+	cred.bv_val = (char *) password;
+	cred.bv_len = strlen(password);
+    }
+    /* ldap_bind_s() without its blocking wait, as simple_bind_s() */
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_BIND, user, -1, NULL);
+    ecode = ldap_sasl_bind(
+	self->ldp, user, LDAP_SASL_SIMPLE, &cred, NULL, NULL, &msgid);
+    if (ecode == LDAP_SUCCESS)
+	ecode = LDAPObject_result_wait(self, msgid, timeout, NULL);
+    LibLDAP_op_end(&op, msgid, ecode, 0, 0);
+    if (ecode != LDAP_SUCCESS)
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.bind_s(): ldap_sasl_bind(): %s",
+	    LDAPObjName(self), ldap_err2string(ecode)
+	    );
+    if (LDAPObject_bound(self, "SIMPLE", user, password) < 0)
+	return NULL;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(LDAPObjectDoc_sasl_external_bind_s, "");
+
+/* SASL EXTERNAL (RFC 4422 appendix A): the identity is the one the
+   connection already carries, e.g. the uid/gid of the peer of an ldapi://
+   socket or a TLS client certificate. No callback, no prompt, no libsasl */
+static PyObject *
+LDAPObject_sasl_external_bind_s(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    int ecode, msgid = -1;
+    const char *authzid = NULL;
+    double timeout = 0.0;
+    struct berval cred = {.bv_val = "", .bv_len = 0};
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {"authzid", "timeout", NULL};
+
+    if (!LDAPObject_conn_valid((PyObject *) self, "sasl_external_bind_s"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "sasl_external_bind_s", args, nargs, kwnames, "|zd", kwlist,
+	    &authzid, &timeout))
+	return NULL;
+    if (authzid) {
+	cred.bv_val = (char *) authzid;
+	cred.bv_len = strlen(authzid);
+    }
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_BIND, authzid, -1, NULL);
+    ecode = ldap_sasl_bind(
+	self->ldp, NULL, "EXTERNAL", &cred, NULL, NULL, &msgid);
+    if (ecode == LDAP_SUCCESS)
+	ecode = LDAPObject_result_wait(self, msgid, timeout, NULL);
+    LibLDAP_op_end(&op, msgid, ecode, 0, 0);
     if (ecode != LDAP_SUCCESS)
 	return PyErr_Format(
-	    LibLDAPErr, "%s.bind_s(): ldap_bind_s(): %s",
+	    LibLDAPErr(self),
+	    "%s.sasl_external_bind_s(): ldap_sasl_bind(): %s",
 	    LDAPObjName(self), ldap_err2string(ecode)
 	    );
+    if (LDAPObject_bound(self, "EXTERNAL", authzid, NULL) < 0)
+	return NULL;
     Py_RETURN_NONE;
 }
 
@@ -118,19 +362,24 @@ LDAPObject_bind_s(LDAPObject *self, PyObject *args, PyObject *kwds)
 PyDoc_STRVAR(LDAPObjectDoc_sasl_bind_s, "");
 
 static PyObject *
-LDAPObject_sasl_bind_s(LDAPObject *self, PyObject *args, PyObject *kwds)
+LDAPObject_sasl_bind_s(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
 {
-    int ecode, dflag, pflag;
+    int ecode, dflag, pflag, msgid = -1, rc = 0;
     char *dn = NULL, *mech = NULL;
-    struct berval cred = {.bv_val = NULL, .bv_len = 0}, *servercredp;
+    double timeout = 0.0;
+    struct berval cred = {.bv_val = NULL, .bv_len = 0};
     LDAPDN ldn;
-    static char *kwlist[] = {"mech", "dn", "password", NULL};
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {"mech", "dn", "password", "timeout", NULL};
     
     if (!LDAPObject_conn_valid((PyObject *) self, "sasl__bind_s"))
 	return NULL;
-    if (!PyArg_ParseTupleAndKeywords(
-	    args, kwds, "|zss#", kwlist, &mech, &dn, &cred.bv_val,
-	    &cred.bv_len))
+    if (!LibLDAP_parse_args(
+	    "sasl_bind_s", args, nargs, kwnames, "|zss#d", kwlist, &mech, &dn,
+	    &cred.bv_val, &cred.bv_len, &timeout))
 	return NULL;
     if (!mech)
 	mech = LDAP_SASL_SIMPLE;
@@ -140,7 +389,7 @@ LDAPObject_sasl_bind_s(LDAPObject *self, PyObject *args, PyObject *kwds)
     pflag = cred.bv_val ? 0 : 1;
     if (sasl_input_name(&dn, "Enter DN: ") < 0)
 	return PyErr_Format(
-	    LibLDAPErr, "%s.sasl_bind_s(): can't get DN",
+	    LibLDAPErr(self), "%s.sasl_bind_s(): can't get DN",
 	    LDAPObjName(self)
 	    );
     ecode = ldap_str2dn(dn, &ldn, LDAP_DN_FORMAT_LDAPV3);
@@ -149,7 +398,7 @@ LDAPObject_sasl_bind_s(LDAPObject *self, PyObject *args, PyObject *kwds)
 	if (dflag)
 	    free(dn);
 	return PyErr_Format(
-	    LibLDAPErr,
+	    LibLDAPErr(self),
 	    "%s.sasl_bind_s(): invalid DN: %s", LDAPObjName(self),
 	    ldap_err2string(ecode)
 	    );
@@ -158,12 +407,25 @@ LDAPObject_sasl_bind_s(LDAPObject *self, PyObject *args, PyObject *kwds)
 	if (dflag)
 	    free(dn);
 	return PyErr_Format(
-	    LibLDAPErr, "%s.sasl_bind_s(): can't get password",
+	    LibLDAPErr(self), "%s.sasl_bind_s(): can't get password",
 	    LDAPObjName(self)
 	    );
     }
-    ecode = ldap_sasl_bind_s(
-	self->ldp, dn, mech, &cred, NULL, NULL, &servercredp);
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_BIND, dn, -1, NULL);
+    ecode = ldap_sasl_bind(self->ldp, dn, mech, &cred, NULL, NULL, &msgid);
+    if (ecode == LDAP_SUCCESS)
+	ecode = LDAPObject_result_wait(self, msgid, timeout, NULL);
+    LibLDAP_op_end(&op, msgid, ecode, 0, 0);
+    /* other mechanisms are recorded, for reconnect() to refuse them */
+    if (ecode == LDAP_SUCCESS) {
+	if (!mech)
+	    rc = LDAPObject_bound(self, "SIMPLE", dn, cred.bv_val);
+	else if (!strcmp(mech, "EXTERNAL"))
+	    rc = LDAPObject_bound(
+		self, "EXTERNAL", cred.bv_len ? cred.bv_val : NULL, NULL);
+	else
+	    rc = LDAPObject_bound(self, mech, dn, NULL);
+    }
     if (dflag)
 	free(dn);
     if (pflag) {
@@ -172,10 +434,12 @@ LDAPObject_sasl_bind_s(LDAPObject *self, PyObject *args, PyObject *kwds)
     }
     if (ecode != LDAP_SUCCESS)
 	return PyErr_Format(
-	    LibLDAPErr,
-	    "%s.sasl_bind_s(): ldap_sasl_bind_s(): %s", LDAPObjName(self),
+	    LibLDAPErr(self),
+	    "%s.sasl_bind_s(): ldap_sasl_bind(): %s", LDAPObjName(self),
 	    ldap_err2string(ecode)
 	    );    
+    if (rc < 0)
+	return NULL;
     Py_RETURN_NONE;
 }
 
@@ -183,25 +447,33 @@ PyDoc_STRVAR(LDAPObjectDoc_sasl_interactive_bind_s, "");
 
 static PyObject *
 LDAPObject_sasl_interactive_bind_s(
-    LDAPObject *self, PyObject *args, PyObject *kwds
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
     )
 {
-    int ecode, uflag, pflag;
+    int ecode, uflag, pflag, msgid = -1, rc = 0;
     char *mechs = NULL;
+    const char *rmech = NULL;
     unsigned int flags = -1;
+    double timeout = 0.0, deadline = 0.0;
+    LDAPMessage *res = NULL;
     SASLAuth_t dflts = {
 	.authname = NULL,
 	.user = NULL,
 	.realm = NULL,
 	.cred = {.bv_val = NULL, .bv_len = 0}
     };
-    static char *kwlist[] = {"mechs", "flags", "user", "password", NULL};
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {
+	"mechs", "flags", "user", "password", "timeout", NULL
+    };
 
     if (!LDAPObject_conn_valid((PyObject *) self, "sasl_interactive_bind_s"))
 	return NULL;
-    if (!PyArg_ParseTupleAndKeywords(
-	    args, kwds, "|O&Iss#", kwlist, sasl_parse_mechs, &mechs, &flags,
-	    &dflts.authname, &dflts.cred.bv_val, &dflts.cred.bv_len))
+    if (!LibLDAP_parse_args(
+	    "sasl_interactive_bind_s", args, nargs, kwnames, "|O&Iss#d",
+	    kwlist, sasl_parse_mechs, &mechs, &flags, &dflts.authname,
+	    &dflts.cred.bv_val, &dflts.cred.bv_len, &timeout))
 	return NULL;
     if (flags == -1) {
 	if (!dflts.authname || !dflts.cred.bv_val)
@@ -218,15 +490,52 @@ LDAPObject_sasl_interactive_bind_s(
 	default:
 	    PyMem_Free(mechs);
 	    return PyErr_Format(
-		LibLDAPErr, "%s.sasl_interactive_bind_s(): invalid value `%u' "
-		"for parameter `flags'", LDAPObjName(self), flags
+		LibLDAPErr(self), "%s.sasl_interactive_bind_s(): "
+		"invalid value `%u' for parameter `flags'", LDAPObjName(self),
+		flags
 		);
 	}
     }
     uflag = dflts.authname ? 0 : 1;
     pflag = dflts.cred.bv_val ? 0 : 1;
-    ecode = ldap_sasl_interactive_bind_s(
-	self->ldp, NULL, mechs, NULL, NULL, flags, sasl_interact, &dflts);
+    if (timeout > 0.0)
+	deadline = LibLDAP_monotonic() + timeout;
+    LibLDAP_op_begin(
+	&op, self->serial, LDAP_REQ_BIND, dflts.authname, -1, NULL);
+    /* ldap_sasl_interactive_bind_s() without its blocking waits: the
+       timeout bounds the whole exchange */
+    for (;;) {
+	double left = 0.0;
+
+	ecode = ldap_sasl_interactive_bind(
+	    self->ldp, NULL, mechs, NULL, NULL, flags, sasl_interact, &dflts,
+	    res, &rmech, &msgid);
+	(void) ldap_msgfree(res);
+	res = NULL;
+	if (ecode != LDAP_SASL_BIND_IN_PROGRESS)
+	    break;
+	if (timeout > 0.0) {
+	    left = deadline - LibLDAP_monotonic();
+	    if (left <= 0.0) {
+		(void) ldap_abandon_ext(self->ldp, msgid, NULL, NULL);
+		ecode = LDAP_TIMEOUT;
+		break;
+	    }
+	}
+	ecode = LDAPObject_result_wait(self, msgid, left, &res);
+	/* no answer: timed out or connection lost */
+	if (!res)
+	    break;
+    }
+    LibLDAP_op_end(&op, msgid, ecode, 0, 0);
+    /* recorded, for reconnect() to refuse it unless EXTERNAL */
+    if (ecode == LDAP_SUCCESS) {
+	if (rmech && !strcmp(rmech, "EXTERNAL"))
+	    rc = LDAPObject_bound(self, "EXTERNAL", NULL, NULL);
+	else
+	    rc = LDAPObject_bound(
+		self, rmech ? rmech : "SASL", dflts.authname, NULL);
+    }
     if (uflag)
 	free(dflts.authname);
     if (pflag) {
@@ -236,10 +545,12 @@ LDAPObject_sasl_interactive_bind_s(
     PyMem_Free(mechs);
     if (ecode != LDAP_SUCCESS)
 	return PyErr_Format(
-	    LibLDAPErr,
-	    "%s.sasl_interactive_bind_s(): ldap_sasl_interactive_bind_s(): %s",
+	    LibLDAPErr(self),
+	    "%s.sasl_interactive_bind_s(): ldap_sasl_interactive_bind(): %s",
 	    LDAPObjName(self), ldap_err2string(ecode)
 	    );
+    if (rc < 0)
+	return NULL;
     Py_RETURN_NONE;
 }
 #endif /* __HAVE_SASL__ */
@@ -249,17 +560,49 @@ PyDoc_STRVAR(LDAPObjectDoc_unbind_s, "");
 static PyObject *
 LDAPObject_unbind_s(LDAPObject *self)
 {
-    int ecode;
+    int ecode, busy;
+    LDAP *ldp = NULL;
+    LibLDAPOp_t op = {.type = 0};
 
+    /* inherited across fork(): not worth a new connection to unbind */
+    if (self->ldp && self->forkgen != LDAPObject_forkgen) {
+	LDAPObject_detach(self);
+	Py_RETURN_NONE;
+    }
     if (!LDAPObject_conn_valid((PyObject *) self, "unbind_s"))
 	return NULL;
-    ecode = ldap_unbind_s(self->ldp);
+    /* the handle is taken from the object before being freed, unless a
+       thread waits on it: libldap would free it under its feet */
+    Py_BEGIN_CRITICAL_SECTION(self);
+    busy = self->busy;
+    if (!busy) {
+	ldp = self->ldp;
+	self->ldp = NULL;
+	Py_CLEAR(self->pending);
+	LDAPObject_renumber(self);
+    }
+    Py_END_CRITICAL_SECTION();
+    if (busy)
+	return PyErr_Format(
+	    LibLDAPErr(self),
+	    "%s.unbind_s(): connection in use by another thread",
+	    LDAPObjName(self)
+	    );
+    /* unbound by another thread meanwhile */
+    if (!ldp)
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.unbind_s(): invalid LDAP connection",
+	    LDAPObjName(self)
+	    );
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_UNBIND, NULL, -1, NULL);
+    /* the handle is freed whatever the outcome */
+    ecode = ldap_unbind_s(ldp);
+    LibLDAP_op_end(&op, -1, ecode, 0, 0);
     if (ecode != LDAP_SUCCESS)
 	return PyErr_Format(
-	    LibLDAPErr, "%s.unbind_s(): ldap_simple_bind_s(): %s",
+	    LibLDAPErr(self), "%s.unbind_s(): ldap_unbind_s(): %s",
 	    LDAPObjName(self), ldap_err2string(ecode)
 	    );
-    self->ldp = NULL;
     Py_RETURN_NONE;
 }
 
@@ -268,59 +611,131 @@ PyDoc_STRVAR(LDAPObjectDoc_start_tls, "");
 static PyObject *
 LDAPObject_start_tls(LDAPObject *self)
 {
-    int ecode, msgid;
+    int ecode, msgid = -1;
+    LibLDAPOp_t op = {.type = 0};
 
     if (!LDAPObject_conn_valid((PyObject *) self, "start_tls"))
 	return NULL;
+    LibLDAP_op_prepare(&op, self->serial, LDAP_REQ_EXTENDED, NULL, -1, NULL);
     ecode = ldap_start_tls(self->ldp, NULL, NULL, &msgid);
+    LDAPObject_op_sent(self, &op, msgid, ecode);
     if (ecode != LDAP_SUCCESS)
 	return PyErr_Format(
-	    LibLDAPErr, "%s.start_tls(): ldap_start_tls(): %s",
+	    LibLDAPErr(self), "%s.start_tls(): ldap_start_tls(): %s",
 	    LDAPObjName(self), ldap_err2string(ecode)
 	    );
+    /* TLS is installed when its answer is received, see result() */
+    Py_BEGIN_CRITICAL_SECTION(self);
+    self->tls_msgid = msgid;
+    Py_END_CRITICAL_SECTION();
     return PyLong_FromLong((long) msgid);
 }
 
 PyDoc_STRVAR(LDAPObjectDoc_start_tls_s, "");
 
 static PyObject *
-LDAPObject_start_tls_s(LDAPObject *self)
+LDAPObject_start_tls_s(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
 {
-    int ecode;
+    int ecode, msgid = -1;
+    double timeout = 0.0;
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {"timeout", NULL};
 
     if (!LDAPObject_conn_valid((PyObject *) self, "start_tls_s"))
 	return NULL;
-    ecode = ldap_start_tls_s(self->ldp, NULL, NULL);
+    if (!LibLDAP_parse_args(
+	    "start_tls_s", args, nargs, kwnames, "|d", kwlist, &timeout))
+	return NULL;
+    /* ldap_start_tls_s() without its blocking wait: the timeout bounds
+       the StartTLS request, not the TLS handshake */
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_EXTENDED, NULL, -1, NULL);
+    ecode = ldap_start_tls(self->ldp, NULL, NULL, &msgid);
+    if (ecode == LDAP_SUCCESS)
+	ecode = LDAPObject_result_wait(self, msgid, timeout, NULL);
+    LibLDAP_op_end(&op, msgid, ecode, 0, 0);
+    if (ecode != LDAP_SUCCESS)
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.start_tls_s(): ldap_start_tls(): %s",
+	    LDAPObjName(self), ldap_err2string(ecode)
+	    );
+    ecode = ldap_install_tls(self->ldp);
     if (ecode != LDAP_SUCCESS)
 	return PyErr_Format(
-	    LibLDAPErr, "%s.start_tls_s(): ldap_start_tls_s(): %s",
+	    LibLDAPErr(self), "%s.start_tls_s(): ldap_install_tls(): %s",
 	    LDAPObjName(self), ldap_err2string(ecode)
 	    );
+    self->tls = 1;
     Py_RETURN_NONE;
 }
 
 PyDoc_STRVAR(LDAPObjectDoc_get_option, "");
 
 static PyObject *
-LDAPObject_get_option(LDAPObject *self, PyObject *args)
+LDAPObject_get_option(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
     int ecode, opt;
+    static char *kwlist[] = {"option", NULL};
     union {
 	int    ival;
 	char  *mech;
 	char **lval;
     } optval;
-    LDAP *ldp = self ? self->ldp : NULL;
+    /* self is the module for ldap_[gs]et_option() (global options) */
+    int global = PyModule_Check((PyObject *) self);
+    LDAP *ldp = global ? NULL : self->ldp;
+    const char *name = global ? "_libldap" : LDAPObjName(self);
     
-    if (!PyArg_ParseTuple(args, "i", &opt))
+    if (!LibLDAP_parse_args(
+	    "get_option", args, nargs, NULL, "i", kwlist, &opt))
 	return NULL;
     switch (opt) {
     case LDAP_OPT_PROTOCOL_VERSION:
     case LDAP_OPT_X_TLS_REQUIRE_CERT:
+    case LDAP_OPT_X_TLS_PROTOCOL_MIN:
 	ecode = ldap_get_option(ldp, opt, (void *) &optval.ival);
 	if (ecode != LDAP_OPT_SUCCESS)
 	    goto failed;
 	return Py_BuildValue("i", optval.ival);
+    case LDAP_OPT_CONNECT_ASYNC:
+    case LDAP_OPT_REFERRALS:
+	ecode = ldap_get_option(ldp, opt, (void *) &optval.ival);
+	if (ecode != LDAP_OPT_SUCCESS)
+	    goto failed;
+	return PyBool_FromLong((long) optval.ival);
+    case LDAP_OPT_NETWORK_TIMEOUT:
+    {
+	struct timeval *tv = NULL;
+	PyObject *ret;
+
+	ecode = ldap_get_option(ldp, opt, (void *) &tv);
+	if (ecode != LDAP_OPT_SUCCESS)
+	    goto failed;
+	if (!tv)
+	    Py_RETURN_NONE;
+	ret = PyFloat_FromDouble(tv->tv_sec + tv->tv_usec / 1e6);
+	ldap_memfree(tv);
+	return ret;
+    }
+    case LDAP_OPT_X_TLS_CACERTFILE:
+    case LDAP_OPT_X_TLS_CACERTDIR:
+    case LDAP_OPT_X_TLS_CERTFILE:
+    case LDAP_OPT_X_TLS_KEYFILE:
+    case LDAP_OPT_X_TLS_CIPHER_SUITE:
+    {
+	PyObject *ret;
+
+	optval.mech = NULL;
+	ecode = ldap_get_option(ldp, opt, (void *) &optval.mech);
+	if (ecode != LDAP_OPT_SUCCESS)
+	    goto failed;
+	ret = Py_BuildValue("z", optval.mech);
+	ldap_memfree(optval.mech);
+	return ret;
+    }
 #ifdef __HAVE_SASL__
     case LDAP_OPT_X_SASL_MECH:
     {
@@ -360,877 +775,3334 @@ LDAPObject_get_option(LDAPObject *self, PyObject *args)
 #endif /* __HAVE_SASL__ */
     default:
 	return PyErr_Format(
-	    LibLDAPErr, "%s.get_option(): `%d': option not supported",
-	    LDAPObjName(self)
+	    LibLDAPErr(self), "%s.get_option(): `%d': option not supported",
+	    name, opt
 	    );
     }
   failed:
     return PyErr_Format(
-	LibLDAPErr,"%s.get_option(): ldap_get_option() failed",
-	LDAPObjName(self)
+	LibLDAPErr(self),"%s.get_option(): ldap_get_option() failed",
+	name
 	);
 }
 
 PyDoc_STRVAR(LDAPObjectDoc_set_option, "");
 
 static PyObject *
-LDAPObject_set_option(LDAPObject *self, PyObject *args)
+LDAPObject_set_option(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
     int ecode, opt, optval;
-    LDAP *ldp = self ? self->ldp : NULL;
+    const char *strval = NULL;
+    PyObject *py_optval;
+    static char *kwlist[] = {"option", "optval", NULL};
+    /* self is the module for ldap_[gs]et_option() (global options) */
+    int global = PyModule_Check((PyObject *) self);
+    LDAP *ldp = global ? NULL : self->ldp;
+    const char *name = global ? "_libldap" : LDAPObjName(self);
     
-    if (!PyArg_ParseTuple(args, "ii", &opt, &optval))
+    if (!LibLDAP_parse_args(
+	    "set_option", args, nargs, NULL, "iO", kwlist, &opt, &py_optval))
 	return NULL;
     switch (opt) {
     case LDAP_OPT_PROTOCOL_VERSION:
     case LDAP_OPT_X_TLS_REQUIRE_CERT:
+    case LDAP_OPT_X_TLS_PROTOCOL_MIN:
+    case LDAP_OPT_X_TLS_NEWCTX:
+	optval = (int) PyLong_AsLong(py_optval);
+	if (optval == -1 && PyErr_Occurred())
+	    return NULL;
 	ecode = ldap_set_option(ldp, opt, (const void *) &optval);
-	if (ecode != LDAP_OPT_SUCCESS)
+	break;
+    case LDAP_OPT_NETWORK_TIMEOUT:
+    {
+	double seconds;
+	struct timeval tv;
+
+	if (py_optval == Py_None) {
+	    ecode = ldap_set_option(ldp, opt, NULL);
+	    break;
+	}
+	seconds = PyFloat_AsDouble(py_optval);
+	if (seconds == -1.0 && PyErr_Occurred())
+	    return NULL;
+	if (seconds < 0.0)
 	    return PyErr_Format(
-		LibLDAPErr,"%s.set_option(): ldap_set_option() failed",
-		LDAPObjName(self)
-		);
+		PyExc_ValueError, "%s.set_option(): negative timeout", name);
+	LDAPObject_timeval(seconds, &tv);
+	ecode = ldap_set_option(ldp, opt, (const void *) &tv);
+	break;
+    }
+    case LDAP_OPT_CONNECT_ASYNC:
+    case LDAP_OPT_REFERRALS:
+	/* boolean options are set by a pointer, whatever it points to */
+	optval = PyObject_IsTrue(py_optval);
+	if (optval == -1)
+	    return NULL;
+	ecode = ldap_set_option(
+	    ldp, opt, optval ? LDAP_OPT_ON : LDAP_OPT_OFF);
+	break;
+    case LDAP_OPT_X_TLS_CACERTFILE:
+    case LDAP_OPT_X_TLS_CACERTDIR:
+    case LDAP_OPT_X_TLS_CERTFILE:
+    case LDAP_OPT_X_TLS_KEYFILE:
+    case LDAP_OPT_X_TLS_CIPHER_SUITE:
+	if (py_optval != Py_None) {
+	    strval = PyUnicode_AsUTF8(py_optval);
+	    if (!strval)
+		return NULL;
+	}
+	ecode = ldap_set_option(ldp, opt, (const void *) strval);
 	break;
     default:
 	return PyErr_Format(
-	    LibLDAPErr, "%s.set_option(): `%d': option not supported",
-	    LDAPObjName(self)
+	    LibLDAPErr(self), "%s.set_option(): `%d': option not supported",
+	    name, opt
+	    );
+    }
+    if (ecode != LDAP_OPT_SUCCESS)
+	return PyErr_Format(
+	    LibLDAPErr(self),"%s.set_option(): ldap_set_option() failed",
+	    name
 	    );
+    /* set again on the connection of a forked child, in the same order:
+       an option set again moves to the end */
+    if (!global) {
+	PyObject *key = PyLong_FromLong((long) opt);
+
+	if (!key)
+	    return NULL;
+	if (PyDict_DelItem(self->options, key) < 0)
+	    PyErr_Clear();
+	ecode = PyDict_SetItem(self->options, key, py_optval);
+	Py_DECREF(key);
+	if (ecode < 0)
+	    return NULL;
     }
     Py_RETURN_NONE;
 }
 
-PyDoc_STRVAR(LDAPObjectDoc_search_ext_s, "");
-
+/* synchronous search: with `refs' set, referrals are not errors and
+   `*refs' is set to (continuation references, referral), see
+   LDAPObject_refs2py() */
 static PyObject *
-LDAPObject_search_ext_s(LDAPObject *self, PyObject *args, PyObject *kwds)
+LDAPObject_search_s(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames, const char *func,
+    PyObject **refs
+    )
 {
-    char *base = NULL, *filter = NULL, **attrs = NULL, **attr;
-    int ecode, limit = LDAP_NO_LIMIT, scope = LDAP_SCOPE_SUBTREE, attrsonly;
-    struct timeval tv = {0L, 0L}, *to = NULL;
+    char dnbuf[LDAPObject_DN_MAX];
+    char *base = NULL, *filter = NULL, **attrs = NULL;
+    char *as_user = NULL;
+    int ecode, msgid = -1, limit = LDAP_NO_LIMIT, scope = LDAP_SCOPE_SUBTREE;
+    int attrsonly, referral;
+    double timeout = 0.0;
+    struct timeval tv, *to = NULL;
     PyObject *py_attrs = NULL, *py_attrsonly = Py_False, *ret;
     LDAPControlsObject *serverctrls = NULL, *clientctrls = NULL;
-    LDAPMessage *res, *ptr;
+    LDAPMessage *res;
     LDAPControl **sctrls, **cctrls;
+    LDAPObject_mark_t mark = {0.0};
+    size_t bytes = 0;
+    LibLDAPOp_t op = {.type = 0};
     static char *kwlist[] = {
 	"base", "scope", "filter", "attrs", "attrsonly", "serverctrls",
-	"clientctrls", "limit", "timeout", NULL
+	"clientctrls", "limit", "timeout", "as_user", NULL
     };
 
-    if (!LDAPObject_conn_valid((PyObject *) self, "search_ext_s"))
+    if (!LDAPObject_conn_valid((PyObject *) self, func))
 	return NULL;
-    if (!PyArg_ParseTupleAndKeywords(
-	    args, kwds, "|sisO!O!O!O!il", kwlist, &base, &scope, &filter,
-	    &PyList_Type, &py_attrs, &PyBool_Type, &py_attrsonly,
-	    &LDAPControlsTypeObject, &serverctrls, &LDAPControlsTypeObject,
-	    &clientctrls, &limit, &tv.tv_sec))
+    if (!LibLDAP_parse_args(
+	    func, args, nargs, kwnames, "|sisO!O!O!O!idz", kwlist, &base,
+	    &scope, &filter, &PyList_Type, &py_attrs, &PyBool_Type,
+	    &py_attrsonly, self->st->controls_type, &serverctrls,
+	    self->st->controls_type, &clientctrls, &limit, &timeout, &as_user))
 	return NULL;
     if (py_attrs) {
-	Py_ssize_t i, len = PyList_Size(py_attrs);
-
-	if (!len)
-	    return PyErr_Format(
-		PyExc_TypeError,
-		"%s.search_ext_s(): argument `attrs' must be a non empty list",
-		LDAPObjName(self)
-		);
-	attrs = PyMem_New(char *, len + 1);
+	attrs = LDAPObject_attrs_parse(self, py_attrs, func);
 	if (!attrs)
-	    return PyErr_NoMemory();
-	(void) memset((void *) attrs, 0, (len + 1) * sizeof(char *));
-	for (i = 0, attr = attrs; i < len; i++, attr++) {
-	    PyObject *py_attr = PyList_GET_ITEM(py_attrs, i);
-	    Py_ssize_t l;
-
-	    if (!PyUnicode_Check(py_attr)) {
-		LibLDAP_value_free((void **) attrs);
-		return PyErr_Format(
-		    PyExc_TypeError,
-		    "%s.search_ext_s(): argument `attrs' must be a list "
-		    "of strings", LDAPObjName(self)
-		    );
-	    }
-	    l = PyUnicode_GET_LENGTH(py_attr);
-	    *attr = PyMem_New(char, l + 1);
-	    if (!*attr) {
-		LibLDAP_value_free((void **) attrs);
-		return PyErr_NoMemory();
-	    }
-	    (void) memcpy((void *) *attr, PyUnicode_DATA(py_attr), l);
-	    (*attr)[l] = 0;
-	}
+	    return NULL;
     }
-    base = (char *) LDAPObject_complete_dn(base, self->dn);
-    if (!base)
+    base = (char *) LDAPObject_complete_dn(self, base, dnbuf, func);
+    if (!base) {
+	LibLDAP_value_free((void **) attrs);
+	if (PyErr_Occurred())
+	    return NULL;
 	return PyErr_Format(
 	    PyExc_TypeError,
-	    "%s.search_ext_s(): argument `base' is not setted",
-	    LDAPObjName(self)
+	    "%s.%s(): argument `base' is not setted",
+	    LDAPObjName(self), func
 	    );
+    }
     attrsonly = py_attrsonly == Py_True ? 1 : 0;
     sctrls = serverctrls ? serverctrls->ctrls : NULL;
     cctrls = clientctrls ? clientctrls->ctrls : NULL;
-    if (tv.tv_sec > 0)
+    if (LDAPObject_as_user(self, as_user, &sctrls, func) < 0) {
+	LibLDAP_value_free((void **) attrs);
+	return NULL;
+    }
+    /* the time limit sent to the server, the client gives up later */
+    if (timeout > 0.0) {
+	LDAPObject_timeval(timeout, &tv);
 	to = &tv;
-    ecode = ldap_search_ext_s(
+    }
+    LDAPObject_prof_start(self, mark);
+    op.attrs = attrs;
+    op.ctrls = sctrls;
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_SEARCH, base, scope, filter);
+    res = NULL;
+    ecode = ldap_search_ext(
 	self->ldp, base, scope, filter, attrs, attrsonly, sctrls, cctrls, to,
-	limit, &res);
-    LibLDAP_value_free((void **) attrs);
+	limit, &msgid);
+    if (ecode == LDAP_SUCCESS)
+	ecode = LDAPObject_result_wait(self, msgid, timeout, &res);
+    LDAPObject_prof_mark(self, mark, network);
+    /* the server sends the client elsewhere for the whole search */
+    referral = refs && ecode == LDAP_REFERRAL;
+    if (referral)
+	ecode = LDAP_SUCCESS;
     if (ecode != LDAP_SUCCESS) {
 	(void) ldap_msgfree(res);
+	LibLDAP_op_end(&op, msgid, ecode, 0, 0);
+	LDAPObject_as_user_free(as_user, sctrls);
+	LibLDAP_value_free((void **) attrs);
 	return PyErr_Format(
-	    LibLDAPErr, "%s.search_ext_s(): ldap_search_ext_s(): %s",
-	    LDAPObjName(self), ldap_err2string(ecode)
+	    LibLDAPErr(self), "%s.%s(): ldap_search_ext(): %s",
+	    LDAPObjName(self), func, ldap_err2string(ecode)
 	    );
     }
-    if (LDAPControls_Check(
-	    self->ldp, res, LDAPObjName(self), "search_ext_s") < 0) {
+    if (!referral &&
+	LDAPControls_Check((PyObject *) self, res, func) < 0) {
 	(void) ldap_msgfree(res);
+	LibLDAP_op_end(&op, msgid, LDAPObject_result_code(self), 0, 0);
+	LDAPObject_as_user_free(as_user, sctrls);
+	LibLDAP_value_free((void **) attrs);
 	return NULL;
     }
-    ret = PyList_New(0);
-    if (!ret)
-	return NULL;
-    for (ptr = ldap_first_entry(self->ldp, res); ptr;
-	 ptr = ldap_next_entry(self->ldp, ptr)) {
-	char *attr, *dn;
-	BerElement *ber;
-	PyObject *py_attr = PyDict_New(), *py_entry;
-
-	if (!py_attr)
-	    goto failed;
-	for (attr = ldap_first_attribute(self->ldp, ptr, &ber ); 
-	     attr; attr = ldap_next_attribute(self->ldp, ptr, ber)) {
-	    char **vals = NULL;
-	    int i;
-	    PyObject *py_vals = PyList_New(0);
-
-	    if (!py_vals)
-		goto clean;
-	    vals = ldap_get_values(self->ldp, ptr, attr);
-	    if (!vals) {
-		(void) PyErr_Format(
-		    LibLDAPErr, "%s.search_ext_s(): ldap_get_values(): %s",
-		    LDAPObjName(self), ldap_err2string(ecode)
-		    );
-		goto clean;
-	    }
-	    for (i = 0; vals[i]; i++) {
-		PyObject *py_val = PyUnicode_FromString(vals[i]);
-		
-		if (!py_val) {
-		    ldap_value_free(vals);
-		    goto clean;
-		}
-		if (PyList_Append(py_vals, py_val) == -1) {
-		    Py_DECREF(py_val);
-		    ldap_value_free(vals);
-		    goto clean;
-		}
-		Py_DECREF(py_val);
-	    }
-	    ldap_value_free(vals);
-	    if (PyDict_SetItemString(py_attr, attr, py_vals) == -1)
-		goto clean;
-	    Py_DECREF(py_vals);
-	    ldap_memfree(attr);
-	    continue;
-	  clean:
-	    Py_XDECREF(py_vals);
-	    Py_DECREF(py_attr);
-	    ldap_memfree(attr);
-	    ber_free(ber, 0);
-	    goto failed;
-	}
-	ber_free(ber, 0);
-	dn = ldap_get_dn(self->ldp, ptr);
-	if (!dn) {
-	    (void) PyErr_Format(
-		LibLDAPErr, "%s.search_ext_s(): ldap_get_dn(): %s",
-		LDAPObjName(self), ldap_err2string(ecode)
-		);
-	    Py_DECREF(py_attr);
-	    goto failed;
-	}
-	py_entry = Py_BuildValue("(sO)", dn, py_attr);
-	Py_DECREF(py_attr);
-	ldap_memfree(dn);
-	if (!py_entry)
-	    goto failed;
-	if (PyList_Append(ret, py_entry) == -1) {
-	    Py_DECREF(py_entry);
-	    goto failed;
-	}
-	Py_DECREF(py_entry);
+    ret = LDAPObject_entries2py(
+	self, res, func,
+	sctrls && ldap_control_find(LDAP_CONTROL_X_DEREF, sctrls, NULL),
+	&mark, &bytes);
+    if (ret && refs) {
+	*refs = LDAPObject_refs2py(self, res, func);
+	if (!*refs)
+	    Py_CLEAR(ret);
     }
     (void) ldap_msgfree(res);
+    if (!ret) {
+	LibLDAP_op_end(&op, msgid, LDAP_LOCAL_ERROR, 0, bytes);
+	LDAPObject_as_user_free(as_user, sctrls);
+	LibLDAP_value_free((void **) attrs);
+	return NULL;
+    }
+    LDAPObject_prof_mark(self, mark, decode);
+    LDAPObject_prof_commit(self, mark, PyList_GET_SIZE(ret));
+    LibLDAP_op_end(&op, msgid, ecode, PyList_GET_SIZE(ret), bytes);
+    LDAPObject_as_user_free(as_user, sctrls);
+    LibLDAP_value_free((void **) attrs);
     return ret;
-  failed:
-    Py_DECREF(ret);
-    (void) ldap_msgfree(res);
-    return NULL;
 }
 
-PyDoc_STRVAR(LDAPObjectDoc_add_ext_s, "");
+PyDoc_STRVAR(LDAPObjectDoc_search_ext_s, "");
 
 static PyObject *
-LDAPObject_add_ext_s(LDAPObject *self, PyObject *args, PyObject *kwds)
+LDAPObject_search_ext_s(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
 {
-    char *dn;
-    int ecode;
-    PyObject *py_mods;
-    LDAPMod **mods;
-    LDAPControlsObject *serverctrls = NULL, *clientctrls = NULL;
-    LDAPControl **sctrls, **cctrls;
-    static char *kwlist[] = {"dn", "mods", "serverctrls", "clientctrls", NULL};
+    return LDAPObject_search_s(
+	self, args, nargs, kwnames, "search_ext_s", NULL);
+}
 
-    if (!LDAPObject_conn_valid((PyObject *) self, "add_ext_s"))
+PyDoc_STRVAR(LDAPObjectDoc_search_refs_s, "");
+
+static PyObject *
+LDAPObject_search_refs_s(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    PyObject *entries, *refs = NULL;
+
+    entries = LDAPObject_search_s(
+	self, args, nargs, kwnames, "search_refs_s", &refs);
+    if (!entries)
 	return NULL;
-    if (!PyArg_ParseTupleAndKeywords(
-	    args, kwds, "sO!|O!O!", kwlist, &dn, &PyList_Type, &py_mods,
-	    &LDAPControlsTypeObject, &serverctrls, &LDAPControlsTypeObject,
-	    &clientctrls))
+    return Py_BuildValue("(NN)", entries, refs);
+}
+
+PyDoc_STRVAR(LDAPObjectDoc_search_dns, "");
+
+static PyObject *
+LDAPObject_search_dns(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    PyObject *ret;
+
+    if (!LDAPObject_conn_valid((PyObject *) self, "search_dns"))
+	return NULL;
+    ret = PyList_New(0);
+    if (!ret)
+	return NULL;
+    if (LDAPObject_search_noattrs(
+	    self, args, nargs, kwnames, "search_dns", ret) < 0) {
+	Py_DECREF(ret);
+	return NULL;
+    }
+    return ret;
+}
+
+PyDoc_STRVAR(LDAPObjectDoc_search_count, "");
+
+static PyObject *
+LDAPObject_search_count(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    Py_ssize_t count;
+
+    if (!LDAPObject_conn_valid((PyObject *) self, "search_count"))
+	return NULL;
+    count = LDAPObject_search_noattrs(
+	self, args, nargs, kwnames, "search_count", NULL);
+    if (count < 0)
+	return NULL;
+    return PyLong_FromSsize_t(count);
+}
+
+PyDoc_STRVAR(LDAPObjectDoc_search_ext, "");
+
+static PyObject *
+LDAPObject_search_ext(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    char dnbuf[LDAPObject_DN_MAX];
+    char *base = NULL, *filter = NULL, **attrs = NULL;
+    char *as_user = NULL;
+    int ecode, msgid = -1, limit = LDAP_NO_LIMIT, scope = LDAP_SCOPE_SUBTREE;
+    double timeout = 0.0;
+    struct timeval tv, *to = NULL;
+    PyObject *py_attrs = NULL, *py_attrsonly = Py_False;
+    LDAPControlsObject *serverctrls = NULL, *clientctrls = NULL;
+    LDAPControl **sctrls, **cctrls;
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {
+	"base", "scope", "filter", "attrs", "attrsonly", "serverctrls",
+	"clientctrls", "limit", "timeout", "as_user", NULL
+    };
+
+    if (!LDAPObject_conn_valid((PyObject *) self, "search_ext"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "search_ext", args, nargs, kwnames, "|sisO!O!O!O!idz", kwlist,
+	    &base, &scope, &filter, &PyList_Type, &py_attrs, &PyBool_Type,
+	    &py_attrsonly, self->st->controls_type, &serverctrls,
+	    self->st->controls_type, &clientctrls, &limit, &timeout, &as_user))
+	return NULL;
+    if (py_attrs) {
+	attrs = LDAPObject_attrs_parse(self, py_attrs, "search_ext");
+	if (!attrs)
+	    return NULL;
+    }
+    base = (char *) LDAPObject_complete_dn(
+	self, base, dnbuf, "search_ext");
+    if (!base) {
+	LibLDAP_value_free((void **) attrs);
+	if (PyErr_Occurred())
+	    return NULL;
+	return PyErr_Format(
+	    PyExc_TypeError,
+	    "%s.search_ext(): argument `base' is not setted",
+	    LDAPObjName(self)
+	    );
+    }
+    sctrls = serverctrls ? serverctrls->ctrls : NULL;
+    cctrls = clientctrls ? clientctrls->ctrls : NULL;
+    if (LDAPObject_as_user(self, as_user, &sctrls, "search_ext") < 0) {
+	LibLDAP_value_free((void **) attrs);
+	return NULL;
+    }
+    /* server side time limit only */
+    if (timeout > 0.0) {
+	LDAPObject_timeval(timeout, &tv);
+	to = &tv;
+    }
+    op.attrs = attrs;
+    op.ctrls = sctrls;
+    LibLDAP_op_prepare(&op, self->serial, LDAP_REQ_SEARCH, base, scope, filter);
+    ecode = ldap_search_ext(
+	self->ldp, base, scope, filter, attrs, py_attrsonly == Py_True,
+	sctrls, cctrls, to, limit, &msgid);
+    LDAPObject_op_sent(self, &op, msgid, ecode);
+    LDAPObject_as_user_free(as_user, sctrls);
+    LibLDAP_value_free((void **) attrs);
+    if (ecode != LDAP_SUCCESS)
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.search_ext(): ldap_search_ext(): %s",
+	    LDAPObjName(self), ldap_err2string(ecode)
+	    );
+    return PyLong_FromLong((long) msgid);
+}
+
+PyDoc_STRVAR(LDAPObjectDoc_add_ext_s, "");
+
+static PyObject *
+LDAPObject_add_ext_s(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    char dnbuf[LDAPObject_DN_MAX];
+    char *dn, *as_user = NULL;
+    int ecode, msgid = -1;
+    double timeout = 0.0;
+    PyObject *py_mods;
+    LDAPMod **mods;
+    LDAPControlsObject *serverctrls = NULL, *clientctrls = NULL;
+    LDAPControl **sctrls, **cctrls;
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {
+	"dn", "mods", "serverctrls", "clientctrls", "timeout", "as_user", NULL
+    };
+
+    if (!LDAPObject_conn_valid((PyObject *) self, "add_ext_s"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "add_ext_s", args, nargs, kwnames, "sO!|O!O!dz", kwlist, &dn,
+	    &PyList_Type, &py_mods, self->st->controls_type, &serverctrls,
+	    self->st->controls_type, &clientctrls, &timeout, &as_user))
+	return NULL;
+    dn = (char *) LDAPObject_complete_dn(self, dn, dnbuf, "add_ext_s");
+    if (!dn)
 	return NULL;
-    dn = (char *) LDAPObject_complete_dn(dn, self->dn);
-    mods = LDAPObject_mods_parse(self, py_mods, "add_ext_s");
+    mods = LDAPObject_mods_parse(self, &py_mods, 1, "add_ext_s");
     if (!mods)
     	return NULL;
     sctrls = serverctrls ? serverctrls->ctrls : NULL;
     cctrls = clientctrls ? clientctrls->ctrls : NULL;
-    ecode = ldap_add_ext_s(self->ldp, dn, mods, sctrls, cctrls);
-    LibLDAP_value_free((void **) mods);
+    if (LDAPObject_as_user(self, as_user, &sctrls, "add_ext_s") < 0) {
+	LDAPObject_mods_free(mods, py_mods);
+	return NULL;
+    }
+    op.ctrls = sctrls;
+    op.mods = mods;
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_ADD, dn, -1, NULL);
+    ecode = ldap_add_ext(self->ldp, dn, mods, sctrls, cctrls, &msgid);
+    if (ecode == LDAP_SUCCESS)
+	ecode = LDAPObject_result_wait(self, msgid, timeout, NULL);
+    LibLDAP_op_end(&op, msgid, ecode, 0, 0);
+    LDAPObject_as_user_free(as_user, sctrls);
+    LDAPObject_mods_free(mods, py_mods);
     if (ecode != LDAP_SUCCESS)
 	return PyErr_Format(
-	    LibLDAPErr, "%s.add_ext_s(): ldap_add_ext_s(): %s",
+	    LibLDAPErr(self), "%s.add_ext_s(): ldap_add_ext(): %s",
 	    LDAPObjName(self), ldap_err2string(ecode)
 	    );
     Py_RETURN_NONE;
 }
 
+PyDoc_STRVAR(LDAPObjectDoc_add_ext, "");
+
+static PyObject *
+LDAPObject_add_ext(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    char dnbuf[LDAPObject_DN_MAX];
+    char *dn, *as_user = NULL;
+    int ecode, msgid = -1;
+    PyObject *py_mods;
+    LDAPMod **mods;
+    LDAPControlsObject *serverctrls = NULL, *clientctrls = NULL;
+    LDAPControl **sctrls, **cctrls;
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {
+	"dn", "mods", "serverctrls", "clientctrls", "as_user", NULL
+    };
+
+    if (!LDAPObject_conn_valid((PyObject *) self, "add_ext"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "add_ext", args, nargs, kwnames, "sO!|O!O!z", kwlist, &dn,
+	    &PyList_Type, &py_mods, self->st->controls_type, &serverctrls,
+	    self->st->controls_type, &clientctrls, &as_user))
+	return NULL;
+    dn = (char *) LDAPObject_complete_dn(self, dn, dnbuf, "add_ext");
+    if (!dn)
+	return NULL;
+    mods = LDAPObject_mods_parse(self, &py_mods, 1, "add_ext");
+    if (!mods)
+    	return NULL;
+    sctrls = serverctrls ? serverctrls->ctrls : NULL;
+    cctrls = clientctrls ? clientctrls->ctrls : NULL;
+    if (LDAPObject_as_user(self, as_user, &sctrls, "add_ext") < 0) {
+	LDAPObject_mods_free(mods, py_mods);
+	return NULL;
+    }
+    op.ctrls = sctrls;
+    op.mods = mods;
+    LibLDAP_op_prepare(&op, self->serial, LDAP_REQ_ADD, dn, -1, NULL);
+    ecode = ldap_add_ext(self->ldp, dn, mods, sctrls, cctrls, &msgid);
+    LDAPObject_op_sent(self, &op, msgid, ecode);
+    LDAPObject_as_user_free(as_user, sctrls);
+    LDAPObject_mods_free(mods, py_mods);
+    if (ecode != LDAP_SUCCESS)
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.add_ext(): ldap_add_ext(): %s",
+	    LDAPObjName(self), ldap_err2string(ecode)
+	    );
+    return PyLong_FromLong((long) msgid);
+}
+
 PyDoc_STRVAR(LDAPObjectDoc_delete_ext_s, "");
 
 static PyObject *
-LDAPObject_delete_ext_s(LDAPObject *self, PyObject *args, PyObject *kwds)
+LDAPObject_delete_ext_s(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
 {
-    char *dn;
-    int ecode;
+    char dnbuf[LDAPObject_DN_MAX];
+    char *dn, *as_user = NULL;
+    int ecode, msgid = -1;
+    double timeout = 0.0;
     LDAPControlsObject *serverctrls = NULL, *clientctrls = NULL;
     LDAPControl **sctrls, **cctrls;
-    static char *kwlist[] = {"dn", "serverctrls", "clientctrls", NULL};
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {
+	"dn", "serverctrls", "clientctrls", "timeout", "as_user", NULL
+    };
 
     if (!LDAPObject_conn_valid((PyObject *) self, "delete_ext_s"))
 	return NULL;
-    if (!PyArg_ParseTupleAndKeywords(
-	    args, kwds, "s|O!O!", kwlist, &dn, &LDAPControlsTypeObject,
-	    &serverctrls, &LDAPControlsTypeObject, &clientctrls))
+    if (!LibLDAP_parse_args(
+	    "delete_ext_s", args, nargs, kwnames, "s|O!O!dz", kwlist, &dn,
+	    self->st->controls_type, &serverctrls, self->st->controls_type,
+	    &clientctrls, &timeout, &as_user))
+	return NULL;
+    dn = (char *) LDAPObject_complete_dn(self, dn, dnbuf, "delete_ext_s");
+    if (!dn)
 	return NULL;
-    dn = (char *) LDAPObject_complete_dn(dn, self->dn);
     sctrls = serverctrls ? serverctrls->ctrls : NULL;
     cctrls = clientctrls ? clientctrls->ctrls : NULL;
-    ecode = ldap_delete_ext_s(self->ldp, dn , sctrls, cctrls);
+    if (LDAPObject_as_user(self, as_user, &sctrls, "delete_ext_s") < 0)
+	return NULL;
+    op.ctrls = sctrls;
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_DELETE, dn, -1, NULL);
+    ecode = ldap_delete_ext(self->ldp, dn , sctrls, cctrls, &msgid);
+    if (ecode == LDAP_SUCCESS)
+	ecode = LDAPObject_result_wait(self, msgid, timeout, NULL);
+    LibLDAP_op_end(&op, msgid, ecode, 0, 0);
+    LDAPObject_as_user_free(as_user, sctrls);
     if (ecode != LDAP_SUCCESS) {
 	return PyErr_Format(
-	    LibLDAPErr, "%s.delete_ext_s(): ldap_delete_ext_s(): %s",
+	    LibLDAPErr(self), "%s.delete_ext_s(): ldap_delete_ext(): %s",
 	    LDAPObjName(self), ldap_err2string(ecode)
 	    );
     }
     Py_RETURN_NONE;
 }
 
+PyDoc_STRVAR(LDAPObjectDoc_delete_ext, "");
+
+static PyObject *
+LDAPObject_delete_ext(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    char dnbuf[LDAPObject_DN_MAX];
+    char *dn, *as_user = NULL;
+    int ecode, msgid = -1;
+    LDAPControlsObject *serverctrls = NULL, *clientctrls = NULL;
+    LDAPControl **sctrls, **cctrls;
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {
+	"dn", "serverctrls", "clientctrls", "as_user", NULL
+    };
+
+    if (!LDAPObject_conn_valid((PyObject *) self, "delete_ext"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "delete_ext", args, nargs, kwnames, "s|O!O!z", kwlist, &dn,
+	    self->st->controls_type, &serverctrls, self->st->controls_type,
+	    &clientctrls, &as_user))
+	return NULL;
+    dn = (char *) LDAPObject_complete_dn(self, dn, dnbuf, "delete_ext");
+    if (!dn)
+	return NULL;
+    sctrls = serverctrls ? serverctrls->ctrls : NULL;
+    cctrls = clientctrls ? clientctrls->ctrls : NULL;
+    if (LDAPObject_as_user(self, as_user, &sctrls, "delete_ext") < 0)
+	return NULL;
+    op.ctrls = sctrls;
+    LibLDAP_op_prepare(&op, self->serial, LDAP_REQ_DELETE, dn, -1, NULL);
+    ecode = ldap_delete_ext(self->ldp, dn, sctrls, cctrls, &msgid);
+    LDAPObject_op_sent(self, &op, msgid, ecode);
+    LDAPObject_as_user_free(as_user, sctrls);
+    if (ecode != LDAP_SUCCESS)
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.delete_ext(): ldap_delete_ext(): %s",
+	    LDAPObjName(self), ldap_err2string(ecode)
+	    );
+    return PyLong_FromLong((long) msgid);
+}
+
 PyDoc_STRVAR(LDAPObjectDoc_modify_ext_s, "");
 
 static PyObject *
-LDAPObject_modify_ext_s(LDAPObject *self, PyObject *args, PyObject *kwds)
+LDAPObject_modify_ext_s(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
 {
-    char *dn;
-    int ecode;
+    char dnbuf[LDAPObject_DN_MAX];
+    char *dn, *as_user = NULL;
+    int ecode, msgid = -1;
+    double timeout = 0.0;
     PyObject *py_mods;
     LDAPMod **mods;
     LDAPControlsObject *serverctrls = NULL, *clientctrls = NULL;
     LDAPControl **sctrls, **cctrls;
-    static char *kwlist[] = {"dn", "mods", "serverctrls", "clientctrls", NULL};
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {
+	"dn", "mods", "serverctrls", "clientctrls", "timeout", "as_user", NULL
+    };
 
     if (!LDAPObject_conn_valid((PyObject *) self, "modify_ext_s"))
 	return NULL;
-    if (!PyArg_ParseTupleAndKeywords(
-	    args, kwds, "sO!|O!O!", kwlist, &dn, &PyList_Type, &py_mods,
-	    &LDAPControlsTypeObject, &serverctrls, &LDAPControlsTypeObject,
-	    &clientctrls))
+    if (!LibLDAP_parse_args(
+	    "modify_ext_s", args, nargs, kwnames, "sO!|O!O!dz", kwlist, &dn,
+	    &PyList_Type, &py_mods, self->st->controls_type, &serverctrls,
+	    self->st->controls_type, &clientctrls, &timeout, &as_user))
+	return NULL;
+    dn = (char *) LDAPObject_complete_dn(self, dn, dnbuf, "modify_ext_s");
+    if (!dn)
 	return NULL;
-    dn = (char *) LDAPObject_complete_dn(dn, self->dn);
-    mods = LDAPObject_mods_parse(self, py_mods, "modify_ext_s");
+    mods = LDAPObject_mods_parse(self, &py_mods, 0, "modify_ext_s");
     if (!mods)
     	return NULL;
     sctrls = serverctrls ? serverctrls->ctrls : NULL;
     cctrls = clientctrls ? clientctrls->ctrls : NULL;
-    ecode = ldap_modify_ext_s(self->ldp, dn, mods, sctrls, cctrls);
-    LibLDAP_value_free((void **) mods);
+    if (LDAPObject_as_user(self, as_user, &sctrls, "modify_ext_s") < 0) {
+	LDAPObject_mods_free(mods, py_mods);
+	return NULL;
+    }
+    op.ctrls = sctrls;
+    op.mods = mods;
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_MODIFY, dn, -1, NULL);
+    ecode = ldap_modify_ext(self->ldp, dn, mods, sctrls, cctrls, &msgid);
+    if (ecode == LDAP_SUCCESS)
+	ecode = LDAPObject_result_wait(self, msgid, timeout, NULL);
+    LibLDAP_op_end(&op, msgid, ecode, 0, 0);
+    LDAPObject_as_user_free(as_user, sctrls);
+    LDAPObject_mods_free(mods, py_mods);
     if (ecode != LDAP_SUCCESS)
 	return PyErr_Format(
-	    LibLDAPErr, "%s.modify_ext_s(): ldap_modify_ext_s(): %s",
+	    LibLDAPErr(self), "%s.modify_ext_s(): ldap_modify_ext(): %s",
 	    LDAPObjName(self), ldap_err2string(ecode)
 	    );
     Py_RETURN_NONE;
 }
 
+PyDoc_STRVAR(LDAPObjectDoc_modify_ext, "");
+
+static PyObject *
+LDAPObject_modify_ext(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    char dnbuf[LDAPObject_DN_MAX];
+    char *dn, *as_user = NULL;
+    int ecode, msgid = -1;
+    PyObject *py_mods;
+    LDAPMod **mods;
+    LDAPControlsObject *serverctrls = NULL, *clientctrls = NULL;
+    LDAPControl **sctrls, **cctrls;
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {
+	"dn", "mods", "serverctrls", "clientctrls", "as_user", NULL
+    };
+
+    if (!LDAPObject_conn_valid((PyObject *) self, "modify_ext"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "modify_ext", args, nargs, kwnames, "sO!|O!O!z", kwlist, &dn,
+	    &PyList_Type, &py_mods, self->st->controls_type, &serverctrls,
+	    self->st->controls_type, &clientctrls, &as_user))
+	return NULL;
+    dn = (char *) LDAPObject_complete_dn(self, dn, dnbuf, "modify_ext");
+    if (!dn)
+	return NULL;
+    mods = LDAPObject_mods_parse(self, &py_mods, 0, "modify_ext");
+    if (!mods)
+    	return NULL;
+    sctrls = serverctrls ? serverctrls->ctrls : NULL;
+    cctrls = clientctrls ? clientctrls->ctrls : NULL;
+    if (LDAPObject_as_user(self, as_user, &sctrls, "modify_ext") < 0) {
+	LDAPObject_mods_free(mods, py_mods);
+	return NULL;
+    }
+    op.ctrls = sctrls;
+    op.mods = mods;
+    LibLDAP_op_prepare(&op, self->serial, LDAP_REQ_MODIFY, dn, -1, NULL);
+    ecode = ldap_modify_ext(self->ldp, dn, mods, sctrls, cctrls, &msgid);
+    LDAPObject_op_sent(self, &op, msgid, ecode);
+    LDAPObject_as_user_free(as_user, sctrls);
+    LDAPObject_mods_free(mods, py_mods);
+    if (ecode != LDAP_SUCCESS)
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.modify_ext(): ldap_modify_ext(): %s",
+	    LDAPObjName(self), ldap_err2string(ecode)
+	    );
+    return PyLong_FromLong((long) msgid);
+}
+
 PyDoc_STRVAR(LDAPObjectDoc_modrdn2_s, "");
 
 static PyObject *
-LDAPObject_modrdn2_s(LDAPObject *self, PyObject *args, PyObject *kwds)
+LDAPObject_modrdn2_s(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
 {
+    char dnbuf[LDAPObject_DN_MAX];
     char *dn, *newrdn;
-    int ecode, deleteoldrdn;
+    int ecode, msgid = -1, deleteoldrdn;
+    double timeout = 0.0;
     PyObject *py_deleteoldrdn = Py_False;
-    static char *kwlist[] = {"dn", "newrdn", "deleteoldrdn", NULL};
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {"dn", "newrdn", "deleteoldrdn", "timeout", NULL};
 
     if (!LDAPObject_conn_valid((PyObject *) self, "modrdn2_s"))
 	return NULL;
-    if (!PyArg_ParseTupleAndKeywords(
-	    args, kwds, "ss|O!", kwlist, &dn, &newrdn, &PyBool_Type,
-	    &py_deleteoldrdn))
+    if (!LibLDAP_parse_args(
+	    "modrdn2_s", args, nargs, kwnames, "ss|O!d", kwlist, &dn, &newrdn,
+	    &PyBool_Type, &py_deleteoldrdn, &timeout))
+	return NULL;
+    dn = (char *) LDAPObject_complete_dn(self, dn, dnbuf, "modrdn2_s");
+    if (!dn)
 	return NULL;
-    dn = (char *) LDAPObject_complete_dn(dn, self->dn);
     deleteoldrdn = py_deleteoldrdn == Py_False ? 0 : 1;
-    ecode = ldap_modrdn2_s(self->ldp, dn, newrdn, deleteoldrdn);
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_MODDN, dn, -1, NULL);
+    ecode = ldap_rename(
+	self->ldp, dn, newrdn, NULL, deleteoldrdn, NULL, NULL, &msgid);
+    if (ecode == LDAP_SUCCESS)
+	ecode = LDAPObject_result_wait(self, msgid, timeout, NULL);
+    LibLDAP_op_end(&op, msgid, ecode, 0, 0);
     if (ecode != LDAP_SUCCESS)
 	return PyErr_Format(
-	    LibLDAPErr, "%s.modrdn2_s(): "
-	    "ldap_modrdn2_s(): %s", LDAPObjName(self),
+	    LibLDAPErr(self), "%s.modrdn2_s(): "
+	    "ldap_rename(): %s", LDAPObjName(self),
 	    ldap_err2string(ecode)
 	    );
     Py_RETURN_NONE;
 }
 
-PyDoc_STRVAR(LDAPObjectDoc_create_sort_control, "");
+PyDoc_STRVAR(LDAPObjectDoc_compare_ext_s, "");
 
 static PyObject *
-LDAPObject_create_sort_control(LDAPObject *self, PyObject *args, PyObject *kwds)
+LDAPObject_compare_ext_s(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
 {
-    char *keylist;
-    int ecode, iscritical;
-    LDAPSortKey **sk;
-    LDAPControl *ctrl;
-    LDAPControlObject *ret;
-    PyObject *py_iscritical = Py_False;
-    static char *kwlist[] = {"keylist", "iscritical", "serverctrls", NULL};
+    char dnbuf[LDAPObject_DN_MAX];
+    char *dn, *attr, *value, *as_user = NULL;
+    int ecode, msgid = -1;
+    double timeout = 0.0;
+    BerValue bv;
+    LDAPControlsObject *serverctrls = NULL, *clientctrls = NULL;
+    LDAPControl **sctrls, **cctrls;
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {
+	"dn", "attr", "value", "serverctrls", "clientctrls", "timeout",
+	"as_user", NULL
+    };
 
-    if (!LDAPObject_conn_valid((PyObject *) self, "create_sort_control"))
+    if (!LDAPObject_conn_valid((PyObject *) self, "compare_ext_s"))
 	return NULL;
-    if (!PyArg_ParseTupleAndKeywords(
-	    args, kwds, "s|O!", kwlist, &keylist, &PyBool_Type, &py_iscritical))
+    if (!LibLDAP_parse_args(
+	    "compare_ext_s", args, nargs, kwnames, "sss|O!O!dz", kwlist, &dn,
+	    &attr, &value, self->st->controls_type, &serverctrls,
+	    self->st->controls_type, &clientctrls, &timeout, &as_user))
 	return NULL;
-    ecode = ldap_create_sort_keylist(&sk, keylist);
-    if (ecode != LDAP_SUCCESS)
-	return PyErr_Format(
-	    LibLDAPErr, "%s.create_sort_control(): "
-	    "ldap_create_sort_keylist(): %s", LDAPObjName(self),
-	    ldap_err2string(ecode)
-	    );
-    iscritical = py_iscritical == Py_False ? 0 : 1;
-    ecode = ldap_create_sort_control(self->ldp, sk, iscritical, &ctrl);
-    ldap_free_sort_keylist(sk);
-    if (ecode != LDAP_SUCCESS)
-	return PyErr_Format(
-	    LibLDAPErr, "%s.create_sort_control(): "
-	    "ldap_create_sort_control(): %s", LDAPObjName(self),
-	    ldap_err2string(ecode)
-	    );
-    ret = (LDAPControlObject *)
-	LDAPControlTypeObject.tp_new(&LDAPControlTypeObject, NULL, NULL);
-    if (!ret) {
-	ldap_control_free(ctrl);
+    dn = (char *) LDAPObject_complete_dn(self, dn, dnbuf, "compare_ext_s");
+    if (!dn)
 	return NULL;
-    }
-    ret->ctrl = ctrl;
-    return (PyObject *) ret;
+    bv.bv_val = value;
+    bv.bv_len = strlen(value);
+    sctrls = serverctrls ? serverctrls->ctrls : NULL;
+    cctrls = clientctrls ? clientctrls->ctrls : NULL;
+    if (LDAPObject_as_user(self, as_user, &sctrls, "compare_ext_s") < 0)
+	return NULL;
+    op.ctrls = sctrls;
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_COMPARE, dn, -1, NULL);
+    ecode = ldap_compare_ext(
+	self->ldp, dn, attr, &bv, sctrls, cctrls, &msgid);
+    if (ecode == LDAP_SUCCESS)
+	ecode = LDAPObject_result_wait(self, msgid, timeout, NULL);
+    LibLDAP_op_end(&op, msgid, ecode, 0, 0);
+    LDAPObject_as_user_free(as_user, sctrls);
+    if (ecode == LDAP_COMPARE_TRUE)
+	Py_RETURN_TRUE;
+    if (ecode == LDAP_COMPARE_FALSE)
+	Py_RETURN_FALSE;
+    return PyErr_Format(
+	LibLDAPErr(self), "%s.compare_ext_s(): ldap_compare_ext(): %s",
+	LDAPObjName(self), ldap_err2string(ecode)
+	);
 }
 
-PyDoc_STRVAR(LDAPObjectDoc_create_assertion_control, "");
+PyDoc_STRVAR(LDAPObjectDoc_compare_ext, "");
 
 static PyObject *
-LDAPObject_create_assertion_control(
-    LDAPObject *self, PyObject *args, PyObject *kwds
+LDAPObject_compare_ext(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
     )
 {
-    int ecode, iscritical;
-    char *filter;
-    LDAPControl *ctrl;
-    LDAPControlObject *ret;
-    PyObject *py_iscritical = Py_False;
-    static char *kwlist[] = {"filter", "iscritical", NULL};
+    char dnbuf[LDAPObject_DN_MAX];
+    char *dn, *attr, *value, *as_user = NULL;
+    int ecode, msgid = -1;
+    BerValue bv;
+    LDAPControlsObject *serverctrls = NULL, *clientctrls = NULL;
+    LDAPControl **sctrls, **cctrls;
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {
+	"dn", "attr", "value", "serverctrls", "clientctrls", "as_user", NULL
+    };
 
-    if (!LDAPObject_conn_valid((PyObject *) self, "create_assertion_control"))
+    if (!LDAPObject_conn_valid((PyObject *) self, "compare_ext"))
 	return NULL;
-    if (!PyArg_ParseTupleAndKeywords(
-	    args, kwds, "s|O!", kwlist, &filter, &PyBool_Type, &py_iscritical))
+    if (!LibLDAP_parse_args(
+	    "compare_ext", args, nargs, kwnames, "sss|O!O!z", kwlist, &dn,
+	    &attr, &value, self->st->controls_type, &serverctrls,
+	    self->st->controls_type, &clientctrls, &as_user))
 	return NULL;
-    iscritical = py_iscritical == Py_False ? 0 : 1;
-    ecode = ldap_create_assertion_control(self->ldp, filter, iscritical, &ctrl);
+    dn = (char *) LDAPObject_complete_dn(self, dn, dnbuf, "compare_ext");
+    if (!dn)
+	return NULL;
+    bv.bv_val = value;
+    bv.bv_len = strlen(value);
+    sctrls = serverctrls ? serverctrls->ctrls : NULL;
+    cctrls = clientctrls ? clientctrls->ctrls : NULL;
+    if (LDAPObject_as_user(self, as_user, &sctrls, "compare_ext") < 0)
+	return NULL;
+    op.ctrls = sctrls;
+    /* asynchronous operations are traced up to the sending of the request */
+    LibLDAP_op_prepare(&op, self->serial, LDAP_REQ_COMPARE, dn, -1, NULL);
+    ecode = ldap_compare_ext(
+	self->ldp, dn, attr, &bv, sctrls, cctrls, &msgid);
+    LDAPObject_op_sent(self, &op, msgid, ecode);
+    LDAPObject_as_user_free(as_user, sctrls);
     if (ecode != LDAP_SUCCESS)
 	return PyErr_Format(
-	    LibLDAPErr, "%s.create_assertion_control(): "
-	    "ldap_create_assertion_control(): %s", LDAPObjName(self),
-	    ldap_err2string(ecode)
+	    LibLDAPErr(self), "%s.compare_ext(): ldap_compare_ext(): %s",
+	    LDAPObjName(self), ldap_err2string(ecode)
 	    );
-    ret = (LDAPControlObject *)
-	LDAPControlTypeObject.tp_new(&LDAPControlTypeObject, NULL, NULL);
-    if (!ret) {
-	ldap_control_free(ctrl);
-	return NULL;
-    }
-    ret->ctrl = ctrl;
-    return (PyObject *) ret;    
+    return PyLong_FromLong((long) msgid);
 }
 
-static PyMethodDef LDAPObjectMethods[] = {
-    {"simple_bind_s", (PyCFunction) LDAPObject_simple_bind_s,
-     METH_VARARGS | METH_KEYWORDS, LDAPObjectDoc_simple_bind_s
-    },
-    {"bind_s", (PyCFunction) LDAPObject_bind_s,
-     METH_VARARGS | METH_KEYWORDS, LDAPObjectDoc_bind_s
-    },
-#ifdef __HAVE_SASL__
-    {"sasl_bind_s", (PyCFunction) LDAPObject_sasl_bind_s,
-     METH_VARARGS | METH_KEYWORDS, LDAPObjectDoc_sasl_bind_s
-    },
-    {"sasl_interactive_bind_s",
-     (PyCFunction) LDAPObject_sasl_interactive_bind_s,
-     METH_VARARGS | METH_KEYWORDS, LDAPObjectDoc_sasl_interactive_bind_s
-    },
-#endif /* __HAVE_SASL__ */
-    {"unbind_s", (PyCFunction) LDAPObject_unbind_s, METH_NOARGS,
-     LDAPObjectDoc_unbind_s
-    },
-    {"start_tls", (PyCFunction) LDAPObject_start_tls, METH_NOARGS,
-     LDAPObjectDoc_start_tls
-    },
-    {"start_tls_s", (PyCFunction) LDAPObject_start_tls_s, METH_NOARGS,
-     LDAPObjectDoc_start_tls_s
-    },
-    {"get_option", (PyCFunction) LDAPObject_get_option,
-     METH_VARARGS, LDAPObjectDoc_get_option
-    },
-    {"set_option", (PyCFunction) LDAPObject_set_option,
-     METH_VARARGS, LDAPObjectDoc_set_option
-    },
-    {"search_ext_s", (PyCFunction) LDAPObject_search_ext_s,
-     METH_VARARGS | METH_KEYWORDS, LDAPObjectDoc_search_ext_s
-    },
-    {"add_ext_s", (PyCFunction) LDAPObject_add_ext_s,
-     METH_VARARGS | METH_KEYWORDS, LDAPObjectDoc_add_ext_s
-    },
-    {"delete_ext_s", (PyCFunction) LDAPObject_delete_ext_s,
-     METH_VARARGS | METH_KEYWORDS, LDAPObjectDoc_delete_ext_s
-    },
-    {"modify_ext_s", (PyCFunction) LDAPObject_modify_ext_s,
-     METH_VARARGS | METH_KEYWORDS, LDAPObjectDoc_modify_ext_s
-    },
-    {"modrdn2_s", (PyCFunction) LDAPObject_modrdn2_s,
-     METH_VARARGS | METH_KEYWORDS, LDAPObjectDoc_modrdn2_s
-    },
-    {"create_sort_control", (PyCFunction) LDAPObject_create_sort_control,
-     METH_VARARGS | METH_KEYWORDS, LDAPObjectDoc_create_sort_control
-    },
-    {"create_assertion_control",
-     (PyCFunction) LDAPObject_create_assertion_control,
-     METH_VARARGS | METH_KEYWORDS, LDAPObjectDoc_create_assertion_control
-    },
-    {NULL, NULL, 0, NULL}
-};
+PyDoc_STRVAR(LDAPObjectDoc_result, "");
 
-/* MEMBERS */
+static PyObject *
+LDAPObject_result(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    int rc, msgid = LDAP_RES_ANY;
+    double timeout = 0.0;
+    struct timeval tv = {0L, 0L}, *to = &tv;
+    LDAPMessage *res = NULL;
+    PyObject *ret;
+    size_t bytes = 0;
+    static char *kwlist[] = {"msgid", "timeout", NULL};
 
-static PyMemberDef LDAPObjectMembers[] = {
-    {"uri", T_OBJECT, offsetof(LDAPObject, uri), READONLY,
-     "LDAP URI (Uniform Resource Identifier) - RFC 4516 compliant"},
-    {NULL, 0, 0, 0, NULL}
-};
+    if (!LDAPObject_conn_valid((PyObject *) self, "result"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "result", args, nargs, kwnames, "|id", kwlist, &msgid, &timeout))
+	return NULL;
+    /* a negative timeout polls: zero timeval */
+    if (timeout > 0.0)
+	LDAPObject_timeval(timeout, &tv);
+    else if (timeout == 0.0)
+	to = NULL;
+    if (!LDAPObject_enter(self, "result"))
+	return NULL;
+    if (to && !tv.tv_sec && !tv.tv_usec)
+	rc = ldap_result(self->ldp, msgid, LDAP_MSG_ALL, to, &res);
+    else {
+	Py_BEGIN_ALLOW_THREADS
+	rc = ldap_result(self->ldp, msgid, LDAP_MSG_ALL, to, &res);
+	Py_END_ALLOW_THREADS
+    }
+    if (rc == 0) {
+	LDAPObject_leave(self);
+	Py_RETURN_NONE;
+    }
+    if (rc < 0) {
+	rc = LDAPObject_result_code(self);
+	LDAPObject_leave(self);
+	(void) ldap_msgfree(res);
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.result(): ldap_result(): %s",
+	    LDAPObjName(self), ldap_err2string(rc)
+	    );
+    }
+    ret = LDAPObject_msg2py(self, res, "result", &bytes);
+    LDAPObject_op_done(
+	self, ldap_msgid(res), res,
+	ret && PyList_Check(ret) ? PyList_GET_SIZE(ret) : 0, bytes);
+    LDAPObject_leave(self);
+    if (ret)
+	ret = Py_BuildValue("(iN)", ldap_msgid(res), ret);
+    else if (PyErr_ExceptionMatches(LibLDAPErr(self))) {
+	/* tells which operation failed when waiting for any */
+	PyObject *type, *value, *tb, *py_msgid;
 
-/* GET/SET */
+	PyErr_Fetch(&type, &value, &tb);
+	PyErr_NormalizeException(&type, &value, &tb);
+	py_msgid = PyLong_FromLong((long) ldap_msgid(res));
+	if (!py_msgid || PyObject_SetAttrString(value, "msgid", py_msgid) < 0)
+	    PyErr_Clear();
+	Py_XDECREF(py_msgid);
+	PyErr_Restore(type, value, tb);
+    }
+    (void) ldap_msgfree(res);
+    return ret;
+}
+
+PyDoc_STRVAR(LDAPObjectDoc_abandon, "");
 
 static PyObject *
-LDAPObject_getscheme(LDAPObject *self, void *closure)
+LDAPObject_abandon(LDAPObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
-    if (!self->lud->lud_scheme)
-	Py_RETURN_NONE;
-    return PyUnicode_FromString(self->lud->lud_scheme);
+    int ecode, msgid;
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {"msgid", NULL};
+
+    if (!LDAPObject_conn_valid((PyObject *) self, "abandon"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "abandon", args, nargs, NULL, "i", kwlist, &msgid))
+	return NULL;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (msgid == self->tls_msgid)
+	self->tls_msgid = 0;
+    Py_END_CRITICAL_SECTION();
+    /* the bind may have been done, or not */
+    LDAPObject_bind_done(self, msgid, 0);
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_ABANDON, NULL, -1, NULL);
+    ecode = ldap_abandon_ext(self->ldp, msgid, NULL, NULL);
+    LibLDAP_op_end(&op, msgid, ecode, 0, 0);
+    /* no answer will come */
+    if (ecode == LDAP_SUCCESS)
+	LDAPObject_op_done(self, msgid, NULL, 0, 0);
+    if (ecode != LDAP_SUCCESS)
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.abandon(): ldap_abandon_ext(): %s",
+	    LDAPObjName(self), ldap_err2string(ecode)
+	    );
+    Py_RETURN_NONE;
 }
 
+PyDoc_STRVAR(LDAPObjectDoc_cancel, "");
+
+/* Cancel extended operation (RFC 3909): unlike an abandon, the server
+   answers, and the cancelled operation gets a final answer too */
 static PyObject *
-LDAPObject_gethost(LDAPObject *self, void *closure)
+LDAPObject_cancel(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
 {
-    if (!self->lud->lud_host)
-	Py_RETURN_NONE;
-    return PyUnicode_FromString(self->lud->lud_host);
+    int ecode, msgid, cancelid = -1;
+    double timeout = 0.0;
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {"msgid", "timeout", NULL};
+
+    if (!LDAPObject_conn_valid((PyObject *) self, "cancel"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "cancel", args, nargs, kwnames, "i|d", kwlist, &msgid, &timeout))
+	return NULL;
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_EXTENDED, NULL, -1, NULL);
+    ecode = ldap_cancel(self->ldp, msgid, NULL, NULL, &cancelid);
+    if (ecode == LDAP_SUCCESS)
+	ecode = LDAPObject_result_wait(self, cancelid, timeout, NULL);
+    LibLDAP_op_end(&op, cancelid, ecode, 0, 0);
+    switch (ecode) {
+    case LDAP_SUCCESS:
+	Py_RETURN_TRUE;
+    case LDAP_NO_SUCH_OPERATION:
+    case LDAP_TOO_LATE:
+    case LDAP_CANNOT_CANCEL:
+	Py_RETURN_FALSE;
+    default:
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.cancel(): ldap_cancel(): %s",
+	    LDAPObjName(self), ldap_err2string(ecode)
+	    );
+    }
 }
 
+PyDoc_STRVAR(LDAPObjectDoc_fileno, "");
+
 static PyObject *
-LDAPObject_getip(LDAPObject *self, void *closure)
+LDAPObject_fileno(LDAPObject *self)
 {
-    int ecode;
-    char host[NI_MAXHOST];
+    int fd = -1;
 
-    if (!self->addr)
-	Py_RETURN_NONE;
-    ecode = getnameinfo(
-	self->addr, self->addrlen, host, sizeof(host), NULL, 0, NI_NUMERICHOST
-	);
-    if (ecode)
+    if (!LDAPObject_conn_valid((PyObject *) self, "fileno"))
+	return NULL;
+    if (ldap_get_option(self->ldp, LDAP_OPT_DESC, (void *) &fd)
+	!= LDAP_OPT_SUCCESS)
 	return PyErr_Format(
-	    LibLDAPErr, "`getip' attribute: getnameinfo(): %s",
-	    gai_strerror(ecode)
+	    LibLDAPErr(self), "%s.fileno(): ldap_get_option() failed",
+	    LDAPObjName(self)
 	    );
-    return PyUnicode_FromString(host);
+    return PyLong_FromLong((long) fd);
 }
 
+PyDoc_STRVAR(LDAPObjectDoc_create_sort_control, "");
+
 static PyObject *
-LDAPObject_getport(LDAPObject *self, void *closure)
+LDAPObject_create_sort_control(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
 {
-    return PyLong_FromLong((long) self->lud->lud_port);
+    char *keylist;
+    int ecode, iscritical;
+    LDAPSortKey **sk;
+    LDAPControl *ctrl;
+    LDAPControlObject *ret;
+    PyObject *py_iscritical = Py_False;
+    static char *kwlist[] = {"keylist", "iscritical", "serverctrls", NULL};
+
+    if (!LDAPObject_conn_valid((PyObject *) self, "create_sort_control"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "create_sort_control", args, nargs, kwnames, "s|O!", kwlist,
+	    &keylist, &PyBool_Type, &py_iscritical))
+	return NULL;
+    ecode = ldap_create_sort_keylist(&sk, keylist);
+    if (ecode != LDAP_SUCCESS)
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.create_sort_control(): "
+	    "ldap_create_sort_keylist(): %s", LDAPObjName(self),
+	    ldap_err2string(ecode)
+	    );
+    iscritical = py_iscritical == Py_False ? 0 : 1;
+    ecode = ldap_create_sort_control(self->ldp, sk, iscritical, &ctrl);
+    ldap_free_sort_keylist(sk);
+    if (ecode != LDAP_SUCCESS)
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.create_sort_control(): "
+	    "ldap_create_sort_control(): %s", LDAPObjName(self),
+	    ldap_err2string(ecode)
+	    );
+    ret = (LDAPControlObject *)
+	self->st->control_type->tp_new(self->st->control_type, NULL, NULL);
+    if (!ret) {
+	ldap_control_free(ctrl);
+	return NULL;
+    }
+    ret->ctrl = ctrl;
+    return (PyObject *) ret;
+}
+
+PyDoc_STRVAR(LDAPObjectDoc_create_assertion_control, "");
+
+static PyObject *
+LDAPObject_create_assertion_control(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    int ecode, iscritical;
+    char *filter;
+    LDAPControl *ctrl;
+    LDAPControlObject *ret;
+    PyObject *py_iscritical = Py_False;
+    static char *kwlist[] = {"filter", "iscritical", NULL};
+
+    if (!LDAPObject_conn_valid((PyObject *) self, "create_assertion_control"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "create_assertion_control", args, nargs, kwnames, "s|O!", kwlist,
+	    &filter, &PyBool_Type, &py_iscritical))
+	return NULL;
+    iscritical = py_iscritical == Py_False ? 0 : 1;
+    ecode = ldap_create_assertion_control(self->ldp, filter, iscritical, &ctrl);
+    if (ecode != LDAP_SUCCESS)
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.create_assertion_control(): "
+	    "ldap_create_assertion_control(): %s", LDAPObjName(self),
+	    ldap_err2string(ecode)
+	    );
+    ret = (LDAPControlObject *)
+	self->st->control_type->tp_new(self->st->control_type, NULL, NULL);
+    if (!ret) {
+	ldap_control_free(ctrl);
+	return NULL;
+    }
+    ret->ctrl = ctrl;
+    return (PyObject *) ret;    
+}
+
+PyDoc_STRVAR(LDAPObjectDoc_create_deref_control, "");
+
+static PyObject *
+LDAPObject_create_deref_control(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    int ecode, iscritical;
+    Py_ssize_t i, len, pos = 0;
+    LDAPDerefSpec *ds, *spec;
+    LDAPControl *ctrl;
+    LDAPControlObject *ret = NULL;
+    PyObject *py_specs, *py_iscritical = Py_False, *key, *value;
+    static char *kwlist[] = {"specs", "iscritical", NULL};
+
+    if (!LDAPObject_conn_valid((PyObject *) self, "create_deref_control"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "create_deref_control", args, nargs, kwnames, "O!|O!", kwlist,
+	    &PyDict_Type, &py_specs, &PyBool_Type, &py_iscritical))
+	return NULL;
+    len = PyDict_Size(py_specs);
+    if (!len)
+	return PyErr_Format(
+	    PyExc_TypeError,
+	    "%s.create_deref_control(): argument `specs' must be a non empty "
+	    "dictionary", LDAPObjName(self)
+	    );
+    ds = PyMem_New(LDAPDerefSpec, len + 1);
+    if (!ds)
+	return PyErr_NoMemory();
+    (void) memset((void *) ds, 0, (len + 1) * sizeof(LDAPDerefSpec));
+    /* strings are borrowed from `specs', which outlives the control
+       creation */
+    for (spec = ds; PyDict_Next(py_specs, &pos, &key, &value); spec++) {
+	if (!PyUnicode_Check(key) || !PyList_Check(value) ||
+	    !PyList_GET_SIZE(value)) {
+	    (void) PyErr_Format(
+		PyExc_TypeError,
+		"%s.create_deref_control(): argument `specs' must map "
+		"attribute names to non empty lists of strings",
+		LDAPObjName(self)
+		);
+	    goto clean;
+	}
+	spec->derefAttr = (char *) PyUnicode_AsUTF8(key);
+	if (!spec->derefAttr)
+	    goto clean;
+	len = PyList_GET_SIZE(value);
+	spec->attributes = PyMem_New(char *, len + 1);
+	if (!spec->attributes) {
+	    (void) PyErr_NoMemory();
+	    goto clean;
+	}
+	spec->attributes[len] = NULL;
+	for (i = 0; i < len; i++) {
+	    PyObject *py_attr = PyList_GET_ITEM(value, i);
+
+	    spec->attributes[i] = PyUnicode_Check(py_attr) ?
+		(char *) PyUnicode_AsUTF8(py_attr) : NULL;
+	    if (!spec->attributes[i]) {
+		if (!PyErr_Occurred())
+		    (void) PyErr_Format(
+			PyExc_TypeError,
+			"%s.create_deref_control(): argument `specs' must map "
+			"attribute names to non empty lists of strings",
+			LDAPObjName(self)
+			);
+		goto clean;
+	    }
+	}
+    }
+    iscritical = py_iscritical == Py_False ? 0 : 1;
+    ecode = ldap_create_deref_control(self->ldp, ds, iscritical, &ctrl);
+    if (ecode != LDAP_SUCCESS) {
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.create_deref_control(): "
+	    "ldap_create_deref_control(): %s", LDAPObjName(self),
+	    ldap_err2string(ecode)
+	    );
+	goto clean;
+    }
+    ret = (LDAPControlObject *)
+	self->st->control_type->tp_new(self->st->control_type, NULL, NULL);
+    if (!ret)
+	ldap_control_free(ctrl);
+    else
+	ret->ctrl = ctrl;
+  clean:
+    for (spec = ds; spec->attributes; spec++)
+	PyMem_Free(spec->attributes);
+    PyMem_Free(ds);
+    return (PyObject *) ret;
+}
+
+PyDoc_STRVAR(LDAPObjectDoc_create_matched_values_control, "");
+
+static PyObject *
+LDAPObject_create_matched_values_control(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    int ecode, iscritical;
+    char *filter;
+    BerElement *ber;
+    BerValue value;
+    LDAPControl *ctrl;
+    LDAPControlObject *ret;
+    PyObject *py_iscritical = Py_False;
+    static char *kwlist[] = {"filter", "iscritical", NULL};
+
+    if (!LDAPObject_conn_valid(
+	    (PyObject *) self, "create_matched_values_control"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "create_matched_values_control", args, nargs, kwnames, "s|O!",
+	    kwlist, &filter, &PyBool_Type, &py_iscritical))
+	return NULL;
+    iscritical = py_iscritical == Py_False ? 0 : 1;
+    /* libldap has no helper for this control: its value, a sequence of
+       simple filters, is BER encoded here */
+    ber = ber_alloc_t(LBER_USE_DER);
+    if (!ber)
+	return PyErr_NoMemory();
+    if (ldap_put_vrFilter(ber, filter) == -1) {
+	ber_free(ber, 1);
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.create_matched_values_control(): "
+	    "ldap_put_vrFilter(): %s: bad filter", LDAPObjName(self), filter
+	    );
+    }
+    if (ber_flatten2(ber, &value, 0) == -1) {
+	ber_free(ber, 1);
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.create_matched_values_control(): "
+	    "ber_flatten2() failed", LDAPObjName(self)
+	    );
+    }
+    ecode = ldap_control_create(
+	LDAP_CONTROL_VALUESRETURNFILTER, iscritical, &value, 1, &ctrl);
+    ber_free(ber, 1);
+    if (ecode != LDAP_SUCCESS)
+	return PyErr_Format(
+	    LibLDAPErr(self), "%s.create_matched_values_control(): "
+	    "ldap_control_create(): %s", LDAPObjName(self),
+	    ldap_err2string(ecode)
+	    );
+    ret = (LDAPControlObject *)
+	self->st->control_type->tp_new(self->st->control_type, NULL, NULL);
+    if (!ret) {
+	ldap_control_free(ctrl);
+	return NULL;
+    }
+    ret->ctrl = ctrl;
+    return (PyObject *) ret;
+}
+
+PyDoc_STRVAR(LDAPObjectDoc_create_proxy_authz_control, "");
+
+static PyObject *
+LDAPObject_create_proxy_authz_control(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    char *authzid;
+    LDAPControl *ctrl;
+    LDAPControlObject *ret;
+    PyObject *py_iscritical = Py_True;
+    static char *kwlist[] = {"authzid", "iscritical", NULL};
+
+    if (!LDAPObject_conn_valid(
+	    (PyObject *) self, "create_proxy_authz_control"))
+	return NULL;
+    if (!LibLDAP_parse_args(
+	    "create_proxy_authz_control", args, nargs, kwnames, "s|O!",
+	    kwlist, &authzid, &PyBool_Type, &py_iscritical))
+	return NULL;
+    ctrl = LDAPObject_proxy_authz(
+	self, authzid, py_iscritical == Py_False ? 0 : 1,
+	"create_proxy_authz_control");
+    if (!ctrl)
+	return NULL;
+    ret = (LDAPControlObject *)
+	self->st->control_type->tp_new(self->st->control_type, NULL, NULL);
+    if (!ret) {
+	ldap_control_free(ctrl);
+	return NULL;
+    }
+    ret->ctrl = ctrl;
+    return (PyObject *) ret;
+}
+
+PyDoc_STRVAR(LDAPObjectDoc_get_profile, "");
+
+static PyObject *
+LDAPObject_get_profile(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames
+    )
+{
+    PyObject *py_reset = Py_False, *ret, *last;
+    LDAPProfile_t prof, prof_last;
+    static char *kwlist[] = {"reset", NULL};
+
+    if (!LibLDAP_parse_args(
+	    "get_profile", args, nargs, kwnames, "|O!", kwlist, &PyBool_Type,
+	    &py_reset))
+	return NULL;
+    /* searches of other threads may be committed meanwhile */
+    Py_BEGIN_CRITICAL_SECTION(self);
+    prof = self->prof;
+    prof_last = self->prof_last;
+    if (py_reset == Py_True) {
+	(void) memset((void *) &self->prof, 0, sizeof(LDAPProfile_t));
+	(void) memset((void *) &self->prof_last, 0, sizeof(LDAPProfile_t));
+    }
+    Py_END_CRITICAL_SECTION();
+    ret = LDAPObject_prof2py(&prof);
+    if (!ret)
+	return NULL;
+    last = LDAPObject_prof2py(&prof_last);
+    if (!last) {
+	Py_DECREF(ret);
+	return NULL;
+    }
+    if (PyDict_SetItemString(ret, "last", last) == -1) {
+	Py_DECREF(last);
+	Py_DECREF(ret);
+	return NULL;
+    }
+    Py_DECREF(last);
+    return ret;
+}
+
+static PyMethodDef LDAPObjectMethods[] = {
+    {"simple_bind_s", (PyCFunction) LDAPObject_simple_bind_s,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_simple_bind_s
+    },
+    {"simple_bind", (PyCFunction) LDAPObject_simple_bind,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_simple_bind
+    },
+    {"bind_s", (PyCFunction) LDAPObject_bind_s,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_bind_s
+    },
+    {"sasl_external_bind_s", (PyCFunction) LDAPObject_sasl_external_bind_s,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_sasl_external_bind_s
+    },
+#ifdef __HAVE_SASL__
+    {"sasl_bind_s", (PyCFunction) LDAPObject_sasl_bind_s,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_sasl_bind_s
+    },
+    {"sasl_interactive_bind_s",
+     (PyCFunction) LDAPObject_sasl_interactive_bind_s,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_sasl_interactive_bind_s
+    },
+#endif /* __HAVE_SASL__ */
+    {"unbind_s", (PyCFunction) LDAPObject_unbind_s, METH_NOARGS,
+     LDAPObjectDoc_unbind_s
+    },
+    {"start_tls", (PyCFunction) LDAPObject_start_tls, METH_NOARGS,
+     LDAPObjectDoc_start_tls
+    },
+    {"start_tls_s", (PyCFunction) LDAPObject_start_tls_s,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_start_tls_s
+    },
+    {"get_option", (PyCFunction) LDAPObject_get_option,
+     METH_FASTCALL, LDAPObjectDoc_get_option
+    },
+    {"set_option", (PyCFunction) LDAPObject_set_option,
+     METH_FASTCALL, LDAPObjectDoc_set_option
+    },
+    {"search_ext_s", (PyCFunction) LDAPObject_search_ext_s,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_search_ext_s
+    },
+    {"search_refs_s", (PyCFunction) LDAPObject_search_refs_s,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_search_refs_s
+    },
+    {"search_ext", (PyCFunction) LDAPObject_search_ext,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_search_ext
+    },
+    {"search_dns", (PyCFunction) LDAPObject_search_dns,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_search_dns
+    },
+    {"search_count", (PyCFunction) LDAPObject_search_count,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_search_count
+    },
+    {"add_ext_s", (PyCFunction) LDAPObject_add_ext_s,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_add_ext_s
+    },
+    {"add_ext", (PyCFunction) LDAPObject_add_ext,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_add_ext
+    },
+    {"delete_ext_s", (PyCFunction) LDAPObject_delete_ext_s,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_delete_ext_s
+    },
+    {"delete_ext", (PyCFunction) LDAPObject_delete_ext,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_delete_ext
+    },
+    {"modify_ext_s", (PyCFunction) LDAPObject_modify_ext_s,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_modify_ext_s
+    },
+    {"modify_ext", (PyCFunction) LDAPObject_modify_ext,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_modify_ext
+    },
+    {"modrdn2_s", (PyCFunction) LDAPObject_modrdn2_s,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_modrdn2_s
+    },
+    {"compare_ext_s", (PyCFunction) LDAPObject_compare_ext_s,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_compare_ext_s
+    },
+    {"compare_ext", (PyCFunction) LDAPObject_compare_ext,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_compare_ext
+    },
+    {"result", (PyCFunction) LDAPObject_result,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_result
+    },
+    {"abandon", (PyCFunction) LDAPObject_abandon, METH_FASTCALL,
+     LDAPObjectDoc_abandon
+    },
+    {"cancel", (PyCFunction) LDAPObject_cancel,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_cancel
+    },
+    {"fileno", (PyCFunction) LDAPObject_fileno, METH_NOARGS,
+     LDAPObjectDoc_fileno
+    },
+    {"create_sort_control", (PyCFunction) LDAPObject_create_sort_control,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_create_sort_control
+    },
+    {"create_assertion_control",
+     (PyCFunction) LDAPObject_create_assertion_control,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_create_assertion_control
+    },
+    {"create_deref_control",
+     (PyCFunction) LDAPObject_create_deref_control,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_create_deref_control
+    },
+    {"create_matched_values_control",
+     (PyCFunction) LDAPObject_create_matched_values_control,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_create_matched_values_control
+    },
+    {"create_proxy_authz_control",
+     (PyCFunction) LDAPObject_create_proxy_authz_control,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_create_proxy_authz_control
+    },
+    {"get_profile", (PyCFunction) LDAPObject_get_profile,
+     METH_FASTCALL | METH_KEYWORDS, LDAPObjectDoc_get_profile
+    },
+    {NULL, NULL, 0, NULL}
+};
+
+/* MEMBERS */
+
+static PyMemberDef LDAPObjectMembers[] = {
+    {"uri", T_OBJECT, offsetof(LDAPObject, uri), READONLY,
+     "LDAP URI (Uniform Resource Identifier) - RFC 4516 compliant"},
+    {NULL, 0, 0, 0, NULL}
+};
+
+/* GET/SET */
+
+static PyObject *
+LDAPObject_getscheme(LDAPObject *self, void *closure)
+{
+    if (!self->lud->lud_scheme)
+	Py_RETURN_NONE;
+    return PyUnicode_FromString(self->lud->lud_scheme);
+}
+
+static PyObject *
+LDAPObject_gethost(LDAPObject *self, void *closure)
+{
+    if (!self->lud->lud_host)
+	Py_RETURN_NONE;
+    return PyUnicode_FromString(self->lud->lud_host);
+}
+
+static PyObject *
+LDAPObject_getip(LDAPObject *self, void *closure)
+{
+    int ecode;
+    char host[NI_MAXHOST];
+    struct sockaddr_storage addr;
+    socklen_t addrlen = 0;
+
+    /* looked up on first use: __init__() must not wait for the DNS */
+    if (!self->resolved && LDAPObject_resolve(self) < 0)
+	return NULL;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->addr) {
+	addrlen = self->addrlen;
+	(void) memcpy((void *) &addr, (const void *) self->addr, addrlen);
+    }
+    Py_END_CRITICAL_SECTION();
+    if (!addrlen)
+	Py_RETURN_NONE;
+    ecode = getnameinfo(
+	(struct sockaddr *) &addr, addrlen, host, sizeof(host), NULL, 0,
+	NI_NUMERICHOST
+	);
+    if (ecode)
+	return PyErr_Format(
+	    LibLDAPErr(self), "`getip' attribute: getnameinfo(): %s",
+	    gai_strerror(ecode)
+	    );
+    return PyUnicode_FromString(host);
+}
+
+static PyObject *
+LDAPObject_getport(LDAPObject *self, void *closure)
+{
+    if (LDAPObject_is_ldapi(self))
+	Py_RETURN_NONE;
+    return PyLong_FromLong((long) self->lud->lud_port);
+}
+
+static PyObject *
+LDAPObject_getdn(LDAPObject *self, void *closure)
+{
+    PyObject *dn;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    dn = self->dn ? self->dn : Py_None;
+    Py_INCREF(dn);
+    Py_END_CRITICAL_SECTION();
+    return dn;
+}
+
+static int
+LDAPObject_setdn(LDAPObject *self, PyObject *dn, void *closure)
+{
+    PyObject *prev;
+
+    if (!dn) {
+	PyErr_SetString(
+	    PyExc_TypeError, "`dn' attribute cannot be deleted"
+	    );
+	return -1;
+    }
+    if (!PyUnicode_Check(dn) && dn != Py_None) {
+	PyErr_SetString(
+	    PyExc_TypeError, "`dn' attribute value must be a string or None"
+	    );
+	return -1;
+    }
+    if (dn == Py_None)
+	dn = NULL;
+    else
+	Py_INCREF(dn);
+    Py_BEGIN_CRITICAL_SECTION(self);
+    prev = self->dn;
+    self->dn = dn;
+    Py_END_CRITICAL_SECTION();
+    /* may run arbitrary code: outside of the critical section */
+    Py_XDECREF(prev);
+    return 0;
+}
+
+static PyObject *
+LDAPObject_getprofile(LDAPObject *self, void *closure)
+{
+    return PyBool_FromLong((long) self->profile);
+}
+
+static int
+LDAPObject_setprofile(LDAPObject *self, PyObject *profile, void *closure)
+{
+    if (!profile) {
+	PyErr_SetString(
+	    PyExc_TypeError, "`profile' attribute cannot be deleted"
+	    );
+	return -1;
+    }
+    if (!PyBool_Check(profile)) {
+	PyErr_SetString(
+	    PyExc_TypeError, "`profile' attribute value must be a boolean"
+	    );
+	return -1;
+    }
+    self->profile = profile == Py_True ? 1 : 0;
+    return 0;
+}
+
+/* What it takes to open the same connection again, e.g. in another
+   process: passwords are left out */
+static PyObject *
+LDAPObject_getspec(LDAPObject *self, void *closure)
+{
+    PyObject *options, *bind, *ret = NULL;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    options = PyDict_Copy(self->options);
+    if (!options)
+	bind = NULL;
+    else if (self->bind)
+	bind = PyTuple_GetSlice(self->bind, 0, 2);
+    else {
+	bind = Py_None;
+	Py_INCREF(bind);
+    }
+    if (bind)
+	ret = Py_BuildValue(
+	    "{s:O,s:i,s:O,s:O,s:O,s:O,s:O}",
+	    "uri", self->uri ? self->uri : Py_None,
+	    "version", self->version,
+	    "happy_eyeballs", self->he ? Py_True : Py_False,
+	    "dn", self->dn ? self->dn : Py_None,
+	    "options", options,
+	    "start_tls", self->tls ? Py_True : Py_False,
+	    "bind", bind
+	    );
+    Py_END_CRITICAL_SECTION();
+    Py_XDECREF(options);
+    Py_XDECREF(bind);
+    return ret;
+}
+
+static PyGetSetDef LDAPObjectGetSet[] = {
+    {"scheme", (getter) LDAPObject_getscheme, NULL,
+     "URI scheme",  NULL},
+    {"host", (getter) LDAPObject_gethost, NULL,
+     "LDAP host to contact",  NULL},
+    {"ip", (getter) LDAPObject_getip, NULL,
+     "IPv4/v6 address of LDAP host to contact",  NULL},
+    {"port", (getter) LDAPObject_getport, NULL,
+     "port on host",  NULL},
+    {"dn", (getter) LDAPObject_getdn, (setter) LDAPObject_setdn,
+     "base DN",  NULL},
+    {"profile", (getter) LDAPObject_getprofile,
+     (setter) LDAPObject_setprofile, "search profiling flag",  NULL},
+    {"spec", (getter) LDAPObject_getspec, NULL,
+     "connection parameters",  NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+/* SPECIAL METHODS */
+
+static void
+LDAPObject_dealloc(LDAPObject *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+
+    Py_XDECREF(self->uri);
+    Py_XDECREF(self->dn);
+    Py_XDECREF(self->options);
+    Py_XDECREF(self->bind);
+    Py_XDECREF(self->bindreq);
+    Py_CLEAR(self->pending);
+    /* the connection of the parent process is left alone */
+    if (self->ldp && self->forkgen != LDAPObject_forkgen)
+	LDAPObject_detach(self);
+    if (self->ldp)
+	(void) ldap_unbind(self->ldp);
+    ldap_free_urldesc(self->lud);
+    PyMem_Free((void *) self->addr);
+    tp->tp_free((PyObject *) self);
+    Py_DECREF(tp);
+}
+
+static int
+LDAPObject_init(LDAPObject *self, PyObject *args, PyObject *kwds)
+{
+    const char *uri;
+    int ecode, version = LDAP_VERSION3, fd = -1;
+    PyObject *py_he = Py_False;
+    static char *kwlist[] = {"uri", "version", "fd", "happy_eyeballs", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(
+	    args, kwds, "s|iiO!", kwlist, &uri, &version, &fd,
+	    &PyBool_Type, &py_he))
+	return -1;
+    /* the connection is shared by the threads using the object: it is
+       never replaced under their feet */
+    if (self->lud) {
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.__init__(): already initialized",
+	    LDAPObjName(self)
+	    );
+	return -1;
+    }
+    if (version != LDAP_VERSION2 && version != LDAP_VERSION3) {
+	(void) PyErr_Format(
+	    PyExc_ValueError,
+	    "%s.__init__(): argument `version' must be %d or %d",
+	    LDAPObjName(self), LDAP_VERSION2, LDAP_VERSION3
+	    );
+	return -1;
+    }    
+    ecode = ldap_url_parse(uri, &self->lud);
+    if (ecode != LDAP_URL_SUCCESS) {
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.__init__(): ldap_url_parse(): %s",
+	    LDAPObjName(self), ldap_url_err2string(ecode)
+	    );
+	return -1;
+    }
+    /* with an already connected socket, there is nothing to resolve */
+    self->resolved = fd >= 0 || LDAPObject_is_ldapi(self);
+    if (!LDAPObject_is_ldapi(self) &&
+	(self->lud->lud_port <=0 || self->lud->lud_port > 0xffff)) {
+	(void) PyErr_Format(
+	    LibLDAPErr(self),
+	    "%s.__init__(): %d: invalid  port, "
+	    "must be an integer in range ]0, %d]", LDAPObjName(self),
+	    self->lud->lud_port, 0xffff
+	    );
+	return -1;
+    }
+    if (self->lud->lud_dn) {
+	char *s = strrchr(uri, '/');
+	char u[s - uri + 1];
+
+	self->dn = PyUnicode_FromString(self->lud->lud_dn);
+	if (!self->dn)
+	    return -1;
+	(void) strncpy(u, uri, s - uri);
+	u[s - uri] = 0;
+	self->uri = PyUnicode_FromString(u);
+    }
+    else
+	self->uri = PyUnicode_FromString(uri);
+    if (!self->uri)
+	return -1;
+    self->version = version;
+    self->he = py_he == Py_True;
+    return LDAPObject_connect(self, fd, "__init__");
+}
+
+static PyObject *
+LDAPObject_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    LDAPObject *self;
+
+    (void) pthread_once(&LDAPObject_atfork_once, LDAPObject_atfork_register);
+    self = (LDAPObject *) type->tp_alloc(type, 0);
+    if (self) {
+	self->st = LibLDAP_state((PyObject *) self);
+	self->uri = NULL;
+	self->dn = NULL;
+	self->ldp = NULL;
+	self->lud = NULL;
+	self->addr = NULL;
+	self->addrlen = 0;
+	self->resolved = 0;
+	self->tls_msgid = 0;
+	self->bind_msgid = 0;
+	self->handle = 0;
+	self->serial = __atomic_add_fetch(
+	    &LDAPObject_serial, 1, __ATOMIC_RELAXED);
+	self->profile = 0;
+	(void) memset((void *) &self->prof, 0, sizeof(LDAPProfile_t));
+	(void) memset((void *) &self->prof_last, 0, sizeof(LDAPProfile_t));
+	self->forkgen = LDAPObject_forkgen;
+	self->version = LDAP_VERSION3;
+	self->he = 0;
+	self->tls = 0;
+	self->bind = NULL;
+	self->bindreq = NULL;
+	self->pending = NULL;
+	self->busy = 0;
+	self->options = PyDict_New();
+	if (!self->options) {
+	    Py_DECREF(self);
+	    return NULL;
+	}
+    }
+    return (PyObject *) self;
+}
+
+/* TYPE */
+
+static PyType_Slot LDAPTypeSlots[] = {
+    {Py_tp_doc, (void *) LDAPObjectDoc},
+    {Py_tp_dealloc, (void *) LDAPObject_dealloc},
+    {Py_tp_methods, (void *) LDAPObjectMethods},
+    {Py_tp_members, (void *) LDAPObjectMembers},
+    {Py_tp_getset, (void *) LDAPObjectGetSet},
+    {Py_tp_init, (void *) LDAPObject_init},
+    {Py_tp_new, (void *) LDAPObject_new},
+    {0, NULL}
+};
+
+PyType_Spec LDAPTypeSpec = {
+    "_libldap.LDAP_",				/* name */
+    sizeof(LDAPObject),				/* basicsize */
+    0,						/* itemsize */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,	/* flags */
+    LDAPTypeSlots				/* slots */
+};
+
+/*****************************************************************************
+ * LOCAL FUNCTION DEFINITIONS
+ *****************************************************************************/
+
+static const char *__ldap_url_err2string[] = {
+    "success",
+    "can't allocate memory space",
+    "parameter is bad",
+    "URL doesn't begin with \"ldap[si]://\"",
+    "URL is missing trailing \">\"",
+    "URL is bad",
+    "host port is bad",
+    "bad (or missing) attributes",
+    "scope string is invalid (or missing)",
+    "bad or missing filter",
+    "bad or missing extensions",
+#define LDAP_URL_ERR_UNKNOWN 0x0b
+    "unknown error"
+};
+
+static const char *
+ldap_url_err2string(int ecode)
+{
+    if (ecode < LDAP_URL_SUCCESS || ecode > LDAP_URL_ERR_BADEXTS)
+	return __ldap_url_err2string[LDAP_URL_ERR_UNKNOWN];
+    return __ldap_url_err2string[ecode];
+}
+
+/* `buf' holds LDAPObject_DN_MAX bytes: the default DN may be changed by
+   another thread, which each caller gets its own copy of. Returns NULL
+   without an exception if there is neither `dni' nor default DN, raises
+   ValueError if the DN does not fit */
+static const char *
+LDAPObject_complete_dn(
+    LDAPObject *self, const char *dni, char *buf, const char *func)
+{
+    int n;
+    PyObject *dnc;
+    const char *sep, *dncp = "";
+    Py_ssize_t lc = 0;
+    size_t li = dni ? strlen(dni) : 0;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    dnc = self->dn;
+    Py_XINCREF(dnc);
+    Py_END_CRITICAL_SECTION();
+    if (dnc) {
+	/* valid as long as the reference is held */
+	dncp = PyUnicode_AsUTF8AndSize(dnc, &lc);
+	if (!dncp) {
+	    Py_DECREF(dnc);
+	    return NULL;
+	}
+    }
+    sep = dnc ? "," : "";
+    if (!dni) {
+	if (!dnc)
+	    return NULL;
+	sep = dni = "";
+    }
+    if (strcasecmp(dni, LibLDAPSchemaBase)) {
+	if (dnc && li >= (size_t) lc) {
+	    const char *s = dni + li - lc;
+	    
+	    if (!memcmp((const void *) s, (const void *) dncp, lc + 1))
+		sep = dncp = "";
+	}
+    }
+    else
+	sep = dncp = "";	
+    n = snprintf(buf, LDAPObject_DN_MAX, "%s%s%s", dni, sep, dncp);
+    Py_XDECREF(dnc);
+    if (n >= LDAPObject_DN_MAX) {
+	(void) PyErr_Format(
+	    PyExc_ValueError, "%s.%s(): DN longer than %d bytes",
+	    LDAPObjName(self), func, LDAPObject_DN_MAX - 1
+	    );
+	return NULL;
+    }
+    return buf;
+}
+
+static char **
+LDAPObject_attrs_parse(LDAPObject *self, PyObject *py_attrs, const char *func)
+{
+    Py_ssize_t i, len = PyList_Size(py_attrs);
+    char **attrs, **attr;
+
+    if (!len)
+	return (char **) PyErr_Format(
+	    PyExc_TypeError,
+	    "%s.%s(): argument `attrs' must be a non empty list",
+	    LDAPObjName(self), func
+	    );
+    attrs = PyMem_New(char *, len + 1);
+    if (!attrs)
+	return (char **) PyErr_NoMemory();
+    (void) memset((void *) attrs, 0, (len + 1) * sizeof(char *));
+    for (i = 0, attr = attrs; i < len; i++, attr++) {
+	PyObject *py_attr = PyList_GET_ITEM(py_attrs, i);
+	Py_ssize_t l;
+
+	if (!PyUnicode_Check(py_attr)) {
+	    LibLDAP_value_free((void **) attrs);
+	    return (char **) PyErr_Format(
+		PyExc_TypeError,
+		"%s.%s(): argument `attrs' must be a list of strings",
+		LDAPObjName(self), func
+		);
+	}
+	l = PyUnicode_GET_LENGTH(py_attr);
+	*attr = PyMem_New(char, l + 1);
+	if (!*attr) {
+	    LibLDAP_value_free((void **) attrs);
+	    return (char **) PyErr_NoMemory();
+	}
+	(void) memcpy((void *) *attr, PyUnicode_DATA(py_attr), l);
+	(*attr)[l] = 0;
+    }
+    return attrs;
+}
+
+/* `*py_mods' is replaced by a tuple snapshot of the list, holding the
+   LDAPMod objects whose data is used until LDAPObject_mods_free(): the
+   list may be changed by another thread meanwhile. The array points to
+   the LDAPMod structures of the objects, nothing is copied */
+static LDAPMod **
+LDAPObject_mods_parse(LDAPObject *self, PyObject **py_mods, int add,
+		      const char *func)
+{
+    Py_ssize_t i, len;
+    LDAPMod **ptr, **ret;
+    PyObject *mods = PyList_AsTuple(*py_mods);
+
+    if (!mods)
+	return NULL;
+    len = PyTuple_GET_SIZE(mods);
+    if (!len) {
+	Py_DECREF(mods);
+	return (LDAPMod **) PyErr_Format(
+	    PyExc_TypeError, 
+	    "%s.%s(): argument `mods' must be a non empty list",
+	    LDAPObjName(self), func
+	    );
+    }
+    ret = PyMem_New(LDAPMod *, len + 1);
+    if (!ret) {
+	Py_DECREF(mods);
+	PyErr_SetNone(PyExc_MemoryError);
+	return NULL;
+    }
+    (void) memset((void *) ret, 0, (len + 1) * sizeof(LDAPMod *));
+    for (i = 0, ptr = ret; i < len; i++, ptr++) {
+	PyObject *py_mod = PyTuple_GET_ITEM(mods, i);
+
+	if (!LDAPModObject_Check(self->st, py_mod)) {
+	    LDAPObject_mods_free(ret, mods);
+	    return (LDAPMod **) PyErr_Format(
+		PyExc_TypeError,
+		"%s.%s(): argument `mods' must be a list of LDAPMod objects",
+		LDAPObjName(self), func
+		);
+	}
+	/* an Add request only lists attributes and values */
+	if (add && ((LDAPModObject *) py_mod)->mod.mod_op != LDAP_MOD_ADD) {
+	    LDAPObject_mods_free(ret, mods);
+	    return (LDAPMod **) PyErr_Format(
+		PyExc_ValueError,
+		"%s.%s(): attribute `mode' of each LDAPMod object must be "
+		"%d (LDAP_MOD_ADD)", LDAPObjName(self), func, LDAP_MOD_ADD
+		);
+	}
+	*ptr = &((LDAPModObject *) py_mod)->mod;
+    }
+    *py_mods = mods;
+    return ret;
+}
+
+static void
+LDAPObject_mods_free(LDAPMod **mods, PyObject *py_mods)
+{
+    PyMem_Free((void *) mods);
+    Py_DECREF(py_mods);
+}
+
+static int
+LDAPObject_conn_valid(PyObject *pyo, const char *func)
+{
+    LDAPObject *self = (LDAPObject *) pyo;
+
+    if (!self->ldp) {
+	(void) PyErr_Format(
+	    LibLDAPErr(pyo), "%s.%s(): invalid LDAP connection",
+	    LDAPObjName(pyo), func
+	    );
+	return 0;
+    }
+    if (self->forkgen != LDAPObject_forkgen &&
+	LDAPObject_reconnect(self, func) < 0)
+	return 0;
+    return 1;
+}
+
+/* marks the handle as used by the calling thread, which is about to wait
+   on it without the GIL: unbind_s() refuses to free it until
+   LDAPObject_leave(). Raises LDAPError if the connection is gone */
+static int
+LDAPObject_enter(LDAPObject *self, const char *func)
+{
+    int ok;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    ok = self->ldp != NULL;
+    if (ok)
+	self->busy++;
+    Py_END_CRITICAL_SECTION();
+    if (!ok)
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.%s(): invalid LDAP connection",
+	    LDAPObjName(self), func
+	    );
+    return ok;
+}
+
+static void
+LDAPObject_leave(LDAPObject *self)
+{
+    Py_BEGIN_CRITICAL_SECTION(self);
+    self->busy--;
+    Py_END_CRITICAL_SECTION();
+}
+
+/* `ldp' was opened or freed */
+static void
+LDAPObject_renumber(LDAPObject *self)
+{
+    self->handle = __atomic_add_fetch(
+	&LDAPObject_handles, 1, __ATOMIC_RELAXED);
+}
+
+static void
+LDAPObject_atfork_child(void)
+{
+    LDAPObject_forkgen++;
+}
+
+static void
+LDAPObject_atfork_register(void)
+{
+    (void) pthread_atfork(NULL, NULL, LDAPObject_atfork_child);
+}
+
+static int
+LDAPObject_connect(LDAPObject *self, int fd, const char *func)
+{
+    int ecode, raced = 0;
+
+    if (self->he && fd < 0 && !LDAPObject_is_ldapi(self)) {
+	fd = LDAPObject_happy_eyeballs(self, func);
+	if (fd < 0)
+	    return -1;
+	raced = 1;
+    }
+    if (fd < 0)
+	ecode = ldap_initialize(
+	    &self->ldp, (char *) PyUnicode_1BYTE_DATA(self->uri));
+    else {
+	int proto = LDAPObject_is_ldapi(self) ?
+	    LDAP_PROTO_IPC : LDAP_PROTO_TCP;
+
+	ecode = ldap_init_fd(
+	    (ber_socket_t) fd, proto, (char *) PyUnicode_1BYTE_DATA(self->uri),
+	    &self->ldp);
+    }
+    if (ecode != LDAP_SUCCESS) {
+	if (raced)
+	    (void) close(fd);
+    	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.%s(): %s() %s", LDAPObjName(self), func,
+	    fd < 0 ? "ldap_initialize" : "ldap_init_fd", ldap_err2string(ecode)
+	    );
+    	return -1;
+    }
+    ecode = ldap_set_option(
+	self->ldp, LDAP_OPT_PROTOCOL_VERSION, &self->version);
+    if (ecode != LDAP_OPT_SUCCESS) {
+	(void) PyErr_Format(
+	    LibLDAPErr(self),
+	    "%s.%s(): ldap_set_option() [LDAP_OPT_PROTOCOL_VERSION] "
+	    "failed", LDAPObjName(self), func
+	    );
+	    return -1;
+    }
+    if (LibLDAP_tls_setup(self->ldp, self->lud) < 0) {
+	(void) PyErr_Format(
+	    LibLDAPErr(self),
+	    "%s.%s(): TLS session resumption: libldap not built with "
+	    "OpenSSL or ldap_set_option() [LDAP_OPT_X_TLS_CONNECT_CB] failed",
+	    LDAPObjName(self), func
+	    );
+	return -1;
+    }
+    /* libldap only does the TLS handshake of ldaps:// when it connects */
+    if (raced && !strcasecmp(self->lud->lud_scheme, "ldaps")) {
+	ecode = ldap_install_tls(self->ldp);
+	if (ecode != LDAP_SUCCESS) {
+	    (void) PyErr_Format(
+		LibLDAPErr(self), "%s.%s(): ldap_install_tls(): %s",
+		LDAPObjName(self), func, ldap_err2string(ecode)
+		);
+	    return -1;
+	}
+    }
+    self->forkgen = LDAPObject_forkgen;
+    LDAPObject_renumber(self);
+    return 0;
 }
 
-static PyObject *
-LDAPObject_getdn(LDAPObject *self, void *closure)
+/* Drops the connection inherited from the parent process: its socket is
+   replaced by a dead one before libldap closes it, so that neither an
+   unbind request nor a TLS close notify is sent on the parent's
+   connection */
+static void
+LDAPObject_detach(LDAPObject *self)
 {
-    if (!self->dn)
-	Py_RETURN_NONE;
-    Py_INCREF(self->dn);
-    return self->dn;
+    int fd = -1, null;
+
+    if (ldap_get_option(self->ldp, LDAP_OPT_DESC, &fd) == LDAP_OPT_SUCCESS &&
+	fd >= 0) {
+	null = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (null >= 0) {
+	    (void) dup2(null, fd);
+	    (void) close(null);
+	}
+    }
+    (void) ldap_unbind_ext(self->ldp, NULL, NULL);
+    self->ldp = NULL;
+    LDAPObject_renumber(self);
+    self->tls_msgid = 0;
+    self->bind_msgid = 0;
+    Py_CLEAR(self->bindreq);
+    /* the threads of the parent waiting on the handle are not in this
+       process */
+    self->busy = 0;
+    Py_CLEAR(self->pending);
 }
 
+/* Opens a new connection in a forked child process and brings it to the
+   state of the parent's one: options, StartTLS and bind */
 static int
-LDAPObject_setdn(LDAPObject *self, PyObject *dn, void *closure)
+LDAPObject_reconnect(LDAPObject *self, const char *func)
 {
-    if (!dn) {
-	PyErr_SetString(
-	    PyExc_TypeError, "`dn' attribute cannot be deleted"
-	    );
-	return -1;
+    int claimed = 0, busy;
+    Py_ssize_t i;
+    PyObject *items, *ret, *bind;
+    LDAP *ldp;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->forkgen != LDAPObject_forkgen) {
+	LDAPObject_detach(self);
+	self->forkgen = LDAPObject_forkgen;
+	claimed = 1;
     }
-    if (!PyUnicode_Check(dn) && dn != Py_None) {
-	PyErr_SetString(
-	    PyExc_TypeError, "`dn' attribute value must be a string or None"
-	    );
+    Py_END_CRITICAL_SECTION();
+    /* another thread of the child is reconnecting */
+    if (!claimed) {
+	if (!self->ldp)
+	    (void) PyErr_Format(
+		LibLDAPErr(self), "%s.%s(): invalid LDAP connection",
+		LDAPObjName(self), func
+		);
+	return self->ldp ? 0 : -1;
+    }
+    if (LDAPObject_connect(self, -1, func) < 0)
 	return -1;
+    /* options are replayed in the order they were set */
+    items = PyDict_Items(self->options);
+    if (!items)
+	goto failed;
+    for (i = 0; i < PyList_GET_SIZE(items); i++) {
+	PyObject *item = PyList_GET_ITEM(items, i);
+
+	ret = LDAPObject_set_option(self, PySequence_Fast_ITEMS(item), 2);
+	if (!ret) {
+	    Py_DECREF(items);
+	    goto failed;
+	}
+	Py_DECREF(ret);
     }
-    Py_XDECREF(self->dn);
-    if (dn == Py_None)
-	self->dn = NULL;
-    else {
-	Py_INCREF(dn);
-	self->dn = dn;
+    Py_DECREF(items);
+    if (self->tls) {
+	ret = LDAPObject_start_tls_s(self, NULL, 0, NULL);
+	if (!ret)
+	    goto failed;
+	Py_DECREF(ret);
+    }
+    Py_BEGIN_CRITICAL_SECTION(self);
+    bind = self->bind;
+    Py_XINCREF(bind);
+    Py_END_CRITICAL_SECTION();
+    if (bind) {
+	PyObject *mech = PyTuple_GET_ITEM(bind, 0);
+	PyObject *user = PyTuple_GET_ITEM(bind, 1);
+	PyObject *password = PyTuple_GET_ITEM(bind, 2);
+	PyObject *args[2] = {user, password};
+
+	if (!PyUnicode_CompareWithASCIIString(mech, "EXTERNAL"))
+	    ret = LDAPObject_sasl_external_bind_s(self, args, 1, NULL);
+	else if (!PyUnicode_CompareWithASCIIString(mech, "SIMPLE"))
+	    /* anonymous or unauthenticated bind */
+	    ret = LDAPObject_simple_bind_s(
+		self, args, user == Py_None ? 0 : password == Py_None ? 1 : 2,
+		NULL);
+	else
+	    /* rather than going on with another identity */
+	    ret = PyErr_Format(
+		LibLDAPErr(self), "%s.%s(): %U bind can't be done again",
+		LDAPObjName(self), func, mech
+		);
+	Py_DECREF(bind);
+	if (!ret)
+	    goto failed;
+	Py_DECREF(ret);
     }
     return 0;
+ failed:
+    /* half restored, the connection must not be used. Another thread of
+       the child may already wait on it: the handle is then kept for it,
+       with its socket shut down */
+    Py_BEGIN_CRITICAL_SECTION(self);
+    busy = self->busy;
+    ldp = self->ldp;
+    if (!busy) {
+	self->ldp = NULL;
+	LDAPObject_renumber(self);
+    }
+    Py_END_CRITICAL_SECTION();
+    if (!ldp)
+	return -1;
+    if (!busy)
+	(void) ldap_unbind_ext(ldp, NULL, NULL);
+    else {
+	int fd = -1;
+
+	if (ldap_get_option(ldp, LDAP_OPT_DESC, &fd) == LDAP_OPT_SUCCESS &&
+	    fd >= 0)
+	    (void) shutdown(fd, SHUT_RDWR);
+    }
+    return -1;
 }
 
-static PyGetSetDef LDAPObjectGetSet[] = {
-    {"scheme", (getter) LDAPObject_getscheme, NULL,
-     "URI scheme",  NULL},
-    {"host", (getter) LDAPObject_gethost, NULL,
-     "LDAP host to contact",  NULL},
-    {"ip", (getter) LDAPObject_getip, NULL,
-     "IPv4/v6 address of LDAP host to contact",  NULL},
-    {"port", (getter) LDAPObject_getport, NULL,
-     "port on host",  NULL},
-    {"dn", (getter) LDAPObject_getdn, (setter) LDAPObject_setdn,
-     "base DN",  NULL},
-    {NULL, NULL, NULL, NULL, NULL}
-};
+static int
+LDAPObject_bound(
+    LDAPObject *self, const char *mech, const char *user, const char *password)
+{
+    PyObject *bind, *old, *req;
 
-/* SPECIAL METHODS */
+    bind = Py_BuildValue("(szz)", mech, user, password);
+    if (!bind)
+	return -1;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    old = self->bind;
+    self->bind = bind;
+    /* supersedes a pending simple_bind() */
+    req = self->bindreq;
+    self->bindreq = NULL;
+    self->bind_msgid = 0;
+    Py_END_CRITICAL_SECTION();
+    Py_XDECREF(old);
+    Py_XDECREF(req);
+    return 0;
+}
 
+/* answer to the bind `msgid': the pending simple_bind() it completes
+   becomes the bind to replay if `success' */
 static void
-LDAPObject_dealloc(LDAPObject *self)
+LDAPObject_bind_done(LDAPObject *self, int msgid, int success)
 {
-    Py_XDECREF(self->uri);
-    Py_XDECREF(self->dn);
-    if (self->ldp)
-	(void) ldap_unbind(self->ldp);
-    ldap_free_urldesc(self->lud);
-    PyMem_Free((void *) self->addr);
-    Py_TYPE(self)->tp_free((PyObject *) self);
+    PyObject *old = NULL;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->bind_msgid && msgid == self->bind_msgid) {
+	self->bind_msgid = 0;
+	if (success) {
+	    old = self->bind;
+	    self->bind = self->bindreq;
+	}
+	else
+	    old = self->bindreq;
+	self->bindreq = NULL;
+    }
+    Py_END_CRITICAL_SECTION();
+    Py_XDECREF(old);
 }
 
 static int
-LDAPObject_init(LDAPObject *self, PyObject *args, PyObject *kwds)
+LDAPObject_resolve(LDAPObject *self)
 {
-    const char *uri;
-    int ecode, version = LDAP_VERSION3;
+    int ecode;
+    struct sockaddr *addr;
     struct addrinfo *res, hints = {
 	.ai_flags = 0,
 	.ai_family = AF_UNSPEC,
 	.ai_socktype = SOCK_STREAM,
 	.ai_protocol = IPPROTO_TCP
     };
-    static char *kwlist[] = {"uri", "version", NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(
-	    args, kwds, "s|i", kwlist, &uri, &version))
-	return -1;
-    if (version != LDAP_VERSION2 && version != LDAP_VERSION3) {
+    ecode = getaddrinfo(self->lud->lud_host, NULL, &hints, &res);
+    if (ecode) {
 	(void) PyErr_Format(
-	    PyExc_ValueError,
-	    "%s.__init__(): argument `version' must be %d or %d",
-	    LDAPObjName(self), LDAP_VERSION2, LDAP_VERSION3
+	    LibLDAPErr(self),
+	    "`ip' attribute: `%s': getaddrinfo(): %s",
+	    self->lud->lud_host, gai_strerror(ecode)
 	    );
 	return -1;
-    }    
-    ecode = ldap_url_parse(uri, &self->lud);
-    if (ecode != LDAP_URL_SUCCESS) {
-	(void) PyErr_Format(
-	    LibLDAPErr, "%s.__init__(): ldap_url_parse(): %s",
-	    LDAPObjName(self), ldap_url_err2string(ecode)
-	    );
+    }
+    addr = (struct sockaddr *) PyMem_Malloc(res->ai_addrlen);
+    if (!addr) {
+	freeaddrinfo(res);
+	PyErr_SetNone(PyExc_MemoryError);
 	return -1;
     }
-    ecode = getaddrinfo(self->lud->lud_host, NULL, &hints, &res);
+    (void) memcpy((void *) addr, (const void *) res->ai_addr, res->ai_addrlen);
+    /* another thread may have looked it up meanwhile */
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (!self->resolved) {
+	self->addr = addr;
+	self->addrlen = res->ai_addrlen;
+	self->resolved = 1;
+	addr = NULL;
+    }
+    Py_END_CRITICAL_SECTION();
+    PyMem_Free((void *) addr);
+    freeaddrinfo(res);
+    return 0;
+}
+
+/* connection attempts to all the addresses of the host, alternating
+   address families, are started LDAPObject_HE_DELAY seconds apart (or as
+   soon as the previous one failed) and raced: the first connected socket
+   is returned, the others are closed. The network timeout
+   (LDAP_OPT_NETWORK_TIMEOUT) of the connection, or else the global one,
+   if any, bounds the whole race */
+static int
+LDAPObject_happy_eyeballs(LDAPObject *self, const char *func)
+{
+    int ecode, i, n = 0, next = 0, pending = 0, fd = -1, err = ETIMEDOUT;
+    int intr = 0;
+    char port[8];
+    double started = 0.0, deadline = -1.0;
+    struct timeval *tv = NULL;
+    PyObject *key, *py_tv = NULL;
+    struct addrinfo *res, *a, *b, **addrs, **inflight, *won = NULL;
+    struct pollfd *pfds;
+    struct addrinfo hints = {
+	.ai_flags = AI_NUMERICSERV,
+	.ai_family = AF_UNSPEC,
+	.ai_socktype = SOCK_STREAM,
+	.ai_protocol = IPPROTO_TCP
+    };
+
+    (void) snprintf(port, sizeof(port), "%d", self->lud->lud_port);
+    ecode = getaddrinfo(self->lud->lud_host, port, &hints, &res);
     if (ecode) {
 	(void) PyErr_Format(
-	    LibLDAPErr,
-	    "%s.__init__(): `%s': getaddrinfo(): %s", LDAPObjName(self),
-	    self->lud->lud_host, gai_strerror(ecode)
+	    LibLDAPErr(self), "%s.%s(): `%s': getaddrinfo(): %s",
+	    LDAPObjName(self), func, self->lud->lud_host, gai_strerror(ecode)
 	    );
 	return -1;
     }
-    self->addr = (struct sockaddr *) PyMem_Malloc(res->ai_addrlen);
-    if (!self->addr) {
+    for (a = res; a; a = a->ai_next)
+	n++;
+    addrs = (struct addrinfo **) PyMem_Malloc(2 * n * sizeof(*addrs));
+    pfds = (struct pollfd *) PyMem_Malloc(n * sizeof(*pfds));
+    if (!addrs || !pfds) {
+	PyMem_Free((void *) addrs);
+	PyMem_Free((void *) pfds);
+	freeaddrinfo(res);
 	PyErr_SetNone(PyExc_MemoryError);
 	return -1;
     }
-    (void) memcpy(
-	(void *) self->addr, (const void *) res->ai_addr, res->ai_addrlen
-	);
-    self->addrlen = res->ai_addrlen;
-    freeaddrinfo(res);
-    if (self->lud->lud_port <=0 || self->lud->lud_port > 0xffff) {
-	(void) PyErr_Format(
-	    LibLDAPErr,
-	    "%s.__init__(): %d: invalid  port, "
-	    "must be an integer in range ]0, %d]", LDAPObjName(self),
-	    self->lud->lud_port, 0xffff
-	    );
-	return -1;
+    inflight = addrs + n;
+    /* the family preferred by getaddrinfo() (RFC 6724) first */
+    for (i = 0, a = b = res; i < n; ) {
+	while (a && a->ai_family != res->ai_family)
+	    a = a->ai_next;
+	if (a) {
+	    addrs[i++] = a;
+	    a = a->ai_next;
+	}
+	while (b && b->ai_family == res->ai_family)
+	    b = b->ai_next;
+	if (b) {
+	    addrs[i++] = b;
+	    b = b->ai_next;
+	}
+    }
+    /* the options of the connection are set again after it is opened
+       (reconnect after fork()): libldap does not know them yet */
+    key = PyLong_FromLong((long) LDAP_OPT_NETWORK_TIMEOUT);
+    if (!key) {
+	PyMem_Free((void *) addrs);
+	PyMem_Free((void *) pfds);
+	freeaddrinfo(res);
+	return -1;
+    }
+    Py_BEGIN_CRITICAL_SECTION(self);
+    py_tv = PyDict_GetItem(self->options, key);
+    Py_XINCREF(py_tv);
+    Py_END_CRITICAL_SECTION();
+    Py_DECREF(key);
+    if (py_tv) {
+	/* None: no timeout */
+	if (py_tv != Py_None)
+	    deadline = LibLDAP_monotonic() + PyFloat_AsDouble(py_tv);
+	Py_DECREF(py_tv);
+    }
+    else if (ldap_get_option(NULL, LDAP_OPT_NETWORK_TIMEOUT, (void *) &tv)
+	     == LDAP_OPT_SUCCESS && tv) {
+	deadline = LibLDAP_monotonic() + tv->tv_sec + tv->tv_usec / 1e6;
+	ldap_memfree(tv);
+    }
+    while (!won) {
+	int timeout = -1, rc;
+	double now = LibLDAP_monotonic();
+
+	if (next < n && (!pending || now >= started + LDAPObject_HE_DELAY)) {
+	    int s;
+
+	    a = addrs[next++];
+	    s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+	    if (s < 0 || fcntl(s, F_SETFL, O_NONBLOCK) < 0) {
+		err = errno;
+		if (s >= 0)
+		    (void) close(s);
+		continue;
+	    }
+	    if (!connect(s, a->ai_addr, a->ai_addrlen)) {
+		fd = s;
+		won = a;
+		break;
+	    }
+	    /* interrupted, the connection goes on asynchronously */
+	    if (errno != EINPROGRESS && errno != EINTR) {
+		err = errno;
+		(void) close(s);
+		continue;
+	    }
+	    pfds[pending].fd = s;
+	    pfds[pending].events = POLLOUT;
+	    inflight[pending++] = a;
+	    started = now;
+	    continue;
+	}
+	if (!pending)
+	    break;
+	if (next < n)
+	    timeout = (int) ((started + LDAPObject_HE_DELAY - now) * 1000) + 1;
+	if (deadline >= 0.0) {
+	    if (now >= deadline) {
+		err = ETIMEDOUT;
+		break;
+	    }
+	    if (timeout < 0 || deadline - now < timeout / 1000.0)
+		timeout = (int) ((deadline - now) * 1000) + 1;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	rc = poll(pfds, pending, timeout);
+	if (rc < 0)
+	    err = errno;
+	Py_END_ALLOW_THREADS
+	if (rc < 0) {
+	    /* a signal handler raising (KeyboardInterrupt) stops the race */
+	    if (err == EINTR && !(intr = PyErr_CheckSignals() < 0))
+		continue;
+	    break;
+	}
+	for (i = 0; rc > 0 && i < pending; ) {
+	    int soerr = 0;
+	    socklen_t len = sizeof(soerr);
+
+	    if (!pfds[i].revents) {
+		i++;
+		continue;
+	    }
+	    if (getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &soerr, &len) < 0)
+		soerr = errno;
+	    if (!soerr) {
+		fd = pfds[i].fd;
+		won = inflight[i];
+		pfds[i] = pfds[--pending];
+		break;
+	    }
+	    err = soerr;
+	    (void) close(pfds[i].fd);
+	    pfds[i] = pfds[--pending];
+	    inflight[i] = inflight[pending];
+	}
+    }
+    for (i = 0; i < pending; i++)
+	(void) close(pfds[i].fd);
+    if (won) {
+	/* the connected address is the one reported by `ip', it replaces
+	   the one of a previous connection (reconnect after fork()) */
+	struct sockaddr *addr, *old;
+
+	addr = (struct sockaddr *) PyMem_Malloc(won->ai_addrlen);
+	if (addr) {
+	    (void) memcpy(
+		(void *) addr, (const void *) won->ai_addr, won->ai_addrlen);
+	    Py_BEGIN_CRITICAL_SECTION(self);
+	    old = self->addr;
+	    self->addr = addr;
+	    self->addrlen = won->ai_addrlen;
+	    self->resolved = 1;
+	    Py_END_CRITICAL_SECTION();
+	    PyMem_Free((void *) old);
+	}
+	(void) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    }
+    else if (!intr)
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.%s(): `%s': connect(): %s",
+	    LDAPObjName(self), func, self->lud->lud_host, strerror(err)
+	    );
+    PyMem_Free((void *) addrs);
+    PyMem_Free((void *) pfds);
+    freeaddrinfo(res);
+    return fd;
+}
+
+/* when `deref' is set, entries carrying a dereference response control
+   are returned as 3-tuples (see LDAPObject_deref2py()) */
+static PyObject *
+LDAPObject_entries2py(
+    LDAPObject *self, LDAPMessage *res, const char *func, int deref,
+    LDAPObject_mark_t *mark, size_t *bytes
+    )
+{
+    LDAPMessage *ptr;
+    PyObject *ret;
+
+    LDAPObject_prof_mark(self, *mark, decode);
+    ret = PyList_New(0);
+    if (!ret)
+	return NULL;
+    LDAPObject_prof_mark(self, *mark, build);
+    for (ptr = ldap_first_entry(self->ldp, res); ptr;
+	 ptr = ldap_next_entry(self->ldp, ptr)) {
+	char *attr, *dn;
+	BerElement *ber;
+	PyObject *py_attr, *py_entry, *py_deref = NULL;
+
+	LDAPObject_prof_mark(self, *mark, decode);
+	py_attr = PyDict_New();
+	if (!py_attr)
+	    goto failed;
+	LDAPObject_prof_mark(self, *mark, build);
+	for (attr = ldap_first_attribute(self->ldp, ptr, &ber); 
+	     attr; attr = ldap_next_attribute(self->ldp, ptr, ber)) {
+	    char **vals = NULL;
+	    int i;
+	    PyObject *py_vals = NULL;
+
+	    vals = ldap_get_values(self->ldp, ptr, attr);
+	    if (!vals) {
+		(void) PyErr_Format(
+		    LibLDAPErr(self), "%s.%s(): ldap_get_values(): %s",
+		    LDAPObjName(self), func,
+		    ldap_err2string(LDAPObject_result_code(self))
+		    );
+		goto clean;
+	    }
+	    LDAPObject_prof_mark(self, *mark, decode);
+	    py_vals = PyList_New(0);
+	    if (!py_vals) {
+		ldap_value_free(vals);
+		goto clean;
+	    }
+	    for (i = 0; vals[i]; i++) {
+		size_t l = strlen(vals[i]);
+		PyObject *py_val = PyUnicode_FromStringAndSize(vals[i], l);
+
+		*bytes += l;
+		if (!py_val) {
+		    ldap_value_free(vals);
+		    goto clean;
+		}
+		if (PyList_Append(py_vals, py_val) == -1) {
+		    Py_DECREF(py_val);
+		    ldap_value_free(vals);
+		    goto clean;
+		}
+		Py_DECREF(py_val);
+	    }
+	    if (PyDict_SetItemString(py_attr, attr, py_vals) == -1) {
+		ldap_value_free(vals);
+		goto clean;
+	    }
+	    Py_DECREF(py_vals);
+	    LDAPObject_prof_mark(self, *mark, build);
+	    ldap_value_free(vals);
+	    ldap_memfree(attr);
+	    continue;
+	  clean:
+	    Py_XDECREF(py_vals);
+	    Py_DECREF(py_attr);
+	    ldap_memfree(attr);
+	    ber_free(ber, 0);
+	    goto failed;
+	}
+	ber_free(ber, 0);
+	if (deref &&
+	    LDAPObject_deref2py(self, ptr, func, &py_deref, bytes) < 0) {
+	    Py_DECREF(py_attr);
+	    goto failed;
+	}
+	dn = ldap_get_dn(self->ldp, ptr);
+	if (!dn) {
+	    (void) PyErr_Format(
+		LibLDAPErr(self), "%s.%s(): ldap_get_dn(): %s",
+		LDAPObjName(self), func,
+		ldap_err2string(LDAPObject_result_code(self))
+		);
+	    Py_DECREF(py_attr);
+	    Py_XDECREF(py_deref);
+	    goto failed;
+	}
+	LDAPObject_prof_mark(self, *mark, decode);
+	*bytes += strlen(dn);
+	if (py_deref)
+	    py_entry = Py_BuildValue("(sNN)", dn, py_attr, py_deref);
+	else
+	    py_entry = Py_BuildValue("(sN)", dn, py_attr);
+	ldap_memfree(dn);
+	if (!py_entry)
+	    goto failed;
+	if (PyList_Append(ret, py_entry) == -1) {
+	    Py_DECREF(py_entry);
+	    goto failed;
+	}
+	Py_DECREF(py_entry);
+	LDAPObject_prof_mark(self, *mark, build);
+    }
+    return ret;
+  failed:
+    Py_DECREF(ret);
+    return NULL;
+}
+
+/* converts the dereference response control of `entry', if any, into a
+   dictionary {derefAttr: [(dn, {attr: [value, ...], ...}), ...], ...}.
+   `*ret' is left NULL when the entry carries no such control */
+static int
+LDAPObject_deref2py(
+    LDAPObject *self, LDAPMessage *entry, const char *func, PyObject **ret,
+    size_t *bytes
+    )
+{
+    int ecode;
+    LDAPControl **ctrls = NULL, *ctrl;
+    LDAPDerefRes *drs = NULL, *dr;
+    LDAPDerefVal *dv;
+    PyObject *py_deref;
+
+    *ret = NULL;
+    ecode = ldap_get_entry_controls(self->ldp, entry, &ctrls);
+    if (ecode != LDAP_SUCCESS) {
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.%s(): ldap_get_entry_controls(): %s",
+	    LDAPObjName(self), func, ldap_err2string(ecode)
+	    );
+	return -1;
+    }
+    if (!ctrls)
+	return 0;
+    ctrl = ldap_control_find(LDAP_CONTROL_X_DEREF, ctrls, NULL);
+    if (!ctrl) {
+	ldap_controls_free(ctrls);
+	return 0;
+    }
+    ecode = ldap_parse_derefresponse_control(self->ldp, ctrl, &drs);
+    ldap_controls_free(ctrls);
+    if (ecode != LDAP_SUCCESS) {
+	(void) PyErr_Format(
+	    LibLDAPErr(self),
+	    "%s.%s(): ldap_parse_derefresponse_control(): %s",
+	    LDAPObjName(self), func, ldap_err2string(ecode)
+	    );
+	return -1;
+    }
+    py_deref = PyDict_New();
+    if (!py_deref)
+	goto failed;
+    for (dr = drs; dr; dr = dr->next) {
+	PyObject *py_refs, *py_attrs, *py_ref;
+
+	py_refs = PyDict_GetItemString(py_deref, dr->derefAttr);
+	if (!py_refs) {
+	    py_refs = PyList_New(0);
+	    if (!py_refs)
+		goto failed;
+	    if (PyDict_SetItemString(py_deref, dr->derefAttr, py_refs) == -1) {
+		Py_DECREF(py_refs);
+		goto failed;
+	    }
+	    Py_DECREF(py_refs);
+	}
+	py_attrs = PyDict_New();
+	if (!py_attrs)
+	    goto failed;
+	for (dv = dr->attrVals; dv; dv = dv->next) {
+	    BerValue *bv;
+	    PyObject *py_vals = PyList_New(0);
+
+	    if (!py_vals) {
+		Py_DECREF(py_attrs);
+		goto failed;
+	    }
+	    for (bv = dv->vals; bv && bv->bv_val; bv++) {
+		PyObject *py_val =
+		    PyUnicode_FromStringAndSize(bv->bv_val, bv->bv_len);
+
+		*bytes += bv->bv_len;
+		if (!py_val || PyList_Append(py_vals, py_val) == -1) {
+		    Py_XDECREF(py_val);
+		    Py_DECREF(py_vals);
+		    Py_DECREF(py_attrs);
+		    goto failed;
+		}
+		Py_DECREF(py_val);
+	    }
+	    if (PyDict_SetItemString(py_attrs, dv->type, py_vals) == -1) {
+		Py_DECREF(py_vals);
+		Py_DECREF(py_attrs);
+		goto failed;
+	    }
+	    Py_DECREF(py_vals);
+	}
+	*bytes += dr->derefVal.bv_len;
+	py_ref = Py_BuildValue(
+	    "(NN)", PyUnicode_FromStringAndSize(
+		dr->derefVal.bv_val, dr->derefVal.bv_len), py_attrs);
+	if (!py_ref)
+	    goto failed;
+	if (PyList_Append(py_refs, py_ref) == -1) {
+	    Py_DECREF(py_ref);
+	    goto failed;
+	}
+	Py_DECREF(py_ref);
+    }
+    ldap_derefresponse_free(drs);
+    *ret = py_deref;
+    return 0;
+  failed:
+    Py_XDECREF(py_deref);
+    ldap_derefresponse_free(drs);
+    return -1;
+}
+
+/* list of the URIs of a referral (RFC 4511 4.1.10) or of a continuation
+   reference (4.5.3), None if `uris' is NULL */
+static PyObject *
+LDAPObject_uris2py(char **uris)
+{
+    Py_ssize_t i, n = 0;
+    PyObject *ret;
+
+    if (!uris)
+	Py_RETURN_NONE;
+    for (; uris[n]; n++)
+	;
+    ret = PyList_New(n);
+    if (!ret)
+	return NULL;
+    for (i = 0; i < n; i++) {
+	PyObject *uri = PyUnicode_FromString(uris[i]);
+
+	if (!uri) {
+	    Py_DECREF(ret);
+	    return NULL;
+	}
+	PyList_SET_ITEM(ret, i, uri);
     }
-    if (self->lud->lud_dn) {
-	char *s = strrchr(uri, '/');
-	char u[s - uri + 1];
+    return ret;
+}
 
-	self->dn = PyUnicode_FromString(self->lud->lud_dn);
-	if (!self->dn)
-	    return -1;
-	(void) strncpy(u, uri, s - uri);
-	u[s - uri] = 0;
-	self->uri = PyUnicode_FromString(u);
+/* (references, referral) of the search result `res': the URI lists of
+   its continuation references and the URIs of the referral the server
+   answered with instead of a result, None if it did not */
+static PyObject *
+LDAPObject_refs2py(LDAPObject *self, LDAPMessage *res, const char *func)
+{
+    int ecode, errcode;
+    char **uris = NULL;
+    LDAPMessage *ptr;
+    PyObject *refs, *referral;
+
+    refs = PyList_New(0);
+    if (!refs)
+	return NULL;
+    for (ptr = ldap_first_reference(self->ldp, res); ptr;
+	 ptr = ldap_next_reference(self->ldp, ptr)) {
+	PyObject *ref;
+
+	ecode = ldap_parse_reference(self->ldp, ptr, &uris, NULL, 0);
+	if (ecode != LDAP_SUCCESS) {
+	    (void) PyErr_Format(
+		LibLDAPErr(self), "%s.%s(): ldap_parse_reference(): %s",
+		LDAPObjName(self), func, ldap_err2string(ecode)
+		);
+	    goto failed;
+	}
+	ref = LDAPObject_uris2py(uris);
+	ldap_memvfree((void **) uris);
+	if (!ref)
+	    goto failed;
+	if (PyList_Append(refs, ref) == -1) {
+	    Py_DECREF(ref);
+	    goto failed;
+	}
+	Py_DECREF(ref);
     }
-    else
-	self->uri = PyUnicode_FromString(uri);
-    if (!self->uri)
-	return -1;
-    ecode = ldap_initialize(
-	&self->ldp, (char *) PyUnicode_1BYTE_DATA(self->uri));
+    uris = NULL;
+    ecode = ldap_parse_result(
+	self->ldp, res, &errcode, NULL, NULL, &uris, NULL, 0);
     if (ecode != LDAP_SUCCESS) {
-    	(void) PyErr_Format(
-	    LibLDAPErr, "%s.__init__(): ldap_initialize() %s",
-	    LDAPObjName(self), ldap_err2string(ecode)
-	    );
-    	return -1;
-    }
-    ecode = ldap_set_option(self->ldp, LDAP_OPT_PROTOCOL_VERSION, &version);
-    if (ecode != LDAP_OPT_SUCCESS) {
 	(void) PyErr_Format(
-	    LibLDAPErr,
-	    "%s.__init__(): ldap_set_option() [LDAP_OPT_PROTOCOL_VERSION] "
-	    "failed", LDAPObjName(self)
+	    LibLDAPErr(self), "%s.%s(): ldap_parse_result(): %s",
+	    LDAPObjName(self), func, ldap_err2string(ecode)
 	    );
-	    return -1;
+	goto failed;
     }
-    return 0;
+    referral = LDAPObject_uris2py(errcode == LDAP_REFERRAL ? uris : NULL);
+    ldap_memvfree((void **) uris);
+    if (!referral)
+	goto failed;
+    return Py_BuildValue("(NN)", refs, referral);
+  failed:
+    Py_DECREF(refs);
+    return NULL;
+}
+
+/* commits the profile of a search to its connection */
+static void
+LDAPObject_prof_add(LDAPObject *self, LDAPProfile_t *prof, Py_ssize_t n)
+{
+    prof->count = 1;
+    prof->entries = (unsigned long) n;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    self->prof_last = *prof;
+    self->prof.count++;
+    self->prof.entries += prof->entries;
+    self->prof.network += prof->network;
+    self->prof.decode += prof->decode;
+    self->prof.build += prof->build;
+    Py_END_CRITICAL_SECTION();
 }
 
 static PyObject *
-LDAPObject_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+LDAPObject_prof2py(LDAPProfile_t *prof)
 {
-    LDAPObject *self;
+    return Py_BuildValue(
+	"{s:k,s:k,s:d,s:d,s:d}", "count", prof->count,
+	"entries", prof->entries, "network", prof->network,
+	"decode", prof->decode, "build", prof->build
+	);
+}
 
-    self = (LDAPObject *) type->tp_alloc(type, 0);
-    if (self) {
-	self->uri = NULL;
-	self->dn = NULL;
-	self->ldp = NULL;
-	self->lud = NULL;
-	self->addr = NULL;
-	self->addrlen = 0;
-    }
-    return (PyObject *) self;
+static int
+LDAPObject_result_code(LDAPObject *self)
+{
+    int ecode = LDAP_OTHER;
+
+    (void) ldap_get_option(self->ldp, LDAP_OPT_RESULT_CODE, (void *) &ecode);
+    return ecode;
 }
 
-/* TYPE */
+static void
+LDAPObject_op_release(PyObject *capsule)
+{
+    PyMem_RawFree(PyCapsule_GetPointer(capsule, NULL));
+}
 
-PyTypeObject LDAPTypeObject = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "_libldap.LDAP_",				/* tp_name */
-    sizeof(LDAPObject),				/* tp_basicsize */
-    0,						/* tp_itemsize */
-    (destructor) LDAPObject_dealloc,		/* tp_dealloc */
-    0,						/* tp_print */
-    0,						/* tp_getattr */
-    0,						/* tp_setattr */
-    0,						/* tp_compare */
-    0,						/* tp_repr */
-    0,						/* tp_as_number */
-    0,						/* tp_as_sequence */
-    0,						/* tp_as_mapping */
-    0,						/* tp_hash  */
-    0,						/* tp_call */
-    0,						/* tp_str */
-    0,						/* tp_getattro */
-    0,						/* tp_setattro */
-    0,						/* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,	/* tp_flags */
-    LDAPObjectDoc,				/* tp_doc */
-    0,						/* tp_traverse */
-    0,						/* tp_clear */
-    0,						/* tp_richcompare */
-    0,						/* tp_weaklistoffset */
-    0,						/* tp_iter */
-    0,						/* tp_iternext */
-    LDAPObjectMethods,				/* tp_methods */
-    LDAPObjectMembers,				/* tp_members */
-    LDAPObjectGetSet,				/* tp_getset */
-    0,						/* tp_base */
-    0,						/* tp_dict */
-    0,						/* tp_descr_get */
-    0,						/* tp_descr_set */
-    0,						/* tp_dictoffset */
-    (initproc) LDAPObject_init,			/* tp_init */
-    0,						/* tp_alloc */
-    (newfunc) LDAPObject_new,			/* tp_new */
-};
+/* Asynchronous operations emit START once their request is sent, with
+   its msgid, then FINISH when result() gets their answer. Meanwhile a
+   copy of the operation is kept in `pending' (msgid -> capsule), so that
+   its duration is the real latency. Tracing never makes an operation
+   fail: errors are ignored */
+static void
+LDAPObject_op_sent(LDAPObject *self, LibLDAPOp_t *op, int msgid, int ecode)
+{
+    PyObject *key, *capsule;
+    LibLDAPOp_t *copy;
 
-/*****************************************************************************
- * LOCAL FUNCTION DEFINITIONS
- *****************************************************************************/
+    if (!op->type || !LibLDAP_tracing_get())
+	return;
+    if (ecode != LDAP_SUCCESS) {
+	LibLDAP_trace_end(op, msgid, ecode, 0, 0);
+	return;
+    }
+    LibLDAP_trace_start(op, msgid);
+    copy = LibLDAP_op_copy(op);
+    if (!copy)
+	return;
+    capsule = PyCapsule_New((void *) copy, NULL, LDAPObject_op_release);
+    if (!capsule) {
+	PyMem_RawFree((void *) copy);
+	PyErr_Clear();
+	return;
+    }
+    key = PyLong_FromLong((long) msgid);
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (key && !self->pending)
+	self->pending = PyDict_New();
+    if (!key || !self->pending ||
+	PyDict_SetItem(self->pending, key, capsule) < 0)
+	PyErr_Clear();
+    Py_END_CRITICAL_SECTION();
+    Py_XDECREF(key);
+    Py_DECREF(capsule);
+}
 
-static const char *__ldap_url_err2string[] = {
-    "success",
-    "can't allocate memory space",
-    "parameter is bad",
-    "URL doesn't begin with \"ldap[si]://\"",
-    "URL is missing trailing \">\"",
-    "URL is bad",
-    "host port is bad",
-    "bad (or missing) attributes",
-    "scope string is invalid (or missing)",
-    "bad or missing filter",
-    "bad or missing extensions",
-#define LDAP_URL_ERR_UNKNOWN 0x0b
-    "unknown error"
-};
+/* FINISH of the asynchronous operation `msgid' if traced: `res' is its
+   answer (NULL if abandoned), `entries' and `bytes' what it returned */
+static void
+LDAPObject_op_done(
+    LDAPObject *self, int msgid, LDAPMessage *res, int entries, size_t bytes)
+{
+    PyObject *key, *capsule = NULL;
+    PyObject *etype, *evalue, *etb;
+    int errcode = LDAP_USER_CANCELLED;
 
-static const char *
-ldap_url_err2string(int ecode)
+    if (!self->pending || !PyDict_GET_SIZE(self->pending))
+	return;
+    /* the exception raised by result() is kept */
+    PyErr_Fetch(&etype, &evalue, &etb);
+    key = PyLong_FromLong((long) msgid);
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (key) {
+	capsule = PyDict_GetItemWithError(self->pending, key);
+	Py_XINCREF(capsule);
+	if (capsule)
+	    (void) PyDict_DelItem(self->pending, key);
+    }
+    Py_END_CRITICAL_SECTION();
+    PyErr_Clear();
+    Py_XDECREF(key);
+    if (capsule && LibLDAP_tracing_get()) {
+	if (res &&
+	    ldap_parse_result(
+		self->ldp, res, &errcode, NULL, NULL, NULL, NULL, 0)
+	    != LDAP_SUCCESS)
+	    errcode = LDAPObject_result_code(self);
+	LibLDAP_trace_end(
+	    (LibLDAPOp_t *) PyCapsule_GetPointer(capsule, NULL), msgid,
+	    errcode, entries, bytes);
+    }
+    Py_XDECREF(capsule);
+    PyErr_Restore(etype, evalue, etb);
+}
+
+static void
+LDAPObject_timeval(double seconds, struct timeval *tv)
 {
-    if (ecode < LDAP_URL_SUCCESS || ecode > LDAP_URL_ERR_BADEXTS)
-	return __ldap_url_err2string[LDAP_URL_ERR_UNKNOWN];
-    return __ldap_url_err2string[ecode];
+    tv->tv_sec = (long) seconds;
+    tv->tv_usec = (long) ((seconds - tv->tv_sec) * 1e6);
 }
 
-static const char *
-LDAPObject_complete_dn(const char *dni, PyObject *dnc)
+/* waits for the complete answer to the request `msgid', for at most
+   `timeout' seconds if positive, without holding the GIL. On expiry, the
+   request is abandoned so that the server stops working on it and
+   LDAP_TIMEOUT is returned, otherwise the result code of the operation.
+   The answer is stored in `*res' if not NULL, freed otherwise */
+static int
+LDAPObject_result_wait(
+    LDAPObject *self, int msgid, double timeout, LDAPMessage **res
+    )
 {
-    const char *sep = dnc ? "," : "", *dncp = dnc ? PyUnicode_DATA(dnc) : "";
-    size_t li = dni ? strlen(dni) : 0, lc = strlen(dncp);
+    int rc, ecode, errcode;
+    struct timeval tv, *to = NULL;
+    LDAPMessage *msg = NULL;
 
-    if (!dni) {
-	if (!dnc)
-	    return NULL;
-	sep = dni = "";
+    if (timeout > 0.0) {
+	LDAPObject_timeval(timeout, &tv);
+	to = &tv;
     }
-    if (strcasecmp(dni, LibLDAPSchemaBase)) {
-	if (dnc && li >= lc) {
-	    const char *s = dni + li - lc;
-	    
-	    if (!memcmp((const void *) s, (const void *) dncp, lc + 1))
-		sep = dncp = "";
-	}
+    if (!LDAPObject_enter(self, "result")) {
+	PyErr_Clear();
+	return LDAP_SERVER_DOWN;
     }
+    Py_BEGIN_ALLOW_THREADS
+    rc = ldap_result(self->ldp, msgid, LDAP_MSG_ALL, to, &msg);
+    Py_END_ALLOW_THREADS
+    if (!rc) {
+	(void) ldap_abandon_ext(self->ldp, msgid, NULL, NULL);
+	LDAPObject_leave(self);
+	return LDAP_TIMEOUT;
+    }
+    if (rc < 0) {
+	ecode = LDAPObject_result_code(self);
+	LDAPObject_leave(self);
+	return ecode;
+    }
+    ecode = ldap_parse_result(
+	self->ldp, msg, &errcode, NULL, NULL, NULL, NULL, 0);
+    LDAPObject_leave(self);
+    if (ecode == LDAP_SUCCESS)
+	ecode = errcode;
+    if (res)
+	*res = msg;
     else
-	sep = dncp = "";	
-    snprintf(
-	LDAPObject_complete_dn_buf, sizeof(LDAPObject_complete_dn_buf),
-	"%s%s%s", dni, sep, dncp
-	);
-    return LDAPObject_complete_dn_buf;
+	(void) ldap_msgfree(msg);
+    return ecode;
 }
 
-static LDAPMod **
-LDAPObject_mods_parse(LDAPObject *self, PyObject *py_mods, const char *func)
+/* converts the complete result `res' of an asynchronous operation: True or
+   False for a compare or a simple bind (invalid credentials), the list of
+   entries for a search, None otherwise. Raises LDAPError if the operation
+   failed. The size of the DNs and values of the entries is added to
+   `*bytes' */
+static PyObject *
+LDAPObject_msg2py(
+    LDAPObject *self, LDAPMessage *res, const char *func, size_t *bytes)
 {
-    Py_ssize_t i, len = PyList_GET_SIZE(py_mods);
-    LDAPMod **ptr, **ret;
+    int ecode, errcode;
+    char *errmsg = NULL;
+    LDAPObject_mark_t mark = {0.0};
+    PyObject *ret;
 
-    if (!len)
-	return (LDAPMod **) PyErr_Format(
-	    PyExc_TypeError, 
-	    "%s.%s(): argument `mods' must be a non empty list",
-	    LDAPObjName(self), func
+    switch (ldap_msgtype(res)) {
+    case LDAP_RES_COMPARE:
+    case LDAP_RES_BIND:
+	ecode = ldap_parse_result(
+	    self->ldp, res, &errcode, NULL, &errmsg, NULL, NULL, 0);
+	if (ldap_msgtype(res) == LDAP_RES_BIND)
+	    LDAPObject_bind_done(
+		self, ldap_msgid(res),
+		ecode == LDAP_SUCCESS && errcode == LDAP_SUCCESS);
+	if (ecode == LDAP_SUCCESS &&
+	    errcode == (ldap_msgtype(res) == LDAP_RES_BIND ?
+			LDAP_SUCCESS : LDAP_COMPARE_TRUE)) {
+	    ldap_memfree(errmsg);
+	    Py_RETURN_TRUE;
+	}
+	if (ecode == LDAP_SUCCESS &&
+	    errcode == (ldap_msgtype(res) == LDAP_RES_BIND ?
+			LDAP_INVALID_CREDENTIALS : LDAP_COMPARE_FALSE)) {
+	    ldap_memfree(errmsg);
+	    Py_RETURN_FALSE;
+	}
+	(void) PyErr_Format(
+	    LibLDAPErr(self),
+	    "%s.%s(): ldap_parse_result(): %s: error code %d: error msg: %s",
+	    LDAPObjName(self), func, ldap_err2string(ecode), errcode,
+	    errmsg ? errmsg : "<none>"
 	    );
-    ret = PyMem_New(LDAPMod *, len + 1);
-    if (!ret) {
-	PyErr_SetNone(PyExc_MemoryError);
+	ldap_memfree(errmsg);
 	return NULL;
-    }
-    (void) memset((void *) ret, 0, (len + 1) * sizeof(LDAPMod *));
-    for (i = 0, ptr = ret; i < len; i++, ptr++) {
-	PyObject *py_mod = PyList_GET_ITEM(py_mods, i);
-	int isi = PyObject_IsInstance(py_mod, (PyObject *) &LDAPModTypeObject);
-
-	if (isi == -1) {
-	    LibLDAP_value_free((void **) ret);
-	    return NULL;
-	}
-	if (!isi) {
-	    LibLDAP_value_free((void **) ret);
-	    return (LDAPMod **) PyErr_Format(
-		PyExc_TypeError,
-		"%s.%s(): argument `mods' must be a list of LDAPMod objects",
-		LDAPObjName(self), func
-		);
+    case LDAP_RES_EXTENDED:
+	/* only one thread gets the answer to start_tls() */
+	errcode = 0;
+	Py_BEGIN_CRITICAL_SECTION(self);
+	if (ldap_msgid(res) == self->tls_msgid) {
+	    self->tls_msgid = 0;
+	    errcode = 1;
 	}
-	if (!strcmp(func, "add_ext_s") &&
-	    ((LDAPModObject *) py_mod)->mod->mod_op != LDAP_MOD_ADD) {
-	    LibLDAP_value_free((void **) ret);
-	    return (LDAPMod **) PyErr_Format(
-		PyExc_ValueError,
-		"%s.%s(): attribute `mode' of each LDAPMod object must be "
-		"%d (LDAP_MOD_ADD)", LDAPObjName(self), func, LDAP_MOD_ADD
+	Py_END_CRITICAL_SECTION();
+	if (!errcode)
+	    break;
+	/* answer to start_tls(): the handshake follows */
+	ecode = ldap_parse_result(
+	    self->ldp, res, &errcode, NULL, &errmsg, NULL, NULL, 0);
+	if (ecode == LDAP_SUCCESS && errcode != LDAP_SUCCESS)
+	    ecode = errcode;
+	ldap_memfree(errmsg);
+	if (ecode == LDAP_SUCCESS)
+	    ecode = ldap_install_tls(self->ldp);
+	if (ecode != LDAP_SUCCESS) {
+	    (void) PyErr_Format(
+		LibLDAPErr(self), "%s.%s(): ldap_install_tls(): %s",
+		LDAPObjName(self), func, ldap_err2string(ecode)
 		);
-	}
-	*ptr = PyMem_New(LDAPMod, 1);
-	if (!*ptr) {
-	    LibLDAP_value_free((void **) ret);
-	    PyErr_SetNone(PyExc_MemoryError);
 	    return NULL;
 	}
-	(void) memcpy(
-	    (void *) *ptr, (const void *) ((LDAPModObject *) py_mod)->mod,
-	    sizeof(**ptr)
+	self->tls = 1;
+	Py_RETURN_NONE;
+    case LDAP_RES_SEARCH_ENTRY:
+    case LDAP_RES_SEARCH_REFERENCE:
+    case LDAP_RES_SEARCH_RESULT:
+	if (LDAPControls_Check((PyObject *) self, res, func) < 0)
+	    return NULL;
+	LDAPObject_prof_start(self, mark);
+	ret = LDAPObject_entries2py(self, res, func, 1, &mark, bytes);
+	if (!ret)
+	    return NULL;
+	LDAPObject_prof_mark(self, mark, decode);
+	LDAPObject_prof_commit(self, mark, PyList_GET_SIZE(ret));
+	return ret;
+    default:
+	break;
+    }
+    if (LDAPControls_Check((PyObject *) self, res, func) < 0)
+	return NULL;
+    Py_RETURN_NONE;
+}
+
+/* proxied authorization control (RFC 4370), its value is the authzId
+   itself, not BER encoded */
+static LDAPControl *
+LDAPObject_proxy_authz(
+    LDAPObject *self, const char *authzid, int iscritical, const char *func
+    )
+{
+    int ecode;
+    BerValue value;
+    LDAPControl *ctrl;
+
+    value.bv_val = (char *) authzid;
+    value.bv_len = strlen(authzid);
+    ecode = ldap_control_create(
+	LDAP_CONTROL_PROXY_AUTHZ, iscritical, &value, 1, &ctrl);
+    if (ecode != LDAP_SUCCESS) {
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "%s.%s(): ldap_control_create(): %s",
+	    LDAPObjName(self), func, ldap_err2string(ecode)
 	    );
+	return NULL;
     }
-    return ret;
+    return ctrl;
 }
 
+/* appends to the server controls `*sctrls' a critical proxied
+   authorization control for `as_user', a DN or an authzId ("dn:..." or
+   "u:..."). `*sctrls' is then a new array which must be released with
+   LDAPObject_as_user_free(). Nothing is done if `as_user' is NULL */
 static int
-LDAPObject_conn_valid(PyObject *pyo, const char *func)
+LDAPObject_as_user(
+    LDAPObject *self, const char *as_user, LDAPControl ***sctrls,
+    const char *func
+    )
+{
+    size_t n = 0;
+    char *authzid = NULL;
+    LDAPControl **ctrls, *ctrl;
+
+    if (!as_user)
+	return 0;
+    if (*as_user && strncmp(as_user, "dn:", 3) && strncmp(as_user, "u:", 2)) {
+	authzid = PyMem_New(char, strlen(as_user) + 4);
+	if (!authzid) {
+	    (void) PyErr_NoMemory();
+	    return -1;
+	}
+	(void) strcpy(authzid, "dn:");
+	(void) strcat(authzid, as_user);
+    }
+    ctrl = LDAPObject_proxy_authz(
+	self, authzid ? authzid : as_user, 1, func);
+    PyMem_Free(authzid);
+    if (!ctrl)
+	return -1;
+    if (*sctrls)
+	for (; (*sctrls)[n]; n++)
+	    ;
+    ctrls = PyMem_New(LDAPControl *, n + 2);
+    if (!ctrls) {
+	ldap_control_free(ctrl);
+	(void) PyErr_NoMemory();
+	return -1;
+    }
+    if (n)
+	(void) memcpy((void *) ctrls, (void *) *sctrls,
+		      n * sizeof(LDAPControl *));
+    ctrls[n] = ctrl;
+    ctrls[n + 1] = NULL;
+    *sctrls = ctrls;
+    return 0;
+}
+
+/* only the last control of `sctrls' belongs to it, the other ones are
+   borrowed from the caller's LDAPControls object */
+static void
+LDAPObject_as_user_free(const char *as_user, LDAPControl **sctrls)
+{
+    LDAPControl **ctrl;
+
+    if (!as_user)
+	return;
+    for (ctrl = sctrls; ctrl[1]; ctrl++)
+	;
+    ldap_control_free(*ctrl);
+    PyMem_Free(sctrls);
+}
+
+/* search requesting no attribute: entries are received and freed one at a
+   time, so that neither the whole result chain nor a Python object per
+   entry is ever built. The DN of each entry is appended to `dns' unless
+   NULL. Returns the number of entries or -1 on error */
+static Py_ssize_t
+LDAPObject_search_noattrs(
+    LDAPObject *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames, const char *func,
+    PyObject *dns
+    )
 {
-    if (!((LDAPObject *) pyo)->ldp) {
+    char dnbuf[LDAPObject_DN_MAX];
+    char *base = NULL, *filter = NULL, *as_user = NULL;
+    int ecode, msgid, rc, limit = LDAP_NO_LIMIT, scope = LDAP_SCOPE_SUBTREE;
+    struct timeval tv = {0L, 0L}, *to = NULL;
+    LDAPControlsObject *serverctrls = NULL, *clientctrls = NULL;
+    LDAPMessage *res;
+    LDAPControl **sctrls, **cctrls;
+    double deadline = 0.0, timeout = 0.0;
+    LDAPObject_mark_t mark = {0.0};
+    size_t bytes = 0;
+    Py_ssize_t count = 0;
+    LibLDAPOp_t op = {.type = 0};
+    static char *kwlist[] = {
+	"base", "scope", "filter", "serverctrls", "clientctrls", "limit",
+	"timeout", "as_user", NULL
+    };
+
+    if (!LibLDAP_parse_args(
+	    func, args, nargs, kwnames, "|sisO!O!idz", kwlist, &base, &scope,
+	    &filter, self->st->controls_type, &serverctrls,
+	    self->st->controls_type, &clientctrls, &limit, &timeout, &as_user))
+	return -1;
+    base = (char *) LDAPObject_complete_dn(self, base, dnbuf, func);
+    if (!base) {
+	if (!PyErr_Occurred())
+	    (void) PyErr_Format(
+		PyExc_TypeError, "%s.%s(): argument `base' is not setted",
+		LDAPObjName(self), func
+		);
+	return -1;
+    }
+    sctrls = serverctrls ? serverctrls->ctrls : NULL;
+    cctrls = clientctrls ? clientctrls->ctrls : NULL;
+    if (LDAPObject_as_user(self, as_user, &sctrls, func) < 0)
+	return -1;
+    if (timeout > 0.0) {
+	LDAPObject_timeval(timeout, &tv);
+	to = &tv;
+	deadline = LibLDAP_monotonic() + timeout;
+    }
+    LDAPObject_prof_start(self, mark);
+    op.attrs = LDAPObject_noattrs;
+    op.ctrls = sctrls;
+    LibLDAP_op_begin(&op, self->serial, LDAP_REQ_SEARCH, base, scope, filter);
+    ecode = ldap_search_ext(
+	self->ldp, base, scope, filter, LDAPObject_noattrs, 1, sctrls, cctrls,
+	to, limit, &msgid);
+    if (ecode != LDAP_SUCCESS) {
+	LibLDAP_op_end(&op, -1, ecode, 0, 0);
+	LDAPObject_as_user_free(as_user, sctrls);
 	(void) PyErr_Format(
-	    LibLDAPErr, "%s.%s(): invalid LDAP connection", LDAPObjName(pyo),
-	    func
+	    LibLDAPErr(self), "%s.%s(): ldap_search_ext(): %s",
+	    LDAPObjName(self), func, ldap_err2string(ecode)
 	    );
-	return 0;
+	return -1;
     }
-    return 1;
+    if (!LDAPObject_enter(self, func)) {
+	LibLDAP_op_end(&op, msgid, LDAP_SERVER_DOWN, 0, 0);
+	LDAPObject_as_user_free(as_user, sctrls);
+	return -1;
+    }
+    for (;;) {
+	/* the timeout bounds the whole search, as for search_ext_s() */
+	if (to) {
+	    double left = deadline - LibLDAP_monotonic();
+
+	    LDAPObject_timeval(left < 0.0 ? 0.0 : left, &tv);
+	}
+	Py_BEGIN_ALLOW_THREADS
+	rc = ldap_result(self->ldp, msgid, LDAP_MSG_ONE, to, &res);
+	Py_END_ALLOW_THREADS
+	LDAPObject_prof_mark(self, mark, network);
+	if (rc <= 0) {
+	    ecode = rc ? LDAPObject_result_code(self) : LDAP_TIMEOUT;
+	    if (!rc)
+		(void) ldap_abandon_ext(self->ldp, msgid, NULL, NULL);
+	    LibLDAP_op_end(&op, msgid, ecode, count, bytes);
+	    LDAPObject_leave(self);
+	    LDAPObject_as_user_free(as_user, sctrls);
+	    (void) PyErr_Format(
+		LibLDAPErr(self), "%s.%s(): ldap_result(): %s",
+		LDAPObjName(self), func, ldap_err2string(ecode)
+		);
+	    return -1;
+	}
+	if (rc == LDAP_RES_SEARCH_RESULT)
+	    break;
+	if (rc == LDAP_RES_SEARCH_ENTRY) {
+	    count++;
+	    if (dns) {
+		char *dn = ldap_get_dn(self->ldp, res);
+		PyObject *py_dn;
+		size_t l;
+
+		if (!dn) {
+		    ecode = LDAPObject_result_code(self);
+		    (void) ldap_msgfree(res);
+		    (void) ldap_abandon_ext(self->ldp, msgid, NULL, NULL);
+		    LibLDAP_op_end(&op, msgid, ecode, count, bytes);
+		    LDAPObject_leave(self);
+		    LDAPObject_as_user_free(as_user, sctrls);
+		    (void) PyErr_Format(
+			LibLDAPErr(self), "%s.%s(): ldap_get_dn(): %s",
+			LDAPObjName(self), func, ldap_err2string(ecode)
+			);
+		    return -1;
+		}
+		LDAPObject_prof_mark(self, mark, decode);
+		l = strlen(dn);
+		bytes += l;
+		py_dn = PyUnicode_FromStringAndSize(dn, l);
+		ldap_memfree(dn);
+		if (!py_dn || PyList_Append(dns, py_dn) == -1) {
+		    Py_XDECREF(py_dn);
+		    (void) ldap_msgfree(res);
+		    (void) ldap_abandon_ext(self->ldp, msgid, NULL, NULL);
+		    LibLDAP_op_end(&op, msgid, LDAP_LOCAL_ERROR, count, bytes);
+		    LDAPObject_leave(self);
+		    LDAPObject_as_user_free(as_user, sctrls);
+		    return -1;
+		}
+		Py_DECREF(py_dn);
+		LDAPObject_prof_mark(self, mark, build);
+	    }
+	}
+	/* references are not chased */
+	(void) ldap_msgfree(res);
+    }
+    if (LDAPControls_Check((PyObject *) self, res, func) < 0) {
+	(void) ldap_msgfree(res);
+	LibLDAP_op_end(&op, msgid, LDAPObject_result_code(self), count, bytes);
+	LDAPObject_leave(self);
+	LDAPObject_as_user_free(as_user, sctrls);
+	return -1;
+    }
+    (void) ldap_msgfree(res);
+    LDAPObject_prof_mark(self, mark, decode);
+    LDAPObject_prof_commit(self, mark, count);
+    LibLDAP_op_end(&op, msgid, LDAP_SUCCESS, count, bytes);
+    LDAPObject_leave(self);
+    LDAPObject_as_user_free(as_user, sctrls);
+    return count;
 }
 
 #ifdef __HAVE_SASL__
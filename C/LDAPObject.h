@@ -14,18 +14,49 @@
 
 /* OBJECT */
 
+typedef struct {
+    unsigned long    count;
+    unsigned long    entries;
+    double           network;
+    double           decode;
+    double           build;
+} LDAPProfile_t;
+
 typedef struct {
     PyObject_HEAD
+    LibLDAPState_t  *st;		/* module state, for the types */
     PyObject        *uri;
     PyObject        *dn;
     LDAP            *ldp;
     LDAPURLDesc     *lud;
     struct sockaddr *addr;
     socklen_t        addrlen;
+    int              resolved;		/* addr looked up, see `ip' */
+    int              tls_msgid;		/* pending StartTLS request */
+    int              bind_msgid;	/* pending simple_bind() */
+    unsigned long    serial;		/* connection number, for tracing */
+    unsigned long    handle;		/* number of `ldp', see below */
+    unsigned long    forkgen;		/* process of the connection */
+    int              version;
+    int              he;		/* happy eyeballs */
+    int              tls;		/* StartTLS done */
+    PyObject        *options;		/* options set: option -> value */
+    PyObject        *bind;		/* last bind: (mech, user, password) */
+    PyObject        *bindreq;		/* bind of `bind_msgid', same form */
+    PyObject        *pending;		/* traced async operations, or NULL */
+    int              busy;		/* threads using `ldp' without the GIL */
+    int              profile;
+    LDAPProfile_t    prof;
+    LDAPProfile_t    prof_last;
 } LDAPObject;
 
-extern PyTypeObject LDAPTypeObject;
+extern PyType_Spec LDAPTypeSpec;
+/* incremented whenever the handle of a connection is opened or freed,
+   its `handle' number then changes: a completion queue knows the
+   descriptors it watches may be stale */
+extern unsigned long LDAPObject_handles;
+extern volatile unsigned long LDAPObject_forkgen;
 
-#define LDAPObject_Check(o) ((o)->ob_type == &LDAPTypeObject)
+#define LDAPObject_Check(st, o) PyObject_TypeCheck((o), (st)->ldap_type)
 
 #endif /* LDAPOBJECT_H */
@@ -6,17 +6,13 @@
 #include <ldap_schema.h>
 #include <LDAPSchema.h>
 
-#ifdef __LIBLDAP_DARWIN__
-extern PyObject *LibLDAPErr;
-#endif
-
 /*****************************************************************************
  * LOCAL FUNCTION DECLARATIONS
  *****************************************************************************/
 
 static PyObject *LibLDAP_C2Py_strs(char **);
 static PyObject *LibLDAP_C2Py_lseis(LDAPSchemaExtensionItem **);
-static int LibLDAP_check_flags(int, const char *);
+static int LibLDAP_check_flags(PyObject *, int, const char *);
 
 /*****************************************************************************
  * MODULE METHODS (SCHEMA)
@@ -34,12 +30,12 @@ LibLDAP_ldap_str2syntax(PyObject *self, PyObject *args)
 
     if (!PyArg_ParseTuple(args, "s|i", &str, &flags))
 	return NULL;
-    if (LibLDAP_check_flags(flags, "ldap_str2syntax") < 0)
+    if (LibLDAP_check_flags(self, flags, "ldap_str2syntax") < 0)
 	return NULL;
     syn = ldap_str2syntax(str, &code, &errp, flags);
     if (!syn)
 	return PyErr_Format(
-	    LibLDAPErr, "ldap_str2syntax(): `%s': %s", errp,
+	    LibLDAPErr(self), "ldap_str2syntax(): `%s': %s", errp,
 	    ldap_scherr2str(code));
     ret = PyDict_New();
     if (!ret) {
@@ -97,12 +93,12 @@ LibLDAP_ldap_str2matchingrule(PyObject *self, PyObject *args)
 
     if (!PyArg_ParseTuple(args, "s|i", &str, &flags))
 	return NULL;
-    if (LibLDAP_check_flags(flags, "ldap_str2matchingrule") < 0)
+    if (LibLDAP_check_flags(self, flags, "ldap_str2matchingrule") < 0)
 	return NULL;
     mr = ldap_str2matchingrule(str, &code, &errp, flags);
     if (!mr)
 	return PyErr_Format(
-	    LibLDAPErr, "ldap_str2matchingrule(): `%s': %s", errp,
+	    LibLDAPErr(self), "ldap_str2matchingrule(): `%s': %s", errp,
 	    ldap_scherr2str(code));
     ret = PyDict_New();
     if (!ret) {
@@ -173,12 +169,12 @@ LibLDAP_ldap_str2matchingruleuse(PyObject *self, PyObject *args)
 
     if (!PyArg_ParseTuple(args, "s|i", &str, &flags))
 	return NULL;
-    if (LibLDAP_check_flags(flags, "ldap_str2matchingruleuse") < 0)
+    if (LibLDAP_check_flags(self, flags, "ldap_str2matchingruleuse") < 0)
 	return NULL;
     mru = ldap_str2matchingruleuse(str, &code, &errp, flags);
     if (!mru)
 	return PyErr_Format(
-	    LibLDAPErr, "ldap_str2matchingruleuse(): `%s': %s", errp,
+	    LibLDAPErr(self), "ldap_str2matchingruleuse(): `%s': %s", errp,
 	    ldap_scherr2str(code));
     ret = PyDict_New();
     if (!ret) {
@@ -246,12 +242,12 @@ LibLDAP_ldap_str2attributetype(PyObject *self, PyObject *args)
 
     if (!PyArg_ParseTuple(args, "s|i", &str, &flags))
 	return NULL;
-    if (LibLDAP_check_flags(flags, "ldap_str2attributetype") < 0)
+    if (LibLDAP_check_flags(self, flags, "ldap_str2attributetype") < 0)
 	return NULL;
     at = ldap_str2attributetype(str, &code, &errp, flags);
     if (!at)
 	return PyErr_Format(
-	    LibLDAPErr, "ldap_str2attributetype(): `%s': %s", errp,
+	    LibLDAPErr(self), "ldap_str2attributetype(): `%s': %s", errp,
 	    ldap_scherr2str(code));
     ret = PyDict_New();
     if (!ret) {
@@ -378,12 +374,12 @@ LibLDAP_ldap_str2objectclass(PyObject *self, PyObject *args)
 
     if (!PyArg_ParseTuple(args, "s|i", &str, &flags))
 	return NULL;
-    if (LibLDAP_check_flags(flags, "ldap_str2objectclass") < 0)
+    if (LibLDAP_check_flags(self, flags, "ldap_str2objectclass") < 0)
 	return NULL;
     oc = ldap_str2objectclass(str, &code, &errp, flags);
     if (!oc)
 	return PyErr_Format(
-	    LibLDAPErr, "ldap_str2objectclass(): `%s': %s", errp,
+	    LibLDAPErr(self), "ldap_str2objectclass(): `%s': %s", errp,
 	    ldap_scherr2str(code));
     ret = PyDict_New();
     if (!ret) {
@@ -481,18 +477,8 @@ static PyMethodDef LibLDAPSchemaMethods[] = {
 int
 LibLDAP_add_schema_methods(PyObject *m)
 {
-    PyMethodDef *ml;
-
-    for (ml = LibLDAPSchemaMethods; ml->ml_name; ml++) {
-	PyObject *func = PyCFunction_New(ml, NULL);
-
-	if (!func)
-	    return -1;
-	if (PyModule_AddObject(m, ml->ml_name, func) == -1) {
-	    Py_DECREF(func);
-	    return -1;
-	}
-    }	
+    if (PyModule_AddFunctions(m, LibLDAPSchemaMethods) < 0)
+	return -1;
     return 0;
 }
 
@@ -565,10 +551,11 @@ LibLDAP_C2Py_lseis(LDAPSchemaExtensionItem **lseis)
 }
 
 static int
-LibLDAP_check_flags(int flags, const char *func)
+LibLDAP_check_flags(PyObject *self, int flags, const char *func)
 {
     if (flags >= LDAP_SCHEMA_ALLOW_NONE && flags <= LDAP_SCHEMA_ALLOW_ALL)
 	return 0;
-    (void) PyErr_Format(LibLDAPErr,"%s(): `%d': invalid flags", func, flags);
+    (void) PyErr_Format(
+	LibLDAPErr(self), "%s(): `%d': invalid flags", func, flags);
     return -1;
 }
@@ -0,0 +1,332 @@
+/*****************************************************************************
+ * INCLUDED FILES & MACRO DEFINITIONS
+ *****************************************************************************/
+
+#include <libldap.h>
+#include <LDAPTLS.h>
+
+
+#ifdef __HAVE_OPENSSL__
+#include <openssl/ssl.h>
+#include <pthread.h>
+
+/* TLS sessions are cached per SSL context and server, i.e. per
+   "context:host:port": a session resumed skips the verification of the
+   certificates and carries the client certificate of the handshake that
+   made it, both set by the context */
+#define LIBLDAP_TLS_CACHE_SIZE	64
+#define LIBLDAP_TLS_KEYLEN	320
+
+typedef struct {
+    char          key[LIBLDAP_TLS_KEYLEN];
+    SSL_SESSION  *session;
+    unsigned long used;			/* LRU stamp, 0 if free */
+} LibLDAPTLSSession_t;
+
+typedef struct {
+    int                 enabled;
+    int                 openssl;	/* libldap uses OpenSSL, -1 unknown */
+    int                 index;		/* SSL ex_data index: LDAPURLDesc */
+    int                 ctx_index;	/* SSL_CTX ex_data index: serial */
+    unsigned long       ctx_serial;
+    pthread_mutex_t     lock;
+    unsigned long       clock;
+    unsigned long       handshakes;
+    unsigned long       resumed;
+    unsigned long       received;	/* sessions sent by servers */
+    LibLDAPTLSSession_t sessions[LIBLDAP_TLS_CACHE_SIZE];
+} LibLDAPTLSCache_t;
+
+/*****************************************************************************
+ * LOCAL VARIABLES
+ *****************************************************************************/
+
+static LibLDAPTLSCache_t LibLDAP_tls = {
+    .openssl = -1, .index = -1, .ctx_index = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+/*****************************************************************************
+ * LOCAL FUNCTION DECLARATIONS
+ *****************************************************************************/
+
+static int LibLDAP_tls_package(void);
+static void LibLDAP_tls_key(SSL_CTX *, const LDAPURLDesc *, char *);
+static LibLDAPTLSSession_t *LibLDAP_tls_lookup(const char *, int);
+static void LibLDAP_tls_flush(void);
+static int LibLDAP_tls_connect_cb(LDAP *, void *, void *, void *);
+static int LibLDAP_tls_new_session_cb(SSL *, SSL_SESSION *);
+static void LibLDAP_tls_info_cb(const SSL *, int, int);
+
+/*****************************************************************************
+ * MODULE METHODS (TLS)
+ *****************************************************************************/
+
+PyDoc_STRVAR(LibLDAP_tls_resumptionDoc, "");
+
+static PyObject *
+LibLDAP_tls_resumption(PyObject *self, PyObject *args)
+{
+    PyObject *py_enable;
+
+    if (!PyArg_ParseTuple(args, "O!", &PyBool_Type, &py_enable))
+	return NULL;
+    /* process-wide: any thread of any interpreter may get here first */
+    (void) pthread_mutex_lock(&LibLDAP_tls.lock);
+    if (LibLDAP_tls.openssl < 0)
+	LibLDAP_tls.openssl = LibLDAP_tls_package();
+    if (LibLDAP_tls.openssl && LibLDAP_tls.index < 0)
+	LibLDAP_tls.index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    if (LibLDAP_tls.openssl && LibLDAP_tls.ctx_index < 0)
+	LibLDAP_tls.ctx_index = SSL_CTX_get_ex_new_index(
+	    0, NULL, NULL, NULL, NULL);
+    if (LibLDAP_tls.index >= 0 && LibLDAP_tls.ctx_index >= 0)
+	LibLDAP_tls.enabled = py_enable == Py_True;
+    (void) pthread_mutex_unlock(&LibLDAP_tls.lock);
+    if (py_enable == Py_True && !LibLDAP_tls.openssl)
+	return PyErr_Format(
+	    LibLDAPErr(self), "tls_resumption(): libldap is not built with "
+	    "OpenSSL"
+	    );
+    if (LibLDAP_tls.openssl &&
+	(LibLDAP_tls.index < 0 || LibLDAP_tls.ctx_index < 0))
+	return PyErr_Format(
+	    LibLDAPErr(self), "tls_resumption(): SSL_get_ex_new_index() failed"
+	    );
+    if (py_enable != Py_True)
+	LibLDAP_tls_flush();
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(LibLDAP_get_tls_statsDoc, "");
+
+static PyObject *
+LibLDAP_get_tls_stats(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    int i;
+    unsigned long handshakes, resumed, received, cached = 0;
+    PyObject *py_reset = Py_False;
+    static char *kwlist[] = {"reset", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(
+	    args, kwds, "|O!", kwlist, &PyBool_Type, &py_reset))
+	return NULL;
+    (void) pthread_mutex_lock(&LibLDAP_tls.lock);
+    handshakes = LibLDAP_tls.handshakes;
+    resumed = LibLDAP_tls.resumed;
+    received = LibLDAP_tls.received;
+    for (i = 0; i < LIBLDAP_TLS_CACHE_SIZE; i++)
+	if (LibLDAP_tls.sessions[i].used)
+	    cached++;
+    if (py_reset == Py_True)
+	LibLDAP_tls.handshakes = LibLDAP_tls.resumed = LibLDAP_tls.received = 0;
+    (void) pthread_mutex_unlock(&LibLDAP_tls.lock);
+    return Py_BuildValue(
+	"{s:O,s:k,s:k,s:d,s:k,s:k}",
+	"enabled", LibLDAP_tls.enabled ? Py_True : Py_False,
+	"handshakes", handshakes, "resumed", resumed,
+	"rate", handshakes ? (double) resumed / handshakes : 0.0,
+	"received", received, "cached", cached
+	);
+}
+
+static PyMethodDef LibLDAPTLSMethods[] = {
+    {"tls_resumption", (PyCFunction) LibLDAP_tls_resumption,
+     METH_VARARGS, LibLDAP_tls_resumptionDoc
+    },
+    {"get_tls_stats", (PyCFunction) LibLDAP_get_tls_stats,
+     METH_VARARGS | METH_KEYWORDS, LibLDAP_get_tls_statsDoc
+    },
+    {NULL, NULL, 0, NULL}
+};
+#endif /* __HAVE_OPENSSL__ */
+
+/*****************************************************************************
+ * GLOBAL FUNCTION DEFINITIONS
+ *****************************************************************************/
+
+/* called for each new connection: when resumption is enabled, the TLS
+   handshakes of `ldp' are hooked so as to offer the last session received
+   from the same server. `lud' must outlive `ldp' */
+int
+LibLDAP_tls_setup(LDAP *ldp, LDAPURLDesc *lud)
+{
+#ifdef __HAVE_OPENSSL__
+    if (!LibLDAP_tls.enabled || !strcasecmp(lud->lud_scheme, "ldapi"))
+	return 0;
+    /* never enabled otherwise, checked again before casting to SSL */
+    if (LibLDAP_tls.openssl != 1)
+	return -1;
+    if (ldap_set_option(
+	    ldp, LDAP_OPT_X_TLS_CONNECT_CB, (const void *) LibLDAP_tls_connect_cb)
+	!= LDAP_OPT_SUCCESS)
+	return -1;
+    if (ldap_set_option(ldp, LDAP_OPT_X_TLS_CONNECT_ARG, (const void *) lud)
+	!= LDAP_OPT_SUCCESS)
+	return -1;
+#endif /* __HAVE_OPENSSL__ */
+    return 0;
+}
+
+int
+LibLDAP_add_tls_methods(PyObject *m)
+{
+#ifdef __HAVE_OPENSSL__
+    if (PyModule_AddFunctions(m, LibLDAPTLSMethods) < 0)
+	return -1;
+#endif /* __HAVE_OPENSSL__ */
+    return 0;
+}
+
+#ifdef __HAVE_OPENSSL__
+/*****************************************************************************
+ * LOCAL FUNCTION DEFINITIONS
+ *****************************************************************************/
+
+/* the TLS library of libldap: libssl may be installed beside a libldap
+   built with GnuTLS, whose objects must not be given to OpenSSL */
+static int
+LibLDAP_tls_package(void)
+{
+    char *package = NULL;
+    int ret;
+
+    if (ldap_get_option(NULL, LDAP_OPT_X_TLS_PACKAGE, (void *) &package)
+	!= LDAP_OPT_SUCCESS)
+	return 0;
+    ret = package && !strcmp(package, "OpenSSL");
+    ldap_memfree(package);
+    return ret;
+}
+
+/* contexts are told apart by a serial number of their own rather than by
+   their address, which a new context may get once the old one is freed.
+   Must be called with the lock held */
+static void
+LibLDAP_tls_key(SSL_CTX *ctx, const LDAPURLDesc *lud, char *key)
+{
+    unsigned long serial;
+
+    serial = (unsigned long) SSL_CTX_get_ex_data(ctx, LibLDAP_tls.ctx_index);
+    if (!serial) {
+	serial = ++LibLDAP_tls.ctx_serial;
+	(void) SSL_CTX_set_ex_data(
+	    ctx, LibLDAP_tls.ctx_index, (void *) serial);
+    }
+    (void) snprintf(
+	key, LIBLDAP_TLS_KEYLEN, "%lu:%s:%d", serial,
+	lud->lud_host ? lud->lud_host : "", lud->lud_port);
+}
+
+/* must be called with the lock held. With `create', a free or the least
+   recently used entry is returned if `key' is not found */
+static LibLDAPTLSSession_t *
+LibLDAP_tls_lookup(const char *key, int create)
+{
+    int i;
+    LibLDAPTLSSession_t *entry, *victim = LibLDAP_tls.sessions;
+
+    for (i = 0; i < LIBLDAP_TLS_CACHE_SIZE; i++) {
+	entry = LibLDAP_tls.sessions + i;
+	if (entry->used && !strcmp(entry->key, key))
+	    return entry;
+	if (entry->used < victim->used)
+	    victim = entry;
+    }
+    if (!create)
+	return NULL;
+    if (victim->session)
+	SSL_SESSION_free(victim->session);
+    victim->session = NULL;
+    (void) strcpy(victim->key, key);
+    return victim;
+}
+
+static void
+LibLDAP_tls_flush(void)
+{
+    int i;
+
+    (void) pthread_mutex_lock(&LibLDAP_tls.lock);
+    for (i = 0; i < LIBLDAP_TLS_CACHE_SIZE; i++) {
+	LibLDAPTLSSession_t *entry = LibLDAP_tls.sessions + i;
+
+	if (entry->session)
+	    SSL_SESSION_free(entry->session);
+	entry->session = NULL;
+	entry->used = 0;
+    }
+    (void) pthread_mutex_unlock(&LibLDAP_tls.lock);
+}
+
+/* called by libldap before each TLS handshake (StartTLS or ldaps://) */
+static int
+LibLDAP_tls_connect_cb(LDAP *ldp, void *ssl, void *ctx, void *arg)
+{
+    char key[LIBLDAP_TLS_KEYLEN];
+    SSL_SESSION *session = NULL;
+    LibLDAPTLSSession_t *entry;
+
+    if (!LibLDAP_tls.enabled || LibLDAP_tls.openssl != 1)
+	return 0;
+    /* libldap gives no access to the end of the handshake: sessions are
+       collected by the context (with TLS 1.3 they arrive after it) */
+    SSL_CTX_set_session_cache_mode(
+	(SSL_CTX *) ctx,
+	SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb((SSL_CTX *) ctx, LibLDAP_tls_new_session_cb);
+    (void) SSL_set_ex_data((SSL *) ssl, LibLDAP_tls.index, arg);
+    SSL_set_info_callback((SSL *) ssl, LibLDAP_tls_info_cb);
+    (void) pthread_mutex_lock(&LibLDAP_tls.lock);
+    LibLDAP_tls_key((SSL_CTX *) ctx, (LDAPURLDesc *) arg, key);
+    entry = LibLDAP_tls_lookup(key, 0);
+    if (entry && entry->session) {
+	session = entry->session;
+	(void) SSL_SESSION_up_ref(session);
+	entry->used = ++LibLDAP_tls.clock;
+    }
+    (void) pthread_mutex_unlock(&LibLDAP_tls.lock);
+    if (session) {
+	(void) SSL_set_session((SSL *) ssl, session);
+	SSL_SESSION_free(session);
+    }
+    return 0;
+}
+
+static int
+LibLDAP_tls_new_session_cb(SSL *ssl, SSL_SESSION *session)
+{
+    char key[LIBLDAP_TLS_KEYLEN];
+    LDAPURLDesc *lud = SSL_get_ex_data(ssl, LibLDAP_tls.index);
+    LibLDAPTLSSession_t *entry;
+
+    /* connections of the shared context not set up by us */
+    if (!lud || !LibLDAP_tls.enabled || !SSL_SESSION_is_resumable(session))
+	return 0;
+    (void) pthread_mutex_lock(&LibLDAP_tls.lock);
+    LibLDAP_tls_key(SSL_get_SSL_CTX(ssl), lud, key);
+    entry = LibLDAP_tls_lookup(key, 1);
+    if (entry->session)
+	SSL_SESSION_free(entry->session);
+    entry->session = session;
+    entry->used = ++LibLDAP_tls.clock;
+    LibLDAP_tls.received++;
+    (void) pthread_mutex_unlock(&LibLDAP_tls.lock);
+    /* the reference to `session' is kept */
+    return 1;
+}
+
+static void
+LibLDAP_tls_info_cb(const SSL *ssl, int where, int ret)
+{
+    if (!(where & SSL_CB_HANDSHAKE_DONE))
+	return;
+    (void) pthread_mutex_lock(&LibLDAP_tls.lock);
+    LibLDAP_tls.handshakes++;
+    if (SSL_session_reused((SSL *) ssl))
+	LibLDAP_tls.resumed++;
+    (void) pthread_mutex_unlock(&LibLDAP_tls.lock);
+    /* counted once: TLS 1.3 post-handshake messages may signal it again */
+    SSL_set_info_callback((SSL *) ssl, NULL);
+}
+#endif /* __HAVE_OPENSSL__ */
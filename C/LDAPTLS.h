@@ -0,0 +1,11 @@
+#ifndef LDAPTLS_H
+#define LDAPTLS_H
+
+/*****************************************************************************
+ * GLOBAL FUNCTION DECLARATIONS
+ *****************************************************************************/
+
+extern int LibLDAP_tls_setup(LDAP *, LDAPURLDesc *);
+extern int LibLDAP_add_tls_methods(PyObject *);
+
+#endif /* LDAPTLS_H */
@@ -0,0 +1,1103 @@
+/*****************************************************************************
+ * INCLUDED FILES & MACRO DEFINITIONS
+ *****************************************************************************/
+
+#include <libldap.h>
+#include <LDAPTrace.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+
+#define LibLDAPTraceCAPI "_libldap.trace_capi"
+
+/* capture file: magic, then records (see libldap.rst) */
+#define LIBLDAP_CAPTURE_MAGIC	"LDAPCAP1"
+#define LIBLDAP_CAPTURE_NULL	0xffffffffUL
+
+typedef struct {
+    int           type;
+    unsigned long conn;
+    int           scope;
+    int           result;
+    Py_ssize_t    entries;
+    double        start;
+    double        duration;
+    char          dn[LIBLDAP_SLOWLOG_STRLEN];
+    char          filter[LIBLDAP_SLOWLOG_STRLEN];
+    char          attrs[LIBLDAP_SLOWLOG_STRLEN];
+    char          ctrls[LIBLDAP_SLOWLOG_STRLEN];
+} LibLDAPSlowRec_t;
+
+typedef struct {
+    double            threshold;	/* in seconds */
+    uint32_t          rate;		/* sampling rate scaled to 2^32 - 1 */
+    uint32_t          seed;		/* xorshift32 state */
+    PyObject         *callback;
+    PyInterpreterState *interp;		/* owner of `callback' */
+    LibLDAPSlowRec_t *recs;		/* ring buffer */
+    size_t            size;
+    size_t            head;		/* next record to drain */
+    size_t            count;
+    unsigned long     dropped;		/* records overwritten */
+} LibLDAPSlowLog_t;
+
+typedef struct {
+    FILE          *fp;
+    char          *path;
+    double         start;		/* monotonic clock */
+    unsigned long  records;
+    unsigned long  bytes;
+    int            error;		/* errno of the first failure */
+    unsigned char *buf;			/* record being encoded */
+    size_t         len;
+    size_t         size;
+} LibLDAPCapture_t;
+
+/*****************************************************************************
+ * GLOBAL VARIABLES
+ *****************************************************************************/
+
+int LibLDAP_tracing = 0;
+
+/*****************************************************************************
+ * LOCAL VARIABLES
+ *****************************************************************************/
+
+/* The trace consumers are process-wide, shared by the threads and the
+   interpreters loading the module: their state is only changed and read
+   with LibLDAP_trace_lock held, Python code is never called with it.
+   Python callbacks are only called in the interpreter which set them */
+static pthread_mutex_t LibLDAP_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static LibLDAPTraceFunc LibLDAP_trace_func = NULL;
+static void *LibLDAP_trace_arg = NULL;
+static PyObject *LibLDAP_trace_hook = NULL;
+static PyInterpreterState *LibLDAP_trace_interp = NULL;
+static LibLDAPSlowLog_t LibLDAP_slowlog = {
+    .threshold = 0.0,
+    .rate = UINT32_MAX,
+    .seed = 2463534242U,
+    .callback = NULL,
+    .interp = NULL,
+    .recs = NULL,
+    .size = 0,
+    .head = 0,
+    .count = 0,
+    .dropped = 0
+};
+static LibLDAPCapture_t LibLDAP_capture = {
+    .fp = NULL,
+    .path = NULL,
+    .start = 0.0,
+    .records = 0,
+    .bytes = 0,
+    .error = 0,
+    .buf = NULL,
+    .len = 0,
+    .size = 0
+};
+
+/* attributes whose values are not captured, options (";binary") aside */
+static const char *LibLDAP_capture_secrets[] = {
+    "userPassword", "unicodePwd", "authPassword", "sambaNTPassword",
+    "sambaLMPassword", NULL
+};
+
+/*****************************************************************************
+ * LOCAL FUNCTION DECLARATIONS
+ *****************************************************************************/
+
+static void LibLDAP_trace_pyhook(int, const LibLDAPOp_t *, void *);
+static int LibLDAP_trace_owner(PyInterpreterState *);
+static void LibLDAP_trace_call(int, LibLDAPOp_t *);
+static PyObject *LibLDAP_op2py(const LibLDAPOp_t *);
+static void LibLDAP_slowlog_record(const LibLDAPOp_t *);
+static PyObject *LibLDAP_slowrec2py(const LibLDAPSlowRec_t *);
+static void LibLDAP_strs2buf(char *, size_t, char **);
+static void LibLDAP_ctrls2buf(char *, size_t, LDAPControl **);
+static PyObject *LibLDAP_buf2py(const char *, int);
+static void LibLDAP_capture_record(const LibLDAPOp_t *);
+static int LibLDAP_capture_secret(const char *);
+static unsigned char *LibLDAP_capture_reserve(size_t);
+static void LibLDAP_capture_int(uint64_t, size_t);
+static void LibLDAP_capture_str(const char *, size_t);
+static PyObject *LibLDAP_capture2py(const LibLDAPCapture_t *);
+
+/*****************************************************************************
+ * MODULE METHODS (TRACE)
+ *****************************************************************************/
+
+PyDoc_STRVAR(LibLDAP_set_trace_hookDoc, "");
+
+static PyObject *
+LibLDAP_set_trace_hook(PyObject *self, PyObject *args)
+{
+    PyObject *hook, *prev;
+
+    if (!PyArg_ParseTuple(args, "O", &hook))
+	return NULL;
+    if (hook != Py_None && !PyCallable_Check(hook))
+	return PyErr_Format(
+	    PyExc_TypeError,
+	    "set_trace_hook(): argument `hook' must be callable or None"
+	    );
+    (void) pthread_mutex_lock(&LibLDAP_trace_lock);
+    if (!LibLDAP_trace_owner(LibLDAP_trace_interp)) {
+	(void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+	return PyErr_Format(
+	    PyExc_RuntimeError, "set_trace_hook(): set by another interpreter");
+    }
+    prev = LibLDAP_trace_hook;
+    if (hook == Py_None) {
+	LibLDAP_trace_func = NULL;
+	LibLDAP_trace_arg = NULL;
+	LibLDAP_trace_hook = NULL;
+	LibLDAP_trace_interp = NULL;
+	LibLDAP_tracing_clear(LIBLDAP_TRACE_HOOK);
+    }
+    else {
+	Py_INCREF(hook);
+	LibLDAP_trace_func = LibLDAP_trace_pyhook;
+	LibLDAP_trace_arg = (void *) hook;
+	LibLDAP_trace_hook = hook;
+	LibLDAP_trace_interp = PyInterpreterState_Get();
+	LibLDAP_tracing_set(LIBLDAP_TRACE_HOOK);
+    }
+    (void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+    Py_XDECREF(prev);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(LibLDAP_get_trace_hookDoc, "");
+
+static PyObject *
+LibLDAP_get_trace_hook(PyObject *self)
+{
+    PyObject *hook = Py_None;
+
+    (void) pthread_mutex_lock(&LibLDAP_trace_lock);
+    if (LibLDAP_trace_hook &&
+	LibLDAP_trace_interp == PyInterpreterState_Get())
+	hook = LibLDAP_trace_hook;
+    Py_INCREF(hook);
+    (void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+    return hook;
+}
+
+PyDoc_STRVAR(LibLDAP_set_slowlogDoc, "");
+
+static PyObject *
+LibLDAP_set_slowlog(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    double threshold, rate = 1.0;
+    Py_ssize_t size = 1024;
+    PyObject *callback = Py_None, *prev;
+    LibLDAPSlowRec_t *recs = NULL, *prev_recs;
+    static char *kwlist[] = {"threshold", "rate", "size", "callback", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(
+	    args, kwds, "d|dnO", kwlist, &threshold, &rate, &size, &callback))
+	return NULL;
+    if (rate < 0.0 || rate > 1.0)
+	return PyErr_Format(
+	    PyExc_ValueError,
+	    "set_slowlog(): argument `rate' must be in range [0, 1]"
+	    );
+    if (size <= 0)
+	return PyErr_Format(
+	    PyExc_ValueError,
+	    "set_slowlog(): argument `size' must be a positive integer"
+	    );
+    if (callback != Py_None && !PyCallable_Check(callback))
+	return PyErr_Format(
+	    PyExc_TypeError,
+	    "set_slowlog(): argument `callback' must be callable or None"
+	    );
+    /* shared by the interpreters: not taken from an interpreter heap */
+    if (threshold >= 0.0 && callback == Py_None) {
+	if ((size_t) size > PY_SSIZE_T_MAX / sizeof(LibLDAPSlowRec_t))
+	    return PyErr_NoMemory();
+	recs = PyMem_RawMalloc(size * sizeof(LibLDAPSlowRec_t));
+	if (!recs)
+	    return PyErr_NoMemory();
+    }
+    (void) pthread_mutex_lock(&LibLDAP_trace_lock);
+    if (!LibLDAP_trace_owner(LibLDAP_slowlog.interp)) {
+	(void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+	PyMem_RawFree((void *) recs);
+	return PyErr_Format(
+	    PyExc_RuntimeError, "set_slowlog(): set by another interpreter");
+    }
+    prev = LibLDAP_slowlog.callback;
+    prev_recs = LibLDAP_slowlog.recs;
+    LibLDAP_tracing_clear(LIBLDAP_TRACE_SLOWLOG);
+    LibLDAP_slowlog.callback = NULL;
+    LibLDAP_slowlog.interp = NULL;
+    LibLDAP_slowlog.recs = recs;
+    LibLDAP_slowlog.size = recs ? (size_t) size : 0;
+    LibLDAP_slowlog.head = 0;
+    LibLDAP_slowlog.count = 0;
+    LibLDAP_slowlog.dropped = 0;
+    if (threshold >= 0.0) {
+	LibLDAP_slowlog.threshold = threshold;
+	LibLDAP_slowlog.rate = (uint32_t) (rate * (double) UINT32_MAX);
+	if (callback != Py_None) {
+	    Py_INCREF(callback);
+	    LibLDAP_slowlog.callback = callback;
+	    LibLDAP_slowlog.interp = PyInterpreterState_Get();
+	}
+	LibLDAP_tracing_set(LIBLDAP_TRACE_SLOWLOG);
+    }
+    (void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+    PyMem_RawFree((void *) prev_recs);
+    Py_XDECREF(prev);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(LibLDAP_drain_slowlogDoc, "");
+
+static PyObject *
+LibLDAP_drain_slowlog(PyObject *self)
+{
+    PyObject *ret = PyList_New(0);
+    LibLDAPSlowRec_t tmp;
+
+    if (!ret)
+	return NULL;
+    /* records are taken one at a time: operations completed meanwhile
+       never wait for the conversion */
+    for (;;) {
+	PyObject *rec;
+
+	(void) pthread_mutex_lock(&LibLDAP_trace_lock);
+	if (!LibLDAP_slowlog.count) {
+	    (void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+	    break;
+	}
+	tmp = LibLDAP_slowlog.recs[LibLDAP_slowlog.head];
+	LibLDAP_slowlog.head =
+	    (LibLDAP_slowlog.head + 1) % LibLDAP_slowlog.size;
+	LibLDAP_slowlog.count--;
+	(void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+	rec = LibLDAP_slowrec2py(&tmp);
+	if (!rec) {
+	    Py_DECREF(ret);
+	    return NULL;
+	}
+	if (PyList_Append(ret, rec) == -1) {
+	    Py_DECREF(rec);
+	    Py_DECREF(ret);
+	    return NULL;
+	}
+	Py_DECREF(rec);
+    }
+    return ret;
+}
+
+PyDoc_STRVAR(LibLDAP_get_slowlogDoc, "");
+
+static PyObject *
+LibLDAP_get_slowlog(PyObject *self)
+{
+    LibLDAPSlowLog_t slowlog;
+    PyObject *callback = Py_None;
+
+    (void) pthread_mutex_lock(&LibLDAP_trace_lock);
+    if (!(LibLDAP_tracing_get() & LIBLDAP_TRACE_SLOWLOG)) {
+	(void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+	Py_RETURN_NONE;
+    }
+    slowlog = LibLDAP_slowlog;
+    /* the callback of another interpreter is not shown */
+    if (slowlog.callback && slowlog.interp == PyInterpreterState_Get())
+	callback = slowlog.callback;
+    Py_INCREF(callback);
+    (void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+    return Py_BuildValue(
+	"{s:d,s:d,s:n,s:N,s:n,s:k}",
+	"threshold", slowlog.threshold,
+	"rate", (double) slowlog.rate / (double) UINT32_MAX,
+	"size", (Py_ssize_t) slowlog.size, "callback", callback,
+	"pending", (Py_ssize_t) slowlog.count, "dropped", slowlog.dropped
+	);
+}
+
+PyDoc_STRVAR(LibLDAP_start_captureDoc, "");
+
+static PyObject *
+LibLDAP_start_capture(PyObject *self, PyObject *args)
+{
+    PyObject *path;
+    FILE *fp = NULL;
+    char *cpath;
+    int started, error = 0;
+
+    if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path))
+	return NULL;
+    cpath = PyMem_RawMalloc(PyBytes_GET_SIZE(path) + 1);
+    if (!cpath) {
+	Py_DECREF(path);
+	return PyErr_NoMemory();
+    }
+    (void) strcpy(cpath, PyBytes_AS_STRING(path));
+    /* the file is opened with the lock held: a capture being started
+       elsewhere must not be truncated */
+    (void) pthread_mutex_lock(&LibLDAP_trace_lock);
+    started = LibLDAP_capture.fp != NULL;
+    if (!started) {
+	/* the capture holds DNs and values: readable by its owner only */
+	int fd = open(cpath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+	fp = fd < 0 ? NULL : fdopen(fd, "wb");
+	if (!fp && fd >= 0) {
+	    error = errno;
+	    (void) close(fd);
+	}
+	else if (fp) {
+	    (void) setvbuf(fp, NULL, _IOFBF, 65536);
+	    if (fwrite(LIBLDAP_CAPTURE_MAGIC, 1, 8, fp) != 8) {
+		error = errno ? errno : EIO;
+		(void) fclose(fp);
+		fp = NULL;
+	    }
+	}
+	else
+	    error = errno;
+    }
+    if (fp) {
+	LibLDAP_capture.fp = fp;
+	LibLDAP_capture.path = cpath;
+	LibLDAP_capture.start = LibLDAP_monotonic();
+	LibLDAP_capture.records = 0;
+	LibLDAP_capture.bytes = 8;
+	LibLDAP_capture.error = 0;
+	LibLDAP_tracing_set(LIBLDAP_TRACE_CAPTURE);
+    }
+    (void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+    if (started)
+	(void) PyErr_Format(
+	    LibLDAPErr(self), "start_capture(): a capture is already started"
+	    );
+    else if (!fp) {
+	errno = error;
+	(void) PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+    }
+    Py_DECREF(path);
+    if (!fp) {
+	PyMem_RawFree((void *) cpath);
+	return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(LibLDAP_stop_captureDoc, "");
+
+static PyObject *
+LibLDAP_stop_capture(PyObject *self)
+{
+    PyObject *ret;
+    LibLDAPCapture_t cap;
+
+    (void) pthread_mutex_lock(&LibLDAP_trace_lock);
+    cap = LibLDAP_capture;
+    if (cap.fp) {
+	LibLDAP_tracing_clear(LIBLDAP_TRACE_CAPTURE);
+	LibLDAP_capture.fp = NULL;
+	LibLDAP_capture.path = NULL;
+	LibLDAP_capture.buf = NULL;
+	LibLDAP_capture.size = 0;
+    }
+    (void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+    if (!cap.fp)
+	Py_RETURN_NONE;
+    if (fclose(cap.fp) == EOF && !cap.error)
+	cap.error = errno;
+    PyMem_RawFree((void *) cap.buf);
+    if (cap.error) {
+	errno = cap.error;
+	ret = PyErr_SetFromErrnoWithFilename(PyExc_OSError, cap.path);
+    }
+    else
+	ret = LibLDAP_capture2py(&cap);
+    PyMem_RawFree((void *) cap.path);
+    return ret;
+}
+
+PyDoc_STRVAR(LibLDAP_get_captureDoc, "");
+
+static PyObject *
+LibLDAP_get_capture(PyObject *self)
+{
+    PyObject *ret;
+    LibLDAPCapture_t cap;
+
+    /* the path may be freed by stop_capture() once the lock released */
+    (void) pthread_mutex_lock(&LibLDAP_trace_lock);
+    cap = LibLDAP_capture;
+    if (cap.fp) {
+	cap.path = PyMem_RawMalloc(strlen(LibLDAP_capture.path) + 1);
+	if (cap.path)
+	    (void) strcpy(cap.path, LibLDAP_capture.path);
+    }
+    (void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+    if (!cap.fp)
+	Py_RETURN_NONE;
+    if (!cap.path)
+	return PyErr_NoMemory();
+    ret = LibLDAP_capture2py(&cap);
+    PyMem_RawFree((void *) cap.path);
+    return ret;
+}
+
+static PyMethodDef LibLDAPTraceMethods[] = {
+    {"set_trace_hook", (PyCFunction) LibLDAP_set_trace_hook,
+     METH_VARARGS, LibLDAP_set_trace_hookDoc
+    },
+    {"get_trace_hook", (PyCFunction) LibLDAP_get_trace_hook,
+     METH_NOARGS, LibLDAP_get_trace_hookDoc
+    },
+    {"set_slowlog", (PyCFunction) LibLDAP_set_slowlog,
+     METH_VARARGS | METH_KEYWORDS, LibLDAP_set_slowlogDoc
+    },
+    {"drain_slowlog", (PyCFunction) LibLDAP_drain_slowlog,
+     METH_NOARGS, LibLDAP_drain_slowlogDoc
+    },
+    {"get_slowlog", (PyCFunction) LibLDAP_get_slowlog,
+     METH_NOARGS, LibLDAP_get_slowlogDoc
+    },
+    {"start_capture", (PyCFunction) LibLDAP_start_capture,
+     METH_VARARGS, LibLDAP_start_captureDoc
+    },
+    {"stop_capture", (PyCFunction) LibLDAP_stop_capture,
+     METH_NOARGS, LibLDAP_stop_captureDoc
+    },
+    {"get_capture", (PyCFunction) LibLDAP_get_capture,
+     METH_NOARGS, LibLDAP_get_captureDoc
+    },
+    {NULL, NULL, 0, NULL}
+};
+
+/*****************************************************************************
+ * GLOBAL FUNCTION DEFINITIONS
+ *****************************************************************************/
+
+/* C API (exported through capsule `_libldap.trace_capi'): must be called
+   with the GIL held, `func' is called with the GIL held too, by any
+   interpreter and any thread. It replaces the Python hook of the calling
+   interpreter, it is ignored while another interpreter has one */
+void
+LibLDAP_set_trace_func(LibLDAPTraceFunc func, void *arg)
+{
+    PyObject *hook;
+
+    (void) pthread_mutex_lock(&LibLDAP_trace_lock);
+    if (LibLDAP_trace_hook &&
+	LibLDAP_trace_interp != PyInterpreterState_Get()) {
+	(void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+	return;
+    }
+    hook = LibLDAP_trace_hook;
+    LibLDAP_trace_func = func;
+    LibLDAP_trace_arg = arg;
+    LibLDAP_trace_hook = NULL;
+    LibLDAP_trace_interp = NULL;
+    if (func)
+	LibLDAP_tracing_set(LIBLDAP_TRACE_HOOK);
+    else
+	LibLDAP_tracing_clear(LIBLDAP_TRACE_HOOK);
+    (void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+    Py_XDECREF(hook);
+}
+
+void
+LibLDAP_trace_init(
+    LibLDAPOp_t *op, unsigned long conn, int type, const char *dn, int scope,
+    const char *filter
+    )
+{
+    op->type = type;
+    op->conn = conn;
+    op->dn = dn;
+    op->scope = scope;
+    op->filter = filter;
+    op->msgid = -1;
+    op->result = LDAP_SUCCESS;
+    op->entries = 0;
+    op->bytes = 0;
+    op->start = LibLDAP_monotonic();
+    op->duration = 0.0;
+}
+
+void
+LibLDAP_trace_begin(
+    LibLDAPOp_t *op, unsigned long conn, int type, const char *dn, int scope,
+    const char *filter
+    )
+{
+    LibLDAP_trace_init(op, conn, type, dn, scope, filter);
+    if (LibLDAP_tracing_get() & LIBLDAP_TRACE_HOOK)
+	LibLDAP_trace_call(LIBLDAP_TRACE_START, op);
+}
+
+/* the request of an asynchronous operation prepared by
+   LibLDAP_trace_init() is sent */
+void
+LibLDAP_trace_start(LibLDAPOp_t *op, int msgid)
+{
+    if (!op->type)
+	return;
+    op->msgid = msgid;
+    if (LibLDAP_tracing_get() & LIBLDAP_TRACE_HOOK)
+	LibLDAP_trace_call(LIBLDAP_TRACE_START, op);
+}
+
+void
+LibLDAP_trace_end(
+    LibLDAPOp_t *op, int msgid, int result, Py_ssize_t entries, size_t bytes
+    )
+{
+    if (!op->type)
+	return;
+    op->msgid = msgid;
+    op->result = result;
+    op->entries = entries;
+    op->bytes = bytes;
+    op->duration = LibLDAP_monotonic() - op->start;
+    if (LibLDAP_tracing_get() & LIBLDAP_TRACE_HOOK)
+	LibLDAP_trace_call(LIBLDAP_TRACE_FINISH, op);
+    if (LibLDAP_tracing_get() & LIBLDAP_TRACE_SLOWLOG)
+	LibLDAP_slowlog_record(op);
+    if (LibLDAP_tracing_get() & LIBLDAP_TRACE_CAPTURE) {
+	(void) pthread_mutex_lock(&LibLDAP_trace_lock);
+	if (LibLDAP_capture.fp && !LibLDAP_capture.error)
+	    LibLDAP_capture_record(op);
+	(void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+    }
+}
+
+/* copy of `op' in a single block, to be freed with PyMem_RawFree(), made
+   for asynchronous operations whose arguments are gone by the time their
+   answer is received. NULL if out of memory */
+LibLDAPOp_t *
+LibLDAP_op_copy(const LibLDAPOp_t *op)
+{
+    size_t fixed = sizeof(LibLDAPOp_t), strs = 0;
+    char **attr, **val, *p;
+    LDAPControl **ctrl;
+    LDAPMod **mod;
+    LibLDAPOp_t *ret;
+    void **f;
+
+    /* pointer arrays and structures first, then the strings */
+    strs += op->dn ? strlen(op->dn) + 1 : 0;
+    strs += op->filter ? strlen(op->filter) + 1 : 0;
+    for (attr = op->attrs; attr && *attr; attr++) {
+	fixed += sizeof(char *);
+	strs += strlen(*attr) + 1;
+    }
+    fixed += op->attrs ? sizeof(char *) : 0;
+    for (ctrl = op->ctrls; ctrl && *ctrl; ctrl++) {
+	fixed += sizeof(LDAPControl *) + sizeof(LDAPControl);
+	strs += strlen((*ctrl)->ldctl_oid) + 1;
+	strs += (*ctrl)->ldctl_value.bv_len + 1;
+    }
+    fixed += op->ctrls ? sizeof(LDAPControl *) : 0;
+    for (mod = op->mods; mod && *mod; mod++) {
+	fixed += sizeof(LDAPMod *) + sizeof(LDAPMod);
+	strs += strlen((*mod)->mod_type) + 1;
+	for (val = (*mod)->mod_values; val && *val; val++) {
+	    fixed += sizeof(char *);
+	    strs += strlen(*val) + 1;
+	}
+	fixed += (*mod)->mod_values ? sizeof(char *) : 0;
+    }
+    fixed += op->mods ? sizeof(LDAPMod *) : 0;
+    ret = PyMem_RawMalloc(fixed + strs);
+    if (!ret)
+	return NULL;
+    *ret = *op;
+    f = (void **) (ret + 1);
+    p = (char *) ret + fixed;
+#define LibLDAP_op_strcpy(dst, src, len)				\
+    do {								\
+	(void) memcpy((void *) p, (const void *) (src), (len));		\
+	p[len] = 0;							\
+	(dst) = p;							\
+	p += (len) + 1;							\
+    } while (0)
+    if (op->dn)
+	LibLDAP_op_strcpy(ret->dn, op->dn, strlen(op->dn));
+    if (op->filter)
+	LibLDAP_op_strcpy(ret->filter, op->filter, strlen(op->filter));
+    if (op->attrs) {
+	ret->attrs = (char **) f;
+	for (attr = op->attrs; *attr; attr++, f++)
+	    LibLDAP_op_strcpy(*f, *attr, strlen(*attr));
+	*f++ = NULL;
+    }
+    if (op->ctrls) {
+	size_t n;
+
+	for (n = 0; op->ctrls[n]; n++)
+	    ;
+	ret->ctrls = (LDAPControl **) f;
+	f += n + 1;
+	for (n = 0, ctrl = op->ctrls; *ctrl; ctrl++, n++) {
+	    LDAPControl *c = (LDAPControl *) f;
+
+	    f += sizeof(LDAPControl) / sizeof(void *);
+	    *c = **ctrl;
+	    LibLDAP_op_strcpy(
+		c->ldctl_oid, (*ctrl)->ldctl_oid, strlen((*ctrl)->ldctl_oid));
+	    if ((*ctrl)->ldctl_value.bv_val)
+		LibLDAP_op_strcpy(
+		    c->ldctl_value.bv_val, (*ctrl)->ldctl_value.bv_val,
+		    (*ctrl)->ldctl_value.bv_len);
+	    else
+		p++;
+	    ret->ctrls[n] = c;
+	}
+	ret->ctrls[n] = NULL;
+    }
+    if (op->mods) {
+	size_t n;
+
+	for (n = 0; op->mods[n]; n++)
+	    ;
+	ret->mods = (LDAPMod **) f;
+	f += n + 1;
+	for (n = 0, mod = op->mods; *mod; mod++, n++) {
+	    LDAPMod *m = (LDAPMod *) f;
+
+	    f += sizeof(LDAPMod) / sizeof(void *);
+	    m->mod_op = (*mod)->mod_op;
+	    LibLDAP_op_strcpy(
+		m->mod_type, (*mod)->mod_type, strlen((*mod)->mod_type));
+	    m->mod_values = NULL;
+	    if ((*mod)->mod_values) {
+		m->mod_values = (char **) f;
+		for (val = (*mod)->mod_values; *val; val++, f++)
+		    LibLDAP_op_strcpy(*f, *val, strlen(*val));
+		*f++ = NULL;
+	    }
+	    ret->mods[n] = m;
+	}
+	ret->mods[n] = NULL;
+    }
+#undef LibLDAP_op_strcpy
+    return ret;
+}
+
+const char *
+LibLDAP_op_name(int type)
+{
+    switch (type) {
+    case LDAP_REQ_BIND:
+	return "bind";
+    case LDAP_REQ_UNBIND:
+	return "unbind";
+    case LDAP_REQ_SEARCH:
+	return "search";
+    case LDAP_REQ_MODIFY:
+	return "modify";
+    case LDAP_REQ_ADD:
+	return "add";
+    case LDAP_REQ_DELETE:
+	return "delete";
+    case LDAP_REQ_MODDN:
+	return "modrdn";
+    case LDAP_REQ_COMPARE:
+	return "compare";
+    case LDAP_REQ_ABANDON:
+	return "abandon";
+    case LDAP_REQ_EXTENDED:
+	return "extended";
+    default:
+	return "unknown";
+    }
+}
+
+int
+LibLDAP_add_trace_methods(PyObject *m)
+{
+    PyObject *capi;
+
+    if (PyModule_AddFunctions(m, LibLDAPTraceMethods) < 0)
+	return -1;
+    capi = PyCapsule_New(
+	(void *) LibLDAP_set_trace_func, LibLDAPTraceCAPI, NULL);
+    if (!capi)
+	return -1;
+    if (PyModule_AddObject(m, "trace_capi", capi) == -1) {
+	Py_DECREF(capi);
+	return -1;
+    }
+    return 0;
+}
+
+/*****************************************************************************
+ * LOCAL FUNCTION DEFINITIONS
+ *****************************************************************************/
+
+/* with LibLDAP_trace_lock held: a callback is only replaced or removed
+   by the interpreter which set it, the others cannot release it */
+/* called with LibLDAP_trace_lock held: the caller raises once released */
+static int
+LibLDAP_trace_owner(PyInterpreterState *interp)
+{
+    return !interp || interp == PyInterpreterState_Get();
+}
+
+static void
+LibLDAP_trace_call(int event, LibLDAPOp_t *op)
+{
+    LibLDAPTraceFunc func;
+    void *arg;
+    PyObject *hook = NULL;
+
+    (void) pthread_mutex_lock(&LibLDAP_trace_lock);
+    func = LibLDAP_trace_func;
+    arg = LibLDAP_trace_arg;
+    if (LibLDAP_trace_hook) {
+	/* kept alive until called: it may be replaced meanwhile */
+	if (LibLDAP_trace_interp == PyInterpreterState_Get()) {
+	    hook = LibLDAP_trace_hook;
+	    Py_INCREF(hook);
+	}
+	else
+	    func = NULL;
+    }
+    (void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+    if (func)
+	func(event, op, arg);
+    Py_XDECREF(hook);
+}
+
+static void
+LibLDAP_trace_pyhook(int event, const LibLDAPOp_t *op, void *arg)
+{
+    PyObject *hook = (PyObject *) arg, *info, *res;
+    PyObject *etype, *evalue, *etb;
+
+    /* a hook must never change the outcome of the traced operation */
+    PyErr_Fetch(&etype, &evalue, &etb);
+    Py_INCREF(hook);
+    info = LibLDAP_op2py(op);
+    if (info) {
+	res = PyObject_CallFunction(
+	    hook, "sO", event == LIBLDAP_TRACE_START ? "start" : "finish",
+	    info
+	    );
+	Py_DECREF(info);
+	Py_XDECREF(res);
+    }
+    if (PyErr_Occurred())
+	PyErr_WriteUnraisable(hook);
+    Py_DECREF(hook);
+    PyErr_Restore(etype, evalue, etb);
+}
+
+static PyObject *
+LibLDAP_op2py(const LibLDAPOp_t *op)
+{
+    char attrs[LIBLDAP_SLOWLOG_STRLEN], ctrls[LIBLDAP_SLOWLOG_STRLEN];
+
+    LibLDAP_strs2buf(attrs, sizeof(attrs), op->attrs);
+    LibLDAP_ctrls2buf(ctrls, sizeof(ctrls), op->ctrls);
+    return Py_BuildValue(
+	"{s:s,s:k,s:z,s:i,s:z,s:N,s:N,s:i,s:i,s:n,s:n,s:d,s:d}",
+	"op", LibLDAP_op_name(op->type), "conn", op->conn, "dn", op->dn,
+	"scope", op->scope,
+	"filter", op->filter, "attrs", LibLDAP_buf2py(attrs, 1),
+	"controls", LibLDAP_buf2py(ctrls, 1), "msgid", op->msgid,
+	"result", op->result, "entries", op->entries,
+	"bytes", (Py_ssize_t) op->bytes, "start", op->start,
+	"duration", op->duration
+	);
+}
+
+/* called for each operation slower than the threshold: records are
+   copied into the preallocated ring buffer, nothing is allocated unless
+   a callback is used */
+static void
+LibLDAP_slowlog_record(const LibLDAPOp_t *op)
+{
+    LibLDAPSlowRec_t *rec, tmp;
+    PyObject *callback = NULL;
+
+    (void) pthread_mutex_lock(&LibLDAP_trace_lock);
+    if (!(LibLDAP_tracing_get() & LIBLDAP_TRACE_SLOWLOG) ||
+	op->duration < LibLDAP_slowlog.threshold)
+	goto done;
+    if (LibLDAP_slowlog.rate != UINT32_MAX) {
+	uint32_t x = LibLDAP_slowlog.seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	LibLDAP_slowlog.seed = x;
+	if (x > LibLDAP_slowlog.rate)
+	    goto done;
+    }
+    if (LibLDAP_slowlog.callback) {
+	if (LibLDAP_slowlog.interp != PyInterpreterState_Get())
+	    goto done;
+	callback = LibLDAP_slowlog.callback;
+	Py_INCREF(callback);
+	rec = &tmp;
+    }
+    else {
+	size_t tail =
+	    (LibLDAP_slowlog.head + LibLDAP_slowlog.count) %
+	    LibLDAP_slowlog.size;
+
+	rec = LibLDAP_slowlog.recs + tail;
+	if (LibLDAP_slowlog.count == LibLDAP_slowlog.size) {
+	    LibLDAP_slowlog.head =
+		(LibLDAP_slowlog.head + 1) % LibLDAP_slowlog.size;
+	    LibLDAP_slowlog.dropped++;
+	}
+	else
+	    LibLDAP_slowlog.count++;
+    }
+    rec->type = op->type;
+    rec->conn = op->conn;
+    rec->scope = op->scope;
+    rec->result = op->result;
+    rec->entries = op->entries;
+    rec->start = op->start;
+    rec->duration = op->duration;
+    (void) snprintf(rec->dn, sizeof(rec->dn), "%s", op->dn ? op->dn : "");
+    (void) snprintf(
+	rec->filter, sizeof(rec->filter), "%s", op->filter ? op->filter : "");
+    LibLDAP_strs2buf(rec->attrs, sizeof(rec->attrs), op->attrs);
+    LibLDAP_ctrls2buf(rec->ctrls, sizeof(rec->ctrls), op->ctrls);
+  done:
+    (void) pthread_mutex_unlock(&LibLDAP_trace_lock);
+    if (callback) {
+	PyObject *info, *res;
+	PyObject *etype, *evalue, *etb;
+
+	PyErr_Fetch(&etype, &evalue, &etb);
+	info = LibLDAP_slowrec2py(&tmp);
+	if (info) {
+	    res = PyObject_CallFunctionObjArgs(callback, info, NULL);
+	    Py_DECREF(info);
+	    Py_XDECREF(res);
+	}
+	if (PyErr_Occurred())
+	    PyErr_WriteUnraisable(callback);
+	Py_DECREF(callback);
+	PyErr_Restore(etype, evalue, etb);
+    }
+}
+
+static PyObject *
+LibLDAP_slowrec2py(const LibLDAPSlowRec_t *rec)
+{
+    return Py_BuildValue(
+	"{s:s,s:k,s:N,s:i,s:N,s:N,s:N,s:i,s:n,s:d,s:d}",
+	"op", LibLDAP_op_name(rec->type), "conn", rec->conn,
+	"dn", LibLDAP_buf2py(rec->dn, 0),
+	"scope", rec->scope, "filter", LibLDAP_buf2py(rec->filter, 0),
+	"attrs", LibLDAP_buf2py(rec->attrs, 1),
+	"controls", LibLDAP_buf2py(rec->ctrls, 1), "result", rec->result,
+	"entries", rec->entries, "start", rec->start,
+	"duration", rec->duration
+	);
+}
+
+/* space separated list, truncated to the buffer size */
+static void
+LibLDAP_strs2buf(char *buf, size_t size, char **strs)
+{
+    size_t len = 0;
+
+    *buf = 0;
+    for (; strs && *strs && len < size; strs++)
+	len += snprintf(buf + len, size - len, len ? " %s" : "%s", *strs);
+}
+
+static void
+LibLDAP_ctrls2buf(char *buf, size_t size, LDAPControl **ctrls)
+{
+    size_t len = 0;
+
+    *buf = 0;
+    for (; ctrls && *ctrls && len < size; ctrls++)
+	len += snprintf(
+	    buf + len, size - len, len ? " %s" : "%s", (*ctrls)->ldctl_oid);
+}
+
+/* "" -> None, "a b" -> ['a', 'b'] if `split', "a b" otherwise */
+static PyObject *
+LibLDAP_buf2py(const char *buf, int split)
+{
+    PyObject *str, *ret;
+
+    if (!*buf)
+	Py_RETURN_NONE;
+    str = PyUnicode_DecodeUTF8(buf, strlen(buf), "replace");
+    if (!str || !split)
+	return str;
+    ret = PyUnicode_Split(str, NULL, -1);
+    Py_DECREF(str);
+    return ret;
+}
+
+/* encodes the operation into LibLDAP_capture.buf and appends it to the
+   capture file, with LibLDAP_trace_lock held: the capture stops on the
+   first failure which is then reported by stop_capture() */
+static void
+LibLDAP_capture_record(const LibLDAPOp_t *op)
+{
+    LibLDAPCapture_t *cap = &LibLDAP_capture;
+    char **attr;
+    LDAPControl **ctrl;
+    LDAPMod **mod;
+    size_t n;
+
+    cap->len = 0;
+    LibLDAP_capture_int(0, 4);		/* record length, set below */
+    LibLDAP_capture_int(op->type, 1);
+    LibLDAP_capture_int(op->scope < 0 ? 0xff : op->scope, 1);
+    LibLDAP_capture_int(0, 2);
+    LibLDAP_capture_int(op->conn, 4);
+    LibLDAP_capture_int((uint32_t) op->result, 4);
+    LibLDAP_capture_int(op->entries, 4);
+    LibLDAP_capture_int(op->bytes, 8);
+    {
+	double d[2] = {op->start - cap->start, op->duration};
+	uint64_t u[2];
+
+	(void) memcpy((void *) u, (const void *) d, sizeof(u));
+	LibLDAP_capture_int(u[0], 8);
+	LibLDAP_capture_int(u[1], 8);
+    }
+    LibLDAP_capture_str(op->dn, op->dn ? strlen(op->dn) : 0);
+    LibLDAP_capture_str(op->filter, op->filter ? strlen(op->filter) : 0);
+    for (n = 0, attr = op->attrs; attr && *attr && n < 0xffff; attr++)
+	n++;
+    LibLDAP_capture_int(n, 2);
+    for (attr = op->attrs; n--; attr++)
+	LibLDAP_capture_str(*attr, strlen(*attr));
+    for (n = 0, ctrl = op->ctrls; ctrl && *ctrl && n < 0xffff; ctrl++)
+	n++;
+    LibLDAP_capture_int(n, 2);
+    for (ctrl = op->ctrls; n--; ctrl++) {
+	LibLDAP_capture_str((*ctrl)->ldctl_oid, strlen((*ctrl)->ldctl_oid));
+	LibLDAP_capture_int((*ctrl)->ldctl_iscritical ? 1 : 0, 1);
+	LibLDAP_capture_str(
+	    (*ctrl)->ldctl_value.bv_val, (*ctrl)->ldctl_value.bv_len);
+    }
+    for (n = 0, mod = op->mods; mod && *mod && n < 0xffff; mod++)
+	n++;
+    LibLDAP_capture_int(n, 2);
+    for (mod = op->mods; n--; mod++) {
+	char **val;
+	size_t nvals = 0;
+	int secret = LibLDAP_capture_secret((*mod)->mod_type);
+
+	LibLDAP_capture_int((*mod)->mod_op & ~LDAP_MOD_BVALUES, 1);
+	LibLDAP_capture_str((*mod)->mod_type, strlen((*mod)->mod_type));
+	for (val = (*mod)->mod_values; val && *val; val++)
+	    nvals++;
+	LibLDAP_capture_int(nvals, 4);
+	/* passwords: only their number is kept, values are None */
+	for (val = (*mod)->mod_values; nvals--; val++)
+	    LibLDAP_capture_str(
+		secret ? NULL : *val, secret ? 0 : strlen(*val));
+    }
+    if (cap->error)
+	goto failed;
+    n = cap->len - 4;
+    cap->buf[0] = n & 0xff;
+    cap->buf[1] = (n >> 8) & 0xff;
+    cap->buf[2] = (n >> 16) & 0xff;
+    cap->buf[3] = (n >> 24) & 0xff;
+    if (fwrite((const void *) cap->buf, 1, cap->len, cap->fp) != cap->len) {
+	cap->error = errno ? errno : EIO;
+	goto failed;
+    }
+    cap->records++;
+    cap->bytes += cap->len;
+    return;
+  failed:
+    LibLDAP_tracing_clear(LIBLDAP_TRACE_CAPTURE);
+}
+
+static int
+LibLDAP_capture_secret(const char *type)
+{
+    const char **secret;
+
+    for (secret = LibLDAP_capture_secrets; *secret; secret++) {
+	size_t len = strlen(*secret);
+
+	if (!strncasecmp(type, *secret, len) &&
+	    (type[len] == '\0' || type[len] == ';'))
+	    return 1;
+    }
+    return 0;
+}
+
+/* returns `n' bytes appended to the record, NULL on failure */
+static unsigned char *
+LibLDAP_capture_reserve(size_t n)
+{
+    LibLDAPCapture_t *cap = &LibLDAP_capture;
+
+    if (cap->error)
+	return NULL;
+    if (cap->len + n > cap->size) {
+	size_t size = cap->size ? cap->size : 4096;
+	unsigned char *buf;
+
+	while (size < cap->len + n)
+	    size *= 2;
+	buf = PyMem_RawRealloc((void *) cap->buf, size);
+	if (!buf) {
+	    cap->error = ENOMEM;
+	    return NULL;
+	}
+	cap->buf = buf;
+	cap->size = size;
+    }
+    cap->len += n;
+    return cap->buf + cap->len - n;
+}
+
+/* little endian integer of `n' bytes */
+static void
+LibLDAP_capture_int(uint64_t value, size_t n)
+{
+    unsigned char *ptr = LibLDAP_capture_reserve(n);
+
+    for (; ptr && n; n--, value >>= 8)
+	*ptr++ = value & 0xff;
+}
+
+/* 32 bit length (LIBLDAP_CAPTURE_NULL for NULL) followed by the bytes */
+static void
+LibLDAP_capture_str(const char *str, size_t len)
+{
+    unsigned char *ptr;
+
+    LibLDAP_capture_int(str ? len : LIBLDAP_CAPTURE_NULL, 4);
+    if (!str)
+	return;
+    ptr = LibLDAP_capture_reserve(len);
+    if (ptr)
+	(void) memcpy((void *) ptr, (const void *) str, len);
+}
+
+static PyObject *
+LibLDAP_capture2py(const LibLDAPCapture_t *cap)
+{
+    return Py_BuildValue(
+	"{s:y,s:k,s:k,s:i}",
+	"path", cap->path, "records", cap->records, "bytes", cap->bytes,
+	"error", cap->error
+	);
+}
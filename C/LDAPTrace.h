@@ -0,0 +1,98 @@
+#ifndef LDAPTRACE_H
+#define LDAPTRACE_H
+
+/*****************************************************************************
+ * INCLUDED FILES & MACRO DEFINITIONS
+ *****************************************************************************/
+
+#define LIBLDAP_TRACE_START	0
+#define LIBLDAP_TRACE_FINISH	1
+
+/* consumers of operation records (LibLDAP_tracing bit mask) */
+#define LIBLDAP_TRACE_HOOK	0x01
+#define LIBLDAP_TRACE_SLOWLOG	0x02
+#define LIBLDAP_TRACE_CAPTURE	0x04
+
+/* size of string fields of slow operation records */
+#define LIBLDAP_SLOWLOG_STRLEN	256
+
+/* LibLDAP_tracing is changed with LibLDAP_trace_lock held but read
+   without it by every operation: both are atomic */
+#define LibLDAP_tracing_get()						\
+    __atomic_load_n(&LibLDAP_tracing, __ATOMIC_RELAXED)
+#define LibLDAP_tracing_set(mask)					\
+    ((void) __atomic_fetch_or(&LibLDAP_tracing, (mask), __ATOMIC_RELAXED))
+#define LibLDAP_tracing_clear(mask)					\
+    ((void) __atomic_fetch_and(&LibLDAP_tracing, ~(mask), __ATOMIC_RELAXED))
+
+/* Only LibLDAP_tracing is tested inline: an operation costs a single
+   load and test when no consumer is registered */
+#define LibLDAP_op_begin(op, c, t, d, s, f)				\
+    do {								\
+	if (LibLDAP_tracing_get())					\
+	    LibLDAP_trace_begin((op), (c), (t), (d), (s), (f));	\
+    } while (0)
+
+#define LibLDAP_op_end(op, id, rc, n, b)				\
+    do {								\
+	if (LibLDAP_tracing_get())					\
+	    LibLDAP_trace_end((op), (id), (rc), (n), (b));		\
+    } while (0)
+
+/* asynchronous operations are prepared before their request is sent,
+   START is emitted once it is sent, with its msgid, by
+   LibLDAP_trace_start() and FINISH when the answer is received */
+#define LibLDAP_op_prepare(op, c, t, d, s, f)				\
+    do {								\
+	if (LibLDAP_tracing_get())					\
+	    LibLDAP_trace_init((op), (c), (t), (d), (s), (f));		\
+    } while (0)
+
+/*****************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+    int           type;		/* LDAP_REQ_*, 0 if not traced */
+    unsigned long conn;		/* serial number of the connection */
+    const char   *dn;		/* base DN or target DN */
+    int           scope;	/* search scope, -1 otherwise */
+    const char   *filter;	/* search filter or NULL */
+    char        **attrs;	/* requested attributes or NULL */
+    LDAPControl **ctrls;	/* server controls or NULL */
+    LDAPMod     **mods;		/* add and modify modifications or NULL */
+    int           msgid;	/* -1 for synchronous operations */
+    int           result;	/* LDAP result code */
+    Py_ssize_t    entries;	/* number of entries returned */
+    size_t        bytes;	/* size of DNs and values returned */
+    double        start;	/* monotonic clock */
+    double        duration;	/* in seconds */
+} LibLDAPOp_t;
+
+/* fields `attrs', `ctrls' and `mods' are set by the caller before
+   LibLDAP_op_begin(), they are left untouched by LibLDAP_trace_begin() */
+
+typedef void (*LibLDAPTraceFunc)(int, const LibLDAPOp_t *, void *);
+
+/*****************************************************************************
+ * GLOBAL VARIABLES
+ *****************************************************************************/
+
+extern int LibLDAP_tracing;
+
+/*****************************************************************************
+ * GLOBAL FUNCTION DECLARATIONS
+ *****************************************************************************/
+
+extern void LibLDAP_set_trace_func(LibLDAPTraceFunc, void *);
+extern void LibLDAP_trace_init(
+    LibLDAPOp_t *, unsigned long, int, const char *, int, const char *);
+extern void LibLDAP_trace_begin(
+    LibLDAPOp_t *, unsigned long, int, const char *, int, const char *);
+extern void LibLDAP_trace_start(LibLDAPOp_t *, int);
+extern void LibLDAP_trace_end(LibLDAPOp_t *, int, int, Py_ssize_t, size_t);
+extern LibLDAPOp_t *LibLDAP_op_copy(const LibLDAPOp_t *);
+extern const char *LibLDAP_op_name(int);
+extern int LibLDAP_add_trace_methods(PyObject *);
+
+#endif /* LDAPTRACE_H */
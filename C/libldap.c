@@ -8,15 +8,18 @@
 #include <LDAPModObject.h>
 #include <LDAPControls.h>
 #include <LDAPSchema.h>
-
-#ifdef __LIBLDAP_DARWIN__
-PyObject *LibLDAPErr;
-#endif
+#include <LDAPTrace.h>
+#include <LDAPTLS.h>
+#include <LDAPCompletionQueue.h>
+#include <time.h>
+#include <stdarg.h>
+#include <limits.h>
 
 /*****************************************************************************
  * LOCAL FUNCTION DECLARATIONS
  *****************************************************************************/
 
+static int LibLDAP_add_type(PyObject *, PyType_Spec *, PyTypeObject **);
 static int LibLDAP_add_constants(PyObject *);
 
 /*****************************************************************************
@@ -26,15 +29,17 @@ static int LibLDAP_add_constants(PyObject *);
 PyDoc_STRVAR(LibLDAP_ldap_get_optionDoc, "");
 
 static PyObject *
-LibLDAP_ldap_get_option(PyObject *self, PyObject *args)
+LibLDAP_ldap_get_option(
+    PyObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
     PyMethodDef *ml;
 
-    for (ml = LDAPTypeObject.tp_methods; ml->ml_name; ml++)
+    /* called with the module as `self': global options */
+    for (ml = LibLDAP_state(self)->ldap_type->tp_methods; ml->ml_name; ml++)
 	if (!strcmp(ml->ml_name, "get_option"))
-	    return ml->ml_meth(NULL, args);
+	    return ((LibLDAPFast_t) ml->ml_meth)(self, args, nargs);
     return PyErr_Format(
-	LibLDAPErr,
+	LibLDAPErr(self),
 	"ldap_get_option(): LDAPObject has no method `get_option()'"
 	);
 }
@@ -42,15 +47,16 @@ LibLDAP_ldap_get_option(PyObject *self, PyObject *args)
 PyDoc_STRVAR(LibLDAP_ldap_set_optionDoc, "");
 
 static PyObject *
-LibLDAP_ldap_set_option(PyObject *self, PyObject *args)
+LibLDAP_ldap_set_option(
+    PyObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
     PyMethodDef *ml;
 
-    for (ml = LDAPTypeObject.tp_methods; ml->ml_name; ml++)
+    for (ml = LibLDAP_state(self)->ldap_type->tp_methods; ml->ml_name; ml++)
 	if (!strcmp(ml->ml_name, "set_option"))
-	    return ml->ml_meth(NULL, args);
+	    return ((LibLDAPFast_t) ml->ml_meth)(self, args, nargs);
     return PyErr_Format(
-	LibLDAPErr,
+	LibLDAPErr(self),
 	"ldap_set_option(): LDAPObject has no method `set_option()'"
 	);
 }
@@ -60,13 +66,8 @@ PyDoc_STRVAR(LibLDAP_initializeDoc, "");
 static PyObject *
 LibLDAP_ldap_initialize(PyObject *self, PyObject *args, PyObject *kwds)
 {
-    PyObject *ldp = LDAPTypeObject.tp_new(&LDAPTypeObject, args, kwds);
-
-    if (!ldp)
-	return NULL;
-    if (LDAPTypeObject.tp_init(ldp, args, kwds) == -1)
-	return NULL;
-    return ldp;
+    return PyObject_Call(
+	(PyObject *) LibLDAP_state(self)->ldap_type, args, kwds);
 }
 
 PyDoc_STRVAR(LibLDAP_is_valid_dnDoc, "");
@@ -92,10 +93,10 @@ LibLDAP_ldap_is_valid_dn(PyObject *self, PyObject *args)
 
 static PyMethodDef LibLDAPMethods[] = {
     {"ldap_get_option", (PyCFunction) LibLDAP_ldap_get_option,
-     METH_VARARGS, LibLDAP_ldap_get_optionDoc
+     METH_FASTCALL, LibLDAP_ldap_get_optionDoc
     },
     {"ldap_set_option", (PyCFunction) LibLDAP_ldap_set_option,
-     METH_VARARGS, LibLDAP_ldap_set_optionDoc
+     METH_FASTCALL, LibLDAP_ldap_set_optionDoc
     },
     {"ldap_initialize", (PyCFunction) LibLDAP_ldap_initialize,
      METH_VARARGS | METH_KEYWORDS, LibLDAP_initializeDoc
@@ -112,46 +113,106 @@ static PyMethodDef LibLDAPMethods[] = {
 
 PyDoc_STRVAR(LibLDAPDoc, "OpenLDAP library wrapper");
 
-static struct PyModuleDef LibLDAPModule = {
-   PyModuleDef_HEAD_INIT,
-   "_libldap",
-   LibLDAPDoc,
-   -1,
-   LibLDAPMethods
-};
+static int
+LibLDAP_traverse(PyObject *m, visitproc visit, void *arg)
+{
+    LibLDAPState_t *st = (LibLDAPState_t *) PyModule_GetState(m);
 
-PyMODINIT_FUNC
-PyInit__libldap(void)
+    Py_VISIT(st->error);
+    Py_VISIT(st->ldap_type);
+    Py_VISIT(st->mod_type);
+    Py_VISIT(st->control_type);
+    Py_VISIT(st->controls_type);
+    Py_VISIT(st->cq_type);
+    return 0;
+}
+
+static int
+LibLDAP_clear(PyObject *m)
 {
-    PyObject *m;
+    LibLDAPState_t *st = (LibLDAPState_t *) PyModule_GetState(m);
 
-    if (PyType_Ready(&LDAPModTypeObject) < 0)
-        return NULL;
-    if (PyType_Ready(&LDAPControlTypeObject) < 0)
-        return NULL;
-    if (PyType_Ready(&LDAPControlsTypeObject) < 0)
-        return NULL;    
-    if (PyType_Ready(&LDAPTypeObject) < 0)
-        return NULL;
-    m = PyModule_Create(&LibLDAPModule);
-    if (!m)
-	return NULL;
+    Py_CLEAR(st->error);
+    Py_CLEAR(st->ldap_type);
+    Py_CLEAR(st->mod_type);
+    Py_CLEAR(st->control_type);
+    Py_CLEAR(st->controls_type);
+    Py_CLEAR(st->cq_type);
+    LDAPModObject_freelist_clear(st);
+    return 0;
+}
+
+static void
+LibLDAP_free(void *m)
+{
+    (void) LibLDAP_clear((PyObject *) m);
+}
+
+/* executed for each interpreter importing the module: the types and the
+   exception are created anew each time, nothing is shared */
+static int
+LibLDAP_exec(PyObject *m)
+{
+    LibLDAPState_t *st = (LibLDAPState_t *) PyModule_GetState(m);
+
+    st->error = PyErr_NewException("_libldap.LDAPError", NULL, NULL);
+    if (!st->error)
+	return -1;
+    Py_INCREF(st->error);
+    if (PyModule_AddObject(m, "LDAPError", st->error) < 0) {
+	Py_DECREF(st->error);
+	return -1;
+    }
+    if (LibLDAP_add_type(m, &LDAPModTypeSpec, &st->mod_type) < 0)
+	return -1;
+    /* no PyType_Spec slot for it before 3.14 */
+    st->mod_type->tp_vectorcall = LDAPModObject_vectorcall;
+    if (LibLDAP_add_type(m, &LDAPControlTypeSpec, &st->control_type) < 0)
+	return -1;
+    if (LibLDAP_add_type(m, &LDAPControlsTypeSpec, &st->controls_type) < 0)
+	return -1;
+    if (LibLDAP_add_type(m, &LDAPTypeSpec, &st->ldap_type) < 0)
+	return -1;
+    if (LibLDAP_add_type(m, &LDAPCompletionQueueTypeSpec, &st->cq_type) < 0)
+	return -1;
     if (LibLDAP_add_schema_methods(m) < 0)
-	return NULL;
-    Py_INCREF(&LDAPModTypeObject);
-    PyModule_AddObject(m, "LDAPMod", (PyObject *) &LDAPModTypeObject);
-    Py_INCREF(&LDAPControlTypeObject);
-    PyModule_AddObject(m, "LDAPControl", (PyObject *) &LDAPControlTypeObject);
-    Py_INCREF(&LDAPControlsTypeObject);
-    PyModule_AddObject(m, "LDAPControls", (PyObject *) &LDAPControlsTypeObject);
-    Py_INCREF(&LDAPTypeObject);
-    PyModule_AddObject(m, "LDAP_", (PyObject *) &LDAPTypeObject);
-    LibLDAPErr = PyErr_NewException("_libldap.LDAPError", NULL, NULL);
-    Py_INCREF(LibLDAPErr);
-    PyModule_AddObject(m, "LDAPError", LibLDAPErr);
+	return -1;
+    if (LibLDAP_add_trace_methods(m) < 0)
+	return -1;
+    if (LibLDAP_add_tls_methods(m) < 0)
+	return -1;
     if (LibLDAP_add_constants(m) < 0)
-	return NULL;
-    return m;
+	return -1;
+    return 0;
+}
+
+static PyModuleDef_Slot LibLDAPSlots[] = {
+    {Py_mod_exec, LibLDAP_exec},
+#ifdef Py_mod_multiple_interpreters
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}
+};
+
+struct PyModuleDef LibLDAPModule = {
+    PyModuleDef_HEAD_INIT,
+    "_libldap",
+    LibLDAPDoc,
+    sizeof(LibLDAPState_t),
+    LibLDAPMethods,
+    LibLDAPSlots,
+    LibLDAP_traverse,
+    LibLDAP_clear,
+    LibLDAP_free
+};
+
+PyMODINIT_FUNC
+PyInit__libldap(void)
+{
+    return PyModuleDef_Init(&LibLDAPModule);
 }
 
 /*****************************************************************************
@@ -168,10 +229,286 @@ LibLDAP_value_free(void **vals)
     PyMem_Free((void *) vals);
 }
 
+/* module state from the module itself (module functions) or from an
+   instance of one of its types, subclasses included */
+LibLDAPState_t *
+LibLDAP_state(PyObject *o)
+{
+    PyObject *m;
+
+    if (PyModule_Check(o))
+	m = o;
+    else {
+#if PY_VERSION_HEX >= 0x030B0000
+	m = PyType_GetModuleByDef(Py_TYPE(o), &LibLDAPModule);
+#else
+	PyObject *mro = Py_TYPE(o)->tp_mro;
+	Py_ssize_t i;
+
+	for (i = 0, m = NULL; !m && i < PyTuple_GET_SIZE(mro); i++) {
+	    PyTypeObject *base = (PyTypeObject *) PyTuple_GET_ITEM(mro, i);
+
+	    if (!PyType_HasFeature(base, Py_TPFLAGS_HEAPTYPE))
+		continue;
+	    m = PyType_GetModule(base);
+	    if (!m)
+		PyErr_Clear();
+	    else if (PyModule_GetDef(m) != &LibLDAPModule)
+		m = NULL;
+	}
+#endif
+    }
+    return (LibLDAPState_t *) PyModule_GetState(m);
+}
+
+double
+LibLDAP_monotonic(void)
+{
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/* PyArg_ParseTupleAndKeywords() for METH_FASTCALL | METH_KEYWORDS methods
+   (vectorcall): arguments are taken from the C array `args' (`nargs'
+   positional ones followed by the values of the keywords `kwnames'),
+   without building a tuple and a dictionary. Only the format units used
+   by the module are supported: s, s#, z, z#, i, I, d, O, O!, O& and |.
+   `func' names the method in error messages. Returns 1 on success, 0 on
+   error */
+int
+LibLDAP_parse_args(
+    const char *func, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames, const char *format, char **kwlist, ...
+    )
+{
+    PyObject *objs[LIBLDAP_ARGS_MAX], *o;
+    Py_ssize_t i, k, n, nkw = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+    const char *f;
+    int optional = 0, ret = 0;
+    va_list va;
+
+    for (n = 0; kwlist[n]; n++) {
+	if (n == LIBLDAP_ARGS_MAX) {
+	    (void) PyErr_Format(
+		PyExc_SystemError, "%s(): too many arguments to parse", func);
+	    return 0;
+	}
+	objs[n] = NULL;
+    }
+    if (nargs > n) {
+	(void) PyErr_Format(
+	    PyExc_TypeError, "%s() takes at most %zd arguments (%zd given)",
+	    func, n, nargs
+	    );
+	return 0;
+    }
+    for (i = 0; i < nargs; i++)
+	objs[i] = args[i];
+    for (i = 0; i < nkw; i++) {
+	const char *key = PyUnicode_AsUTF8(PyTuple_GET_ITEM(kwnames, i));
+
+	if (!key)
+	    return 0;
+	for (k = 0; k < n && strcmp(key, kwlist[k]); k++)
+	    ;
+	if (k == n) {
+	    (void) PyErr_Format(
+		PyExc_TypeError, "%s(): `%s' is an invalid keyword argument",
+		func, key
+		);
+	    return 0;
+	}
+	if (objs[k]) {
+	    (void) PyErr_Format(
+		PyExc_TypeError,
+		"%s(): argument `%s' given by name and position", func, key
+		);
+	    return 0;
+	}
+	objs[k] = args[nargs + i];
+    }
+    /* every unit consumes its pointers, whether its argument is given or
+       not */
+    va_start(va, kwlist);
+    for (f = format, k = 0; *f; f++, k++) {
+	if (*f == '|') {
+	    optional = 1;
+	    k--;
+	    continue;
+	}
+	o = objs[k];
+	if (!o && !optional) {
+	    (void) PyErr_Format(
+		PyExc_TypeError,
+		"%s(): missing required argument `%s' (pos %zd)", func,
+		kwlist[k], k + 1
+		);
+	    goto done;
+	}
+	switch (*f) {
+	case 's':
+	case 'z':
+	{
+	    const char **p = va_arg(va, const char **), *s = NULL;
+	    Py_ssize_t *plen = NULL, len = 0;
+
+	    if (f[1] == '#')
+		plen = va_arg(va, Py_ssize_t *);
+	    if (!o)
+		;
+	    else if (*f == 'z' && o == Py_None)
+		s = NULL;
+	    else if (PyUnicode_Check(o)) {
+		s = PyUnicode_AsUTF8AndSize(o, &len);
+		if (!s)
+		    goto done;
+	    }
+	    else if (plen && PyBytes_Check(o)) {
+		s = PyBytes_AS_STRING(o);
+		len = PyBytes_GET_SIZE(o);
+	    }
+	    else {
+		(void) PyErr_Format(
+		    PyExc_TypeError, "%s(): argument `%s' must be %s, not %s",
+		    func, kwlist[k], *f == 'z' ? "str or None" : "str",
+		    Py_TYPE(o)->tp_name
+		    );
+		goto done;
+	    }
+	    if (o && !plen && s && strlen(s) != (size_t) len) {
+		(void) PyErr_Format(
+		    PyExc_ValueError, "%s(): argument `%s': embedded null "
+		    "character", func, kwlist[k]
+		    );
+		goto done;
+	    }
+	    if (o) {
+		*p = s;
+		if (plen)
+		    *plen = len;
+	    }
+	    if (plen)
+		f++;
+	    break;
+	}
+	case 'i':
+	{
+	    int *p = va_arg(va, int *);
+	    long l;
+
+	    if (!o)
+		break;
+	    l = PyLong_AsLong(o);
+	    if (l == -1 && PyErr_Occurred())
+		goto done;
+	    if (l < INT_MIN || l > INT_MAX) {
+		(void) PyErr_Format(
+		    PyExc_OverflowError, "%s(): argument `%s' out of range",
+		    func, kwlist[k]
+		    );
+		goto done;
+	    }
+	    *p = (int) l;
+	    break;
+	}
+	case 'I':
+	{
+	    unsigned int *p = va_arg(va, unsigned int *);
+	    unsigned long l;
+
+	    if (!o)
+		break;
+	    l = PyLong_AsUnsignedLongMask(o);
+	    if (l == (unsigned long) -1 && PyErr_Occurred())
+		goto done;
+	    *p = (unsigned int) l;
+	    break;
+	}
+	case 'd':
+	{
+	    double *p = va_arg(va, double *), d;
+
+	    if (!o)
+		break;
+	    d = PyFloat_CheckExact(o) ? PyFloat_AS_DOUBLE(o) :
+		PyFloat_AsDouble(o);
+	    if (d == -1.0 && PyErr_Occurred())
+		goto done;
+	    *p = d;
+	    break;
+	}
+	case 'O':
+	    if (f[1] == '!') {
+		PyTypeObject *type = va_arg(va, PyTypeObject *);
+		PyObject **p = va_arg(va, PyObject **);
+
+		f++;
+		if (!o)
+		    break;
+		if (!PyObject_TypeCheck(o, type)) {
+		    (void) PyErr_Format(
+			PyExc_TypeError,
+			"%s(): argument `%s' must be %s, not %s", func,
+			kwlist[k], type->tp_name, Py_TYPE(o)->tp_name
+			);
+		    goto done;
+		}
+		*p = o;
+	    }
+	    else if (f[1] == '&') {
+		int (*converter)(PyObject *, void *) =
+		    va_arg(va, int (*)(PyObject *, void *));
+		void *p = va_arg(va, void *);
+
+		f++;
+		if (o && !converter(o, p))
+		    goto done;
+	    }
+	    else {
+		PyObject **p = va_arg(va, PyObject **);
+
+		if (o)
+		    *p = o;
+	    }
+	    break;
+	default:
+	    (void) PyErr_Format(
+		PyExc_SystemError, "%s(): `%c': unsupported format unit",
+		func, *f
+		);
+	    goto done;
+	}
+    }
+    ret = 1;
+  done:
+    va_end(va);
+    return ret;
+}
+
 /*****************************************************************************
  * LOCAL FUNCTION DEFINITIONS
  *****************************************************************************/
 
+/* creates the heap type of `spec' for module `m', adds it to the module
+   under the last component of its name and stores it in `*type' */
+static int
+LibLDAP_add_type(PyObject *m, PyType_Spec *spec, PyTypeObject **type)
+{
+    const char *name = strrchr(spec->name, '.') + 1;
+
+    *type = (PyTypeObject *) PyType_FromModuleAndSpec(m, spec, NULL);
+    if (!*type)
+	return -1;
+    Py_INCREF(*type);
+    if (PyModule_AddObject(m, name, (PyObject *) *type) < 0) {
+	Py_DECREF(*type);
+	return -1;
+    }
+    return 0;
+}
+
 static int
 LibLDAP_add_constants(PyObject *m)
 {
@@ -189,6 +526,12 @@ LibLDAP_add_constants(PyObject *m)
 	return -1;
     if (PyModule_AddIntMacro(m, LDAP_NO_LIMIT) < 0)
 	return -1;
+    if (PyModule_AddIntMacro(m, LDAP_OPT_NETWORK_TIMEOUT) < 0)
+	return -1;
+    if (PyModule_AddIntMacro(m, LDAP_OPT_CONNECT_ASYNC) < 0)
+	return -1;
+    if (PyModule_AddIntMacro(m, LDAP_OPT_REFERRALS) < 0)
+	return -1;
     if (PyModule_AddIntMacro(m, LDAP_OPT_X_TLS_REQUIRE_CERT) < 0)
 	return -1;
     if (PyModule_AddIntMacro(m, LDAP_OPT_X_TLS_NEVER) < 0)
@@ -201,6 +544,20 @@ LibLDAP_add_constants(PyObject *m)
 	return -1;
     if (PyModule_AddIntMacro(m, LDAP_OPT_X_TLS_TRY) < 0)
 	return -1;
+    if (PyModule_AddIntMacro(m, LDAP_OPT_X_TLS_PROTOCOL_MIN) < 0)
+	return -1;
+    if (PyModule_AddIntMacro(m, LDAP_OPT_X_TLS_CACERTFILE) < 0)
+	return -1;
+    if (PyModule_AddIntMacro(m, LDAP_OPT_X_TLS_CACERTDIR) < 0)
+	return -1;
+    if (PyModule_AddIntMacro(m, LDAP_OPT_X_TLS_CERTFILE) < 0)
+	return -1;
+    if (PyModule_AddIntMacro(m, LDAP_OPT_X_TLS_KEYFILE) < 0)
+	return -1;
+    if (PyModule_AddIntMacro(m, LDAP_OPT_X_TLS_CIPHER_SUITE) < 0)
+	return -1;
+    if (PyModule_AddIntMacro(m, LDAP_OPT_X_TLS_NEWCTX) < 0)
+	return -1;
 #ifdef __HAVE_SASL__
     if (PyModule_AddIntMacro(m, LDAP_OPT_X_SASL_MECH) < 0)
 	return -1;
@@ -217,6 +574,12 @@ LibLDAP_add_constants(PyObject *m)
 	return -1;
     if (PyModule_AddIntMacro(m, LDAP_AUTH_SIMPLE) < 0)
 	return -1;
+    if (PyModule_AddIntMacro(m, LDAP_RES_ANY) < 0)
+	return -1;
+    if (PyModule_AddIntMacro(m, LDAP_COMPARE_FALSE) < 0)
+	return -1;
+    if (PyModule_AddIntMacro(m, LDAP_COMPARE_TRUE) < 0)
+	return -1;
     if (PyModule_AddStringConstant(
 	    m, "LDAP_SCHEMA_BASE", LibLDAPSchemaBase) < 0)
 	return -1;
@@ -261,8 +624,12 @@ LibLDAP_add_constants(PyObject *m)
 	return -1;
     if (PyModule_AddIntMacro(m, LDAP_SASL_QUIET) < 0)
 	return -1;
-    if (PyModule_AddObject(m, "LDAP_SASL_SIMPLE", Py_None) < 0)
+    /* PyModule_AddObject() steals the reference on success only */
+    Py_INCREF(Py_None);
+    if (PyModule_AddObject(m, "LDAP_SASL_SIMPLE", Py_None) < 0) {
+	Py_DECREF(Py_None);
 	return -1;
+    }
 #endif /* __HAVE_SASL__ */
     return 0;
 }
@@ -12,18 +12,61 @@
 #define LibLDAPSchemaBase "cn=Subschema"
 #define LDAPObjName(o) (((PyObject *) (o))->ob_type->tp_name)
 
+/* exception of the module of `o', a module object or an instance of one
+   of its types */
+#define LibLDAPErr(o) (LibLDAP_state((PyObject *) (o))->error)
+
+/* per object locking of the free-threaded build, no-ops before 3.13 */
+#ifndef Py_BEGIN_CRITICAL_SECTION
+#define Py_BEGIN_CRITICAL_SECTION(op) {
+#define Py_END_CRITICAL_SECTION() }
+#endif
+#ifndef Py_BEGIN_CRITICAL_SECTION2
+#define Py_BEGIN_CRITICAL_SECTION2(a, b) {
+#define Py_END_CRITICAL_SECTION2() }
+#endif
+
+#ifndef Py_TPFLAGS_IMMUTABLETYPE
+#define Py_TPFLAGS_IMMUTABLETYPE 0
+#endif
+
+/* most arguments a method parsed by LibLDAP_parse_args() takes */
+#define LIBLDAP_ARGS_MAX 16
+
+/* METH_FASTCALL function (PyCFunctionFast, public as of 3.13 only) */
+typedef PyObject *(*LibLDAPFast_t)(
+    PyObject *, PyObject *const *, Py_ssize_t);
+
+/*****************************************************************************
+ * MODULE STATE
+ *****************************************************************************/
+
+typedef struct {
+    PyObject     *error;		/* LDAPError */
+    PyTypeObject *ldap_type;		/* LDAP_ */
+    PyTypeObject *mod_type;		/* LDAPMod */
+    PyTypeObject *control_type;		/* LDAPControl */
+    PyTypeObject *controls_type;	/* LDAPControls */
+    PyTypeObject *cq_type;		/* CompletionQueue */
+    PyObject     *mod_free;		/* recycled LDAPMod objects */
+    int           mod_nfree;
+} LibLDAPState_t;
+
 /*****************************************************************************
  * GLOBAL VARIABLES
  *****************************************************************************/
 
-#ifndef __LIBLDAP_DARWIN__
-PyObject *LibLDAPErr;
-#endif
+extern struct PyModuleDef LibLDAPModule;
 
 /*****************************************************************************
  * GLOBAL FUNCTION DECLARATIONS
  *****************************************************************************/
 
+LibLDAPState_t *LibLDAP_state(PyObject *);
 void LibLDAP_value_free(void **);
+double LibLDAP_monotonic(void);
+int LibLDAP_parse_args(
+    const char *, PyObject *const *, Py_ssize_t, PyObject *, const char *,
+    char **, ...);
 
 #endif /* LIBLDAP_H */
@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+
+"""Per-call overhead of LDAP_ methods and of the LDAPMod constructor.
+
+Two kinds of calls are timed:
+
+  - local calls, which never reach the network (get_option(), LDAPMod(),
+    LDAPMods(), create_proxy_authz_control()): their cost is the method
+    call itself, argument parsing included,
+  - round trips (simple_bind_s(), compare_ext_s(), base scope
+    search_ext_s(), add_ext_s()) answered at once by a forked responder over a
+    socketpair, as by a local replica: no server, no network stack.
+
+Arguments are passed the way applications do, positional and keywords
+mixed. The time per call is the median of --repeat runs of --calls
+calls each. A run saved with --output can be given back as --baseline
+to print the difference, e.g. before and after a change:
+
+  $ git checkout HEAD~1 && python3 setup.py build
+  $ python3 bench/call_overhead.py --output before.json
+  $ git checkout - && python3 setup.py build
+  $ python3 bench/call_overhead.py --baseline before.json
+"""
+
+import argparse, json, os, platform, signal, socket, sys, time
+
+HERE = os.path.abspath(os.path.dirname(__file__))
+sys.path.insert(0, os.path.dirname(HERE))
+sys.path.insert(0, HERE)
+
+from libldap import *
+from decode_bench import (
+    SUFFIX, ber_int, git_revision, message, octets, read_message,
+    search_entry, tlv
+    )
+
+DN = 'uid=alice,ou=people,%s' % SUFFIX
+
+BIND_DONE = tlv(0x61, ber_int(0x0a, 0) + octets('') + octets(''))
+COMPARE_TRUE = tlv(0x6f, ber_int(0x0a, 6) + octets('') + octets(''))
+ADD_DONE = tlv(0x69, ber_int(0x0a, 0) + octets('') + octets(''))
+SEARCH_DONE = tlv(0x65, ber_int(0x0a, 0) + octets('') + octets(''))
+ENTRY = search_entry(DN, [('uid', ['alice'])])
+ATTRS = {
+    'objectClass': ['top', 'person', 'inetOrgPerson'],
+    'uid': ['alice'], 'cn': ['Alice Liddell'], 'sn': ['Liddell'],
+    'givenName': ['Alice'], 'mail': ['alice@example.com'],
+    'telephoneNumber': ['+1 555 0100'], 'description': ['imported'],
+    }
+
+def responder(sock):
+    buf = b''
+    while True:
+        msg = read_message(sock, buf)
+        if msg is None:
+            return
+        msgid, tag, buf = msg
+        if tag == 0x42:         # UnbindRequest
+            return
+        if tag == 0x60:         # BindRequest
+            sock.sendall(message(msgid, BIND_DONE))
+        elif tag == 0x68:       # AddRequest
+            sock.sendall(message(msgid, ADD_DONE))
+        elif tag == 0x6e:       # CompareRequest
+            sock.sendall(message(msgid, COMPARE_TRUE))
+        elif tag == 0x63:       # SearchRequest
+            sock.sendall(message(msgid, ENTRY) + message(msgid, SEARCH_DONE))
+
+def calls(l):
+    """name -> (function, round trip)"""
+    return {
+        'get_option': (
+            lambda: l.get_option(LDAP_OPT_PROTOCOL_VERSION), False),
+        'LDAPMod': (
+            lambda: LDAPMod(LDAP_MOD_REPLACE, 'description', ['x']), False),
+        'LDAPMods': (lambda: LDAPMods(LDAP_MOD_ADD, **ATTRS), False),
+        'create_proxy_authz_control': (
+            lambda: l.create_proxy_authz_control('dn:%s' % DN), False),
+        'simple_bind_s': (
+            lambda: l.simple_bind_s(DN, 'secret'), True),
+        'compare_ext_s': (
+            lambda: l.compare_ext_s(DN, 'uid', 'alice'), True),
+        'search_ext_s': (
+            lambda: l.search_ext_s(
+                DN, scope=LDAP_SCOPE_BASE, attrs=['uid'], timeout=5.0),
+            True),
+        'add_ext_s': (
+            lambda: l.add_ext_s(DN, LDAPMods(LDAP_MOD_ADD, **ATTRS)), True),
+        }
+
+def measure(f, n, repeat):
+    """Median time per call in seconds"""
+    runs = []
+    for i in range(repeat):
+        start = time.perf_counter()
+        for j in range(n):
+            f()
+        runs.append((time.perf_counter() - start) / n)
+    return sorted(runs)[repeat // 2]
+
+def bench(args):
+    parent, child = socket.socketpair()
+    pid = os.fork()
+    if not pid:
+        parent.close()
+        try:
+            responder(child)
+        finally:
+            os._exit(0)
+    child.close()
+    try:
+        l = LDAP('ldap://overhead.bench', fd=parent.detach())
+        ret = {}
+        for name, (f, trip) in calls(l).items():
+            n = args.calls // 10 if trip else args.calls
+            for i in range(min(n, 100)):
+                f()
+            ret[name] = {
+                'round_trip': trip, 'calls': n,
+                'seconds': measure(f, n, args.repeat)
+                }
+        l.unbind_s()
+    except BaseException:
+        os.kill(pid, signal.SIGTERM)
+        raise
+    finally:
+        os.waitpid(pid, 0)
+    return ret
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument(
+        '--calls', type=int, default=200000,
+        help='local calls per run, a tenth for round trips '
+        '(default: %(default)s)'
+        )
+    parser.add_argument(
+        '--repeat', type=int, default=5,
+        help='runs per call, the median is kept (default: %(default)s)'
+        )
+    parser.add_argument('--output', default=None, help='JSON output file')
+    parser.add_argument(
+        '--baseline', default=None,
+        help='JSON output of a previous run to compare with'
+        )
+    args = parser.parse_args()
+    if args.calls < 10 or args.repeat < 1:
+        parser.error('--calls must be at least 10, --repeat positive')
+    results = {
+        'date': time.strftime('%Y-%m-%dT%H:%M:%SZ', time.gmtime()),
+        'revision': git_revision(),
+        'python': platform.python_version(),
+        'platform': platform.platform(),
+        'calls': bench(args)
+        }
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+    base = {}
+    if args.baseline:
+        with open(args.baseline) as f:
+            base = json.load(f)['calls']
+    print('%-28s %12s %12s %9s' % ('call', 'ns/call', 'baseline', 'delta'))
+    for name, r in results['calls'].items():
+        ns = r['seconds'] * 1e9
+        if name in base:
+            b = base[name]['seconds'] * 1e9
+            print('%-28s %12.0f %12.0f %+8.1f%%' % (
+                name, ns, b, (ns - b) / b * 100))
+        else:
+            print('%-28s %12.0f %12s %9s' % (name, ns, '-', '-'))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,270 @@
+#!/usr/bin/env python3
+
+"""Server-less benchmark of the conversion of search results to Python.
+
+A forked responder answers every search request sent over a socketpair
+with canned, synthetic BER encoded SearchResultEntry messages followed
+by a SearchResultDone. The client side of the socketpair is handed to
+libldap with LDAP(uri, fd=...), so no server, no network stack and no
+DIT is involved: the numbers only depend on the decoding of the
+messages by liblber and on the building of the Python result.
+
+Phases are measured by the profiling of search_ext_s() (see
+LDAPObject.profile): `decode' is the time spent in liblber/libldap
+accessors, `build' the time spent creating Python objects. Both are
+reported per search, with wall time percentiles and throughput, for
+each of the following entry shapes (see SHAPES):
+
+  - small: many entries with many small single valued attributes,
+  - member: a single group with a huge multi-valued `member',
+  - binary: a few entries with large blobs,
+  - utf8: entries with non-ASCII values.
+
+  $ python3 setup.py build
+  $ python3 bench/decode_bench.py --iterations 500 --output decode.json
+"""
+
+import argparse, json, os, platform, signal, socket, subprocess, sys, time
+
+HERE = os.path.abspath(os.path.dirname(__file__))
+sys.path.insert(0, os.path.dirname(HERE))
+
+from libldap import *
+
+SUFFIX = 'dc=bench,dc=test'
+
+# BER encoding (definite lengths only, as used by LDAP)
+
+def ber_len(n):
+    if n < 0x80:
+        return bytes((n,))
+    b = n.to_bytes((n.bit_length() + 7) // 8, 'big')
+    return bytes((0x80 | len(b),)) + b
+
+def tlv(tag, value):
+    return bytes((tag,)) + ber_len(len(value)) + value
+
+def ber_int(tag, n):
+    return tlv(tag, n.to_bytes(n.bit_length() // 8 + 1, 'big', signed=True))
+
+def octets(s):
+    return tlv(0x04, s if isinstance(s, bytes) else s.encode('utf-8'))
+
+def search_entry(dn, attrs):
+    """SearchResultEntry protocol op, attrs is a list of (type, values)"""
+    return tlv(0x64, octets(dn) + tlv(0x30, b''.join(
+        tlv(0x30, octets(a) + tlv(0x31, b''.join(octets(v) for v in vals)))
+        for a, vals in attrs
+        )))
+
+SEARCH_DONE = tlv(0x65, ber_int(0x0a, 0) + octets('') + octets(''))
+
+def message(msgid, op):
+    return tlv(0x30, ber_int(0x02, msgid) + op)
+
+def read_message(sock, buf):
+    """Returns (msgid, protocol op tag, remaining buffer) or None on EOF"""
+    while True:
+        if len(buf) >= 2:
+            hdr, n = 2, buf[1]
+            if n & 0x80:
+                hdr += n & 0x7f
+                n = int.from_bytes(buf[2:hdr], 'big')
+            if len(buf) >= hdr + n:
+                body, buf = buf[hdr:hdr + n], buf[hdr + n:]
+                idlen = body[1]
+                msgid = int.from_bytes(body[2:2 + idlen], 'big')
+                return msgid, body[2 + idlen], buf
+        data = sock.recv(65536)
+        if not data:
+            return None
+        buf += data
+
+# entry shapes: name -> function(scale) -> list of (dn, attrs)
+
+def shape_small(scale):
+    return [
+        ('uid=user%d,ou=people,%s' % (i, SUFFIX),
+         [('objectClass', ['top', 'person', 'inetOrgPerson'])] +
+         [('attr%d' % j, ['value %d of entry %d' % (j, i)])
+          for j in range(40)])
+        for i in range(200 * scale)
+        ]
+
+def shape_member(scale):
+    return [
+        ('cn=everybody,ou=groups,%s' % SUFFIX,
+         [('objectClass', ['top', 'groupOfNames']), ('cn', ['everybody']),
+          ('member', ['uid=user%d,ou=people,%s' % (i, SUFFIX)
+                      for i in range(50000 * scale)])])
+        ]
+
+def shape_binary(scale):
+    # values are returned as str, blobs are limited to bytes which are
+    # valid NUL free UTF-8
+    blob = bytes(1 + i % 127 for i in range(65536))
+    return [
+        ('uid=user%d,ou=people,%s' % (i, SUFFIX),
+         [('objectClass', ['top', 'inetOrgPerson']), ('jpegPhoto', [blob]),
+          ('userCertificate', [blob[:2048], blob[2048:4096]])])
+        for i in range(50 * scale)
+        ]
+
+def shape_utf8(scale):
+    words = ('Ærøskøbing', 'Ελληνικά', 'Русский', '日本語のテキスト',
+             'العربية', 'Ünïcödé', '한국어', 'emoji 😀🚀')
+    return [
+        ('cn=%s %d,ou=people,%s' % (words[i % len(words)], i, SUFFIX),
+         [('objectClass', ['top', 'person'])] +
+         [('attr%d' % j, [words[(i + j + k) % len(words)] for k in range(3)])
+          for j in range(10)])
+        for i in range(500 * scale)
+        ]
+
+SHAPES = {
+    'small': shape_small,
+    'member': shape_member,
+    'binary': shape_binary,
+    'utf8': shape_utf8
+    }
+
+def responder(sock, entries):
+    ops = [search_entry(dn, attrs) for dn, attrs in entries]
+    buf = b''
+    while True:
+        msg = read_message(sock, buf)
+        if msg is None:
+            return
+        msgid, tag, buf = msg
+        if tag == 0x42:         # UnbindRequest
+            return
+        if tag != 0x63:         # SearchRequest
+            continue
+        sock.sendall(b''.join(message(msgid, op) for op in ops) +
+                     message(msgid, SEARCH_DONE))
+
+def percentiles(samples):
+    if not samples:
+        return {}
+    samples = sorted(samples)
+    n = len(samples)
+    ret = {'min': samples[0], 'max': samples[-1], 'mean': sum(samples) / n}
+    for p in (50, 90, 99):
+        ret['p%s' % p] = samples[min(n - 1, int(n * p / 100))]
+    return ret
+
+def bench_shape(name, args):
+    entries = SHAPES[name](args.scale)
+    nvalues = sum(len(vals) for dn, attrs in entries for a, vals in attrs)
+    nbytes = sum(
+        len(dn.encode('utf-8')) + sum(
+            len(v if isinstance(v, bytes) else v.encode('utf-8'))
+            for a, vals in attrs for v in vals)
+        for dn, attrs in entries
+        )
+    parent, child = socket.socketpair()
+    pid = os.fork()
+    if not pid:
+        # libldap holds the GIL while waiting for results: the responder
+        # must not be a thread of this process
+        parent.close()
+        try:
+            responder(child, entries)
+        finally:
+            os._exit(0)
+    child.close()
+    try:
+        l = LDAP('ldap://decode.bench', fd=parent.detach())
+        l.profile = True
+        for i in range(args.warmup):
+            l.search_ext_s(SUFFIX)
+        l.get_profile(reset=True)
+        walls, decode, build = [], [], []
+        for i in range(args.iterations):
+            start = time.perf_counter()
+            res = l.search_ext_s(SUFFIX)
+            walls.append(time.perf_counter() - start)
+            last = l.get_profile()['last']
+            decode.append(last['decode'])
+            build.append(last['build'])
+            if len(res) != len(entries):
+                raise RuntimeError(
+                    '%s: %d entries instead of %d' % (
+                        name, len(res), len(entries))
+                    )
+            del res
+        del l
+    except BaseException:
+        os.kill(pid, signal.SIGTERM)
+        raise
+    finally:
+        os.waitpid(pid, 0)
+    conv = sum(decode) + sum(build)
+    return {
+        'shape': name,
+        'entries': len(entries),
+        'values': nvalues,
+        'bytes': nbytes,
+        'iterations': args.iterations,
+        'wall': percentiles(walls),
+        'decode': percentiles(decode),
+        'build': percentiles(build),
+        'entries_per_sec': len(entries) * args.iterations / conv,
+        'values_per_sec': nvalues * args.iterations / conv,
+        'bytes_per_sec': nbytes * args.iterations / conv
+        }
+
+def git_revision():
+    try:
+        return subprocess.run(
+            ['git', 'rev-parse', 'HEAD'], cwd=HERE, check=True,
+            stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+            universal_newlines=True
+            ).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument(
+        '--shapes', default=','.join(SHAPES),
+        help='comma separated entry shapes (default: %(default)s)'
+        )
+    parser.add_argument(
+        '--iterations', type=int, default=200,
+        help='searches per shape (default: %(default)s)'
+        )
+    parser.add_argument('--warmup', type=int, default=10)
+    parser.add_argument(
+        '--scale', type=int, default=1,
+        help='multiplies the number of entries or values (default: 1)'
+        )
+    parser.add_argument('--output', default=None,
+                        help='JSON output file (default: table on stdout)')
+    args = parser.parse_args()
+    shapes = args.shapes.split(',')
+    for name in shapes:
+        if name not in SHAPES:
+            parser.error('%s: unknown entry shape' % name)
+    results = {
+        'date': time.strftime('%Y-%m-%dT%H:%M:%SZ', time.gmtime()),
+        'revision': git_revision(),
+        'python': platform.python_version(),
+        'platform': platform.platform(),
+        'runs': [bench_shape(name, args) for name in shapes]
+        }
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+        return
+    print('%-8s %8s %9s %10s %10s %10s %12s' % (
+        'shape', 'entries', 'values', 'decode ms', 'build ms', 'wall p50',
+        'MB/s'))
+    for r in results['runs']:
+        print('%-8s %8d %9d %10.3f %10.3f %10.3f %12.1f' % (
+            r['shape'], r['entries'], r['values'], r['decode']['p50'] * 1e3,
+            r['build']['p50'] * 1e3, r['wall']['p50'] * 1e3,
+            r['bytes_per_sec'] / 1e6))
+
+if __name__ == '__main__':
+    main()
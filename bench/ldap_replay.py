@@ -0,0 +1,273 @@
+#!/usr/bin/env python3
+
+"""Replays an operation capture against an LDAP server.
+
+A capture is recorded by the application itself:
+
+  >>> start_capture('/var/tmp/prod.cap')
+  >>> ...
+  >>> stop_capture()
+
+and replayed against a target server, N times faster than recorded,
+keeping the original inter-arrival times:
+
+  $ python3 setup.py build
+  $ python3 bench/ldap_replay.py /var/tmp/prod.cap ldap://staging.test \\
+        --speed 4 --connections 32 --password secret --output replay.json
+
+Operations of each recorded connection are replayed in order on the
+same replay connection. Recorded connections are spread over
+--connections replay connections, each one driven by its own process.
+An operation whose time has come while the previous one on the same
+connection is still running starts late: the lag is reported along
+with throughput, latency percentiles and errors, next to the latencies
+recorded in the capture.
+
+Search, add, modify and delete operations are replayed. Binds are
+replayed as simple binds with --password (passwords are never
+captured) and skipped without it. Password values of adds and
+modifies, not captured either, are replaced by --password or
+'redacted'. Server controls are not replayed, other operations are
+skipped.
+"""
+
+import argparse, json, multiprocessing, os, platform, struct, sys, time
+
+HERE = os.path.abspath(os.path.dirname(__file__))
+sys.path.insert(0, os.path.dirname(HERE))
+
+from libldap import *
+
+MAGIC = b'LDAPCAP1'
+REDACTED = 'redacted'
+HEADER = struct.Struct('<BBHIiIQdd')
+NULL = 0xffffffff
+
+OP_NAMES = {
+    0x60: 'bind', 0x42: 'unbind', 0x63: 'search', 0x66: 'modify',
+    0x68: 'add', 0x4a: 'delete', 0x6c: 'modrdn', 0x6e: 'compare',
+    0x50: 'abandon', 0x77: 'extended'
+    }
+
+class Record(object):
+    __slots__ = (
+        'op', 'scope', 'conn', 'result', 'entries', 'bytes', 'start',
+        'duration', 'dn', 'filter', 'attrs', 'controls', 'mods'
+        )
+
+def parse_record(data):
+    rec = Record()
+    (op, scope, reserved, rec.conn, rec.result, rec.entries, rec.bytes,
+     rec.start, rec.duration) = HEADER.unpack_from(data, 0)
+    rec.op = OP_NAMES.get(op, 'unknown')
+    rec.scope = None if scope == 0xff else scope
+    pos = HEADER.size
+
+    def integer(fmt):
+        nonlocal pos
+        (value,) = struct.unpack_from(fmt, data, pos)
+        pos += struct.calcsize(fmt)
+        return value
+
+    def string():
+        nonlocal pos
+        n = integer('<I')
+        if n == NULL:
+            return None
+        pos += n
+        return data[pos - n:pos].decode('utf-8', 'replace')
+
+    rec.dn = string()
+    rec.filter = string()
+    rec.attrs = [string() for i in range(integer('<H'))] or None
+    rec.controls = [
+        (string(), bool(integer('<B')), string())
+        for i in range(integer('<H'))
+        ]
+    rec.mods = [
+        (integer('<B'), string(), [string() for j in range(integer('<I'))])
+        for i in range(integer('<H'))
+        ]
+    return rec
+
+def read_capture(path):
+    """Yields the records of a capture, a truncated last record (capture
+    not stopped) is ignored"""
+    with open(path, 'rb') as f:
+        if f.read(len(MAGIC)) != MAGIC:
+            raise ValueError('%s: not a capture file' % path)
+        while True:
+            header = f.read(4)
+            if len(header) < 4:
+                return
+            (n,) = struct.unpack('<I', header)
+            data = f.read(n)
+            if len(data) < n:
+                return
+            yield parse_record(data)
+
+def percentiles(samples):
+    if not samples:
+        return {}
+    samples = sorted(samples)
+    n = len(samples)
+    ret = {'min': samples[0], 'max': samples[-1], 'mean': sum(samples) / n}
+    for p in (50, 90, 99, 99.9):
+        ret['p%s' % p] = samples[min(n - 1, int(n * p / 100))]
+    return ret
+
+def execute(l, rec, password):
+    """Returns False if the operation is skipped"""
+    if rec.op == 'search':
+        kwds = {}
+        if rec.dn is not None:
+            kwds['base'] = rec.dn
+        if rec.scope is not None:
+            kwds['scope'] = rec.scope
+        if rec.filter is not None:
+            kwds['filter'] = rec.filter
+        if rec.attrs:
+            kwds['attrs'] = rec.attrs
+        l.search_ext_s(**kwds)
+    elif rec.op in ('add', 'modify'):
+        mods = [
+            LDAPMod(mode, attr, [
+                v if v is not None else
+                REDACTED if password is None else password
+                for v in values
+                ] or None)
+            for mode, attr, values in rec.mods
+            ]
+        if rec.op == 'add':
+            l.add_ext_s(rec.dn, mods)
+        else:
+            l.modify_ext_s(rec.dn, mods)
+    elif rec.op == 'delete':
+        l.delete_ext_s(rec.dn)
+    elif rec.op == 'bind' and password is not None:
+        l.simple_bind_s(rec.dn, password)
+    else:
+        return False
+    return True
+
+def worker(uri, records, t0, speed, password):
+    """Replays `records' on a single connection, from time.time() `t0'"""
+    l = LDAP(uri)
+    stats = {}
+    for rec in records:
+        due = t0 + max(rec.start, 0.0) / speed
+        delay = due - time.time()
+        if delay > 0:
+            time.sleep(delay)
+        start = time.time()
+        try:
+            done = execute(l, rec, password)
+            error = False
+        except LDAPError:
+            done = error = True
+        end = time.time()
+        s = stats.setdefault(
+            rec.op,
+            {'latency': [], 'lag': [], 'errors': 0, 'skipped': 0}
+            )
+        if not done:
+            s['skipped'] += 1
+            continue
+        s['latency'].append(end - start)
+        s['lag'].append(max(start - due, 0.0))
+        s['errors'] += error
+    return stats
+
+def summary(records):
+    ret = {}
+    for rec in records:
+        s = ret.setdefault(rec.op, {'count': 0, 'latency': [], 'errors': 0})
+        s['count'] += 1
+        s['latency'].append(rec.duration)
+        s['errors'] += rec.result != 0
+    for s in ret.values():
+        s['latency'] = percentiles(s['latency'])
+    return ret
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('capture', help='capture file')
+    parser.add_argument(
+        'uri', nargs='?',
+        help='LDAP URI of the target server, print a summary of the capture '
+        'if omitted'
+        )
+    parser.add_argument(
+        '--speed', type=float, default=1.0,
+        help='replay speed factor (default: %(default)s)'
+        )
+    parser.add_argument(
+        '--connections', type=int, default=16,
+        help='maximum number of replay connections (default: %(default)s)'
+        )
+    parser.add_argument(
+        '--password', default=None,
+        help='password of the binds replayed (default: skip binds)'
+        )
+    parser.add_argument('--output', default='-',
+                        help='JSON output file (default: stdout)')
+    args = parser.parse_args()
+    if args.speed <= 0 or args.connections <= 0:
+        parser.error('--speed and --connections must be positive')
+    records = sorted(read_capture(args.capture), key=lambda r: r.start)
+    results = {
+        'date': time.strftime('%Y-%m-%dT%H:%M:%SZ', time.gmtime()),
+        'python': platform.python_version(),
+        'platform': platform.platform(),
+        'capture': args.capture,
+        'records': len(records),
+        'recorded': summary(records)
+        }
+    if args.uri and records:
+        conns = {}
+        for rec in records:
+            conns.setdefault(rec.conn, len(conns))
+        n = min(len(conns), args.connections)
+        groups = [[] for i in range(n)]
+        for rec in records:
+            groups[conns[rec.conn] % n].append(rec)
+        # leave time to the workers to connect before the first operation
+        t0 = time.time() + 0.5
+        with multiprocessing.Pool(n) as pool:
+            outcomes = pool.starmap(
+                worker,
+                [(args.uri, g, t0, args.speed, args.password) for g in groups]
+                )
+        elapsed = time.time() - t0
+        replayed = {}
+        for stats in outcomes:
+            for op, s in stats.items():
+                r = replayed.setdefault(
+                    op, {'latency': [], 'lag': [], 'errors': 0, 'skipped': 0}
+                    )
+                for k in r:
+                    r[k] += s[k]
+        ops = sum(len(r['latency']) for r in replayed.values())
+        lag = [x for r in replayed.values() for x in r['lag']]
+        for r in replayed.values():
+            r['count'] = len(r['latency'])
+            r['latency'] = percentiles(r['latency'])
+            r['lag'] = percentiles(r['lag'])
+        results['replay'] = {
+            'uri': args.uri,
+            'speed': args.speed,
+            'connections': n,
+            'elapsed': elapsed,
+            'throughput': ops / elapsed,
+            'lag': percentiles(lag),
+            'ops': replayed
+            }
+    if args.output == '-':
+        json.dump(results, sys.stdout, indent=2)
+        print()
+    else:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,1959 @@
+/*
+ * ldap_standin: a small LDAPv3 server standing in for a real one in load
+ * tests. It serves an in-memory DIT, loaded from a LDIF file or generated,
+ * on a Unix or TCP socket and answers bind (simple), search, add, modify,
+ * delete, compare and extended (Who am I?) operations. Latency, throughput
+ * and failures are controlled from the command line:
+ *
+ *   -d [op=]ms   fixed delay of operations (all or per operation type)
+ *   -j ms        uniform random jitter added to every delay
+ *   -q ops       throughput cap, in operations per second
+ *   -r prob      probability for a request to reset its connection
+ *   -b prob      probability for an operation to return busy (51)
+ *   -u prob      probability for an operation to return unavailable (52)
+ *   -s seed      seed of random draws
+ *
+ * Random draws are a function of the seed, of the connection number and
+ * of the message ID, so that a run can be replayed with the same faults.
+ * Each request is processed by its own thread: responses to pipelined
+ * requests on a connection are not serialized.
+ *
+ * Build with:
+ *
+ *	cc -O2 -o bench/ldap_standin bench/ldap_standin.c -llber -lpthread
+ *
+ * and run `bench/ldap_standin -h' for the remaining options. The URL to
+ * connect to is printed on the standard output once the server listens,
+ * operation counters are printed as JSON on the standard error on SIGINT
+ * or SIGTERM.
+ */
+
+/*****************************************************************************
+ * INCLUDED FILES & MACRO DEFINITIONS
+ *****************************************************************************/
+
+#include <lber.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <ctype.h>
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STANDIN_MAX_INCOMING		(16 << 20)
+#define STANDIN_DEFAULT_LISTEN		"127.0.0.1:0"
+#define STANDIN_DEFAULT_SUFFIX		"dc=bench,dc=test"
+
+/* protocol operations */
+#define STANDIN_REQ_BIND		0x60UL
+#define STANDIN_REQ_UNBIND		0x42UL
+#define STANDIN_REQ_SEARCH		0x63UL
+#define STANDIN_REQ_MODIFY		0x66UL
+#define STANDIN_REQ_ADD			0x68UL
+#define STANDIN_REQ_DELETE		0x4aUL
+#define STANDIN_REQ_MODDN		0x6cUL
+#define STANDIN_REQ_COMPARE		0x6eUL
+#define STANDIN_REQ_ABANDON		0x50UL
+#define STANDIN_REQ_EXTENDED		0x77UL
+#define STANDIN_RES_SEARCH_ENTRY	0x64UL
+#define STANDIN_TAG_SIMPLE		0x80UL
+#define STANDIN_TAG_EXOP_RES_VALUE	0x8bUL
+
+/* filter choices */
+#define STANDIN_FILTER_AND		0xa0UL
+#define STANDIN_FILTER_OR		0xa1UL
+#define STANDIN_FILTER_NOT		0xa2UL
+#define STANDIN_FILTER_EQUALITY		0xa3UL
+#define STANDIN_FILTER_SUBSTRINGS	0xa4UL
+#define STANDIN_FILTER_GE		0xa5UL
+#define STANDIN_FILTER_LE		0xa6UL
+#define STANDIN_FILTER_PRESENT		0x87UL
+#define STANDIN_FILTER_APPROX		0xa8UL
+#define STANDIN_SUBSTRINGS_INITIAL	0x80UL
+#define STANDIN_SUBSTRINGS_ANY		0x81UL
+#define STANDIN_SUBSTRINGS_FINAL	0x82UL
+
+/* modify operations */
+#define STANDIN_MOD_ADD			0
+#define STANDIN_MOD_DELETE		1
+#define STANDIN_MOD_REPLACE		2
+
+/* result codes */
+#define STANDIN_SUCCESS			0
+#define STANDIN_PROTOCOL_ERROR		2
+#define STANDIN_SIZELIMIT_EXCEEDED	4
+#define STANDIN_COMPARE_FALSE		5
+#define STANDIN_COMPARE_TRUE		6
+#define STANDIN_AUTH_METHOD_NOT_SUPPORTED 7
+#define STANDIN_NO_SUCH_ATTRIBUTE	16
+#define STANDIN_TYPE_OR_VALUE_EXISTS	20
+#define STANDIN_NO_SUCH_OBJECT		32
+#define STANDIN_INVALID_CREDENTIALS	49
+#define STANDIN_BUSY			51
+#define STANDIN_UNAVAILABLE		52
+#define STANDIN_UNWILLING_TO_PERFORM	53
+#define STANDIN_NOT_ALLOWED_ON_NONLEAF	66
+#define STANDIN_ALREADY_EXISTS		68
+#define STANDIN_OTHER			80
+
+#define STANDIN_OID_WHOAMI		"1.3.6.1.4.1.4203.1.11.3"
+
+/* salts of random draws */
+#define STANDIN_DRAW_RESET		1
+#define STANDIN_DRAW_BUSY		2
+#define STANDIN_DRAW_UNAVAILABLE	3
+#define STANDIN_DRAW_JITTER		4
+
+#define standin_count(counter)						\
+    ((void) __atomic_add_fetch(&(counter), 1, __ATOMIC_RELAXED))
+
+/*****************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+    char          *name;
+    struct berval *vals;
+    int            nvals;
+} StandinAttr_t;
+
+typedef struct StandinEntry {
+    char                *dn;
+    char                *ndn;		/* normalized DN */
+    StandinAttr_t       *attrs;
+    int                  nattrs;
+    size_t               children;
+    size_t               index;		/* in standin_dit.entries */
+    struct StandinEntry *next;		/* hash chain */
+} StandinEntry_t;
+
+typedef struct StandinFilter {
+    ber_tag_t             choice;
+    struct berval         attr;
+    struct berval         value;
+    struct berval        *subs;
+    ber_tag_t            *subtags;
+    int                   nsubs;
+    struct StandinFilter *child;	/* and, or and not */
+    struct StandinFilter *next;
+} StandinFilter_t;
+
+typedef struct {
+    int             fd;
+    unsigned long   id;
+    int             refs;
+    char           *bound;		/* DN of the last successful bind */
+    pthread_mutex_t lock;		/* refs, bound and writes */
+} StandinConn_t;
+
+typedef struct {
+    StandinConn_t *conn;
+    BerElement    *ber;
+    ber_int_t      msgid;
+    int            op;			/* index in standin_ops */
+    const char    *diag;
+    struct berval  value;		/* extended response value */
+} StandinReq_t;
+
+typedef struct {
+    char   *buf;
+    size_t  len;
+    size_t  size;
+    int     failed;
+} StandinOut_t;
+
+typedef struct {
+    ber_int_t      op;
+    struct berval  type;
+    struct berval *vals;
+    int            nvals;
+} StandinMod_t;
+
+typedef int (*StandinHandler)(StandinReq_t *, StandinOut_t *);
+
+/*****************************************************************************
+ * LOCAL FUNCTION DECLARATIONS
+ *****************************************************************************/
+
+static int standin_bind(StandinReq_t *, StandinOut_t *);
+static int standin_search(StandinReq_t *, StandinOut_t *);
+static int standin_modify(StandinReq_t *, StandinOut_t *);
+static int standin_add(StandinReq_t *, StandinOut_t *);
+static int standin_delete(StandinReq_t *, StandinOut_t *);
+static int standin_moddn(StandinReq_t *, StandinOut_t *);
+static int standin_compare(StandinReq_t *, StandinOut_t *);
+static int standin_extended(StandinReq_t *, StandinOut_t *);
+
+/*****************************************************************************
+ * LOCAL VARIABLES
+ *****************************************************************************/
+
+static struct {
+    const char     *name;
+    ber_tag_t       req;
+    ber_tag_t       res;		/* 0 if no response */
+    StandinHandler  handler;
+    double          delay;		/* in seconds */
+    unsigned long   count;
+} standin_ops[] = {
+    {"bind", STANDIN_REQ_BIND, 0x61UL, standin_bind, 0.0, 0},
+    {"search", STANDIN_REQ_SEARCH, 0x65UL, standin_search, 0.0, 0},
+    {"modify", STANDIN_REQ_MODIFY, 0x67UL, standin_modify, 0.0, 0},
+    {"add", STANDIN_REQ_ADD, 0x69UL, standin_add, 0.0, 0},
+    {"delete", STANDIN_REQ_DELETE, 0x6bUL, standin_delete, 0.0, 0},
+    {"modrdn", STANDIN_REQ_MODDN, 0x6dUL, standin_moddn, 0.0, 0},
+    {"compare", STANDIN_REQ_COMPARE, 0x6fUL, standin_compare, 0.0, 0},
+    {"extended", STANDIN_REQ_EXTENDED, 0x78UL, standin_extended, 0.0, 0},
+    {"abandon", STANDIN_REQ_ABANDON, 0UL, NULL, 0.0, 0},
+    {"unbind", STANDIN_REQ_UNBIND, 0UL, NULL, 0.0, 0},
+    {NULL, 0UL, 0UL, NULL, 0.0, 0}
+};
+
+static struct {
+    pthread_rwlock_t   lock;
+    StandinEntry_t   **entries;
+    size_t             count;
+    size_t             size;
+    StandinEntry_t   **buckets;
+    size_t             nbuckets;
+} standin_dit = {PTHREAD_RWLOCK_INITIALIZER, NULL, 0, 0, NULL, 0};
+
+static struct {
+    double          jitter;		/* in seconds */
+    double          reset;
+    double          busy;
+    double          unavailable;
+    double          rate;		/* operations per second */
+    uint64_t        seed;
+    double          next;		/* start of the next throughput slot */
+    pthread_mutex_t lock;
+    unsigned long   connections;
+    unsigned long   resets;
+    unsigned long   busies;
+    unsigned long   unavailables;
+} standin = {
+    0.0, 0.0, 0.0, 0.0, 0.0, 0, 0.0, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0
+};
+
+static volatile sig_atomic_t standin_stop = 0;
+
+/*****************************************************************************
+ * LOCAL FUNCTION DEFINITIONS
+ *****************************************************************************/
+
+static void
+standin_fatal(const char *fmt, const char *arg)
+{
+    (void) fprintf(stderr, "ldap_standin: ");
+    (void) fprintf(stderr, fmt, arg);
+    (void) fputc('\n', stderr);
+    exit(1);
+}
+
+static double
+standin_monotonic(void)
+{
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+standin_sleep(double seconds)
+{
+    struct timespec ts;
+
+    if (seconds <= 0.0)
+	return;
+    ts.tv_sec = (time_t) seconds;
+    ts.tv_nsec = (long) ((seconds - ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+	;
+}
+
+/* uniform draw in [0, 1), a function of the seed, the connection, the
+   message ID and the purpose of the draw only (splitmix64) */
+static double
+standin_draw(unsigned long conn, ber_int_t msgid, int salt)
+{
+    uint64_t x = standin.seed ^ ((uint64_t) conn << 32) ^ (uint32_t) msgid;
+
+    x += 0x9e3779b97f4a7c15ULL * (uint64_t) salt;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return (x >> 11) / 9007199254740992.0;
+}
+
+static void
+standin_throttle(void)
+{
+    double now, slot;
+
+    if (standin.rate <= 0.0)
+	return;
+    (void) pthread_mutex_lock(&standin.lock);
+    now = standin_monotonic();
+    slot = standin.next > now ? standin.next : now;
+    standin.next = slot + 1.0 / standin.rate;
+    (void) pthread_mutex_unlock(&standin.lock);
+    standin_sleep(slot - now);
+}
+
+static int
+standin_memcasecmp(const char *s1, const char *s2, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+	int c1 = tolower((unsigned char) s1[i]);
+	int c2 = tolower((unsigned char) s2[i]);
+
+	if (c1 != c2)
+	    return c1 - c2;
+    }
+    return 0;
+}
+
+static const char *
+standin_memcasemem(const char *s, size_t len, const struct berval *sub)
+{
+    size_t i;
+
+    for (i = 0; i + sub->bv_len <= len; i++)
+	if (!standin_memcasecmp(s + i, sub->bv_val, sub->bv_len))
+	    return s + i;
+    return NULL;
+}
+
+static int
+standin_bvcaseeq(const struct berval *bv, const char *s, size_t len)
+{
+    return bv->bv_len == len && !standin_memcasecmp(bv->bv_val, s, len);
+}
+
+static char *
+standin_strndup(const char *s, size_t len)
+{
+    char *ret = malloc(len + 1);
+
+    if (!ret)
+	return NULL;
+    (void) memcpy(ret, s, len);
+    ret[len] = '\0';
+    return ret;
+}
+
+/* lower case DN without spaces around separators */
+static char *
+standin_dn_normalize(const char *dn, size_t len)
+{
+    char *ndn = malloc(len + 1), *p = ndn;
+    size_t i;
+
+    if (!ndn)
+	return NULL;
+    for (i = 0; i < len; i++) {
+	char c = dn[i];
+
+	if (c == '\\' && i + 1 < len) {
+	    *p++ = c;
+	    *p++ = tolower((unsigned char) dn[++i]);
+	    continue;
+	}
+	if (c == ' ' &&
+	    (p == ndn || p[-1] == ',' || p[-1] == '=' || p[-1] == '+'))
+	    continue;
+	if (c == ',' || c == '=' || c == '+')
+	    while (p > ndn && p[-1] == ' ')
+		p--;
+	*p++ = tolower((unsigned char) c);
+    }
+    while (p > ndn && p[-1] == ' ')
+	p--;
+    *p = '\0';
+    return ndn;
+}
+
+static const char *
+standin_dn_parent(const char *ndn)
+{
+    for (; *ndn; ndn++) {
+	if (*ndn == '\\' && ndn[1])
+	    ndn++;
+	else if (*ndn == ',')
+	    return ndn + 1;
+    }
+    return ndn;
+}
+
+static int
+standin_in_scope(const char *ndn, const char *base, ber_int_t scope)
+{
+    size_t len = strlen(ndn), blen = strlen(base);
+
+    switch (scope) {
+    case 0:
+	return !strcmp(ndn, base);
+    case 1:
+	return !strcmp(standin_dn_parent(ndn), base);
+    case 2:
+    case 3:
+	if (!blen)
+	    return scope == 2 || len;
+	if (len == blen)
+	    return scope == 2 && !strcmp(ndn, base);
+	return len > blen && ndn[len - blen - 1] == ',' &&
+	    !strcmp(ndn + len - blen, base);
+    }
+    return 0;
+}
+
+/* entries */
+
+static StandinAttr_t *
+standin_entry_attr(const StandinEntry_t *e, const char *name, size_t len)
+{
+    int i;
+
+    for (i = 0; i < e->nattrs; i++)
+	if (strlen(e->attrs[i].name) == len &&
+	    !standin_memcasecmp(e->attrs[i].name, name, len))
+	    return &e->attrs[i];
+    return NULL;
+}
+
+static int
+standin_attr_find(const StandinAttr_t *a, const struct berval *val)
+{
+    int i;
+
+    for (i = 0; i < a->nvals; i++)
+	if (standin_bvcaseeq(&a->vals[i], val->bv_val, val->bv_len))
+	    return i;
+    return -1;
+}
+
+static int
+standin_entry_add_value(
+    StandinEntry_t *e, const char *name, size_t nlen,
+    const char *val, size_t vlen
+    )
+{
+    StandinAttr_t *a = standin_entry_attr(e, name, nlen);
+    struct berval *vals;
+
+    if (!a) {
+	a = realloc(e->attrs, (e->nattrs + 1) * sizeof(StandinAttr_t));
+	if (!a)
+	    return -1;
+	e->attrs = a;
+	a += e->nattrs;
+	a->name = standin_strndup(name, nlen);
+	if (!a->name)
+	    return -1;
+	a->vals = NULL;
+	a->nvals = 0;
+	e->nattrs++;
+    }
+    vals = realloc(a->vals, (a->nvals + 1) * sizeof(struct berval));
+    if (!vals)
+	return -1;
+    a->vals = vals;
+    vals[a->nvals].bv_val = standin_strndup(val, vlen);
+    if (!vals[a->nvals].bv_val)
+	return -1;
+    vals[a->nvals++].bv_len = vlen;
+    return 0;
+}
+
+static void
+standin_attr_free(StandinAttr_t *a)
+{
+    int i;
+
+    for (i = 0; i < a->nvals; i++)
+	free(a->vals[i].bv_val);
+    free(a->vals);
+    free(a->name);
+}
+
+static void
+standin_entry_remove_attr(StandinEntry_t *e, StandinAttr_t *a)
+{
+    standin_attr_free(a);
+    *a = e->attrs[--e->nattrs];
+}
+
+static void
+standin_entry_free_attrs(StandinEntry_t *e)
+{
+    int i;
+
+    for (i = 0; i < e->nattrs; i++)
+	standin_attr_free(&e->attrs[i]);
+    free(e->attrs);
+    e->attrs = NULL;
+    e->nattrs = 0;
+}
+
+static void
+standin_entry_free(StandinEntry_t *e)
+{
+    if (!e)
+	return;
+    standin_entry_free_attrs(e);
+    free(e->dn);
+    free(e->ndn);
+    free(e);
+}
+
+static StandinEntry_t *
+standin_entry_new(const char *dn, size_t len)
+{
+    StandinEntry_t *e = calloc(1, sizeof(StandinEntry_t));
+
+    if (!e)
+	return NULL;
+    e->dn = standin_strndup(dn, len);
+    e->ndn = standin_dn_normalize(dn, len);
+    if (!e->dn || !e->ndn) {
+	standin_entry_free(e);
+	return NULL;
+    }
+    return e;
+}
+
+static int
+standin_entry_copy_attrs(StandinEntry_t *dst, const StandinEntry_t *src)
+{
+    int i, j;
+
+    for (i = 0; i < src->nattrs; i++) {
+	const StandinAttr_t *a = &src->attrs[i];
+
+	for (j = 0; j < a->nvals; j++)
+	    if (standin_entry_add_value(
+		    dst, a->name, strlen(a->name),
+		    a->vals[j].bv_val, a->vals[j].bv_len) == -1)
+		return -1;
+    }
+    return 0;
+}
+
+/* DIT, callers hold standin_dit.lock */
+
+static size_t
+standin_dit_hash(const char *ndn)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (; *ndn; ndn++)
+	h = (h ^ (unsigned char) *ndn) * 0x100000001b3ULL;
+    return (size_t) h;
+}
+
+static StandinEntry_t *
+standin_dit_find(const char *ndn)
+{
+    StandinEntry_t *e;
+
+    if (!standin_dit.nbuckets)
+	return NULL;
+    e = standin_dit.buckets[standin_dit_hash(ndn) % standin_dit.nbuckets];
+    for (; e; e = e->next)
+	if (!strcmp(e->ndn, ndn))
+	    return e;
+    return NULL;
+}
+
+static int
+standin_dit_rehash(void)
+{
+    size_t i, n = standin_dit.nbuckets ? standin_dit.nbuckets * 2 : 1024;
+    StandinEntry_t **buckets = calloc(n, sizeof(StandinEntry_t *));
+
+    if (!buckets)
+	return -1;
+    for (i = 0; i < standin_dit.count; i++) {
+	StandinEntry_t *e = standin_dit.entries[i];
+	size_t h = standin_dit_hash(e->ndn) % n;
+
+	e->next = buckets[h];
+	buckets[h] = e;
+    }
+    free(standin_dit.buckets);
+    standin_dit.buckets = buckets;
+    standin_dit.nbuckets = n;
+    return 0;
+}
+
+static int
+standin_dit_insert(StandinEntry_t *e)
+{
+    StandinEntry_t *parent;
+    size_t h;
+
+    if (standin_dit.count == standin_dit.size) {
+	size_t size = standin_dit.size ? standin_dit.size * 2 : 1024;
+	StandinEntry_t **entries = realloc(
+	    standin_dit.entries, size * sizeof(StandinEntry_t *));
+
+	if (!entries)
+	    return -1;
+	standin_dit.entries = entries;
+	standin_dit.size = size;
+    }
+    if (standin_dit.count >= standin_dit.nbuckets &&
+	standin_dit_rehash() == -1)
+	return -1;
+    e->index = standin_dit.count;
+    standin_dit.entries[standin_dit.count++] = e;
+    h = standin_dit_hash(e->ndn) % standin_dit.nbuckets;
+    e->next = standin_dit.buckets[h];
+    standin_dit.buckets[h] = e;
+    parent = standin_dit_find(standin_dn_parent(e->ndn));
+    if (parent)
+	parent->children++;
+    return 0;
+}
+
+static void
+standin_dit_remove(StandinEntry_t *e)
+{
+    StandinEntry_t **p, *parent;
+
+    p = &standin_dit.buckets[standin_dit_hash(e->ndn) % standin_dit.nbuckets];
+    while (*p != e)
+	p = &(*p)->next;
+    *p = e->next;
+    standin_dit.entries[e->index] = standin_dit.entries[--standin_dit.count];
+    standin_dit.entries[e->index]->index = e->index;
+    parent = standin_dit_find(standin_dn_parent(e->ndn));
+    if (parent)
+	parent->children--;
+}
+
+/* filters, values point into the request */
+
+static void
+standin_filter_free(StandinFilter_t *f)
+{
+    while (f) {
+	StandinFilter_t *next = f->next;
+
+	standin_filter_free(f->child);
+	free(f->subs);
+	free(f->subtags);
+	free(f);
+	f = next;
+    }
+}
+
+static StandinFilter_t *
+standin_filter_parse(BerElement *ber)
+{
+    StandinFilter_t *f = calloc(1, sizeof(StandinFilter_t)), **tail;
+    ber_len_t len;
+    ber_tag_t tag;
+    char *last;
+
+    if (!f)
+	return NULL;
+    f->choice = ber_peek_tag(ber, &len);
+    switch (f->choice) {
+    case STANDIN_FILTER_AND:
+    case STANDIN_FILTER_OR:
+	tail = &f->child;
+	for (tag = ber_first_element(ber, &len, &last); tag != LBER_DEFAULT;
+	     tag = ber_next_element(ber, &len, last)) {
+	    *tail = standin_filter_parse(ber);
+	    if (!*tail)
+		goto failed;
+	    tail = &(*tail)->next;
+	}
+	break;
+    case STANDIN_FILTER_NOT:
+	if (ber_skip_tag(ber, &len) == LBER_DEFAULT)
+	    goto failed;
+	f->child = standin_filter_parse(ber);
+	if (!f->child)
+	    goto failed;
+	break;
+    case STANDIN_FILTER_EQUALITY:
+    case STANDIN_FILTER_GE:
+    case STANDIN_FILTER_LE:
+    case STANDIN_FILTER_APPROX:
+	if (ber_scanf(ber, "{mm}", &f->attr, &f->value) == LBER_ERROR)
+	    goto failed;
+	break;
+    case STANDIN_FILTER_PRESENT:
+	if (ber_scanf(ber, "m", &f->attr) == LBER_ERROR)
+	    goto failed;
+	break;
+    case STANDIN_FILTER_SUBSTRINGS:
+	if (ber_scanf(ber, "{m", &f->attr) == LBER_ERROR)
+	    goto failed;
+	for (tag = ber_first_element(ber, &len, &last); tag != LBER_DEFAULT;
+	     tag = ber_next_element(ber, &len, last)) {
+	    struct berval *subs = realloc(
+		f->subs, (f->nsubs + 1) * sizeof(struct berval));
+	    ber_tag_t *subtags;
+
+	    if (!subs)
+		goto failed;
+	    f->subs = subs;
+	    subtags = realloc(f->subtags, (f->nsubs + 1) * sizeof(ber_tag_t));
+	    if (!subtags)
+		goto failed;
+	    f->subtags = subtags;
+	    if (ber_scanf(ber, "m", &f->subs[f->nsubs]) == LBER_ERROR)
+		goto failed;
+	    f->subtags[f->nsubs++] = tag;
+	}
+	break;
+    default:
+	/* extensible match: evaluates to undefined (false) */
+	if (ber_scanf(ber, "x") == LBER_ERROR)
+	    goto failed;
+    }
+    return f;
+  failed:
+    standin_filter_free(f);
+    return NULL;
+}
+
+/* values are compared case insensitively, and numerically for ordering
+   when both are numbers */
+static int
+standin_value_cmp(const struct berval *v1, const struct berval *v2)
+{
+    size_t i, n = v1->bv_len < v2->bv_len ? v1->bv_len : v2->bv_len;
+    int numeric = v1->bv_len && v2->bv_len, rc;
+
+    for (i = 0; numeric && i < v1->bv_len; i++)
+	numeric = isdigit((unsigned char) v1->bv_val[i]);
+    for (i = 0; numeric && i < v2->bv_len; i++)
+	numeric = isdigit((unsigned char) v2->bv_val[i]);
+    if (numeric && v1->bv_len != v2->bv_len)
+	return v1->bv_len < v2->bv_len ? -1 : 1;
+    rc = standin_memcasecmp(v1->bv_val, v2->bv_val, n);
+    if (rc || v1->bv_len == v2->bv_len)
+	return rc;
+    return v1->bv_len < v2->bv_len ? -1 : 1;
+}
+
+static int
+standin_substrings_match(const StandinFilter_t *f, const struct berval *v)
+{
+    const char *p = v->bv_val, *end = v->bv_val + v->bv_len;
+    int i;
+
+    for (i = 0; i < f->nsubs; i++) {
+	const struct berval *sub = &f->subs[i];
+
+	if ((size_t) (end - p) < sub->bv_len)
+	    return 0;
+	switch (f->subtags[i]) {
+	case STANDIN_SUBSTRINGS_INITIAL:
+	    if (standin_memcasecmp(p, sub->bv_val, sub->bv_len))
+		return 0;
+	    p += sub->bv_len;
+	    break;
+	case STANDIN_SUBSTRINGS_ANY:
+	    p = standin_memcasemem(p, end - p, sub);
+	    if (!p)
+		return 0;
+	    p += sub->bv_len;
+	    break;
+	case STANDIN_SUBSTRINGS_FINAL:
+	    if (standin_memcasecmp(end - sub->bv_len, sub->bv_val, sub->bv_len))
+		return 0;
+	    p = end;
+	    break;
+	}
+    }
+    return 1;
+}
+
+static int
+standin_filter_match(const StandinFilter_t *f, const StandinEntry_t *e)
+{
+    const StandinFilter_t *child;
+    const StandinAttr_t *a;
+    int i;
+
+    switch (f->choice) {
+    case STANDIN_FILTER_AND:
+	for (child = f->child; child; child = child->next)
+	    if (!standin_filter_match(child, e))
+		return 0;
+	return 1;
+    case STANDIN_FILTER_OR:
+	for (child = f->child; child; child = child->next)
+	    if (standin_filter_match(child, e))
+		return 1;
+	return 0;
+    case STANDIN_FILTER_NOT:
+	return !standin_filter_match(f->child, e);
+    case STANDIN_FILTER_PRESENT:
+	return standin_bvcaseeq(&f->attr, "objectClass", 11) ||
+	    standin_entry_attr(e, f->attr.bv_val, f->attr.bv_len);
+    case STANDIN_FILTER_EQUALITY:
+    case STANDIN_FILTER_APPROX:
+    case STANDIN_FILTER_GE:
+    case STANDIN_FILTER_LE:
+    case STANDIN_FILTER_SUBSTRINGS:
+	a = standin_entry_attr(e, f->attr.bv_val, f->attr.bv_len);
+	for (i = 0; a && i < a->nvals; i++) {
+	    const struct berval *v = &a->vals[i];
+
+	    switch (f->choice) {
+	    case STANDIN_FILTER_GE:
+		if (standin_value_cmp(v, &f->value) >= 0)
+		    return 1;
+		break;
+	    case STANDIN_FILTER_LE:
+		if (standin_value_cmp(v, &f->value) <= 0)
+		    return 1;
+		break;
+	    case STANDIN_FILTER_SUBSTRINGS:
+		if (standin_substrings_match(f, v))
+		    return 1;
+		break;
+	    default:
+		if (!standin_value_cmp(v, &f->value))
+		    return 1;
+	    }
+	}
+    }
+    return 0;
+}
+
+/* responses */
+
+static void
+standin_out_ber(StandinOut_t *out, BerElement *ber, int rc)
+{
+    struct berval bv;
+
+    if (rc == -1 || ber_flatten2(ber, &bv, 0) == -1) {
+	out->failed = 1;
+	ber_free(ber, 1);
+	return;
+    }
+    if (out->len + bv.bv_len > out->size) {
+	size_t size = out->size ? out->size : 4096;
+	char *buf;
+
+	while (size < out->len + bv.bv_len)
+	    size *= 2;
+	buf = realloc(out->buf, size);
+	if (!buf) {
+	    out->failed = 1;
+	    ber_free(ber, 1);
+	    return;
+	}
+	out->buf = buf;
+	out->size = size;
+    }
+    (void) memcpy(out->buf + out->len, bv.bv_val, bv.bv_len);
+    out->len += bv.bv_len;
+    ber_free(ber, 1);
+}
+
+static void
+standin_out_result(StandinOut_t *out, const StandinReq_t *req, ber_int_t code)
+{
+    BerElement *ber = ber_alloc_t(LBER_USE_DER);
+    int rc;
+
+    if (!ber) {
+	out->failed = 1;
+	return;
+    }
+    rc = ber_printf(
+	ber, "{it{ess", req->msgid, standin_ops[req->op].res, code, "",
+	req->diag ? req->diag : "");
+    if (rc != -1 && req->value.bv_val)
+	rc = ber_printf(ber, "tO", STANDIN_TAG_EXOP_RES_VALUE, &req->value);
+    if (rc != -1)
+	rc = ber_printf(ber, "}}");
+    standin_out_ber(out, ber, rc);
+}
+
+static int
+standin_attr_requested(const char *name, struct berval *attrs, int nattrs)
+{
+    int i;
+
+    if (!nattrs)
+	return 1;
+    for (i = 0; i < nattrs; i++)
+	if (standin_bvcaseeq(&attrs[i], "*", 1) ||
+	    standin_bvcaseeq(&attrs[i], name, strlen(name)))
+	    return 1;
+    return 0;
+}
+
+static void
+standin_out_entry(
+    StandinOut_t *out, const StandinReq_t *req, const StandinEntry_t *e,
+    struct berval *attrs, int nattrs, int typesonly
+    )
+{
+    BerElement *ber = ber_alloc_t(LBER_USE_DER);
+    int i, j, rc;
+
+    if (!ber) {
+	out->failed = 1;
+	return;
+    }
+    rc = ber_printf(
+	ber, "{it{s{", req->msgid, STANDIN_RES_SEARCH_ENTRY, e->dn);
+    for (i = 0; rc != -1 && i < e->nattrs; i++) {
+	const StandinAttr_t *a = &e->attrs[i];
+
+	if (!standin_attr_requested(a->name, attrs, nattrs))
+	    continue;
+	rc = ber_printf(ber, "{s[", a->name);
+	for (j = 0; rc != -1 && !typesonly && j < a->nvals; j++)
+	    rc = ber_printf(ber, "O", &a->vals[j]);
+	if (rc != -1)
+	    rc = ber_printf(ber, "]}");
+    }
+    if (rc != -1)
+	rc = ber_printf(ber, "}}}");
+    standin_out_ber(out, ber, rc);
+}
+
+/* root DSE, generated on the fly */
+static void
+standin_out_root(
+    StandinOut_t *out, const StandinReq_t *req, struct berval *attrs,
+    int nattrs, int typesonly
+    )
+{
+    StandinEntry_t root = {"", "", NULL, 0, 0, 0, NULL};
+    size_t i;
+    int rc = 0;
+
+    for (i = 0; rc != -1 && i < standin_dit.count; i++) {
+	const StandinEntry_t *e = standin_dit.entries[i];
+
+	if (!standin_dit_find(standin_dn_parent(e->ndn)))
+	    rc = standin_entry_add_value(
+		&root, "namingContexts", 14, e->dn, strlen(e->dn));
+    }
+    if (rc != -1)
+	rc = standin_entry_add_value(&root, "supportedLDAPVersion", 20, "3", 1);
+    if (rc != -1)
+	rc = standin_entry_add_value(
+	    &root, "supportedExtension", 18, STANDIN_OID_WHOAMI,
+	    strlen(STANDIN_OID_WHOAMI));
+    if (rc != -1)
+	rc = standin_entry_add_value(
+	    &root, "vendorName", 10, "ldap_standin", 12);
+    if (rc == -1)
+	out->failed = 1;
+    else
+	standin_out_entry(out, req, &root, attrs, nattrs, typesonly);
+    standin_entry_free_attrs(&root);
+}
+
+static void
+standin_send(StandinConn_t *conn, const StandinOut_t *out)
+{
+    size_t done = 0;
+
+    (void) pthread_mutex_lock(&conn->lock);
+    if (out->failed) {
+	/* a truncated response would leave the client waiting */
+	(void) shutdown(conn->fd, SHUT_RDWR);
+	(void) pthread_mutex_unlock(&conn->lock);
+	return;
+    }
+    while (done < out->len) {
+	ssize_t n = write(conn->fd, out->buf + done, out->len - done);
+
+	if (n == -1) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	done += n;
+    }
+    (void) pthread_mutex_unlock(&conn->lock);
+}
+
+/* operations, return a result code or -1 on decoding errors */
+
+static int
+standin_bind(StandinReq_t *req, StandinOut_t *out)
+{
+    StandinConn_t *conn = req->conn;
+    StandinEntry_t *e;
+    StandinAttr_t *a = NULL;
+    struct berval name, cred;
+    ber_int_t version;
+    ber_len_t len;
+    char *ndn, *bound = NULL;
+
+    if (ber_scanf(req->ber, "{im", &version, &name) == LBER_ERROR)
+	return -1;
+    if (version != 3) {
+	req->diag = "only LDAPv3 is supported";
+	return STANDIN_PROTOCOL_ERROR;
+    }
+    if (ber_peek_tag(req->ber, &len) != STANDIN_TAG_SIMPLE) {
+	req->diag = "only simple binds are supported";
+	return STANDIN_AUTH_METHOD_NOT_SUPPORTED;
+    }
+    if (ber_scanf(req->ber, "m", &cred) == LBER_ERROR)
+	return -1;
+    if (name.bv_len) {
+	ndn = standin_dn_normalize(name.bv_val, name.bv_len);
+	if (!ndn)
+	    return STANDIN_OTHER;
+	(void) pthread_rwlock_rdlock(&standin_dit.lock);
+	e = standin_dit_find(ndn);
+	if (e)
+	    a = standin_entry_attr(e, "userPassword", 12);
+	if (a) {
+	    int i;
+
+	    for (i = 0; i < a->nvals; i++)
+		if (a->vals[i].bv_len == cred.bv_len &&
+		    !memcmp(a->vals[i].bv_val, cred.bv_val, cred.bv_len))
+		    break;
+	    if (i < a->nvals)
+		bound = standin_strndup(e->dn, strlen(e->dn));
+	}
+	(void) pthread_rwlock_unlock(&standin_dit.lock);
+	free(ndn);
+	if (!bound)
+	    return STANDIN_INVALID_CREDENTIALS;
+    }
+    (void) pthread_mutex_lock(&conn->lock);
+    free(conn->bound);
+    conn->bound = bound;
+    (void) pthread_mutex_unlock(&conn->lock);
+    return STANDIN_SUCCESS;
+}
+
+static int
+standin_search(StandinReq_t *req, StandinOut_t *out)
+{
+    StandinFilter_t *filter;
+    struct berval base, *attrs = NULL;
+    ber_int_t scope, deref, sizelimit, timelimit, typesonly;
+    ber_len_t len;
+    ber_tag_t tag;
+    char *last, *nbase;
+    int nattrs = 0, rc = STANDIN_SUCCESS;
+    size_t i, n = 0;
+
+    if (ber_scanf(
+	    req->ber, "{meeiib", &base, &scope, &deref, &sizelimit,
+	    &timelimit, &typesonly) == LBER_ERROR)
+	return -1;
+    filter = standin_filter_parse(req->ber);
+    if (!filter)
+	return -1;
+    for (tag = ber_first_element(req->ber, &len, &last); tag != LBER_DEFAULT;
+	 tag = ber_next_element(req->ber, &len, last)) {
+	struct berval *tmp = realloc(attrs, (nattrs + 1) * sizeof(struct berval));
+
+	if (!tmp || ber_scanf(req->ber, "m", &tmp[nattrs]) == LBER_ERROR) {
+	    free(tmp ? tmp : attrs);
+	    standin_filter_free(filter);
+	    return -1;
+	}
+	attrs = tmp;
+	nattrs++;
+    }
+    /* "1.1" alone requests no attribute */
+    if (nattrs == 1 && standin_bvcaseeq(attrs, "1.1", 3))
+	attrs->bv_len = 0;
+    nbase = standin_dn_normalize(base.bv_val, base.bv_len);
+    if (!nbase) {
+	free(attrs);
+	standin_filter_free(filter);
+	return STANDIN_OTHER;
+    }
+    (void) pthread_rwlock_rdlock(&standin_dit.lock);
+    if (!*nbase && !scope)
+	standin_out_root(out, req, attrs, nattrs, typesonly);
+    else if (*nbase && !standin_dit_find(nbase))
+	rc = STANDIN_NO_SUCH_OBJECT;
+    else
+	for (i = 0; i < standin_dit.count && !out->failed; i++) {
+	    const StandinEntry_t *e = standin_dit.entries[i];
+
+	    if (!standin_in_scope(e->ndn, nbase, scope) ||
+		!standin_filter_match(filter, e))
+		continue;
+	    if (sizelimit > 0 && n == (size_t) sizelimit) {
+		rc = STANDIN_SIZELIMIT_EXCEEDED;
+		break;
+	    }
+	    standin_out_entry(out, req, e, attrs, nattrs, typesonly);
+	    n++;
+	}
+    (void) pthread_rwlock_unlock(&standin_dit.lock);
+    free(nbase);
+    free(attrs);
+    standin_filter_free(filter);
+    return rc;
+}
+
+static int
+standin_apply_mod(StandinEntry_t *e, const StandinMod_t *mod)
+{
+    StandinAttr_t *a = standin_entry_attr(e, mod->type.bv_val, mod->type.bv_len);
+    int i, j;
+
+    switch (mod->op) {
+    case STANDIN_MOD_ADD:
+	for (i = 0; i < mod->nvals; i++) {
+	    if (a && standin_attr_find(a, &mod->vals[i]) != -1)
+		return STANDIN_TYPE_OR_VALUE_EXISTS;
+	    if (standin_entry_add_value(
+		    e, mod->type.bv_val, mod->type.bv_len,
+		    mod->vals[i].bv_val, mod->vals[i].bv_len) == -1)
+		return STANDIN_OTHER;
+	    a = standin_entry_attr(e, mod->type.bv_val, mod->type.bv_len);
+	}
+	return STANDIN_SUCCESS;
+    case STANDIN_MOD_DELETE:
+	if (!a)
+	    return STANDIN_NO_SUCH_ATTRIBUTE;
+	for (i = 0; i < mod->nvals; i++) {
+	    j = standin_attr_find(a, &mod->vals[i]);
+	    if (j == -1)
+		return STANDIN_NO_SUCH_ATTRIBUTE;
+	    free(a->vals[j].bv_val);
+	    a->vals[j] = a->vals[--a->nvals];
+	}
+	if (!mod->nvals || !a->nvals)
+	    standin_entry_remove_attr(e, a);
+	return STANDIN_SUCCESS;
+    case STANDIN_MOD_REPLACE:
+	if (a)
+	    standin_entry_remove_attr(e, a);
+	for (i = 0; i < mod->nvals; i++)
+	    if (standin_entry_add_value(
+		    e, mod->type.bv_val, mod->type.bv_len,
+		    mod->vals[i].bv_val, mod->vals[i].bv_len) == -1)
+		return STANDIN_OTHER;
+	return STANDIN_SUCCESS;
+    }
+    return STANDIN_UNWILLING_TO_PERFORM;
+}
+
+static int
+standin_modify(StandinReq_t *req, StandinOut_t *out)
+{
+    StandinMod_t *mods = NULL;
+    StandinEntry_t *e, tmp = {NULL, NULL, NULL, 0, 0, 0, NULL};
+    struct berval dn;
+    ber_len_t len;
+    ber_tag_t tag, vtag;
+    char *last, *vlast, *ndn = NULL;
+    int i, nmods = 0, rc = -1;
+
+    if (ber_scanf(req->ber, "{m", &dn) == LBER_ERROR)
+	return -1;
+    for (tag = ber_first_element(req->ber, &len, &last); tag != LBER_DEFAULT;
+	 tag = ber_next_element(req->ber, &len, last)) {
+	StandinMod_t *mod = realloc(mods, (nmods + 1) * sizeof(StandinMod_t));
+
+	if (!mod)
+	    goto done;
+	mods = mod;
+	mod += nmods++;
+	mod->vals = NULL;
+	mod->nvals = 0;
+	if (ber_scanf(req->ber, "{e{m", &mod->op, &mod->type) == LBER_ERROR)
+	    goto done;
+	for (vtag = ber_first_element(req->ber, &len, &vlast);
+	     vtag != LBER_DEFAULT;
+	     vtag = ber_next_element(req->ber, &len, vlast)) {
+	    struct berval *vals = realloc(
+		mod->vals, (mod->nvals + 1) * sizeof(struct berval));
+
+	    if (!vals)
+		goto done;
+	    mod->vals = vals;
+	    if (ber_scanf(req->ber, "m", &vals[mod->nvals++]) == LBER_ERROR)
+		goto done;
+	}
+    }
+    rc = STANDIN_OTHER;
+    ndn = standin_dn_normalize(dn.bv_val, dn.bv_len);
+    if (!ndn)
+	goto done;
+    (void) pthread_rwlock_wrlock(&standin_dit.lock);
+    e = standin_dit_find(ndn);
+    if (!e)
+	rc = STANDIN_NO_SUCH_OBJECT;
+    else if (standin_entry_copy_attrs(&tmp, e) != -1) {
+	/* modifications are applied to a copy: all or nothing */
+	for (i = 0, rc = STANDIN_SUCCESS; rc == STANDIN_SUCCESS && i < nmods;
+	     i++)
+	    rc = standin_apply_mod(&tmp, &mods[i]);
+	if (rc == STANDIN_SUCCESS) {
+	    StandinAttr_t *attrs = e->attrs;
+	    int nattrs = e->nattrs;
+
+	    e->attrs = tmp.attrs;
+	    e->nattrs = tmp.nattrs;
+	    tmp.attrs = attrs;
+	    tmp.nattrs = nattrs;
+	}
+    }
+    (void) pthread_rwlock_unlock(&standin_dit.lock);
+    standin_entry_free_attrs(&tmp);
+  done:
+    for (i = 0; i < nmods; i++)
+	free(mods[i].vals);
+    free(mods);
+    free(ndn);
+    return rc;
+}
+
+static int
+standin_add(StandinReq_t *req, StandinOut_t *out)
+{
+    StandinEntry_t *e;
+    struct berval dn, type, val;
+    ber_len_t len;
+    ber_tag_t tag, vtag;
+    char *last, *vlast;
+    int rc = STANDIN_SUCCESS;
+
+    if (ber_scanf(req->ber, "{m", &dn) == LBER_ERROR)
+	return -1;
+    e = standin_entry_new(dn.bv_val, dn.bv_len);
+    if (!e)
+	return STANDIN_OTHER;
+    for (tag = ber_first_element(req->ber, &len, &last); tag != LBER_DEFAULT;
+	 tag = ber_next_element(req->ber, &len, last)) {
+	if (ber_scanf(req->ber, "{m", &type) == LBER_ERROR) {
+	    standin_entry_free(e);
+	    return -1;
+	}
+	for (vtag = ber_first_element(req->ber, &len, &vlast);
+	     vtag != LBER_DEFAULT;
+	     vtag = ber_next_element(req->ber, &len, vlast)) {
+	    if (ber_scanf(req->ber, "m", &val) == LBER_ERROR) {
+		standin_entry_free(e);
+		return -1;
+	    }
+	    if (standin_entry_add_value(
+		    e, type.bv_val, type.bv_len, val.bv_val, val.bv_len) == -1) {
+		standin_entry_free(e);
+		return STANDIN_OTHER;
+	    }
+	}
+    }
+    (void) pthread_rwlock_wrlock(&standin_dit.lock);
+    if (standin_dit_find(e->ndn))
+	rc = STANDIN_ALREADY_EXISTS;
+    else if (standin_dit.count && *standin_dn_parent(e->ndn) &&
+	     !standin_dit_find(standin_dn_parent(e->ndn))) {
+	req->diag = "parent does not exist";
+	rc = STANDIN_NO_SUCH_OBJECT;
+    }
+    else if (standin_dit_insert(e) == -1)
+	rc = STANDIN_OTHER;
+    (void) pthread_rwlock_unlock(&standin_dit.lock);
+    if (rc != STANDIN_SUCCESS)
+	standin_entry_free(e);
+    return rc;
+}
+
+static int
+standin_delete(StandinReq_t *req, StandinOut_t *out)
+{
+    StandinEntry_t *e;
+    struct berval dn;
+    char *ndn;
+    int rc = STANDIN_SUCCESS;
+
+    if (ber_scanf(req->ber, "m", &dn) == LBER_ERROR)
+	return -1;
+    ndn = standin_dn_normalize(dn.bv_val, dn.bv_len);
+    if (!ndn)
+	return STANDIN_OTHER;
+    (void) pthread_rwlock_wrlock(&standin_dit.lock);
+    e = standin_dit_find(ndn);
+    if (!e)
+	rc = STANDIN_NO_SUCH_OBJECT;
+    else if (e->children)
+	rc = STANDIN_NOT_ALLOWED_ON_NONLEAF;
+    else
+	standin_dit_remove(e);
+    (void) pthread_rwlock_unlock(&standin_dit.lock);
+    if (rc == STANDIN_SUCCESS)
+	standin_entry_free(e);
+    free(ndn);
+    return rc;
+}
+
+static int
+standin_moddn(StandinReq_t *req, StandinOut_t *out)
+{
+    req->diag = "modrdn is not supported";
+    return STANDIN_UNWILLING_TO_PERFORM;
+}
+
+static int
+standin_compare(StandinReq_t *req, StandinOut_t *out)
+{
+    StandinEntry_t *e;
+    StandinAttr_t *a;
+    struct berval dn, type, val;
+    char *ndn;
+    int rc;
+
+    if (ber_scanf(req->ber, "{m{mm}}", &dn, &type, &val) == LBER_ERROR)
+	return -1;
+    ndn = standin_dn_normalize(dn.bv_val, dn.bv_len);
+    if (!ndn)
+	return STANDIN_OTHER;
+    (void) pthread_rwlock_rdlock(&standin_dit.lock);
+    e = standin_dit_find(ndn);
+    if (!e)
+	rc = STANDIN_NO_SUCH_OBJECT;
+    else if (!(a = standin_entry_attr(e, type.bv_val, type.bv_len)))
+	rc = STANDIN_NO_SUCH_ATTRIBUTE;
+    else if (standin_attr_find(a, &val) != -1)
+	rc = STANDIN_COMPARE_TRUE;
+    else
+	rc = STANDIN_COMPARE_FALSE;
+    (void) pthread_rwlock_unlock(&standin_dit.lock);
+    free(ndn);
+    return rc;
+}
+
+static int
+standin_extended(StandinReq_t *req, StandinOut_t *out)
+{
+    StandinConn_t *conn = req->conn;
+    struct berval oid;
+    size_t len;
+
+    if (ber_scanf(req->ber, "{m", &oid) == LBER_ERROR)
+	return -1;
+    if (!standin_bvcaseeq(&oid, STANDIN_OID_WHOAMI, strlen(STANDIN_OID_WHOAMI))) {
+	req->diag = "unsupported extended operation";
+	return STANDIN_PROTOCOL_ERROR;
+    }
+    (void) pthread_mutex_lock(&conn->lock);
+    len = conn->bound ? strlen(conn->bound) + 3 : 0;
+    req->value.bv_val = malloc(len + 1);
+    if (req->value.bv_val) {
+	if (conn->bound)
+	    (void) sprintf(req->value.bv_val, "dn:%s", conn->bound);
+	req->value.bv_len = len;
+    }
+    (void) pthread_mutex_unlock(&conn->lock);
+    return req->value.bv_val ? STANDIN_SUCCESS : STANDIN_OTHER;
+}
+
+/* connections */
+
+static void
+standin_conn_unref(StandinConn_t *conn)
+{
+    int refs;
+
+    (void) pthread_mutex_lock(&conn->lock);
+    refs = --conn->refs;
+    (void) pthread_mutex_unlock(&conn->lock);
+    if (refs)
+	return;
+    (void) close(conn->fd);
+    (void) pthread_mutex_destroy(&conn->lock);
+    free(conn->bound);
+    free(conn);
+}
+
+static void
+standin_process(StandinReq_t *req)
+{
+    StandinOut_t out = {NULL, 0, 0, 0};
+    unsigned long id = req->conn->id;
+    int op = req->op, rc;
+
+    standin_count(standin_ops[op].count);
+    standin_throttle();
+    standin_sleep(
+	standin_ops[op].delay +
+	standin.jitter * standin_draw(id, req->msgid, STANDIN_DRAW_JITTER));
+    if (!standin_ops[op].res)
+	goto done;
+    if (standin_draw(id, req->msgid, STANDIN_DRAW_BUSY) < standin.busy) {
+	standin_count(standin.busies);
+	req->diag = "injected busy";
+	rc = STANDIN_BUSY;
+    }
+    else if (standin_draw(id, req->msgid, STANDIN_DRAW_UNAVAILABLE) <
+	     standin.unavailable) {
+	standin_count(standin.unavailables);
+	req->diag = "injected unavailable";
+	rc = STANDIN_UNAVAILABLE;
+    }
+    else {
+	rc = standin_ops[op].handler(req, &out);
+	if (rc == -1) {
+	    req->diag = "decoding error";
+	    rc = STANDIN_PROTOCOL_ERROR;
+	}
+    }
+    standin_out_result(&out, req, rc);
+    standin_send(req->conn, &out);
+  done:
+    free(out.buf);
+    free(req->value.bv_val);
+    ber_free(req->ber, 1);
+    standin_conn_unref(req->conn);
+    free(req);
+}
+
+static void *
+standin_worker(void *arg)
+{
+    standin_process((StandinReq_t *) arg);
+    return NULL;
+}
+
+/* threads are detached and do not handle SIGINT and SIGTERM */
+static int
+standin_spawn(void *(*func)(void *), void *arg)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    sigset_t set, old;
+    int rc;
+
+    (void) sigemptyset(&set);
+    (void) sigaddset(&set, SIGINT);
+    (void) sigaddset(&set, SIGTERM);
+    (void) pthread_sigmask(SIG_BLOCK, &set, &old);
+    (void) pthread_attr_init(&attr);
+    (void) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&thread, &attr, func, arg);
+    (void) pthread_attr_destroy(&attr);
+    (void) pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return rc;
+}
+
+static void *
+standin_reader(void *arg)
+{
+    StandinConn_t *conn = (StandinConn_t *) arg;
+    Sockbuf *sb;
+    ber_len_t len, max = STANDIN_MAX_INCOMING;
+    int fd = dup(conn->fd);
+
+    /* the sockbuf closes its own descriptor when freed, workers may
+       still be writing responses on conn->fd */
+    sb = fd == -1 ? NULL : ber_sockbuf_alloc();
+    if (!sb) {
+	if (fd != -1)
+	    (void) close(fd);
+	standin_conn_unref(conn);
+	return NULL;
+    }
+    (void) ber_sockbuf_add_io(
+	sb, &ber_sockbuf_io_tcp, LBER_SBIOD_LEVEL_PROVIDER, (void *) &fd);
+    (void) ber_sockbuf_ctrl(sb, LBER_SB_OPT_SET_MAX_INCOMING, &max);
+    for (;;) {
+	BerElement *ber = ber_alloc_t(LBER_USE_DER);
+	StandinReq_t *req;
+	ber_int_t msgid;
+	ber_tag_t tag;
+	int op;
+
+	if (!ber)
+	    break;
+	tag = ber_get_next(sb, &len, ber);
+	if (tag != LBER_SEQUENCE || ber_get_int(ber, &msgid) == LBER_ERROR) {
+	    ber_free(ber, 1);
+	    break;
+	}
+	tag = ber_peek_tag(ber, &len);
+	for (op = 0; standin_ops[op].name && standin_ops[op].req != tag; op++)
+	    ;
+	if (!standin_ops[op].name || tag == STANDIN_REQ_UNBIND) {
+	    ber_free(ber, 1);
+	    break;
+	}
+	if (standin_draw(conn->id, msgid, STANDIN_DRAW_RESET) < standin.reset) {
+	    standin_count(standin.resets);
+	    ber_free(ber, 1);
+	    (void) shutdown(conn->fd, SHUT_RDWR);
+	    break;
+	}
+	req = calloc(1, sizeof(StandinReq_t));
+	if (!req) {
+	    ber_free(ber, 1);
+	    break;
+	}
+	req->conn = conn;
+	req->ber = ber;
+	req->msgid = msgid;
+	req->op = op;
+	(void) pthread_mutex_lock(&conn->lock);
+	conn->refs++;
+	(void) pthread_mutex_unlock(&conn->lock);
+	if (standin_spawn(standin_worker, req))
+	    standin_process(req);
+    }
+    ber_sockbuf_free(sb);
+    standin_conn_unref(conn);
+    return NULL;
+}
+
+/* setup */
+
+static size_t
+standin_base64_decode(char *s, size_t len)
+{
+    static const char *digits =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint32_t acc = 0;
+    size_t i, n = 0;
+    int bits = 0;
+
+    for (i = 0; i < len; i++) {
+	const char *d = s[i] ? strchr(digits, s[i]) : NULL;
+
+	if (!d)
+	    continue;
+	acc = (acc << 6) | (uint32_t) (d - digits);
+	bits += 6;
+	if (bits >= 8) {
+	    bits -= 8;
+	    s[n++] = (char) (acc >> bits);
+	}
+    }
+    return n;
+}
+
+static void
+standin_dit_add_loaded(StandinEntry_t *e, const char *path)
+{
+    if (standin_dit_find(e->ndn))
+	standin_fatal("%s: duplicate entry", e->dn);
+    if (standin_dit_insert(e) == -1)
+	standin_fatal("%s: out of memory", path);
+}
+
+/* LDIF content records, without URL values */
+static void
+standin_dit_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    StandinEntry_t *e = NULL;
+    char *buf = NULL, *line, *end, *src, *dst;
+    size_t n, len = 0, size = 0;
+
+    if (!f)
+	standin_fatal("%s: cannot open", path);
+    do {
+	if (len + 1 >= size) {
+	    size = size ? size * 2 : 65536;
+	    buf = realloc(buf, size);
+	    if (!buf)
+		standin_fatal("%s: out of memory", path);
+	}
+	n = fread(buf + len, 1, size - len - 1, f);
+	len += n;
+    } while (n);
+    (void) fclose(f);
+    buf[len] = '\0';
+    /* unfold continuation lines */
+    for (src = dst = buf; *src; src++) {
+	if (*src == '\r' && src[1] == '\n')
+	    continue;
+	if (*src == '\n' && src[1] == ' ') {
+	    src++;
+	    continue;
+	}
+	*dst++ = *src;
+    }
+    *dst = '\0';
+    for (line = buf; line < dst; line = end + 1) {
+	char *colon, *value;
+	size_t vlen;
+
+	end = strchr(line, '\n');
+	if (!end)
+	    end = dst;
+	*end = '\0';
+	if (!*line) {
+	    if (e)
+		standin_dit_add_loaded(e, path);
+	    e = NULL;
+	    continue;
+	}
+	if (*line == '#')
+	    continue;
+	colon = strchr(line, ':');
+	if (!colon)
+	    standin_fatal("%s: invalid line", line);
+	value = colon + 1;
+	if (*value == '<')
+	    standin_fatal("%s: URL values are not supported", line);
+	if (*value == ':') {
+	    value++;
+	    while (*value == ' ')
+		value++;
+	    vlen = standin_base64_decode(value, end - value);
+	}
+	else {
+	    while (*value == ' ')
+		value++;
+	    vlen = end - value;
+	}
+	if ((size_t) (colon - line) == 2 && !standin_memcasecmp(line, "dn", 2)) {
+	    if (e)
+		standin_fatal("%s: missing empty line before dn", line);
+	    e = standin_entry_new(value, vlen);
+	    if (!e)
+		standin_fatal("%s: out of memory", path);
+	}
+	else if (!e && (size_t) (colon - line) == 7 &&
+		 !standin_memcasecmp(line, "version", 7))
+	    continue;
+	else if (!e)
+	    standin_fatal("%s: attribute outside of an entry", line);
+	else if (standin_entry_add_value(
+		     e, line, colon - line, value, vlen) == -1)
+	    standin_fatal("%s: out of memory", path);
+    }
+    if (e)
+	standin_dit_add_loaded(e, path);
+    free(buf);
+}
+
+static StandinEntry_t *
+standin_dit_generated(const char *rdn, const char *suffix)
+{
+    char dn[1024];
+    int len = snprintf(
+	dn, sizeof(dn), "%s%s%s", rdn, *rdn ? "," : "", suffix);
+    StandinEntry_t *e;
+
+    if (len < 0 || (size_t) len >= sizeof(dn))
+	standin_fatal("%s: suffix too long", suffix);
+    e = standin_entry_new(dn, len);
+    if (!e)
+	standin_fatal("%s: out of memory", suffix);
+    return e;
+}
+
+#define standin_dit_value(e, name, value)				\
+    do {								\
+	if (standin_entry_add_value(					\
+		(e), (name), strlen(name), (value), strlen(value)) == -1) \
+	    standin_fatal("%s: out of memory", (name));		\
+    } while (0)
+
+/* suffix, ou=people and uid=userN entries with password `secret' */
+static void
+standin_dit_generate(const char *suffix, unsigned long count)
+{
+    StandinEntry_t *e;
+    const char *eq = strchr(suffix, '='), *comma = strchr(suffix, ',');
+    char name[64], value[256];
+    unsigned long i;
+
+    if (!eq || (comma && comma < eq) || (size_t) (eq - suffix) >= sizeof(name))
+	standin_fatal("%s: invalid suffix", suffix);
+    (void) snprintf(name, sizeof(name), "%.*s", (int) (eq - suffix), suffix);
+    (void) snprintf(
+	value, sizeof(value), "%.*s",
+	(int) (comma ? comma - eq - 1 : (long) strlen(eq + 1)), eq + 1);
+    e = standin_dit_generated("", suffix);
+    standin_dit_value(e, "objectClass", "top");
+    standin_dit_value(e, "objectClass", "extensibleObject");
+    standin_dit_value(e, name, value);
+    standin_dit_add_loaded(e, suffix);
+    e = standin_dit_generated("ou=people", suffix);
+    standin_dit_value(e, "objectClass", "organizationalUnit");
+    standin_dit_value(e, "ou", "people");
+    standin_dit_add_loaded(e, suffix);
+    for (i = 0; i < count; i++) {
+	(void) snprintf(value, sizeof(value), "uid=user%lu,ou=people", i);
+	e = standin_dit_generated(value, suffix);
+	standin_dit_value(e, "objectClass", "inetOrgPerson");
+	(void) snprintf(value, sizeof(value), "user%lu", i);
+	standin_dit_value(e, "uid", value);
+	(void) snprintf(value, sizeof(value), "User %lu", i);
+	standin_dit_value(e, "cn", value);
+	(void) snprintf(value, sizeof(value), "%lu", i);
+	standin_dit_value(e, "sn", value);
+	(void) snprintf(value, sizeof(value), "user%lu@example.com", i);
+	standin_dit_value(e, "mail", value);
+	standin_dit_value(e, "userPassword", "secret");
+	standin_dit_add_loaded(e, suffix);
+    }
+}
+
+static void
+standin_set_delay(const char *arg)
+{
+    const char *eq = strchr(arg, '=');
+    char *end;
+    double ms = strtod(eq ? eq + 1 : arg, &end);
+    int i, found = 0;
+
+    if (*end || ms < 0)
+	standin_fatal("%s: invalid delay", arg);
+    for (i = 0; standin_ops[i].name; i++)
+	if (!eq || ((size_t) (eq - arg) == strlen(standin_ops[i].name) &&
+		    !strncmp(arg, standin_ops[i].name, eq - arg))) {
+	    standin_ops[i].delay = ms / 1000.0;
+	    found = 1;
+	}
+    if (!found)
+	standin_fatal("%s: unknown operation", arg);
+}
+
+static double
+standin_probability(const char *arg)
+{
+    char *end;
+    double p = strtod(arg, &end);
+
+    if (*end || p < 0.0 || p > 1.0)
+	standin_fatal("%s: invalid probability", arg);
+    return p;
+}
+
+/* returns the listening socket and sets the URL clients connect to */
+static int
+standin_listen(const char *addr, char *url, size_t size)
+{
+    struct addrinfo hints, *res, *ai;
+    char host[256], serv[32];
+    const char *colon;
+    int fd = -1, on = 1;
+
+    if (strchr(addr, '/')) {
+	struct sockaddr_un sun;
+	char *p;
+
+	if (strlen(addr) >= sizeof(sun.sun_path) ||
+	    strlen(addr) * 3 + 9 > size)
+	    standin_fatal("%s: path too long", addr);
+	(void) memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	(void) strcpy(sun.sun_path, addr);
+	(void) unlink(addr);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1 || bind(fd, (struct sockaddr *) &sun, sizeof(sun)) == -1 ||
+	    listen(fd, SOMAXCONN) == -1)
+	    standin_fatal("%s: cannot listen", addr);
+	p = url + sprintf(url, "ldapi://");
+	for (; *addr; addr++)
+	    if (isalnum((unsigned char) *addr) || strchr("-._~", *addr))
+		*p++ = *addr;
+	    else
+		p += sprintf(p, "%%%02X", (unsigned char) *addr);
+	*p = '\0';
+	return fd;
+    }
+    colon = strrchr(addr, ':');
+    if (!colon || (size_t) (colon - addr) >= sizeof(host))
+	standin_fatal("%s: expected host:port or a socket path", addr);
+    (void) snprintf(host, sizeof(host), "%.*s", (int) (colon - addr), addr);
+    if (*host == '[' && host[strlen(host) - 1] == ']') {
+	(void) memmove(host, host + 1, strlen(host));
+	host[strlen(host) - 1] = '\0';
+    }
+    (void) memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_PASSIVE;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(*host ? host : NULL, colon + 1, &hints, &res))
+	standin_fatal("%s: cannot resolve", addr);
+    for (ai = res; ai; ai = ai->ai_next) {
+	fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (fd == -1)
+	    continue;
+	(void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, SOMAXCONN))
+	    break;
+	(void) close(fd);
+	fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd == -1)
+	standin_fatal("%s: cannot listen", addr);
+    {
+	struct sockaddr_storage ss;
+	socklen_t len = sizeof(ss);
+
+	if (getsockname(fd, (struct sockaddr *) &ss, &len) ||
+	    getnameinfo((struct sockaddr *) &ss, len, NULL, 0, serv,
+			sizeof(serv), NI_NUMERICSERV))
+	    standin_fatal("%s: cannot get the listening port", addr);
+    }
+    (void) snprintf(
+	url, size, "ldap://%.*s:%s", (int) (colon - addr), addr, serv);
+    return fd;
+}
+
+static void
+standin_on_signal(int sig)
+{
+    standin_stop = 1;
+}
+
+static void
+standin_usage(const char *prog, int status)
+{
+    (void) fprintf(
+	status ? stderr : stdout,
+	"usage: %s [-l host:port|path] [-f ldif | -n count [-S suffix]]\n"
+	"          [-d [op=]ms]... [-j ms] [-q ops] [-r prob] [-b prob]\n"
+	"          [-u prob] [-s seed]\n"
+	"\n"
+	"  -l  listen on a TCP address (port 0 picks a free port) or on a\n"
+	"      Unix socket when the argument contains a `/' (default: %s)\n"
+	"  -f  load the DIT from a LDIF file\n"
+	"  -n  generate a DIT of count users under -S suffix (default: %s)\n"
+	"  -d  delay of all operations, or of one of bind, search, modify,\n"
+	"      add, delete, modrdn, compare, extended, abandon\n"
+	"  -j  uniform random jitter added to delays\n"
+	"  -q  throughput cap in operations per second\n"
+	"  -r  probability for a request to reset its connection\n"
+	"  -b  probability for an operation to return busy\n"
+	"  -u  probability for an operation to return unavailable\n"
+	"  -s  seed of random draws (default: 0)\n",
+	prog, STANDIN_DEFAULT_LISTEN, STANDIN_DEFAULT_SUFFIX
+	);
+    exit(status);
+}
+
+/*****************************************************************************
+ * GLOBAL FUNCTION DEFINITIONS
+ *****************************************************************************/
+
+int
+main(int argc, char **argv)
+{
+    const char *listen_addr = STANDIN_DEFAULT_LISTEN, *ldif = NULL;
+    const char *suffix = STANDIN_DEFAULT_SUFFIX;
+    unsigned long count = 0;
+    struct sigaction sa;
+    char url[1024];
+    int c, fd, i;
+
+    while ((c = getopt(argc, argv, "l:f:n:S:d:j:q:r:b:u:s:h")) != -1)
+	switch (c) {
+	case 'l':
+	    listen_addr = optarg;
+	    break;
+	case 'f':
+	    ldif = optarg;
+	    break;
+	case 'n':
+	    count = strtoul(optarg, NULL, 10);
+	    break;
+	case 'S':
+	    suffix = optarg;
+	    break;
+	case 'd':
+	    standin_set_delay(optarg);
+	    break;
+	case 'j':
+	    standin.jitter = atof(optarg) / 1000.0;
+	    break;
+	case 'q':
+	    standin.rate = atof(optarg);
+	    break;
+	case 'r':
+	    standin.reset = standin_probability(optarg);
+	    break;
+	case 'b':
+	    standin.busy = standin_probability(optarg);
+	    break;
+	case 'u':
+	    standin.unavailable = standin_probability(optarg);
+	    break;
+	case 's':
+	    standin.seed = strtoull(optarg, NULL, 0);
+	    break;
+	case 'h':
+	    standin_usage(argv[0], 0);
+	    break;
+	default:
+	    standin_usage(argv[0], 2);
+	}
+    if (optind != argc)
+	standin_usage(argv[0], 2);
+    if (ldif)
+	standin_dit_load(ldif);
+    else
+	standin_dit_generate(suffix, count);
+    (void) signal(SIGPIPE, SIG_IGN);
+    (void) memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = standin_on_signal;
+    (void) sigemptyset(&sa.sa_mask);
+    (void) sigaction(SIGINT, &sa, NULL);
+    (void) sigaction(SIGTERM, &sa, NULL);
+    fd = standin_listen(listen_addr, url, sizeof(url));
+    (void) printf("%s\n", url);
+    (void) fflush(stdout);
+    while (!standin_stop) {
+	StandinConn_t *conn;
+	int cfd = accept(fd, NULL, NULL), on = 1;
+
+	if (cfd == -1) {
+	    if (errno != EINTR)
+		perror("ldap_standin: accept()");
+	    continue;
+	}
+	(void) setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	conn = calloc(1, sizeof(StandinConn_t));
+	if (!conn) {
+	    (void) close(cfd);
+	    continue;
+	}
+	conn->fd = cfd;
+	conn->id = ++standin.connections;
+	conn->refs = 1;
+	(void) pthread_mutex_init(&conn->lock, NULL);
+	if (standin_spawn(standin_reader, conn))
+	    standin_conn_unref(conn);
+    }
+    (void) fprintf(
+	stderr, "{\"connections\": %lu, \"resets\": %lu, \"busy\": %lu, "
+	"\"unavailable\": %lu, \"ops\": {", standin.connections,
+	standin.resets, standin.busies, standin.unavailables);
+    for (i = 0; standin_ops[i].name; i++)
+	(void) fprintf(
+	    stderr, "%s\"%s\": %lu", i ? ", " : "", standin_ops[i].name,
+	    standin_ops[i].count);
+    (void) fprintf(stderr, "}}\n");
+    if (strchr(listen_addr, '/'))
+	(void) unlink(listen_addr);
+    return 0;
+}
@@ -0,0 +1,402 @@
+#!/usr/bin/env python3
+
+"""Reproducible libldap benchmarks against a throwaway local slapd.
+
+For each requested DIT size, a private slapd (mdb backend, listening on
+ldapi:// and on a loopback port) is configured in a temporary
+directory, loaded with slapadd from a generated LDIF and benchmarked:
+
+  - search throughput and latency percentiles, for each result
+    mode (see SEARCH_MODES),
+  - full subtree scan time,
+  - add and modify rates,
+  - simple bind rate,
+  - schema fetch time,
+  - peak RSS of the client for each workload (each one runs in its own
+    process).
+
+Results are written as JSON so that runs can be compared:
+
+  $ python3 setup.py build
+  $ python3 bench/slapd_bench.py --sizes 10000,100000 --width 4 \\
+        --output bench-results.json
+"""
+
+import argparse, json, multiprocessing, os, platform, random, resource
+import shutil, socket, subprocess, sys, tempfile, time
+
+HERE = os.path.abspath(os.path.dirname(__file__))
+sys.path.insert(0, os.path.dirname(HERE))
+
+from libldap import *
+
+SUFFIX = 'dc=bench,dc=test'
+ROOTDN = 'cn=admin,' + SUFFIX
+ROOTPW = 'secret'
+USERPW = 'secret'
+
+SCHEMA_DIRS = (
+    '/etc/ldap/schema', '/etc/openldap/schema',
+    '/usr/local/etc/openldap/schema'
+    )
+MODULE_DIRS = (
+    '/usr/lib/ldap', '/usr/lib64/openldap', '/usr/lib/openldap',
+    '/usr/local/libexec/openldap', '/usr/libexec/openldap'
+    )
+SBIN_DIRS = (
+    '/usr/sbin', '/usr/local/sbin', '/usr/libexec', '/usr/local/libexec'
+    )
+
+def search_list(l, base, filt, attrs):
+    return len(l.search_ext_s(base, filter=filt, attrs=attrs))
+
+def search_profile(l, base, filt, attrs):
+    l.profile = True
+    return len(l.search_ext_s(base, filter=filt, attrs=attrs))
+
+def search_dns(l, base, filt, attrs):
+    return len(l.search_dns(base, filter=filt))
+
+def search_count(l, base, filt, attrs):
+    return l.search_count(base, filter=filt)
+
+# result modes: name -> function(l, base, filter, attrs) -> entry count
+SEARCH_MODES = {
+    'list': search_list,
+    'profile': search_profile,
+    'dns': search_dns,
+    'count': search_count
+    }
+
+def find(name, dirs):
+    path = shutil.which(name)
+    if path:
+        return path
+    for d in dirs:
+        path = os.path.join(d, name)
+        if os.path.exists(path):
+            return path
+    return None
+
+def free_port():
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+        s.bind(('127.0.0.1', 0))
+        return s.getsockname()[1]
+
+def percentiles(samples):
+    if not samples:
+        return {}
+    samples = sorted(samples)
+    n = len(samples)
+    ret = {'min': samples[0], 'max': samples[-1], 'mean': sum(samples) / n}
+    for p in (50, 90, 99, 99.9):
+        ret['p%s' % p] = samples[min(n - 1, int(n * p / 100))]
+    return ret
+
+def user_dn(i):
+    return 'uid=user%d,ou=people,%s' % (i, SUFFIX)
+
+def generate_ldif(path, count, width):
+    with open(path, 'w') as f:
+        f.write(
+            'dn: %s\nobjectClass: dcObject\nobjectClass: organization\n'
+            'dc: bench\no: bench\n\n' % SUFFIX
+            )
+        f.write(
+            'dn: ou=people,%s\nobjectClass: organizationalUnit\n'
+            'ou: people\n\n' % SUFFIX
+            )
+        for i in range(count):
+            f.write(
+                'dn: %s\nobjectClass: inetOrgPerson\nuid: user%d\n'
+                'cn: User %d\nsn: User%d\nmail: user%d@bench.test\n'
+                'userPassword: %s\n' % (user_dn(i), i, i, i, i, USERPW)
+                )
+            for j in range(width):
+                f.write(
+                    'description: attribute value %d of user %d\n' % (j, i))
+            f.write('\n')
+
+class Slapd:
+    def __init__(self, workdir, args):
+        self.workdir = workdir
+        self.args = args
+        self.dbdir = os.path.join(workdir, 'db')
+        self.conf = os.path.join(workdir, 'slapd.conf')
+        self.sock = os.path.join(workdir, 'ldapi')
+        self.port = free_port()
+        self.ldapi = 'ldapi://' + self.sock.replace('/', '%2F')
+        self.ldap = 'ldap://127.0.0.1:%d' % self.port
+        self.proc = None
+
+    def configure(self):
+        os.makedirs(self.dbdir, exist_ok=True)
+        schemas = ''.join(
+            'include %s\n' % os.path.join(self.args.schema_dir, s + '.schema')
+            for s in ('core', 'cosine', 'inetorgperson')
+            )
+        modules = ''
+        if self.args.module_dir and os.path.exists(
+                os.path.join(self.args.module_dir, 'back_mdb.la')):
+            modules = 'modulepath %s\nmoduleload back_mdb\n' % \
+                self.args.module_dir
+        with open(self.conf, 'w') as f:
+            f.write(
+                '%s%spidfile %s\nargsfile %s\n'
+                'sizelimit unlimited\n\n'
+                'database mdb\nmaxsize %d\nsuffix "%s"\nrootdn "%s"\n'
+                'rootpw %s\ndirectory %s\n'
+                'index objectClass,uid eq\n' % (
+                    schemas, modules,
+                    os.path.join(self.workdir, 'slapd.pid'),
+                    os.path.join(self.workdir, 'slapd.args'),
+                    self.args.mdb_size, SUFFIX, ROOTDN, ROOTPW, self.dbdir
+                    )
+                )
+
+    def load(self, ldif):
+        subprocess.run(
+            [self.args.slapadd, '-q', '-f', self.conf, '-l', ldif],
+            check=True
+            )
+
+    def start(self):
+        self.proc = subprocess.Popen([
+            self.args.slapd, '-f', self.conf, '-h',
+            '%s %s' % (self.ldapi, self.ldap), '-d', '0'
+            ])
+        deadline = time.monotonic() + 30
+        while time.monotonic() < deadline:
+            try:
+                with socket.create_connection(('127.0.0.1', self.port), 1):
+                    return
+            except OSError:
+                if self.proc.poll() is not None:
+                    break
+                time.sleep(0.1)
+        self.stop()
+        raise RuntimeError('slapd failed to start')
+
+    def stop(self):
+        if self.proc and self.proc.poll() is None:
+            self.proc.terminate()
+            self.proc.wait()
+        self.proc = None
+
+def connect(uri, dn=ROOTDN, password=ROOTPW):
+    l = LDAP(uri)
+    l.simple_bind_s(dn, password)
+    return l
+
+def timed(samples, func, *args):
+    t = time.perf_counter()
+    ret = func(*args)
+    samples.append(time.perf_counter() - t)
+    return ret
+
+def run_search(uri, count, ops, mode):
+    l = connect(uri)
+    func = SEARCH_MODES[mode]
+    rnd = random.Random(0)
+    base = 'ou=people,' + SUFFIX
+    samples = []
+    t = time.perf_counter()
+    for _ in range(ops):
+        timed(samples, func, l, base, '(uid=user%d)' % rnd.randrange(count),
+              None)
+    elapsed = time.perf_counter() - t
+    ret = {
+        'ops': ops, 'ops_per_sec': ops / elapsed,
+        'latency': percentiles(samples)
+        }
+    samples = []
+    entries = timed(samples, func, l, base, '(objectClass=inetOrgPerson)',
+                    None)
+    ret['scan'] = {
+        'entries': entries, 'seconds': samples[0],
+        'entries_per_sec': entries / samples[0] if samples[0] else None
+        }
+    if mode == 'profile':
+        ret['profile'] = l.get_profile()
+    return ret
+
+def run_add_modify(uri, count, ops, width):
+    l = connect(uri)
+    samples = []
+    t = time.perf_counter()
+    for i in range(count, count + ops):
+        mods = [
+            LDAPMod(LDAP_MOD_ADD, 'objectClass', ['inetOrgPerson']),
+            LDAPMod(LDAP_MOD_ADD, 'uid', ['user%d' % i]),
+            LDAPMod(LDAP_MOD_ADD, 'cn', ['User %d' % i]),
+            LDAPMod(LDAP_MOD_ADD, 'sn', ['User%d' % i])
+            ]
+        if width:
+            mods.append(LDAPMod(
+                LDAP_MOD_ADD, 'description',
+                ['attribute value %d of user %d' % (j, i)
+                 for j in range(width)]
+                ))
+        timed(samples, l.add_ext_s, user_dn(i), mods)
+    elapsed = time.perf_counter() - t
+    ret = {
+        'add': {'ops': ops, 'ops_per_sec': ops / elapsed,
+                'latency': percentiles(samples)}
+        }
+    rnd = random.Random(1)
+    samples = []
+    t = time.perf_counter()
+    for n in range(ops):
+        mod = LDAPMod(LDAP_MOD_REPLACE, 'mail', ['m%d@bench.test' % n])
+        timed(samples, l.modify_ext_s, user_dn(rnd.randrange(count)), [mod])
+    elapsed = time.perf_counter() - t
+    ret['modify'] = {
+        'ops': ops, 'ops_per_sec': ops / elapsed,
+        'latency': percentiles(samples)
+        }
+    for i in range(count, count + ops):
+        l.delete_ext_s(user_dn(i))
+    return ret
+
+def run_bind(uri, count, ops):
+    l = LDAP(uri)
+    rnd = random.Random(2)
+    samples = []
+    t = time.perf_counter()
+    for _ in range(ops):
+        timed(samples, l.simple_bind_s, user_dn(rnd.randrange(count)), USERPW)
+    elapsed = time.perf_counter() - t
+    return {
+        'ops': ops, 'ops_per_sec': ops / elapsed,
+        'latency': percentiles(samples)
+        }
+
+def run_schema(uri, count, ops):
+    l = connect(uri)
+    samples = []
+    for _ in range(ops):
+        timed(samples, l.get_schema)
+    return {'ops': ops, 'latency': percentiles(samples)}
+
+def child(queue, func, args):
+    try:
+        ret = func(*args)
+        ret['peak_rss_kb'] = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+        queue.put(ret)
+    except Exception as e:
+        queue.put({'error': '%s: %s' % (e.__class__.__name__, e)})
+
+def isolated(func, *args):
+    """runs func(*args) in a fresh process so that peak RSS is its own"""
+    ctx = multiprocessing.get_context('fork')
+    queue = ctx.Queue()
+    proc = ctx.Process(target=child, args=(queue, func, args))
+    proc.start()
+    ret = queue.get()
+    proc.join()
+    return ret
+
+def bench_size(args, size):
+    workdir = tempfile.mkdtemp(prefix='libldap-bench-')
+    slapd = Slapd(workdir, args)
+    try:
+        slapd.configure()
+        ldif = os.path.join(workdir, 'dit.ldif')
+        t = time.perf_counter()
+        generate_ldif(ldif, size, args.width)
+        slapd.load(ldif)
+        os.unlink(ldif)
+        load_time = time.perf_counter() - t
+        slapd.start()
+        uri = slapd.ldapi if args.transport == 'ldapi' else slapd.ldap
+        ret = {
+            'size': size, 'width': args.width, 'uri': uri,
+            'load_seconds': load_time, 'search': {}
+            }
+        for mode in args.modes:
+            ret['search'][mode] = isolated(
+                run_search, uri, size, args.ops, mode)
+        ret.update(isolated(run_add_modify, uri, size, args.ops, args.width))
+        ret['bind'] = isolated(run_bind, uri, size, args.ops)
+        ret['schema'] = isolated(run_schema, uri, size, args.schema_ops)
+        return ret
+    finally:
+        slapd.stop()
+        if not args.keep:
+            shutil.rmtree(workdir, ignore_errors=True)
+
+def git_revision():
+    try:
+        return subprocess.run(
+            ['git', 'rev-parse', 'HEAD'], cwd=HERE, capture_output=True,
+            text=True, check=True
+            ).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument(
+        '--sizes', default='10000,100000,1000000',
+        help='comma separated DIT sizes (default: %(default)s)'
+        )
+    parser.add_argument(
+        '--width', type=int, default=4,
+        help='extra description values per entry (default: %(default)s)'
+        )
+    parser.add_argument(
+        '--ops', type=int, default=5000,
+        help='operations per workload (default: %(default)s)'
+        )
+    parser.add_argument('--schema-ops', type=int, default=20)
+    parser.add_argument(
+        '--modes', default=','.join(SEARCH_MODES),
+        help='comma separated result modes (default: %(default)s)'
+        )
+    parser.add_argument(
+        '--transport', choices=('ldapi', 'ldap'), default='ldapi',
+        help='Unix socket or loopback TCP (default: %(default)s)'
+        )
+    parser.add_argument('--slapd', default=find('slapd', SBIN_DIRS))
+    parser.add_argument('--slapadd', default=find('slapadd', SBIN_DIRS))
+    parser.add_argument(
+        '--schema-dir',
+        default=next((d for d in SCHEMA_DIRS if os.path.isdir(d)), None)
+        )
+    parser.add_argument(
+        '--module-dir',
+        default=next((d for d in MODULE_DIRS if os.path.isdir(d)), None)
+        )
+    parser.add_argument(
+        '--mdb-size', type=int, default=8 << 30, help='mdb maxsize in bytes'
+        )
+    parser.add_argument('--keep', action='store_true',
+                        help='keep temporary directories')
+    parser.add_argument('--output', default='-',
+                        help='JSON output file (default: stdout)')
+    args = parser.parse_args()
+    if not args.slapd or not args.slapadd or not args.schema_dir:
+        parser.error('slapd, slapadd or schema directory not found')
+    args.modes = args.modes.split(',')
+    for mode in args.modes:
+        if mode not in SEARCH_MODES:
+            parser.error('%s: unknown result mode' % mode)
+    results = {
+        'date': time.strftime('%Y-%m-%dT%H:%M:%SZ', time.gmtime()),
+        'revision': git_revision(),
+        'python': platform.python_version(),
+        'platform': platform.platform(),
+        'runs': []
+        }
+    for size in (int(s) for s in args.sizes.split(',')):
+        print('benchmarking %d entries...' % size, file=sys.stderr)
+        results['runs'].append(bench_size(args, size))
+    if args.output == '-':
+        json.dump(results, sys.stdout, indent=2)
+        print()
+    else:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+
+if __name__ == '__main__':
+    main()
@@ -1,10 +1,22 @@
 #!/usr/bin/env python3
 
+import re, select, threading, time, urllib.parse
+
 from _libldap import *
 
 class LDAP(LDAP_):
-    def __init__(self, uri, version=LDAP_VERSION3):
-        super(LDAP, self).__init__(uri, version)
+    """`credentials', if given, is called with the DN of the last simple
+    bind to get its password again when the connection is unpickled:
+    passwords are never pickled. It must itself be picklable, e.g. a
+    module level function"""
+
+    def __init__(self, uri, version=LDAP_VERSION3, fd=-1,
+                 happy_eyeballs=False, credentials=None):
+        super(LDAP, self).__init__(uri, version, fd, happy_eyeballs)
+        self.credentials = credentials
+
+    def __reduce__(self):
+        return (_rebuild, (self.__class__, self.spec, self.credentials))
 
     def get_schema(self):
         keys2parse = {
@@ -27,6 +39,27 @@ class LDAP(LDAP_):
             ret.append((r[0], d))
         return ret
 
+def _rebuild(cls, spec, credentials):
+    """Opens a connection like the one `spec' (LDAP_.spec) describes"""
+    l = cls(spec['uri'], spec['version'],
+            happy_eyeballs=spec['happy_eyeballs'], credentials=credentials)
+    l.dn = spec['dn']
+    for option, value in spec['options'].items():
+        l.set_option(option, value)
+    if spec['start_tls']:
+        l.start_tls_s()
+    if spec['bind']:
+        mech, user = spec['bind']
+        if mech == 'EXTERNAL':
+            l.sasl_external_bind_s(user)
+        elif mech != 'SIMPLE':
+            l.unbind_s()
+            raise LDAPError(
+                '%s: %s bind can\'t be done again' % (spec['uri'], mech))
+        elif user is not None and credentials is not None:
+            l.simple_bind_s(user, credentials(user))
+    return l
+
 class LDAPMods(list):
     def __init__(self, mode, **attrs):
         if mode not in (LDAP_MOD_ADD, LDAP_MOD_DELETE, LDAP_MOD_REPLACE):
@@ -46,4 +79,589 @@ class LDAPMods(list):
                     "%s.__init__(): `%s': %s" %
                     (self.__class__.__name__, attr, msg)
                     ) from None
-            self.append(LDAPMod(mode, attr, attrs[attr]))
+            self.append(lm)
+
+class BindVerifier(object):
+    """Checks passwords with simple binds pipelined on a few connections
+    reserved for this purpose.
+
+    Up to `depth' binds are in flight on each of the `connections'
+    connections: a batch of checks costs about one round trip per
+    `depth' checks and per connection instead of a connect and a
+    blocking bind each. The server answers binds of a connection in
+    order, so the oldest request of a connection is always the next one
+    completed.
+
+    A connection is left bound as the last user checked on it: it is
+    never used for anything else. If `service' ((dn, password)) is
+    given, connections are rebound to it at creation and after each
+    batch, so that no end user identity lingers on idle connections.
+    """
+
+    def __init__(self, uri, connections=4, depth=8, service=None,
+                 timeout=0):
+        if connections < 1 or depth < 1:
+            raise ValueError('connections and depth must be positive')
+        self.uri = uri
+        self.depth = depth
+        self.service = service
+        self.timeout = timeout
+        self.conns = [LDAP(uri) for i in range(connections)]
+        self.stats = {'checks': 0, 'accepted': 0, 'rejected': 0,
+                      'errors': 0, 'latency': 0.0}
+        if service:
+            for l in self.conns:
+                l.simple_bind_s(*service)
+
+    def verify(self, user, password):
+        """Returns (ok, latency): `ok' is True if the password of `user'
+        is valid, False if not and None on error"""
+        return self.verify_many([(user, password)])[0]
+
+    def verify_many(self, credentials):
+        """Checks an iterable of (user, password) and returns a list of
+        (ok, latency) in the same order, see verify()"""
+        creds = iter(enumerate(credentials))
+        results = {}
+        inflight = {l: [] for l in self.conns}
+        deadline = time.monotonic() + self.timeout if self.timeout else None
+
+        def submit(l):
+            while len(inflight[l]) < self.depth:
+                try:
+                    i, (user, password) = next(creds)
+                except StopIteration:
+                    return
+                if not user or not password:
+                    # an unauthenticated bind (RFC 4513 5.1.2) succeeds
+                    # without checking anything
+                    results[i] = (False, 0.0)
+                    continue
+                start = time.perf_counter()
+                try:
+                    msgid = l.simple_bind(user, password)
+                except LDAPError:
+                    # the request could not be sent: the connection is
+                    # lost, with the checks in flight on it
+                    results[i] = (None, time.perf_counter() - start)
+                    l = self._replace(l, inflight, results)
+                    continue
+                inflight[l].append((msgid, i, start))
+
+        def harvest(l):
+            n = 0
+            while inflight[l]:
+                msgid, i, start = inflight[l][0]
+                try:
+                    res = l.result(msgid, -1)
+                    if res is None:
+                        break
+                    ok = res[1]
+                except LDAPError as e:
+                    if getattr(e, 'msgid', None) is None:
+                        # no answer read: the connection is lost
+                        self._replace(l, inflight, results)
+                        return n + 1
+                    ok = None
+                inflight[l].pop(0)
+                results[i] = (ok, time.perf_counter() - start)
+                n += 1
+            return n
+
+        for n in range(len(self.conns)):
+            submit(self.conns[n])
+        while any(inflight.values()):
+            progress = 0
+            for n in range(len(self.conns)):
+                progress += harvest(self.conns[n])
+                submit(self.conns[n])
+            if progress:
+                continue
+            wait = None
+            if deadline is not None:
+                wait = deadline - time.monotonic()
+                if wait <= 0:
+                    self._expire(inflight, results)
+                    for i, cred in creds:
+                        results[i] = (None, 0.0)
+                    break
+            fds = {l.fileno(): l for l in self.conns if inflight[l]}
+            select.select(list(fds), [], [], wait)
+        if self.service:
+            for l in list(self.conns):
+                try:
+                    l.simple_bind_s(*self.service)
+                except LDAPError:
+                    self._replace(l, inflight, results)
+        ret = [results[i] for i in range(len(results))]
+        for ok, latency in ret:
+            self.stats['checks'] += 1
+            self.stats['latency'] += latency
+            if ok is None:
+                self.stats['errors'] += 1
+            elif ok:
+                self.stats['accepted'] += 1
+            else:
+                self.stats['rejected'] += 1
+        return ret
+
+    def _expire(self, inflight, results):
+        """Timed out checks are errors, their connections are replaced:
+        late answers must not be taken for those of later checks"""
+        for l in list(self.conns):
+            if inflight[l]:
+                self._replace(l, inflight, results)
+
+    def _replace(self, l, inflight, results):
+        """Replaces the connection `l' by a new one, returned: the checks
+        in flight on `l' are errors. A new connection failing to bind as
+        the service is kept unbound, the next check binds it anyway"""
+        for msgid, i, start in inflight.pop(l):
+            results[i] = (None, time.perf_counter() - start)
+        new = LDAP(self.uri)
+        self.conns[self.conns.index(l)] = new
+        inflight[new] = []
+        if self.service:
+            try:
+                new.simple_bind_s(*self.service)
+            except LDAPError:
+                pass
+        return new
+
+
+class Warmup(object):
+    """Opens `connections' connections to `uri' concurrently, for a fast
+    service startup.
+
+    Connections are created with LDAP_OPT_CONNECT_ASYNC: the connects,
+    StartTLS requests (if `start_tls') and binds (as `bind', a (dn,
+    password) tuple, anonymous otherwise) of all connections are in
+    flight at the same time, driven by a background thread. The
+    constructor returns as soon as `minimum' connections are ready, the
+    others keep being opened in the background: the time to the first
+    request does not grow with the number of connections.
+
+    Ready connections are taken with get(). A connection which failed,
+    or which is not ready `timeout' seconds after the constructor was
+    called, is unbound and its error appended to `errors'.
+    LDAP_OPT_CONNECT_ASYNC is reset on the connections handed out.
+    """
+
+    def __init__(self, uri, connections, minimum=1, start_tls=False,
+                 bind=None, timeout=30):
+        if connections < 1 or not 0 <= minimum <= connections:
+            raise ValueError('0 <= minimum <= connections is required')
+        self.uri = uri
+        self.steps = (['tls'] if start_tls else []) + ['bind']
+        self.bind = bind or ('', '')
+        self.ready = []
+        self.errors = []
+        self.opened = 0
+        self.pending = connections
+        self._cond = threading.Condition()
+        self._deadline = time.monotonic() + timeout
+        self._thread = threading.Thread(
+            target=self._run, args=(connections,), daemon=True)
+        self._thread.start()
+        self.wait(minimum)
+
+    def wait(self, n=None, timeout=None):
+        """Waits until `n' connections (all by default) were opened or
+        no connection is pending anymore, returns the number of opened
+        connections"""
+        with self._cond:
+            self._cond.wait_for(
+                lambda: not self.pending or (
+                    n is not None and self.opened >= n),
+                timeout)
+            return self.opened
+
+    def get(self, timeout=None):
+        """Returns a ready connection, waiting for one if none is ready
+        yet. LDAPError is raised if none will ever be"""
+        with self._cond:
+            self._cond.wait_for(
+                lambda: self.ready or not self.pending, timeout)
+            if not self.ready:
+                raise LDAPError(
+                    '%s.get(): no connection ready' % self.__class__.__name__
+                    )
+            return self.ready.pop(0)
+
+    def _done(self, l, error):
+        with self._cond:
+            self.pending -= 1
+            if error is None:
+                self.opened += 1
+                self.ready.append(l)
+            else:
+                self.errors.append(error)
+            self._cond.notify_all()
+
+    def _drop(self, l, error):
+        """Gives up connection `l' (None if it could not be created)"""
+        if l is not None:
+            try:
+                l.unbind_s()
+            except LDAPError:
+                pass
+        self._done(None, error)
+
+    def _submit(self, l, step):
+        """Sends the request of the `step'th step of `l', returns [msgid,
+        step, sent] or None if `l' is ready"""
+        if step == len(self.steps):
+            return None
+        if self.steps[step] == 'tls':
+            msgid = l.start_tls()
+        else:
+            msgid = l.simple_bind(*self.bind)
+        # the first request is only sent once connected
+        return [msgid, step, step > 0]
+
+    def _run(self, n):
+        inflight = {}
+        for i in range(n):
+            l = None
+            try:
+                l = LDAP(self.uri)
+                l.set_option(LDAP_OPT_CONNECT_ASYNC, True)
+                inflight[l] = self._submit(l, 0)
+            except LDAPError as error:
+                self._drop(l, error)
+        while inflight:
+            progress = False
+            for l, (msgid, step, sent) in list(inflight.items()):
+                try:
+                    res = l.result(msgid, -1)
+                    if res is None:
+                        continue
+                    if res[1] is False:
+                        raise LDAPError(
+                            '%s: bind: invalid credentials' % self.uri)
+                    inflight[l] = self._submit(l, step + 1)
+                    if inflight[l] is None:
+                        # not replayed after fork() nor seen by the user
+                        l.set_option(LDAP_OPT_CONNECT_ASYNC, False)
+                except LDAPError as error:
+                    del inflight[l]
+                    self._drop(l, error)
+                    continue
+                progress = True
+                if inflight[l] is None:
+                    del inflight[l]
+                    self._done(l, None)
+            if progress or not inflight:
+                continue
+            wait = self._deadline - time.monotonic()
+            if wait <= 0:
+                for l in inflight:
+                    self._drop(l, LDAPError('%s: timed out' % self.uri))
+                return
+            rfds, wfds = {}, {}
+            for l, state in list(inflight.items()):
+                try:
+                    fd = l.fileno()
+                except LDAPError as error:
+                    del inflight[l]
+                    self._drop(l, error)
+                    continue
+                if fd < 0:
+                    # socket not created yet: poll again soon
+                    wait = min(wait, 0.01)
+                    continue
+                rfds[fd] = l
+                if not state[2]:
+                    wfds[fd] = l
+            if not inflight:
+                break
+            r, w, x = select.select(list(rfds), list(wfds), [], wait)
+            for fd in w:
+                # connected: the next result() call sends the request
+                inflight[wfds[fd]][2] = True
+
+class Multiplexer(object):
+    """Shares the connection `l' between threads.
+
+    Each method sends its request at once, then blocks the calling
+    thread until the answer arrives. A dispatcher thread is the only
+    one waiting for answers (result(LDAP_RES_ANY)) and hands each of
+    them to the thread waiting for its message id. Many threads thus
+    share a single server connection with a plain blocking API.
+
+    `l' must be bound and must not be used directly anymore, as the
+    dispatcher would take its answers. libldap must be thread-safe
+    (OpenLDAP >= 2.5, or libldap_r).
+    """
+
+    def __init__(self, l, poll=0.5):
+        self.l = l
+        self.poll = poll
+        self._lock = threading.Lock()
+        self._cond = threading.Condition(self._lock)
+        self._waiters = {}
+        self._error = None
+        self._closed = False
+        self._thread = threading.Thread(target=self._dispatch, daemon=True)
+        self._thread.start()
+
+    def search_ext_s(self, *args, timeout=0, **kwds):
+        return self._call('search_ext', args, dict(kwds, timeout=timeout),
+                          timeout)
+
+    def compare_ext_s(self, *args, **kwds):
+        return self._call_s('compare_ext', 5, args, kwds)
+
+    def add_ext_s(self, *args, **kwds):
+        self._call_s('add_ext', 4, args, kwds)
+
+    def delete_ext_s(self, *args, **kwds):
+        self._call_s('delete_ext', 3, args, kwds)
+
+    def modify_ext_s(self, *args, **kwds):
+        self._call_s('modify_ext', 4, args, kwds)
+
+    def close(self):
+        """Stops the dispatcher, pending operations fail"""
+        with self._lock:
+            self._closed = True
+            self._cond.notify()
+        self._thread.join()
+        self._fail(LDAPError('%s: closed' % self.__class__.__name__))
+
+    def _call_s(self, method, n, args, kwds):
+        # arguments of the synchronous method: those of the asynchronous
+        # one but as_user, then timeout and as_user
+        if len(args) > n + 2:
+            raise TypeError('%s_s() takes at most %d positional arguments'
+                            % (method, n + 2))
+        timeout = kwds.pop('timeout', 0)
+        if len(args) > n:
+            timeout = args[n]
+            if len(args) > n + 1:
+                kwds['as_user'] = args[n + 1]
+            args = args[:n]
+        return self._call(method, args, kwds, timeout)
+
+    def _call(self, method, args, kwds, timeout):
+        # [answered, value, exception]
+        slot = [threading.Event(), None, None]
+        with self._lock:
+            if self._error is not None:
+                raise self._error
+            if self._closed:
+                raise LDAPError('%s: closed' % self.__class__.__name__)
+            # registered before the dispatcher can route the answer
+            msgid = getattr(self.l, method)(*args, **kwds)
+            self._waiters[msgid] = slot
+            self._cond.notify()
+        if not slot[0].wait(timeout if timeout > 0 else None):
+            with self._lock:
+                if self._waiters.pop(msgid, None) is not None:
+                    self.l.abandon(msgid)
+                    raise LDAPError(
+                        '%s.%s_s(): timed out' % (
+                            self.__class__.__name__, method)
+                        )
+            # answered meanwhile
+            slot[0].wait()
+        if slot[2] is not None:
+            raise slot[2]
+        return slot[1]
+
+    def _fail(self, error):
+        with self._lock:
+            self._error = error
+            waiters, self._waiters = self._waiters, {}
+        for slot in waiters.values():
+            slot[2] = error
+            slot[0].set()
+
+    def _dispatch(self):
+        while True:
+            with self._lock:
+                while not self._waiters and not self._closed:
+                    self._cond.wait()
+                if self._closed:
+                    return
+            error = None
+            try:
+                res = self.l.result(LDAP_RES_ANY, self.poll)
+            except LDAPError as e:
+                if getattr(e, 'msgid', None) is None:
+                    # the connection itself failed
+                    self._fail(e)
+                    return
+                res, error = (e.msgid, None), e
+            if res is None:
+                continue
+            with self._lock:
+                slot = self._waiters.pop(res[0], None)
+            if slot is not None:
+                slot[1], slot[2] = res[1], error
+                slot[0].set()
+
+class ReferralChaser(object):
+    """Follows the referrals of the searches done on connection `l'.
+
+    A server may answer a search with a referral (RFC 4511 4.1.10): the
+    whole search is to be done by another server. It may also return
+    continuation references (4.5.3) to subtrees held by other servers
+    along with its own entries. Both are followed, `depth' hops at most,
+    and the entries found on all servers are returned in a single list.
+
+    Referred servers are connected to once and the connections are kept,
+    one per server (scheme://host:port). They are opened like `l' (see
+    LDAP.spec): same options, StartTLS and bind, if the bind can be done
+    again (SASL EXTERNAL, or a simple bind with `l.credentials'). A
+    server is not followed if `l' was bound with another SASL mechanism.
+    libldap's own referral chasing is disabled on `l'.
+    """
+
+    def __init__(self, l, depth=4):
+        if depth < 1:
+            raise ValueError('depth must be positive')
+        self.l = l
+        self.depth = depth
+        self._lock = threading.Lock()
+        l.set_option(LDAP_OPT_REFERRALS, False)
+        self._conns = {_ldap_url(l.uri)[0]: l}
+
+    def search_ext_s(self, base=None, scope=LDAP_SCOPE_SUBTREE, filter=None,
+                     attrs=None, **kwds):
+        """Same arguments and result as LDAP.search_ext_s()"""
+        if base is None:
+            base = self.l.dn
+        if attrs is not None:
+            kwds['attrs'] = attrs
+        ret = []
+        seen = {(_ldap_url(self.l.uri)[0], base, scope, filter)}
+        self._search(self.l, base, scope, filter, kwds, 0, ret, seen)
+        return ret
+
+    @property
+    def connections(self):
+        """URI -> connection of the servers connected to so far"""
+        with self._lock:
+            return dict(self._conns)
+
+    def close(self):
+        """Unbinds the connections to referred servers"""
+        with self._lock:
+            conns, self._conns = self._conns, {}
+        for l in conns.values():
+            if l is not self.l:
+                try:
+                    l.unbind_s()
+                except LDAPError:
+                    pass
+
+    def _search(self, l, base, scope, filter, kwds, hops, ret, seen):
+        args = dict(kwds, scope=scope)
+        if base is not None:
+            args['base'] = base
+        if filter is not None:
+            args['filter'] = filter
+        entries, (refs, referral) = l.search_refs_s(**args)
+        if referral is not None:
+            self._follow(referral, False, base, scope, filter, kwds, hops,
+                         ret, seen)
+        ret.extend(entries)
+        for uris in refs:
+            self._follow(uris, True, base, scope, filter, kwds, hops, ret,
+                         seen)
+
+    def _follow(self, uris, continuation, base, scope, filter, kwds, hops,
+                ret, seen):
+        """Searches the first reachable server of `uris', alternatives for
+        the same naming context"""
+        if continuation and scope == LDAP_SCOPE_ONELEVEL:
+            # the referred entry is one of the children searched
+            scope = LDAP_SCOPE_BASE
+        error = LDAPError('%s.search_ext_s(): no URI to follow' % (
+            self.__class__.__name__))
+        for uri in uris:
+            try:
+                server, dn, s, f = _ldap_url(uri)
+            except ValueError as e:
+                error = LDAPError('%s.search_ext_s(): %s' % (
+                    self.__class__.__name__, e))
+                continue
+            # only continuation references may change the scope
+            target = (server or _ldap_url(self.l.uri)[0], dn or base,
+                      s if continuation and s is not None else scope,
+                      f or filter)
+            if target in seen:
+                # referral loop
+                return
+            if hops >= self.depth:
+                raise LDAPError(
+                    '%s.search_ext_s(): %s: more than %d referral hops' % (
+                        self.__class__.__name__, uri, self.depth)
+                    )
+            seen.add(target)
+            found = []
+            try:
+                l = self._connection(target[0])
+                self._search(l, target[1], target[2], target[3], kwds,
+                             hops + 1, found, seen)
+            except LDAPError as e:
+                error = e
+                continue
+            ret.extend(found)
+            return
+        raise error
+
+    def _connection(self, server):
+        with self._lock:
+            l = self._conns.get(server)
+        if l is not None:
+            return l
+        # connected without the lock: other threads chase other referrals
+        cls = self.l.__class__
+        if not isinstance(self.l, LDAP):
+            cls = LDAP
+        spec = dict(self.l.spec, uri=server, dn=None)
+        new = _rebuild(cls, spec, getattr(self.l, 'credentials', None))
+        with self._lock:
+            l = self._conns.setdefault(server, new)
+        if l is not new:
+            # another thread connected first
+            try:
+                new.unbind_s()
+            except LDAPError:
+                pass
+        return l
+
+_LDAP_SCOPES = {
+    'base': LDAP_SCOPE_BASE, 'one': LDAP_SCOPE_ONELEVEL,
+    'sub': LDAP_SCOPE_SUBTREE, 'subordinate': LDAP_SCOPE_CHILDREN
+    }
+_LDAP_PORTS = {'ldap': 389, 'ldaps': 636}
+_HOSTPORT = re.compile(r'^(\[[^]]*\]|[^:]*)(?::(\d+))?$')
+
+def _ldap_url(uri):
+    """(server, dn, scope, filter) of the LDAP URL `uri' (RFC 4516),
+    server being scheme://host:port, None for the parts absent"""
+    scheme, sep, rest = uri.partition('://')
+    scheme = scheme.lower()
+    if not sep or scheme not in ('ldap', 'ldaps', 'ldapi'):
+        raise ValueError('%s: not an LDAP URL' % uri)
+    hostport, sep, rest = rest.partition('/')
+    parts = rest.split('?') + [''] * 4
+    server = None
+    if hostport and scheme == 'ldapi':
+        server = 'ldapi://%s' % hostport
+    elif hostport:
+        m = _HOSTPORT.match(hostport)
+        if not m:
+            raise ValueError('%s: invalid host' % uri)
+        server = '%s://%s:%s' % (
+            scheme, m.group(1).lower(), m.group(2) or _LDAP_PORTS[scheme])
+    scope = None
+    if parts[2]:
+        scope = _LDAP_SCOPES.get(parts[2].lower())
+        if scope is None:
+            raise ValueError('%s: invalid scope' % uri)
+    return (server, urllib.parse.unquote(parts[0]) or None, scope,
+            urllib.parse.unquote(parts[3]) or None)
@@ -25,19 +25,26 @@ else:
 libsasl = find_library('sasl'), find_library('sasl2')
 if libsasl != (None, None):
     define_macros.append(('__HAVE_SASL__', 1))
+
+libraries=['ldap']
+if find_library('ssl'):
+    define_macros.append(('__HAVE_OPENSSL__', 1))
+    libraries += ['ssl', 'crypto']
     
 libldap_module = Extension(
     '_' + PKG_NAME,
     sources=[
         'C/libldap.c', 'C/LDAPObject.c', 'C/LDAPModObject.c', 'C/LDAPSchema.c',
-        'C/LDAPControls.c'
+        'C/LDAPControls.c', 'C/LDAPTrace.c', 'C/LDAPTLS.c',
+        'C/LDAPCompletionQueue.c'
         ],
     depends=[
         'C/libldap.h', 'C/LDAPObject.h', 'C/LDAPModObject.h', 'C/LDAPSchema.h',
-        'C/LDAPControls.h'
+        'C/LDAPControls.h', 'C/LDAPTrace.h', 'C/LDAPTLS.h',
+        'C/LDAPCompletionQueue.h'
         ],
     include_dirs=['C', '/usr/local/include'],
-    libraries=['ldap'],
+    libraries=libraries,
     extra_compile_args = ["-fcommon"],
     library_dirs=library_dirs,
     define_macros=define_macros